@@ -0,0 +1,109 @@
+#ifndef INCLUDED_RISKSERVICE_ADMIN_HEADER
+#define INCLUDED_RISKSERVICE_ADMIN_HEADER
+/*
+ * Admin channel for changing limits while the risk server is running.
+ *
+ * An admin connects over TCP and sends limit lines in the format of the limit
+ * config file, followed by a commit line:
+ *
+ *   instrument  42       50   50
+ *   account     default  300  300
+ *   commit
+ *
+ * The lines since the last commit are applied on top of the current limits as
+ * one update and answered with "OK" or "ERROR <reason>". An update that fails
+ * is discarded as a whole. Sessions can be added, but existing sessions cannot
+ * move to another account. An admin sending more than max_update_length bytes
+ * without a commit is answered with an error and disconnected.
+ */
+
+#include "limit_config.h"
+#include "runtime_profile.h"
+#include "tcp.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rs::admin {
+
+// Limits committed on the channel, and the scopes in which they differ from
+// the limits of the previous update taken.
+struct Update {
+  LimitConfig limits;
+  LimitChanges changes;
+};
+
+// Serves admins from a thread of its own, one connection at a time, and
+// publishes each committed update as a new, complete limit table.
+// The engine thread picks up the latest table with take_update, read-copy-
+// update style: the admin thread never touches the tables the engine uses, and
+// without an update taking costs one atomic load.
+class Channel {
+
+public:
+  // Most bytes of limit lines waiting for a commit.
+  static constexpr std::size_t max_update_length = 1 << 16;
+
+  explicit Channel(const std::string &address, const std::string &port,
+                   LimitConfig current);
+
+  // Stops and joins the admin thread.
+  ~Channel() noexcept;
+
+  // The admin thread points to the channel, so it must stay in place.
+  Channel(const Channel &) = delete;
+  Channel &operator=(const Channel &) = delete;
+  Channel(Channel &&) = delete;
+  Channel &operator=(Channel &&) = delete;
+
+  // Let the admin thread run on the given CPUs only.
+  void pin(const std::vector<unsigned> &cpus) {
+    runtime::pin_thread(thread_.native_handle(), cpus);
+  }
+
+  // Refuse updates until resumed, e.g. while the limits of a backup follow
+  // its primary.
+  void pause();
+
+  // Accept updates on top of current limits, e.g. the limits a backup has
+  // been replicated, discarding any update not taken yet.
+  void resume(LimitConfig current);
+
+  // Return the limits committed last, or nullptr if nothing has been
+  // committed since the previous call. Updates committed in between are
+  // superseded by the latest one, which includes their changes.
+  [[nodiscard]] std::unique_ptr<Update> take_update() noexcept {
+    if (published_.load(std::memory_order_relaxed) == nullptr) {
+      return nullptr;
+    }
+    return std::unique_ptr<Update>(
+        published_.exchange(nullptr, std::memory_order_acquire));
+  }
+
+private:
+  tcp::Server server_;
+  // Limits including all committed updates, and whether updates are refused.
+  // Only used by the admin thread, unless paused or resumed.
+  std::mutex limits_mutex_;
+  LimitConfig limits_;
+  bool paused_{false};
+  // Owned by whoever exchanges it out.
+  std::atomic<Update *> published_{nullptr};
+  std::atomic<bool> running_{true};
+  // Socket of the admin being served, shut down to stop the thread.
+  std::atomic<int> connection_fd_{-1};
+  std::thread thread_;
+
+  void run();
+  void serve(tcp::Connection &);
+
+  // Apply lines on top of the current limits and publish the result.
+  void commit(const std::string &lines);
+};
+
+} // namespace rs::admin
+
+#endif // INCLUDED_RISKSERVICE_ADMIN_HEADER
@@ -0,0 +1,229 @@
+#ifndef INCLUDED_RISKSERVICE_ASYNC_CLIENT_HEADER
+#define INCLUDED_RISKSERVICE_ASYNC_CLIENT_HEADER
+/*
+ * Risk client for coroutines, available in the C++20 build
+ * (-DRS_COROUTINES=ON).
+ *
+ *   rs::co::Task<> trade(rs::AsyncRiskClient &client) {
+ *     auto response = co_await client.check(new_order);
+ *     ...
+ *   }
+ */
+
+#include "event_loop.h"
+#include "format.h"
+#include "tcp.h"
+#include <coroutine>
+#include <stdexcept>
+#include <string>
+
+namespace rs {
+
+// Sends messages to the risk server from coroutines running on an event loop.
+// Any number of coroutines can check orders at the same time over the one
+// connection: each request is sent when it is awaited and the responses, which
+// the server sends in the order of the requests, are handed to the awaiting
+// coroutines in that order. Awaiting does not allocate, the queue of waiting
+// coroutines is linked through their frames.
+class AsyncRiskClient {
+  using PayloadSize = decltype(protocol::Header::payloadSize);
+  using SequenceNum = decltype(protocol::Header::sequenceNumber);
+
+public:
+  explicit AsyncRiskClient(co::EventLoop &loop,
+                           const std::string &server_address,
+                           const std::string &server_port)
+      : loop_(loop), tcp_client_(server_address, server_port) {
+    tcp_client_.socket().set_non_blocking();
+  }
+
+  ~AsyncRiskClient() noexcept = default;
+
+  // Waiting coroutines point to the client, so it must stay in place.
+  AsyncRiskClient(const AsyncRiskClient &) = delete;
+  AsyncRiskClient &operator=(const AsyncRiskClient &) = delete;
+  AsyncRiskClient(AsyncRiskClient &&) = delete;
+  AsyncRiskClient &operator=(AsyncRiskClient &&) = delete;
+
+  // Send message and wait for the server's risk check.
+  // The message must stay alive until the returned task is awaited. Throws if
+  // the connection fails or closes before the response arrives.
+
+  co::Task<protocol::OrderResponse> check(const protocol::NewOrder &order) {
+    return request<protocol::OrderResponse>(order);
+  }
+  co::Task<protocol::OrderResponse>
+  check(const protocol::ModifyOrderQuantity &modify) {
+    return request<protocol::OrderResponse>(modify);
+  }
+  co::Task<protocol::BatchResponse> check(const protocol::OrderBatch &batch) {
+    return request<protocol::BatchResponse>(batch);
+  }
+
+  // Send message that has no response, e.g. DeleteOrder or Trade.
+  template <typename Payload> co::Task<> post(const Payload &payload) {
+    co_await wait_for_room();
+    send(payload);
+  }
+
+private:
+  // Coroutine waiting for a response, queued in the order of the requests.
+  struct Pending {
+    std::coroutine_handle<> handle;
+    // Empty if the connection closed.
+    protocol::MessageView response;
+    bool done{false};
+    Pending *next{nullptr};
+  };
+
+  // Suspends until the reader has handed over the response.
+  struct ResponseAwaiter {
+    Pending &pending;
+
+    bool await_ready() const noexcept { return pending.done; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept {
+      pending.handle = handle;
+    }
+    void await_resume() const noexcept {}
+  };
+
+  co::EventLoop &loop_;
+  tcp::Client tcp_client_;
+  SequenceNum package_counter_{0};
+
+  Pending *pending_head_{nullptr};
+  Pending *pending_tail_{nullptr};
+  // Reader and writer coroutines are running.
+  bool reading_{false};
+  bool writing_{false};
+  bool closed_{false};
+
+  SequenceNum next_package_id() { return ++package_counter_; }
+
+  template <typename Response, typename Payload>
+  co::Task<Response> request(const Payload &payload) {
+    co_await wait_for_room();
+    // Queued and sent without suspending in between, so that the queue stays
+    // in the order of the requests.
+    Pending pending;
+    if (pending_tail_ != nullptr) {
+      pending_tail_->next = &pending;
+    } else {
+      pending_head_ = &pending;
+    }
+    pending_tail_ = &pending;
+    send(payload);
+    if (!reading_) {
+      loop_.spawn(read_responses());
+    }
+    co_await ResponseAwaiter{pending};
+
+    if (pending.response.empty()) {
+      throw std::runtime_error("Connection to risk server closed");
+    }
+    auto header = protocol::decode_header(pending.response);
+    if (header.version != Response::MESSAGE_TYPE) {
+      throw std::runtime_error(rs::format(
+          RS_FMT("Expected response of type {} from risk server, got {}"),
+          Response::MESSAGE_TYPE, header.version));
+    }
+    co_return protocol::decode_payload<Response>(pending.response);
+  }
+
+  // Wait until the send buffer has room for another message.
+  co::Task<> wait_for_room() {
+    const auto &socket = tcp_client_.socket();
+    auto &buffer = tcp_client_.send_buffer();
+    while (!closed_ && buffer.writable() < protocol::max_message_length) {
+      co_await loop_.writable(socket.fd);
+      tcp::send_from(socket, buffer);
+    }
+    if (closed_) {
+      throw std::runtime_error("Connection to risk server closed");
+    }
+  }
+
+  // Encode payload into the send buffer and send what the socket takes without
+  // blocking. The rest is sent by the writer coroutine.
+  template <typename Payload> void send(const Payload &payload) {
+    protocol::Header header{
+        payload.messageType,
+        static_cast<PayloadSize>(sizeof(payload)),
+        next_package_id(),
+        now(),
+    };
+    auto &buffer = tcp_client_.send_buffer();
+    protocol::encode(buffer, header, payload);
+    tcp::send_from(tcp_client_.socket(), buffer);
+    if (!buffer.empty() && !writing_) {
+      loop_.spawn(write_queued());
+    }
+  }
+
+  // Send queued messages whenever the socket has room, until none are left.
+  co::Task<> write_queued() {
+    writing_ = true;
+    const auto &socket = tcp_client_.socket();
+    auto &buffer = tcp_client_.send_buffer();
+    try {
+      while (!buffer.empty() && !closed_) {
+        co_await loop_.writable(socket.fd);
+        tcp::send_from(socket, buffer);
+      }
+    } catch (const std::exception &) {
+      close();
+    }
+    writing_ = false;
+  }
+
+  // Hand responses to the waiting coroutines until none are left.
+  co::Task<> read_responses() {
+    reading_ = true;
+    const auto &socket = tcp_client_.socket();
+    auto &buffer = tcp_client_.recv_buffer();
+    try {
+      while (pending_head_ != nullptr && !closed_) {
+        protocol::MessageView msg;
+        if (!protocol::next_message(buffer, msg)) {
+          co_await loop_.readable(socket.fd);
+          if (tcp::receive_into(socket, buffer) == 0) {
+            close();
+          }
+          continue;
+        }
+        // The response is decoded by the resumed coroutine before it
+        // suspends again, so the view stays valid.
+        resume_next(msg);
+      }
+    } catch (const std::exception &) {
+      close();
+    }
+    reading_ = false;
+  }
+
+  void resume_next(protocol::MessageView response) {
+    auto *pending = pending_head_;
+    pending_head_ = pending->next;
+    if (pending_head_ == nullptr) {
+      pending_tail_ = nullptr;
+    }
+    pending->response = response;
+    pending->done = true;
+    // Not suspended yet if the response was already buffered when queued.
+    if (pending->handle) {
+      pending->handle.resume();
+    }
+  }
+
+  // Fail all waiting coroutines.
+  void close() {
+    closed_ = true;
+    while (pending_head_ != nullptr) {
+      resume_next({});
+    }
+  }
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_ASYNC_CLIENT_HEADER
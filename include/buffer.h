@@ -0,0 +1,126 @@
+#ifndef INCLUDED_RISKSERVICE_BUFFER_HEADER
+#define INCLUDED_RISKSERVICE_BUFFER_HEADER
+/*
+ * Fixed capacity byte buffers and a pool for reusing them.
+ */
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace rs {
+
+// Byte buffer with a fixed capacity, allocated once on construction.
+// Bytes are written to the end of the buffer and read from the front.
+//
+//   [ consumed | readable | writable ]
+//
+class Buffer {
+
+public:
+  explicit Buffer(std::size_t capacity) : data_(capacity) {}
+
+  std::size_t capacity() const noexcept { return data_.size(); }
+
+  // Bytes written but not yet consumed.
+  std::string_view readable() const noexcept {
+    return {data_.data() + begin_, end_ - begin_};
+  }
+  bool empty() const noexcept { return begin_ == end_; }
+  void consume(std::size_t n) noexcept { begin_ += n; }
+
+  // Space after the last written byte.
+  char *write_ptr() noexcept { return data_.data() + end_; }
+  char *write_end() noexcept { return data_.data() + data_.size(); }
+  std::size_t writable() const noexcept { return data_.size() - end_; }
+  void commit(std::size_t n) noexcept { end_ += n; }
+
+  void append(std::string_view bytes) {
+    if (bytes.size() > writable()) {
+      throw std::length_error("Buffer full, unable to append bytes");
+    }
+    std::memcpy(write_ptr(), bytes.data(), bytes.size());
+    commit(bytes.size());
+  }
+
+  void append(char c) {
+    if (writable() == 0) {
+      throw std::length_error("Buffer full, unable to append byte");
+    }
+    *write_ptr() = c;
+    commit(1);
+  }
+
+  // Move readable bytes to the front to make room for writing.
+  // Invalidates all views to readable bytes.
+  void compact() noexcept {
+    if (begin_ > 0) {
+      std::memmove(data_.data(), data_.data() + begin_, end_ - begin_);
+      end_ -= begin_;
+      begin_ = 0;
+    }
+  }
+
+  void clear() noexcept { begin_ = end_ = 0; }
+
+private:
+  std::vector<char> data_;
+  std::size_t begin_{0};
+  std::size_t end_{0};
+};
+
+// Preallocated buffers of equal capacity, handed out and returned without
+// allocating.
+class BufferPool {
+
+  struct Release {
+    BufferPool *pool;
+    void operator()(Buffer *buffer) const noexcept { pool->release(buffer); }
+  };
+
+public:
+  using Handle = std::unique_ptr<Buffer, Release>;
+
+  explicit BufferPool(std::size_t count, std::size_t capacity) {
+    buffers_.reserve(count);
+    free_.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      buffers_.emplace_back(capacity);
+    }
+    for (auto &buffer : buffers_) {
+      free_.push_back(&buffer);
+    }
+  }
+
+  // Handles point back to the pool, so it must stay in place.
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+  BufferPool(BufferPool &&) = delete;
+  BufferPool &operator=(BufferPool &&) = delete;
+
+  // Take an empty buffer from the pool, it is returned when the handle is
+  // destroyed.
+  [[nodiscard]] Handle acquire() {
+    if (free_.empty()) {
+      throw std::runtime_error("Buffer pool exhausted");
+    }
+    auto *buffer = free_.back();
+    free_.pop_back();
+    buffer->clear();
+    return Handle{buffer, Release{this}};
+  }
+
+  std::size_t available() const noexcept { return free_.size(); }
+
+private:
+  std::vector<Buffer> buffers_;
+  std::vector<Buffer *> free_;
+
+  void release(Buffer *buffer) noexcept { free_.push_back(buffer); }
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_BUFFER_HEADER
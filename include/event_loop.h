@@ -0,0 +1,146 @@
+#ifndef INCLUDED_RISKSERVICE_EVENT_LOOP_HEADER
+#define INCLUDED_RISKSERVICE_EVENT_LOOP_HEADER
+/*
+ * Single-threaded event loop resuming coroutines when their sockets are
+ * ready, available in the C++20 build (-DRS_COROUTINES=ON).
+ */
+
+#include "format.h"
+#include "task.h"
+
+extern "C" {
+#include <poll.h>
+}
+
+#include <cerrno>
+#include <coroutine>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace rs::co {
+
+// Runs coroutines that wait for socket events, polling all of their sockets
+// at once. Awaiting a socket appends to preallocated vectors, so it does not
+// allocate once the loop has seen its peak number of waiting coroutines.
+// Not thread-safe, every coroutine of a loop runs on the thread calling run.
+class EventLoop {
+  struct Waiter {
+    std::coroutine_handle<> handle;
+    // Where to store the events the socket is ready for.
+    short *revents;
+  };
+
+public:
+  // Awaitable that suspends until socket fd is ready for any of events, and
+  // returns the poll events it is ready for, which may include POLLHUP and
+  // POLLERR.
+  class Ready {
+  public:
+    Ready(EventLoop &loop, int fd, short events) noexcept
+        : loop_(loop), fd_(fd), events_(events) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      loop_.fds_.push_back({fd_, events_, 0});
+      loop_.waiters_.push_back({handle, &revents_});
+    }
+
+    short await_resume() const noexcept { return revents_; }
+
+  private:
+    EventLoop &loop_;
+    int fd_;
+    short events_;
+    short revents_{0};
+  };
+
+  explicit EventLoop(std::size_t expected_waiters = 64) {
+    fds_.reserve(expected_waiters);
+    waiters_.reserve(expected_waiters);
+    ready_.reserve(expected_waiters);
+  }
+
+  // Coroutines and the frames of their suspended awaiters point into the
+  // loop, so it must stay in place.
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+  EventLoop(EventLoop &&) = delete;
+  EventLoop &operator=(EventLoop &&) = delete;
+
+  Ready ready(int fd, short events) noexcept { return {*this, fd, events}; }
+  Ready readable(int fd) noexcept { return {*this, fd, POLLIN}; }
+  Ready writable(int fd) noexcept { return {*this, fd, POLLOUT}; }
+
+  // Run task until its first suspension, after which it is resumed by the
+  // loop. The task destroys itself when done and must not throw.
+  void spawn(Task<> task) { std::move(task).detach(); }
+
+  // Called before each poll, when every coroutine is waiting for its socket.
+  // E.g. for flushing what has been batched while they were running.
+  template <typename Callback> void on_idle(Callback callback) {
+    idle_ = std::move(callback);
+  }
+
+  // Wake up after timeout milliseconds without any socket becoming ready, -1
+  // to wait for sockets only. E.g. set by the idle callback for timers.
+  void set_timeout(int timeout) noexcept { timeout_ = timeout; }
+
+  // Resume coroutines as their sockets become ready, until stopped or until
+  // no coroutine is waiting.
+  void run() {
+    running_ = true;
+    while (running_ && !waiters_.empty()) {
+      if (idle_) {
+        idle_();
+      }
+      if (::poll(fds_.data(), fds_.size(), timeout_) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error(rs::format(
+            RS_FMT("Failed polling sockets: {}"), std::strerror(errno)));
+      }
+
+      // Take out the ready waiters before resuming any of them, as resumed
+      // coroutines wait again by appending to the poll set.
+      ready_.clear();
+      std::size_t kept = 0;
+      for (std::size_t i = 0; i < waiters_.size(); ++i) {
+        if (fds_[i].revents != 0) {
+          *waiters_[i].revents = fds_[i].revents;
+          ready_.push_back(waiters_[i].handle);
+        } else {
+          fds_[kept] = fds_[i];
+          waiters_[kept] = waiters_[i];
+          ++kept;
+        }
+      }
+      fds_.resize(kept);
+      waiters_.resize(kept);
+
+      for (auto handle : ready_) {
+        handle.resume();
+      }
+    }
+  }
+
+  // Make run return after resuming the coroutines that are ready.
+  void stop() noexcept { running_ = false; }
+
+private:
+  // Poll set and the coroutine waiting for each entry, in the same order.
+  std::vector<pollfd> fds_;
+  std::vector<Waiter> waiters_;
+  std::vector<std::coroutine_handle<>> ready_;
+  std::function<void()> idle_;
+  bool running_{false};
+  int timeout_{-1};
+};
+
+} // namespace rs::co
+
+#endif // INCLUDED_RISKSERVICE_EVENT_LOOP_HEADER
@@ -0,0 +1,130 @@
+#ifndef INCLUDED_RISKSERVICE_FIELD_BATCH_HEADER
+#define INCLUDED_RISKSERVICE_FIELD_BATCH_HEADER
+/*
+ * Decoding of all complete text messages of a receive buffer in one pass.
+ */
+
+#include "protocol.h"
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace rs::protocol {
+
+// Message of a FieldBatch.
+struct BatchedMessage {
+  // Text without the delimiter.
+  MessageView text;
+  // Values of all fields, header first, if decoded is true. Messages that are
+  // not made of decimal fields only are decoded from their text instead, so
+  // that they fail exactly as with the text decoders.
+  const uint64_t *fields;
+  std::size_t field_count;
+  bool decoded;
+};
+
+// Decimal fields of consecutive messages, converted into arrays of values,
+// message offsets and field counts. A first pass over the text indexes the
+// fields and messages, a second one converts the fields.
+//
+// Separators are found 64 bytes at a time, with AVX2 or SSE2 compares, and
+// fields are converted with SSE4.1 multiply-adds, with AVX2 four fields of
+// up to 8 digits at a time, else two, as far as the CPU supports them, which
+// is checked once at runtime. Without them, and on other architectures, the
+// same pass runs with scalar code.
+class FieldBatch {
+
+public:
+  static constexpr std::size_t max_messages = 1 << 8;
+  // Enough for a full OrderBatch.
+  static constexpr std::size_t max_fields = 1 << 13;
+
+  FieldBatch()
+      : values_(max_fields), begins_(max_messages), ends_(max_messages),
+        first_fields_(max_messages), field_counts_(max_messages),
+        decoded_(max_messages), field_begins_(max_fields),
+        field_ends_(max_fields), message_ends_(max_messages + 64),
+        message_fields_(max_messages + 64) {}
+
+  // Replace the batch with the complete messages at the front of bytes, as
+  // many as fit. The views into bytes are valid as long as bytes.
+  // Return the number of messages.
+  std::size_t decode(std::string_view bytes);
+
+  std::size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+
+  BatchedMessage operator[](std::size_t i) const noexcept {
+    return {data_.substr(begins_[i], ends_[i] - 1 - begins_[i]),
+            values_.data() + first_fields_[i], field_counts_[i],
+            decoded_[i] != 0};
+  }
+
+  // Bytes from the front up to and including the delimiter of message i.
+  std::size_t end(std::size_t i) const noexcept { return ends_[i]; }
+
+  // Instructions used on this CPU, "avx2", "sse4.2" or "scalar".
+  static const char *instruction_set() noexcept;
+
+private:
+  std::string_view data_;
+  std::size_t size_{0};
+  std::vector<uint64_t> values_;
+  std::vector<uint32_t> begins_;
+  std::vector<uint32_t> ends_;
+  std::vector<uint32_t> first_fields_;
+  std::vector<uint32_t> field_counts_;
+  std::vector<uint8_t> decoded_;
+  // Index of the scanned bytes: where each field begins and ends, where
+  // each message ends and how many fields begin before. Up to a block of
+  // messages beyond the batch is indexed.
+  std::vector<uint32_t> field_begins_;
+  std::vector<uint32_t> field_ends_;
+  std::vector<uint32_t> message_ends_;
+  std::vector<uint32_t> message_fields_;
+  // Fields that could not be converted, in order.
+  std::vector<uint32_t> invalid_fields_;
+
+  // Decode with the instructions of Isa, which the scan is compiled for.
+  template <typename Isa> std::size_t decode_with(std::string_view bytes);
+  template <typename Isa> std::size_t scan(std::string_view bytes);
+};
+
+// Return a parser over the fields of msg, see make_parser.
+inline auto make_parser(const BatchedMessage &msg) {
+  auto parse_next = [fields = msg.fields, count = msg.field_count,
+                     next = std::size_t{0}]() mutable {
+    if (next == count) {
+      throw std::runtime_error(
+          "Unable to parse next value, reached end of message");
+    }
+    return fields[next++];
+  };
+  return parse_next;
+}
+
+inline Header decode_header(const BatchedMessage &msg) {
+  if (!msg.decoded) {
+    return decode_header(msg.text);
+  }
+  auto parse_next = make_parser(msg);
+  return decode_header_fields(parse_next);
+}
+
+template <typename Payload>
+inline Payload decode_payload(const BatchedMessage &msg) {
+  if (!msg.decoded) {
+    return decode_payload<Payload>(msg.text);
+  }
+  auto parse_next = make_parser(msg);
+  // Skip header.
+  for (auto i = 0; i < 4; ++i) {
+    parse_next();
+  }
+  return PayloadDecoder<Payload>::decode(parse_next);
+}
+
+} // namespace rs::protocol
+
+#endif // INCLUDED_RISKSERVICE_FIELD_BATCH_HEADER
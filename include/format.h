@@ -2,40 +2,177 @@
 #define INCLUDED_RISKSERVICE_FORMAT_HEADER
 /*
  * Simple replacement for fmtlib.
+ *
+ * Format strings are split into literals and "{}" replacement fields at
+ * compile time. Use the RS_FMT macro to create one:
+ *
+ *   rs::format(RS_FMT("order {} of listing {}"), order_id, listing_id);
+ *
+ * Passing the wrong amount of arguments is a compile error.
+ * Arguments are integers, converted with std::to_chars, or string-like.
+ * Characters are formatted as integers.
  */
 
-#include <sstream>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <limits>
 #include <string>
+#include <string_view>
+#include <type_traits>
+
+// Compile-time format string from a string literal.
+#define RS_FMT(str)                                                            \
+  ([] {                                                                        \
+    struct FormatString {                                                      \
+      static constexpr std::string_view view() { return str; }                 \
+    };                                                                         \
+    return FormatString{};                                                     \
+  }())
 
 namespace rs {
 
-// to_string with no-op overloads for string-like types.
-template <typename T> inline std::string to_string(const T &val) {
-  return std::to_string(val);
-}
-inline std::string to_string(char *val) { return val; }
-inline std::string to_string(const char *val) { return val; }
-inline std::string to_string(const std::string &val) { return val; }
-inline std::string to_string(std::string &val) { return val; }
-
-// Base case, format string with no arguments.
-inline std::string format(const std::string &fmt) { return fmt; }
-
-// Recursive string formatter.
-template <typename T, typename... Args>
-inline std::string format(const std::string &fmt, const T &arg,
-                          const Args &...rest) {
-  auto field_begin = fmt.find("{}");
-  if (field_begin == std::string::npos) {
-    throw std::runtime_error("Invalid format string: mismatching amount of "
-                             "replacement fields and format args");
+namespace format_detail {
+
+constexpr std::string_view field = "{}";
+
+constexpr std::size_t count_fields(std::string_view fmt) {
+  std::size_t count = 0;
+  for (auto pos = fmt.find(field); pos != fmt.npos;
+       pos = fmt.find(field, pos + field.size())) {
+    ++count;
+  }
+  return count;
+}
+
+// Literal parts between the replacement fields.
+template <std::size_t Fields>
+constexpr std::array<std::string_view, Fields + 1>
+split_literals(std::string_view fmt) {
+  std::array<std::string_view, Fields + 1> literals{};
+  std::size_t begin = 0;
+  for (std::size_t i = 0; i < Fields; ++i) {
+    auto end = fmt.find(field, begin);
+    literals[i] = fmt.substr(begin, end - begin);
+    begin = end + field.size();
+  }
+  literals[Fields] = fmt.substr(begin);
+  return literals;
+}
+
+template <typename Fmt> struct Parsed {
+  static constexpr std::string_view str = Fmt::view();
+  static constexpr std::size_t fields = count_fields(str);
+  static constexpr auto literals = split_literals<fields>(str);
+  static constexpr std::size_t literals_length = str.size() - 2 * fields;
+};
+
+// Convert argument to a formattable value: a 64 bit integer or a string view.
+template <typename T> constexpr auto as_field(const T &arg) {
+  if constexpr (std::is_enum_v<T>) {
+    return as_field(static_cast<std::underlying_type_t<T>>(arg));
+  } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+    return static_cast<long long>(arg);
+  } else if constexpr (std::is_integral_v<T>) {
+    return static_cast<unsigned long long>(arg);
+  } else {
+    return std::string_view{arg};
   }
-  // Construct new string by converting one format arg and call format
-  // recursively for rest.
-  std::stringstream out;
-  out << fmt.substr(0, field_begin) << to_string(arg)
-      << format(fmt.substr(field_begin + 2), rest...);
-  return out.str();
+}
+
+inline std::size_t field_length(std::string_view s) noexcept {
+  return s.size();
+}
+
+inline std::size_t field_length(unsigned long long n) noexcept {
+  std::size_t digits = 1;
+  for (; n >= 10; n /= 10) {
+    ++digits;
+  }
+  return digits;
+}
+
+inline std::size_t field_length(long long n) noexcept {
+  if (n < 0) {
+    // Negate in unsigned arithmetic, -min does not fit in long long.
+    return 1 + field_length(0ull - static_cast<unsigned long long>(n));
+  }
+  return field_length(static_cast<unsigned long long>(n));
+}
+
+inline char *write_field(char *out, std::string_view s) noexcept {
+  std::memcpy(out, s.data(), s.size());
+  return out + s.size();
+}
+
+template <typename Integer>
+inline char *write_field(char *out, Integer n) noexcept {
+  // The length has been computed already, so the output always fits.
+  return std::to_chars(out, out + std::numeric_limits<Integer>::digits10 + 2, n)
+      .ptr;
+}
+
+// Reused by format_view, one per thread.
+inline std::string &thread_buffer() {
+  thread_local std::string buffer;
+  return buffer;
+}
+
+template <typename Fmt, typename... Args> constexpr void check_arguments() {
+  static_assert(Parsed<Fmt>::fields == sizeof...(Args),
+                "Invalid format string: mismatching amount of replacement "
+                "fields and format args");
+}
+
+} // namespace format_detail
+
+// Exact length of the formatted string.
+template <typename Fmt, typename... Args>
+inline std::size_t formatted_size(Fmt, const Args &...args) {
+  using namespace format_detail;
+  check_arguments<Fmt, Args...>();
+  return (Parsed<Fmt>::literals_length + ... + field_length(as_field(args)));
+}
+
+// Write formatted string to out, which must have room for formatted_size
+// characters, and return the end of the written string.
+template <typename Fmt, typename... Args>
+inline char *format_to(char *out, Fmt, const Args &...args) {
+  using namespace format_detail;
+  check_arguments<Fmt, Args...>();
+  constexpr const auto &literals = Parsed<Fmt>::literals;
+  std::size_t i = 0;
+  out = write_field(out, literals[i++]);
+  ((out = write_field(out, as_field(args)),
+    out = write_field(out, literals[i++])),
+   ...);
+  return out;
+}
+
+// Append formatted string to out.
+template <typename Fmt, typename... Args>
+inline void format_append(std::string &out, Fmt fmt, const Args &...args) {
+  auto begin = out.size();
+  out.resize(begin + formatted_size(fmt, args...));
+  format_to(out.data() + begin, fmt, args...);
+}
+
+// Format into a new string, allocating once.
+template <typename Fmt, typename... Args>
+inline std::string format(Fmt fmt, const Args &...args) {
+  std::string out;
+  format_append(out, fmt, args...);
+  return out;
+}
+
+// Format into a buffer owned by the calling thread and return a view to it.
+// The view is valid until the next call from the same thread.
+template <typename Fmt, typename... Args>
+inline std::string_view format_view(Fmt fmt, const Args &...args) {
+  auto &buffer = format_detail::thread_buffer();
+  buffer.clear();
+  format_append(buffer, fmt, args...);
+  return buffer;
 }
 
 } // namespace rs
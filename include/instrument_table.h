@@ -0,0 +1,115 @@
+#ifndef INCLUDED_RISKSERVICE_INSTRUMENT_TABLE_HEADER
+#define INCLUDED_RISKSERVICE_INSTRUMENT_TABLE_HEADER
+/*
+ * State and limits of all instruments, as a struct of side-indexed arrays.
+ */
+
+#include "limit_config.h"
+#include "positions.h"
+#include "throttle.h"
+#include <array>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace rs {
+
+// Aggregated orders and trades, the limits and the order rate throttle of
+// every listing, in one array per field and side, indexed by a dense
+// instrument index.
+// The side is an index into the arrays, so buys and sells are checked and
+// updated by the same code without branching on the side. Passes over all
+// instruments, such as checking them against new limits, run over contiguous
+// arrays, which the compiler vectorizes.
+class InstrumentTable {
+
+public:
+  using Index = uint32_t;
+  using NetPos = InstrumentState::NetPos;
+
+  // Index of listing, nothing if it has not been added.
+  std::optional<Index> find(ListingID id) const {
+    auto index_it = indices_.find(id);
+    if (index_it == indices_.end()) {
+      return std::nullopt;
+    }
+    return index_it->second;
+  }
+
+  // Add listing without orders and return its index, which stays valid.
+  Index add(ListingID, const Limits &, OrderRate);
+
+  // Reserve arrays for the given number of listings.
+  void reserve(std::size_t listings);
+
+  std::size_t size() const noexcept { return ids_.size(); }
+  ListingID id(Index i) const noexcept { return ids_[i]; }
+
+  InstrumentState state(Index i) const noexcept {
+    return {net_pos_[i], {open_qty_[BUY][i], open_qty_[SELL][i]}};
+  }
+
+  Limits limits(Index i) const noexcept {
+    return {{max_pos_[BUY][i], max_pos_[SELL][i]}};
+  }
+
+  // Return true if worst case positions stay within the limits after adding
+  // qty to the open orders of side, as Exposure::allows.
+  bool allows(Index i, Side side, Quantity qty) const noexcept {
+    return qty + worst_pos(net_pos_[i], open_qty_[side][i], side) <=
+           max_pos_[side][i];
+  }
+
+  // Add qty to the open orders of side, a decrease wraps around.
+  void add_open_qty(Index i, Side side, Quantity qty) noexcept {
+    open_qty_[side][i] += qty;
+  }
+
+  // Apply trade of qty of an order of side to the net position.
+  void add_trade(Index i, Side side, Quantity qty) noexcept {
+    net_pos_[i] -= side_sign(side) * static_cast<NetPos>(qty);
+  }
+
+  void set_limits(Index, const Limits &) noexcept;
+  // Same limits for every instrument.
+  void set_limits(const Limits &) noexcept;
+
+  // Return true if the order rate of instrument has room for another order at
+  // time now, as Throttle::allows.
+  bool allows_order(Index i, Nanoseconds now) noexcept {
+    return throttles_[i].allows(now);
+  }
+
+  // Count an order towards the order rate, after allows_order.
+  void add_order(Index i) noexcept { throttles_[i].add(); }
+
+  OrderRate order_rate(Index i) const noexcept {
+    return throttles_[i].rate();
+  }
+
+  void set_order_rate(Index i, OrderRate rate) noexcept {
+    throttles_[i].set_rate(rate);
+  }
+  // Same order rate for every instrument.
+  void set_order_rate(OrderRate) noexcept;
+
+  // Number of instruments whose worst case positions exceed their limits,
+  // e.g. after the limits have been lowered, checked in one pass over all.
+  std::size_t count_over_limits() const noexcept;
+
+  bool within_limits(Index i) const noexcept {
+    return allows(i, BUY, 0) & allows(i, SELL, 0);
+  }
+
+private:
+  std::unordered_map<ListingID, Index> indices_;
+  std::vector<ListingID> ids_;
+  std::vector<NetPos> net_pos_;
+  std::array<std::vector<Quantity>, 2> open_qty_;
+  std::array<std::vector<Quantity>, 2> max_pos_;
+  std::vector<Throttle> throttles_;
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_INSTRUMENT_TABLE_HEADER
@@ -0,0 +1,183 @@
+#ifndef INCLUDED_RISKSERVICE_LIMIT_CONFIG_HEADER
+#define INCLUDED_RISKSERVICE_LIMIT_CONFIG_HEADER
+/*
+ * Position limits of the firm, accounts, sessions and instruments.
+ *
+ * Limits are loaded from a config file with one limit per line:
+ *
+ *   # scope     id       [account]  max_buy  max_sell
+ *   firm                            1000     1000
+ *   account     default             200      200
+ *   account     7                   500      300
+ *   session     3        7          100      100
+ *   instrument  default             20       15
+ *   instrument  42                  50       50
+ *
+ * Accounts and instruments without a line of their own use the default
+ * limits, which are unlimited if not given. Each session belongs to the
+ * account given on its line. Session 0 is used by connections that do not log
+ * on. Its own limits are unlimited unless configured otherwise, but it belongs
+ * to account 0, which has the default account limits unless it has a line.
+ * Limits, ids and rates are unsigned, so negative numbers are invalid.
+ *
+ * Order rates, the most new orders and modifications per second, are limited
+ * per instrument and per session with lines of their own:
+ *
+ *   # rate  scope       id       max_orders
+ *   rate    instrument  default  1000
+ *   rate    session     3        50
+ *
+ * Instruments and sessions without a rate line use the default rate of their
+ * scope, which is unlimited if not given.
+ */
+
+#include "positions.h"
+#include "protocol.h"
+#include "throttle.h"
+#include <array>
+#include <istream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rs {
+
+using AccountID = uint64_t;
+using SessionID = decltype(protocol::Logon::sessionId);
+
+struct LimitChanges;
+
+struct Limits {
+  static constexpr Quantity unlimited = std::numeric_limits<Quantity>::max();
+  // Maximum worst case position of each side.
+  std::array<Quantity, 2> max_pos{unlimited, unlimited};
+
+  bool operator==(const Limits &other) const noexcept {
+    return max_pos == other.max_pos;
+  }
+  bool operator!=(const Limits &other) const noexcept {
+    return !(*this == other);
+  }
+};
+
+// Orders and trades aggregated over one scope, together with the limits of the
+// scope. Small enough to fit in one cache line.
+struct Exposure {
+  InstrumentState state;
+  Limits limits;
+
+  // Return true if worst case positions stay within the limits after adding
+  // qty to the open orders of side.
+  bool allows(Side side, Quantity qty) const noexcept {
+    return qty + state.worst_pos(side) <= limits.max_pos[side];
+  }
+
+  // Return false if the worst case positions exceed the limits, e.g. after the
+  // limits have been lowered.
+  bool within_limits() const noexcept {
+    return allows(BUY, 0) & allows(SELL, 0);
+  }
+};
+
+struct LimitConfig {
+  struct Session {
+    AccountID account{0};
+    Limits limits;
+
+    bool operator==(const Session &other) const noexcept {
+      return account == other.account && limits == other.limits;
+    }
+  };
+
+  Limits firm;
+  Limits default_account;
+  Limits default_instrument;
+  std::unordered_map<AccountID, Limits> accounts;
+  std::unordered_map<SessionID, Session> sessions{{0, Session{}}};
+  std::unordered_map<ListingID, Limits> instruments;
+  OrderRate default_instrument_rate{unlimited_rate};
+  OrderRate default_session_rate{unlimited_rate};
+  std::unordered_map<ListingID, OrderRate> instrument_rates;
+  std::unordered_map<SessionID, OrderRate> session_rates;
+
+  // Same limits for every instrument and nothing else, e.g. for backtesting.
+  static LimitConfig per_instrument(Quantity max_buy, Quantity max_sell) {
+    LimitConfig config;
+    config.default_instrument = {max_buy, max_sell};
+    return config;
+  }
+
+  // Parse config, throwing with the line number of the first invalid line.
+  [[nodiscard]] static LimitConfig parse(std::istream &input) {
+    return parse(input, LimitConfig{});
+  }
+  // Parse lines that override the limits of base, e.g. to update a config.
+  [[nodiscard]] static LimitConfig parse(std::istream &, LimitConfig base);
+  [[nodiscard]] static LimitConfig load(const std::string &path);
+
+  // Set the limits of one scope, e.g. replicated from a server, and return
+  // that scope as changed.
+  LimitChanges apply(const protocol::LimitUpdate &);
+
+  const Limits &account_limits(AccountID id) const {
+    auto limits_it = accounts.find(id);
+    return limits_it == accounts.end() ? default_account : limits_it->second;
+  }
+
+  const Limits &instrument_limits(ListingID id) const {
+    auto limits_it = instruments.find(id);
+    return limits_it == instruments.end() ? default_instrument
+                                          : limits_it->second;
+  }
+
+  OrderRate instrument_rate(ListingID id) const {
+    auto rate_it = instrument_rates.find(id);
+    return rate_it == instrument_rates.end() ? default_instrument_rate
+                                             : rate_it->second;
+  }
+
+  OrderRate session_rate(SessionID id) const {
+    auto rate_it = session_rates.find(id);
+    return rate_it == session_rates.end() ? default_session_rate
+                                          : rate_it->second;
+  }
+
+  // Return true if any order rate is limited.
+  bool throttles() const {
+    return default_instrument_rate != unlimited_rate ||
+           default_session_rate != unlimited_rate ||
+           !instrument_rates.empty() || !session_rates.empty();
+  }
+};
+
+// Scopes whose limits or rates differ between two configs, so that an update
+// touches only those. A changed default affects every scope without a line
+// of its own.
+struct LimitChanges {
+  bool firm{false};
+  bool default_account{false};
+  bool default_instrument{false};
+  bool default_instrument_rate{false};
+  bool default_session_rate{false};
+  std::vector<AccountID> accounts;
+  std::vector<SessionID> sessions;
+  std::vector<ListingID> instruments;
+  std::vector<ListingID> instrument_rates;
+  std::vector<SessionID> session_rates;
+
+  [[nodiscard]] static LimitChanges between(const LimitConfig &from,
+                                            const LimitConfig &to);
+
+  // Add the changes of a later update, e.g. of two updates applied as one.
+  void add(const LimitChanges &);
+
+  // The changed scopes with their limits in config, one message per scope,
+  // which applied to the config before the changes give config.
+  [[nodiscard]] std::vector<protocol::LimitUpdate>
+  updates(const LimitConfig &config) const;
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_LIMIT_CONFIG_HEADER
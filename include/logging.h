@@ -9,6 +9,7 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
 
 namespace rs::logging {
 
@@ -20,7 +21,7 @@ enum class Level : unsigned {
   CRITICAL = 40,
 };
 
-inline std::string to_string(Level level) {
+inline std::string_view to_string(Level level) {
   switch (level) {
   case Level::DEBUG:
     return "DEBUG";
@@ -46,40 +47,61 @@ public:
   explicit Logger(const std::string &name, Level l = Level::INFO)
       : name(name), threshold(l) {}
 
-  template <typename... Args> void debug(Args &&...args) const {
-    log(Level::DEBUG, std::forward<Args>(args)...);
+  template <typename Fmt, typename... Args>
+  void debug(Fmt fmt, const Args &...args) const {
+    log(Level::DEBUG, fmt, args...);
   }
 
-  template <typename... Args> void info(Args &&...args) const {
-    log(Level::INFO, std::forward<Args>(args)...);
+  template <typename Fmt, typename... Args>
+  void info(Fmt fmt, const Args &...args) const {
+    log(Level::INFO, fmt, args...);
   }
 
-  template <typename... Args> void warn(Args &&...args) const {
-    log(Level::WARN, std::forward<Args>(args)...);
+  template <typename Fmt, typename... Args>
+  void warn(Fmt fmt, const Args &...args) const {
+    log(Level::WARN, fmt, args...);
   }
 
-  template <typename... Args> void error(Args &&...args) const {
-    log(Level::ERROR, std::forward<Args>(args)...);
+  template <typename Fmt, typename... Args>
+  void error(Fmt fmt, const Args &...args) const {
+    log(Level::ERROR, fmt, args...);
   }
 
-  template <typename... Args> void critical(Args &&...args) const {
-    log(Level::CRITICAL, std::forward<Args>(args)...);
+  template <typename Fmt, typename... Args>
+  void critical(Fmt fmt, const Args &...args) const {
+    log(Level::CRITICAL, fmt, args...);
   }
 
 private:
-  std::string now_str() const {
-    std::string buffer(128, '\0');
+  // Write current local time into buffer and return it.
+  std::string_view now_str(char (&buffer)[32]) const {
     auto now = std::time(nullptr);
-    auto now_str_length = std::strftime(buffer.data(), buffer.size(), "%F %T",
-                                        std::localtime(&now));
-    return buffer.substr(0, now_str_length);
+    // Reentrant, since threads log concurrently.
+    std::tm local{};
+    localtime_r(&now, &local);
+    auto now_str_length =
+        std::strftime(buffer, sizeof(buffer), "%F %T", &local);
+    return {buffer, now_str_length};
   }
 
-  template <typename... FormatArgs>
-  void log(Level level, const std::string &fmt, FormatArgs &&...args) const {
+  static std::string &line_buffer() {
+    thread_local std::string line;
+    return line;
+  }
+
+  // Each line is formatted into a buffer reused by the thread and written
+  // with one call.
+  template <typename Fmt, typename... FormatArgs>
+  void log(Level level, Fmt fmt, const FormatArgs &...args) const {
     if (level >= threshold) {
-      std::cerr << rs::format("[{}] {}:{}: ", now_str(), to_string(level), name)
-                << rs::format(fmt, std::forward<FormatArgs>(args)...) << '\n';
+      auto &line = line_buffer();
+      char time_buffer[32];
+      line.clear();
+      rs::format_append(line, RS_FMT("[{}] {}:{}: "), now_str(time_buffer),
+                        to_string(level), name);
+      rs::format_append(line, fmt, args...);
+      line += '\n';
+      std::cerr.write(line.data(), line.size());
     }
   }
 };
@@ -0,0 +1,81 @@
+#ifndef INCLUDED_RISKSERVICE_ORDER_EXPIRY_HEADER
+#define INCLUDED_RISKSERVICE_ORDER_EXPIRY_HEADER
+/*
+ * When open orders expire, for the risk engine and the router's order index.
+ */
+
+#include "protocol.h"
+#include <charconv>
+#include <optional>
+#include <string_view>
+
+namespace rs {
+
+// When open orders expire if they are not deleted, e.g. because a gateway
+// lost the deletion. Times are in seconds.
+struct OrderExpiry {
+  static constexpr Timestamp day = 24 * 60 * 60;
+
+  // Lifetime of an order from its creation, 0 for no limit.
+  Timestamp ttl{0};
+  // Time of day after midnight UTC at which the trading session ends, and
+  // every order entered during the session expires.
+  std::optional<Timestamp> session_end;
+
+  bool enabled() const noexcept { return ttl > 0 || session_end.has_value(); }
+
+  // Time at which an order created at now expires, 0 if never.
+  Timestamp deadline(Timestamp now) const noexcept {
+    Timestamp expires_at = 0;
+    if (ttl > 0) {
+      expires_at = now + ttl;
+    }
+    if (session_end) {
+      // End of the current session, today or tomorrow.
+      auto end = now - now % day + *session_end % day;
+      if (end <= now) {
+        end += day;
+      }
+      if (expires_at == 0 || end < expires_at) {
+        expires_at = end;
+      }
+    }
+    return expires_at;
+  }
+
+  // Seconds after midnight of a time of day given as HH:MM, empty unless both
+  // are one or two digits, with hours below 24 and minutes below 60.
+  static std::optional<Timestamp>
+  parse_time_of_day(std::string_view time) noexcept {
+    auto colon = time.find(':');
+    if (colon == time.npos) {
+      return std::nullopt;
+    }
+    auto hours = parse_digits(time.substr(0, colon));
+    auto minutes = parse_digits(time.substr(colon + 1));
+    if (!hours || !minutes || *hours >= 24 || *minutes >= 60) {
+      return std::nullopt;
+    }
+    return *hours * 60 * 60 + *minutes * 60;
+  }
+
+private:
+  // Value of one or two decimal digits, empty for anything else.
+  static std::optional<Timestamp>
+  parse_digits(std::string_view digits) noexcept {
+    Timestamp value = 0;
+    if (digits.empty() || digits.size() > 2) {
+      return std::nullopt;
+    }
+    auto end = digits.data() + digits.size();
+    auto [ptr, error] = std::from_chars(digits.data(), end, value);
+    if (error != std::errc{} || ptr != end) {
+      return std::nullopt;
+    }
+    return value;
+  }
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_ORDER_EXPIRY_HEADER
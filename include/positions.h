@@ -0,0 +1,156 @@
+#ifndef INCLUDED_RISKSERVICE_POSITIONS_HEADER
+#define INCLUDED_RISKSERVICE_POSITIONS_HEADER
+/*
+ * Instrument positions and lock-free snapshots of them for other threads and
+ * processes.
+ */
+
+#include "protocol.h"
+#include "seqlock.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <optional>
+#include <string>
+
+namespace rs {
+
+// Side of an order, used as the index of side-indexed arrays, so that buys
+// and sells take the same path instead of branching on the side.
+enum Side : uint8_t { BUY = 0, SELL = 1 };
+
+// Side of 'B' or 'S', nothing for any other character.
+inline std::optional<Side> side_of(char side) noexcept {
+  switch (side) {
+  case 'B':
+    return BUY;
+  case 'S':
+    return SELL;
+  default:
+    return std::nullopt;
+  }
+}
+
+inline char side_char(Side side) noexcept { return "BS"[side]; }
+
+// Direction in which trades of side move the net position, negated: +1 for
+// buys and -1 for sells.
+inline long long side_sign(Side side) noexcept { return 1 - 2 * side; }
+
+// Worst case position on side with open quantity qty on that side, if all
+// open orders of the side trade.
+inline long long worst_pos(long long net_pos, Quantity qty,
+                           Side side) noexcept {
+  auto open = static_cast<long long>(qty);
+  return std::max(open, open + side_sign(side) * net_pos);
+}
+
+struct InstrumentState {
+  using NetPos = long long;
+  NetPos net_pos{0};
+
+  // Open quantity of each side.
+  std::array<Quantity, 2> open_qty{};
+
+  NetPos worst_pos(Side side) const noexcept {
+    return rs::worst_pos(net_pos, open_qty[side], side);
+  }
+
+  // Apply trade of qty of an order of side to the net position.
+  void add_trade(Side side, Quantity qty) noexcept {
+    net_pos -= side_sign(side) * static_cast<NetPos>(qty);
+  }
+
+  Quantity buy_qty() const noexcept { return open_qty[BUY]; }
+  Quantity sell_qty() const noexcept { return open_qty[SELL]; }
+  NetPos worst_buy_pos() const noexcept { return worst_pos(BUY); }
+  NetPos worst_sell_pos() const noexcept { return worst_pos(SELL); }
+};
+
+// Fixed capacity hash table of seqlocked InstrumentState snapshots, keyed by
+// listing id with linear probing.
+// One writer thread publishes states, any thread can read them without ever
+// blocking the writer. The table lives either in anonymous memory, for readers
+// in this process, or in named POSIX shared memory, for readers in other
+// processes.
+// Slots are never removed, so a table can hold at most capacity listings.
+class PositionTable {
+
+public:
+  static constexpr std::size_t default_capacity = 1 << 12;
+
+  // Table in memory private to this process.
+  // With huge_pages, the table is put on huge pages reserved with
+  // vm.nr_hugepages, of the system's default size, e.g. 2 MiB or 1 GiB, and
+  // on transparent huge pages if none are reserved.
+  explicit PositionTable(std::size_t capacity = default_capacity,
+                         bool huge_pages = false);
+
+  // Create table in shared memory with given name, e.g. "/risk-positions".
+  // The name is removed when the table is destroyed. With huge_pages, the
+  // table is put on transparent huge pages if shared memory may use them.
+  [[nodiscard]] static PositionTable create_shared(const std::string &name,
+                                                   std::size_t capacity,
+                                                   bool huge_pages = false);
+
+  // Map an existing shared table for reading.
+  [[nodiscard]] static PositionTable attach(const std::string &name);
+
+  ~PositionTable() noexcept;
+
+  PositionTable(const PositionTable &) = delete;
+  PositionTable &operator=(const PositionTable &) = delete;
+
+  PositionTable(PositionTable &&other) noexcept;
+  PositionTable &operator=(PositionTable &&other) noexcept;
+
+  // Write state of listing, only from the writer thread.
+  // Return false if the table is full.
+  bool publish(ListingID, const InstrumentState &) noexcept;
+
+  // Read consistent snapshot of listing state into given state, from any
+  // thread. Return false if the listing has never been published.
+  bool read(ListingID, InstrumentState &) const noexcept;
+
+  std::size_t capacity() const noexcept;
+
+  // True if the table lives in named shared memory.
+  bool shared() const noexcept { return !shared_name_.empty(); }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> occupied;
+    std::atomic<ListingID> listing_id;
+    Seqlock<InstrumentState> state;
+  };
+
+  // Start of the mapped memory, followed by capacity slots.
+  struct alignas(64) Header {
+    uint64_t magic;
+    uint64_t capacity;
+  };
+
+  Header *header_{nullptr};
+  Slot *slots_{nullptr};
+  std::size_t mapped_length_{0};
+  // Set only for the creator of a shared table.
+  std::string shared_name_;
+
+  PositionTable(void *, std::size_t, std::string);
+
+  static std::size_t mapped_length(std::size_t capacity) noexcept {
+    return sizeof(Header) + capacity * sizeof(Slot);
+  }
+
+  // Construct header and empty slots into zeroed memory.
+  void initialize(std::size_t capacity) noexcept;
+
+  // First slot in the probe sequence of listing.
+  std::size_t home(ListingID) const noexcept;
+
+  void unmap() noexcept;
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_POSITIONS_HEADER
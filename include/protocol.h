@@ -4,10 +4,15 @@
  * Message protocol with serialization.
  */
 
+#include "buffer.h"
 #include "format.h"
+#include <array>
+#include <charconv>
 #include <cstdint>
 #include <ctime>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 
 namespace rs::protocol {
 
@@ -55,41 +60,194 @@ struct OrderResponse {
   enum class Status : uint16_t {
     ACCEPTED = 0,
     REJECTED = 1,
+    THROTTLED = 2, // Rejected, order rate of its listing or session exceeded
   };
   uint16_t messageType; // Message type of this message
   uint64_t orderId;     // Order id that refers to the original order id
   Status status;        // Status of the order
 };
 
+struct ReplicationAck {
+  static constexpr uint16_t MESSAGE_TYPE = 6;
+  uint16_t messageType;    // Message type of this message
+  uint64_t sequenceNumber; // Last replicated event applied by the backup
+};
+
+struct PositionQuery {
+  static constexpr uint16_t MESSAGE_TYPE = 7;
+  static constexpr std::size_t max_listings = 32;
+  uint16_t messageType; // Message type of this message
+  uint16_t count;       // Amount of listings queried
+  std::array<uint64_t, max_listings> listingIds; // Queried listings
+};
+
+struct PositionResponse {
+  static constexpr uint16_t MESSAGE_TYPE = 8;
+  uint16_t messageType;  // Message type of this message
+  uint64_t listingId;    // Financial instrument id associated to this message
+  int64_t netPos;        // Net position from trades
+  uint64_t buyQty;       // Total quantity of open buy orders
+  uint64_t sellQty;      // Total quantity of open sell orders
+  int64_t worstBuyPos;   // Position if all open buy orders are filled
+  int64_t worstSellPos;  // Position if all open sell orders are filled
+};
+
+struct OrderBatch {
+  static constexpr uint16_t MESSAGE_TYPE = 9;
+  static constexpr std::size_t max_entries = 512;
+  enum Flags : uint16_t {
+    NONE = 0,
+    ALL_OR_NOTHING = 1, // Reject all entries if any entry is rejected
+  };
+  // New order if messageType is NewOrder::MESSAGE_TYPE, quantity modification
+  // if it is ModifyOrderQuantity::MESSAGE_TYPE. Modifications use only orderId
+  // and quantity.
+  struct Entry {
+    uint16_t messageType;
+    uint64_t listingId;
+    uint64_t orderId;
+    uint64_t quantity;
+    uint64_t price;
+    char side;
+  };
+  uint16_t messageType; // Message type of this message
+  uint16_t flags;       // Bitwise or of Flags
+  uint16_t count;       // Amount of entries
+  std::array<Entry, max_entries> entries;
+};
+
+struct BatchResponse {
+  static constexpr uint16_t MESSAGE_TYPE = 10;
+  static constexpr std::size_t bitmap_words = OrderBatch::max_entries / 64;
+  uint16_t messageType; // Message type of this message
+  uint16_t count;       // Amount of entries in the batch
+  // Bit i is set if entry i was accepted, only the first ceil(count / 64) words
+  // are encoded.
+  std::array<uint64_t, bitmap_words> accepted;
+
+  bool is_accepted(std::size_t i) const noexcept {
+    return (accepted[i / 64] >> (i % 64)) & 1;
+  }
+};
+
+// Identifies the session of the connection. Orders of the connection count
+// towards the limits of the session and its account. Connections that do not
+// log on use session 0.
+struct Logon {
+  static constexpr uint16_t MESSAGE_TYPE = 11;
+  enum Flags : uint16_t {
+    NONE = 0,
+    ROUTED = 1, // Sent by a risk-router, which skips sequence numbers
+  };
+  uint16_t messageType; // Message type of this message
+  uint64_t sessionId;   // Session id configured in the limits file
+  uint16_t flags;       // Bitwise or of Flags
+};
+
+// Response to Logon. Requests of a logged on session are sequenced by the
+// sequence numbers in their headers, across connections: requests before the
+// expected number have been handled, and are answered again from a window of
+// recent responses instead of being handled twice. A request sent again whose
+// response has left the window is answered with a SessionStatus too, echoing
+// its sequence number, since whether it was accepted is no longer known.
+struct SessionStatus {
+  static constexpr uint16_t MESSAGE_TYPE = 12;
+  uint16_t messageType;            // Message type of this message
+  uint64_t sessionId;              // Session id of the Logon
+  uint32_t expectedSequenceNumber; // Next sequence number, 0 if none seen yet
+};
+
+// Liveness check, answered with a Heartbeat with the same token. It is not
+// sequenced and changes nothing, and it is answered in order with the other
+// requests of the connection, so its answer also confirms that all requests
+// sent before it have been handled.
+struct Heartbeat {
+  static constexpr uint16_t MESSAGE_TYPE = 13;
+  uint16_t messageType; // Message type of this message
+  uint64_t token;       // Echoed in the answer
+};
+
+// Limits of one scope, as changed on the admin channel of a server. Not a
+// request: the server replicates and captures it, so that backups and
+// backtests apply the same limits between the same orders. An update of
+// several scopes is one message per scope.
+struct LimitUpdate {
+  static constexpr uint16_t MESSAGE_TYPE = 14;
+  enum Scope : uint16_t {
+    FIRM = 0,
+    ACCOUNT = 1,
+    SESSION = 2,
+    INSTRUMENT = 3,
+    INSTRUMENT_RATE = 4,
+    SESSION_RATE = 5,
+  };
+  enum Flags : uint16_t {
+    NONE = 0,
+    DEFAULT = 1, // Default of the scope, id is not used
+  };
+  uint16_t messageType; // Message type of this message
+  uint16_t scope;       // One of Scope
+  uint16_t flags;       // Bitwise or of Flags
+  uint64_t id;          // Account, session or instrument id
+  uint64_t account;     // Account of a session
+  uint64_t maxBuy;      // Max buy position, or max orders per second of a rate
+  uint64_t maxSell;     // Max sell position
+};
+
 using Message = std::string;
+// Non-owning view to a message, e.g. inside a receive buffer.
+using MessageView = std::string_view;
+
+// Messages are separated by newlines on stream transports.
+constexpr char message_delimiter = '\n';
+// Upper bound for the length of one encoded message with delimiter.
+constexpr std::size_t max_message_length = 1 << 10;
+
+// Split next complete message from the front of buffer into msg, without the
+// delimiter. Return false if the buffer has no complete message.
+// The view is valid until the buffer is compacted.
+inline bool next_message(Buffer &buffer, MessageView &msg) {
+  auto bytes = buffer.readable();
+  auto end = bytes.find(message_delimiter);
+  if (end == bytes.npos) {
+    return false;
+  }
+  msg = bytes.substr(0, end);
+  buffer.consume(end + 1);
+  return true;
+}
 
 // Return a stateful, callable parser that splits given msg into parts,
 // separated by space. Calling the parser returns one 64 bit unsigned int, until
 // all parts have been parsed.
-inline auto make_parser(const Message &msg) {
-  auto parse_next = [&msg, begin = std::size_t{0},
-                     end = std::size_t{0}]() mutable {
-    if (end >= msg.length()) {
+inline auto make_parser(MessageView msg) {
+  auto parse_next = [msg, begin = std::size_t{0}]() mutable {
+    while (begin < msg.length() && msg[begin] == ' ') {
+      ++begin;
+    }
+    if (begin >= msg.length() || msg[begin] == message_delimiter) {
       throw std::runtime_error(
           "Unable to parse next value, reached end of message");
     }
-    end = msg.find(' ', begin);
-    if (end == msg.npos) {
-      end = msg.length();
+    uint64_t value;
+    auto [end, error] =
+        std::from_chars(msg.data() + begin, msg.data() + msg.length(), value);
+    if (error != std::errc{}) {
+      throw std::runtime_error("Unable to parse next value, invalid integer");
     }
-    auto res = msg.substr(begin, end - begin);
-    begin = end + 1;
-    return std::stoull(res);
+    begin = end - msg.data();
+    return value;
   };
   return parse_next;
 }
 
 // Decoders.
 // All messages are parsed into 64 bit unsigned ints and then casted to correct
-// message field type.
+// message field type. Fields come from a parser that returns the next field on
+// each call and throws once there are none left, e.g. one made by make_parser.
 
-inline Header decode_header(const Message &new_order) {
-  auto parse_next = make_parser(new_order);
+template <typename Parser>
+inline Header decode_header_fields(Parser &parse_next) {
   Header h{
       static_cast<decltype(h.version)>(parse_next()),
       static_cast<decltype(h.payloadSize)>(parse_next()),
@@ -99,86 +257,331 @@ inline Header decode_header(const Message &new_order) {
   return h;
 }
 
-template <typename Payload> inline Payload decode_payload(const Message &);
+inline Header decode_header(MessageView new_order) {
+  auto parse_next = make_parser(new_order);
+  return decode_header_fields(parse_next);
+}
+
+// Decodes the fields of Payload that follow the header.
+template <typename Payload> struct PayloadDecoder;
 
-template <> inline NewOrder decode_payload(const Message &msg) {
+template <typename Payload> inline Payload decode_payload(MessageView msg) {
   auto parse_next = make_parser(msg);
   // Skip header.
   for (auto i = 0; i < 4; ++i) {
     parse_next();
   }
-  NewOrder p{
-      static_cast<decltype(p.messageType)>(parse_next()),
-      static_cast<decltype(p.listingId)>(parse_next()),
-      static_cast<decltype(p.orderId)>(parse_next()),
-      static_cast<decltype(p.orderQuantity)>(parse_next()),
-      static_cast<decltype(p.orderPrice)>(parse_next()),
-      static_cast<decltype(p.side)>(parse_next()),
-  };
-  return p;
+  return PayloadDecoder<Payload>::decode(parse_next);
 }
 
-template <> inline DeleteOrder decode_payload(const Message &msg) {
-  auto parse_next = make_parser(msg);
-  for (auto i = 0; i < 4; ++i) {
-    parse_next();
+template <> struct PayloadDecoder<NewOrder> {
+  template <typename Parser> static NewOrder decode(Parser &parse_next) {
+    NewOrder p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.listingId)>(parse_next()),
+        static_cast<decltype(p.orderId)>(parse_next()),
+        static_cast<decltype(p.orderQuantity)>(parse_next()),
+        static_cast<decltype(p.orderPrice)>(parse_next()),
+        static_cast<decltype(p.side)>(parse_next()),
+    };
+    return p;
   }
-  DeleteOrder p{
-      static_cast<decltype(p.messageType)>(parse_next()),
-      static_cast<decltype(p.orderId)>(parse_next()),
+};
+
+template <> struct PayloadDecoder<DeleteOrder> {
+  template <typename Parser> static DeleteOrder decode(Parser &parse_next) {
+    DeleteOrder p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.orderId)>(parse_next()),
+    };
+    return p;
+  }
+};
+
+template <> struct PayloadDecoder<ModifyOrderQuantity> {
+  template <typename Parser>
+  static ModifyOrderQuantity decode(Parser &parse_next) {
+    ModifyOrderQuantity p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.orderId)>(parse_next()),
+        static_cast<decltype(p.newQuantity)>(parse_next()),
+    };
+    return p;
+  }
+};
+
+template <> struct PayloadDecoder<Trade> {
+  template <typename Parser> static Trade decode(Parser &parse_next) {
+    Trade p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.listingId)>(parse_next()),
+        static_cast<decltype(p.tradeId)>(parse_next()),
+        static_cast<decltype(p.tradePrice)>(parse_next()),
+        static_cast<decltype(p.tradeQuantity)>(parse_next()),
+    };
+    return p;
+  }
+};
+
+template <> struct PayloadDecoder<OrderResponse> {
+  template <typename Parser> static OrderResponse decode(Parser &parse_next) {
+    OrderResponse p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.orderId)>(parse_next()),
+        static_cast<decltype(p.status)>(parse_next()),
+    };
+    return p;
+  }
+};
+
+template <> struct PayloadDecoder<ReplicationAck> {
+  template <typename Parser> static ReplicationAck decode(Parser &parse_next) {
+    ReplicationAck p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.sequenceNumber)>(parse_next()),
+    };
+    return p;
+  }
+};
+
+template <> struct PayloadDecoder<PositionQuery> {
+  template <typename Parser> static PositionQuery decode(Parser &parse_next) {
+    PositionQuery p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.count)>(parse_next()),
+        {},
+    };
+    if (p.count > PositionQuery::max_listings) {
+      throw std::runtime_error("Too many listings in position query");
+    }
+    for (std::size_t i = 0; i < p.count; ++i) {
+      p.listingIds[i] = parse_next();
+    }
+    return p;
+  }
+};
+
+// Signed fields are encoded as their two's complement bit pattern.
+template <> struct PayloadDecoder<PositionResponse> {
+  template <typename Parser>
+  static PositionResponse decode(Parser &parse_next) {
+    PositionResponse p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.listingId)>(parse_next()),
+        static_cast<decltype(p.netPos)>(parse_next()),
+        static_cast<decltype(p.buyQty)>(parse_next()),
+        static_cast<decltype(p.sellQty)>(parse_next()),
+        static_cast<decltype(p.worstBuyPos)>(parse_next()),
+        static_cast<decltype(p.worstSellPos)>(parse_next()),
+    };
+    return p;
+  }
+};
+
+template <> struct PayloadDecoder<OrderBatch> {
+  template <typename Parser> static OrderBatch decode(Parser &parse_next) {
+    OrderBatch p;
+    p.messageType = static_cast<decltype(p.messageType)>(parse_next());
+    p.flags = static_cast<decltype(p.flags)>(parse_next());
+    p.count = static_cast<decltype(p.count)>(parse_next());
+    if (p.count > OrderBatch::max_entries) {
+      throw std::runtime_error("Too many entries in order batch");
+    }
+    for (std::size_t i = 0; i < p.count; ++i) {
+      auto &e = p.entries[i];
+      e = OrderBatch::Entry{
+          static_cast<decltype(e.messageType)>(parse_next()),
+          static_cast<decltype(e.listingId)>(parse_next()),
+          static_cast<decltype(e.orderId)>(parse_next()),
+          static_cast<decltype(e.quantity)>(parse_next()),
+          static_cast<decltype(e.price)>(parse_next()),
+          static_cast<decltype(e.side)>(parse_next()),
+      };
+    }
+    return p;
+  }
+};
+
+template <> struct PayloadDecoder<BatchResponse> {
+  template <typename Parser> static BatchResponse decode(Parser &parse_next) {
+    BatchResponse p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.count)>(parse_next()),
+        {},
+    };
+    if (p.count > OrderBatch::max_entries) {
+      throw std::runtime_error("Too many entries in batch response");
+    }
+    for (std::size_t i = 0; i < (p.count + 63u) / 64; ++i) {
+      p.accepted[i] = parse_next();
+    }
+    return p;
+  }
+};
+
+template <> struct PayloadDecoder<Logon> {
+  template <typename Parser> static Logon decode(Parser &parse_next) {
+    Logon p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.sessionId)>(parse_next()),
+        static_cast<decltype(p.flags)>(parse_next()),
+    };
+    return p;
+  }
+};
+
+template <> struct PayloadDecoder<SessionStatus> {
+  template <typename Parser> static SessionStatus decode(Parser &parse_next) {
+    SessionStatus p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.sessionId)>(parse_next()),
+        static_cast<decltype(p.expectedSequenceNumber)>(parse_next()),
+    };
+    return p;
+  }
+};
+
+template <> struct PayloadDecoder<Heartbeat> {
+  template <typename Parser> static Heartbeat decode(Parser &parse_next) {
+    Heartbeat p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.token)>(parse_next()),
+    };
+    return p;
+  }
+};
+
+template <> struct PayloadDecoder<LimitUpdate> {
+  template <typename Parser> static LimitUpdate decode(Parser &parse_next) {
+    LimitUpdate p{
+        static_cast<decltype(p.messageType)>(parse_next()),
+        static_cast<decltype(p.scope)>(parse_next()),
+        static_cast<decltype(p.flags)>(parse_next()),
+        static_cast<decltype(p.id)>(parse_next()),
+        static_cast<decltype(p.account)>(parse_next()),
+        static_cast<decltype(p.maxBuy)>(parse_next()),
+        static_cast<decltype(p.maxSell)>(parse_next()),
+    };
+    return p;
+  }
+};
+
+// Encoders.
+// All field values converted to string with std::to_string.
+// The resulting encoding is a concatenation of all string values, separated by
+// space.
+//
+// Encoders that write into a Buffer append the message delimiter and do not
+// allocate.
+
+// Append field values as decimal integers, separated by space, to out.
+template <typename... Fields>
+inline void encode_fields(Buffer &out, const Fields &...fields) {
+  bool first = true;
+  auto write = [&out, &first](uint64_t value) {
+    if (!first) {
+      out.append(' ');
+    }
+    first = false;
+    auto [end, error] = std::to_chars(out.write_ptr(), out.write_end(), value);
+    if (error != std::errc{}) {
+      throw std::length_error("Buffer full, unable to encode field");
+    }
+    out.commit(end - out.write_ptr());
   };
-  return p;
+  (write(static_cast<uint64_t>(fields)), ...);
 }
 
-template <> inline ModifyOrderQuantity decode_payload(const Message &msg) {
-  auto parse_next = make_parser(msg);
-  for (auto i = 0; i < 4; ++i) {
-    parse_next();
+inline void encode_header(Buffer &out, const Header &h) {
+  encode_fields(out, h.version, h.payloadSize, h.sequenceNumber, h.timestamp);
+}
+
+inline void encode_payload(Buffer &out, const NewOrder &p) {
+  encode_fields(out, p.messageType, p.listingId, p.orderId, p.orderQuantity,
+                p.orderPrice, p.side);
+}
+
+inline void encode_payload(Buffer &out, const DeleteOrder &p) {
+  encode_fields(out, p.messageType, p.orderId);
+}
+
+inline void encode_payload(Buffer &out, const ModifyOrderQuantity &p) {
+  encode_fields(out, p.messageType, p.orderId, p.newQuantity);
+}
+
+inline void encode_payload(Buffer &out, const Trade &p) {
+  encode_fields(out, p.messageType, p.listingId, p.tradeId, p.tradeQuantity,
+                p.tradePrice);
+}
+
+inline void encode_payload(Buffer &out, const OrderResponse &p) {
+  encode_fields(out, p.messageType, p.orderId, static_cast<uint16_t>(p.status));
+}
+
+inline void encode_payload(Buffer &out, const ReplicationAck &p) {
+  encode_fields(out, p.messageType, p.sequenceNumber);
+}
+
+inline void encode_payload(Buffer &out, const PositionQuery &p) {
+  encode_fields(out, p.messageType, p.count);
+  for (std::size_t i = 0; i < p.count; ++i) {
+    out.append(' ');
+    encode_fields(out, p.listingIds[i]);
   }
-  ModifyOrderQuantity p{
-      static_cast<decltype(p.messageType)>(parse_next()),
-      static_cast<decltype(p.orderId)>(parse_next()),
-      static_cast<decltype(p.newQuantity)>(parse_next()),
-  };
-  return p;
 }
 
-template <> inline Trade decode_payload(const Message &msg) {
-  auto parse_next = make_parser(msg);
-  for (auto i = 0; i < 4; ++i) {
-    parse_next();
+inline void encode_payload(Buffer &out, const PositionResponse &p) {
+  encode_fields(out, p.messageType, p.listingId, p.netPos, p.buyQty, p.sellQty,
+                p.worstBuyPos, p.worstSellPos);
+}
+
+inline void encode_payload(Buffer &out, const OrderBatch &p) {
+  encode_fields(out, p.messageType, p.flags, p.count);
+  for (std::size_t i = 0; i < p.count; ++i) {
+    const auto &e = p.entries[i];
+    out.append(' ');
+    encode_fields(out, e.messageType, e.listingId, e.orderId, e.quantity,
+                  e.price, e.side);
   }
-  Trade p{
-      static_cast<decltype(p.messageType)>(parse_next()),
-      static_cast<decltype(p.listingId)>(parse_next()),
-      static_cast<decltype(p.tradeId)>(parse_next()),
-      static_cast<decltype(p.tradePrice)>(parse_next()),
-      static_cast<decltype(p.tradeQuantity)>(parse_next()),
-  };
-  return p;
 }
 
-template <> inline OrderResponse decode_payload(const Message &msg) {
-  auto parse_next = make_parser(msg);
-  for (auto i = 0; i < 4; ++i) {
-    parse_next();
+inline void encode_payload(Buffer &out, const BatchResponse &p) {
+  encode_fields(out, p.messageType, p.count);
+  for (std::size_t i = 0; i < (p.count + 63u) / 64; ++i) {
+    out.append(' ');
+    encode_fields(out, p.accepted[i]);
   }
-  OrderResponse p{
-      static_cast<decltype(p.messageType)>(parse_next()),
-      static_cast<decltype(p.orderId)>(parse_next()),
-      static_cast<decltype(p.status)>(parse_next()),
-  };
-  return p;
 }
 
-// Encoders.
-// All field values converted to string with std::to_string.
-// The resulting encoding is a concatenation of all string values, separated by
-// space.
+inline void encode_payload(Buffer &out, const Logon &p) {
+  encode_fields(out, p.messageType, p.sessionId, p.flags);
+}
+
+inline void encode_payload(Buffer &out, const SessionStatus &p) {
+  encode_fields(out, p.messageType, p.sessionId, p.expectedSequenceNumber);
+}
+
+inline void encode_payload(Buffer &out, const Heartbeat &p) {
+  encode_fields(out, p.messageType, p.token);
+}
+
+inline void encode_payload(Buffer &out, const LimitUpdate &p) {
+  encode_fields(out, p.messageType, p.scope, p.flags, p.id, p.account,
+                p.maxBuy, p.maxSell);
+}
+
+// Append complete message with delimiter to out.
+template <typename Payload>
+inline void encode(Buffer &out, const Header &h, const Payload &p) {
+  encode_header(out, h);
+  out.append(' ');
+  encode_payload(out, p);
+  out.append(message_delimiter);
+}
 
 inline Message encode_header(const Header &h) {
-  return rs::format("{} {} {} {}", h.version, h.payloadSize, h.sequenceNumber,
-                    h.timestamp);
+  return rs::format(RS_FMT("{} {} {} {}"), h.version, h.payloadSize,
+                    h.sequenceNumber, h.timestamp);
 }
 
 template <typename Payload>
@@ -187,28 +590,53 @@ inline Message encode(const Header &h, const Payload &p) {
 }
 
 inline Message encode(const NewOrder &p) {
-  return rs::format("{} {} {} {} {} {}", p.messageType, p.listingId, p.orderId,
-                    p.orderQuantity, p.orderPrice, p.side);
+  // Same bit pattern as encode_fields, for sides outside of ASCII.
+  return rs::format(RS_FMT("{} {} {} {} {} {}"), p.messageType, p.listingId,
+                    p.orderId, p.orderQuantity, p.orderPrice,
+                    static_cast<uint64_t>(p.side));
 }
 
 inline Message encode(const DeleteOrder &p) {
-  return rs::format("{} {}", p.messageType, p.orderId);
+  return rs::format(RS_FMT("{} {}"), p.messageType, p.orderId);
 }
 
 inline Message encode(const ModifyOrderQuantity &p) {
-  return rs::format("{} {} {}", p.messageType, p.orderId, p.newQuantity);
+  return rs::format(RS_FMT("{} {} {}"), p.messageType, p.orderId,
+                    p.newQuantity);
 }
 
 inline Message encode(const Trade &p) {
-  return rs::format("{} {} {} {} {}", p.messageType, p.listingId, p.tradeId,
-                    p.tradeQuantity, p.tradePrice);
+  return rs::format(RS_FMT("{} {} {} {} {}"), p.messageType, p.listingId,
+                    p.tradeId, p.tradeQuantity, p.tradePrice);
 }
 
 inline Message encode(const OrderResponse &p) {
-  return rs::format("{} {} {}", p.messageType, p.orderId,
+  return rs::format(RS_FMT("{} {} {}"), p.messageType, p.orderId,
                     static_cast<uint16_t>(p.status));
 }
 
+inline Message encode(const ReplicationAck &p) {
+  return rs::format(RS_FMT("{} {}"), p.messageType, p.sequenceNumber);
+}
+
+inline Message encode(const Logon &p) {
+  return rs::format(RS_FMT("{} {} {}"), p.messageType, p.sessionId, p.flags);
+}
+
+inline Message encode(const SessionStatus &p) {
+  return rs::format(RS_FMT("{} {} {}"), p.messageType, p.sessionId,
+                    p.expectedSequenceNumber);
+}
+
+inline Message encode(const Heartbeat &p) {
+  return rs::format(RS_FMT("{} {}"), p.messageType, p.token);
+}
+
+inline Message encode(const LimitUpdate &p) {
+  return rs::format(RS_FMT("{} {} {} {} {} {} {}"), p.messageType, p.scope,
+                    p.flags, p.id, p.account, p.maxBuy, p.maxSell);
+}
+
 } // namespace rs::protocol
 
 namespace rs {
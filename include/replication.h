@@ -0,0 +1,226 @@
+#ifndef INCLUDED_RISKSERVICE_REPLICATION_HEADER
+#define INCLUDED_RISKSERVICE_REPLICATION_HEADER
+/*
+ * Primary/backup replication of risk server state transitions.
+ *
+ * The primary streams every accepted state transition as an event to its
+ * backups over TCP. Each event is one line, the replication sequence number
+ * followed by the encoded protocol message that caused the transition:
+ *
+ *   <sequence number> <header> <payload>\n
+ *
+ * Backups apply the events in order and acknowledge the sequence number of the
+ * last applied event with a ReplicationAck line after each read.
+ *
+ * A primary with nothing to replicate sends a Heartbeat event with sequence
+ * number 0 at least every heartbeat_interval, which backups acknowledge but do
+ * not apply. A backup that hears nothing from its primary for its promotion
+ * timeout takes the primary for gone, e.g. after a host failure or a network
+ * partition that closes no connection, and so does a backup whose primary
+ * does not connect within it.
+ */
+
+extern "C" {
+#include <poll.h>
+}
+
+#include "format.h"
+#include "protocol.h"
+#include "tcp.h"
+#include <array>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rs::replication {
+
+using SequenceNum = decltype(protocol::ReplicationAck::sequenceNumber);
+using Nanoseconds = long long;
+
+constexpr std::chrono::milliseconds heartbeat_interval{100};
+constexpr std::chrono::milliseconds default_promotion_timeout{1000};
+
+inline Nanoseconds clock_ns() noexcept {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Split event into its replication sequence number and the replicated message.
+inline std::pair<SequenceNum, protocol::MessageView>
+split_event(protocol::MessageView event) {
+  auto separator = event.find(' ');
+  auto seq = protocol::make_parser(event.substr(0, separator))();
+  return {seq, event.substr(separator + 1)};
+}
+
+// Sending side, owned by the primary risk server.
+// Appended events are buffered and sent in batches, either when the batch is
+// full or when flush is called, e.g. when the server runs out of messages to
+// handle. Each backup has a queue of batches it has not taken yet, sent
+// without blocking. Backups are not waited for unless replication is
+// synchronous, and then for at most ack_timeout, after which a backup that
+// has not acknowledged is removed. A backup is also removed when its queue
+// overflows or when it takes none of it within send_timeout.
+class Primary {
+
+public:
+  static constexpr std::size_t batch_length = 1 << 6;
+  // Upper bound for the length of one encoded event.
+  static constexpr std::size_t event_length =
+      protocol::max_message_length + 24;
+  static constexpr std::size_t lag_window_length = 1 << 12;
+  static constexpr std::chrono::milliseconds ack_timeout{1000};
+  static constexpr std::chrono::milliseconds send_timeout{1000};
+  // Bytes of events queued for one backup.
+  static constexpr std::size_t queue_length = 1 << 20;
+
+  using Address = std::pair<std::string, std::string>;
+
+  explicit Primary(const std::vector<Address> &, bool synchronous);
+
+  ~Primary() noexcept = default;
+
+  Primary(const Primary &) = delete;
+  Primary &operator=(const Primary &) = delete;
+
+  Primary(Primary &&other) noexcept = default;
+  Primary &operator=(Primary &&other) noexcept = default;
+
+  // Append event caused by message with given header and payload.
+  template <typename Payload>
+  void append(const protocol::Header &header, const Payload &payload) {
+    auto seq = ++sequence_number_;
+    append_time_[seq % lag_window_length] = clock_ns();
+    protocol::encode_fields(batch_, seq);
+    batch_.append(' ');
+    protocol::encode(batch_, header, payload);
+    if (++batch_size_ >= batch_length) {
+      flush();
+    }
+  }
+
+  // Make appended events durable before a response is sent.
+  // In synchronous mode, send all appended events and wait until every backup
+  // has acknowledged them. Otherwise only send a heartbeat if one is due.
+  void commit();
+
+  // Send all appended events to backups, or a heartbeat if there are none and
+  // one is due, and read acknowledgements that have already arrived.
+  void flush();
+
+  // Replication lag in events and latency from append to acknowledgement.
+  std::string dump_stats() const;
+
+private:
+  struct Link {
+    std::string address;
+    tcp::Client client;
+    SequenceNum acked;
+    // Events not yet taken by the socket.
+    Buffer queue;
+    // When the queue has to be sent by, zero while it is empty.
+    Nanoseconds send_deadline;
+  };
+
+  std::vector<Link> links_;
+  bool synchronous_;
+
+  SequenceNum sequence_number_{0};
+  Buffer batch_{batch_length * event_length};
+  std::size_t batch_size_{0};
+  // When events or a heartbeat were last sent.
+  Nanoseconds last_sent_ns_{0};
+
+  // Append times of the most recent events, for measuring lag.
+  std::array<Nanoseconds, lag_window_length> append_time_{};
+  Nanoseconds last_lag_ns_{0};
+  Nanoseconds max_lag_ns_{0};
+
+  bool heartbeat_due(Nanoseconds now) const noexcept;
+
+  // Queue the batch for backup, send as much of the queue as the socket takes
+  // without blocking and read acknowledgements. Return false if the backup is
+  // to be removed, because its queue overflows or is past its deadline, or
+  // because it closed its connection.
+  bool send_batch(Link &, Nanoseconds now);
+
+  // Wait until backup has acknowledged all events, at most until deadline.
+  // Return false if it has not.
+  bool wait_for_acks(Link &, Nanoseconds deadline);
+
+  // Read acknowledgements that have arrived from backup, without blocking.
+  // Return false if the backup closed its connection.
+  bool read_acks(Link &);
+};
+
+// Receiving side, owned by a backup risk server.
+class Backup {
+
+public:
+  explicit Backup(
+      const std::string &, const std::string &,
+      std::chrono::milliseconds promotion_timeout = default_promotion_timeout);
+
+  ~Backup() noexcept = default;
+
+  Backup(const Backup &) = delete;
+  Backup &operator=(const Backup &) = delete;
+
+  Backup(Backup &&other) noexcept = default;
+  Backup &operator=(Backup &&other) noexcept = default;
+
+  // Accept a connection from the primary and call apply for each replicated
+  // message, in order, until the primary closes the connection or is silent
+  // for longer than the promotion timeout. Return right away if the primary
+  // does not connect within the promotion timeout.
+  template <typename Apply> void serve(Apply &&apply) {
+    if (!wait_for_primary(tcp_server_.socket(), "No connection")) {
+      return;
+    }
+    auto connection = tcp_server_.next_connection();
+    // Receiving nothing, e.g. when interrupted by a signal, is not the end of
+    // the connection.
+    while (!connection.closed) {
+      if (!wait_for_primary(connection.socket, "No events or heartbeats")) {
+        return;
+      }
+      if (tcp_server_.receive(connection) == 0) {
+        continue;
+      }
+      protocol::MessageView event;
+      while (protocol::next_message(*connection.recv_buffer, event)) {
+        auto [seq, msg] = split_event(event);
+        // Heartbeats have nothing to apply.
+        if (seq == 0) {
+          continue;
+        }
+        apply(msg);
+        applied_ = seq;
+      }
+      protocol::ReplicationAck ack{protocol::ReplicationAck::MESSAGE_TYPE,
+                                   applied_};
+      protocol::Header header{protocol::ReplicationAck::MESSAGE_TYPE,
+                              sizeof(ack), 1, now()};
+      protocol::encode(*connection.send_buffer, header, ack);
+      tcp_server_.send(connection);
+    }
+  }
+
+  SequenceNum applied() const noexcept { return applied_; }
+
+private:
+  tcp::Server tcp_server_;
+  std::chrono::milliseconds promotion_timeout_;
+  SequenceNum applied_{0};
+
+  // Wait until the connection to the primary, or the listening socket, is
+  // readable, at most for the promotion timeout. Return false, and log what
+  // did not come from the primary, if it is not.
+  bool wait_for_primary(const tcp::Socket &, const char *missing) const;
+};
+
+} // namespace rs::replication
+
+#endif // INCLUDED_RISKSERVICE_REPLICATION_HEADER
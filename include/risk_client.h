@@ -2,58 +2,557 @@
 #define INCLUDED_RISKSERVICE_CLIENT_HEADER
 /*
  * Risk client that sends messages to the risk server.
+ *
+ * Given several replicas of the risk server, a primary and its standbys, the
+ * client keeps a connection to each and fails over between them:
+ *
+ *   rs::RiskClient client({{"10.0.0.1", "9000"}, {"10.0.0.2", "9000"}});
+ *   client.logon(session_id);
+ *   client.send_message(new_order);
+ *   if (auto response = client.wait_for_response()) { ... }
+ *
+ * While waiting for a response, the active replica is sent a heartbeat after
+ * heartbeat_interval of silence. If it does not answer within timeout, or
+ * closes the connection, the client moves on to the next replica, logs on to
+ * the session again and sends the requests in flight again, so a response
+ * takes at most one timeout per replica longer. Addresses are resolved once
+ * at construction, reconnecting does not look them up again.
+ *
+ * Requests in flight are only sent again if the new replica knows the
+ * session up to them: the primary answers requests it has handled again from
+ * its window of responses, or with a SessionStatus once they have left it.
+ * Session sequences are not replicated, so a promoted standby cannot tell
+ * which requests the old primary handled. It would e.g. reject an order the
+ * old primary accepted as a duplicate. Its answered requests in flight are
+ * not sent again and their outcome is unknown, as is the outcome of a request
+ * answered with a SessionStatus. Deletions are sent again, deleting twice
+ * changes nothing. Trades are dropped with a warning.
+ *
+ * Up to max_in_flight requests are kept for sending again, in storage
+ * allocated once. Sending more before their responses or a heartbeat confirm
+ * the earlier ones throws.
  */
 
+extern "C" {
+#include <poll.h>
+}
+
 #include "logging.h"
 #include "tcp.h"
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace rs {
 
 auto logger = logging::make_logger("risk_client", logging::Level::INFO);
 
+// Replica of the risk server, as address and port.
+using Replica = std::pair<std::string, std::string>;
+
+struct FailoverOptions {
+  // Silence of the active replica after which it is sent a heartbeat.
+  std::chrono::milliseconds heartbeat_interval{100};
+  // Time a replica has to answer a heartbeat or logon, and to connect.
+  std::chrono::milliseconds timeout{500};
+};
+
 class RiskClient {
   using PayloadSize = decltype(protocol::Header::payloadSize);
   using SequenceNum = decltype(protocol::Header::sequenceNumber);
+  using Clock = std::chrono::steady_clock;
 
 public:
+  // Requests kept for sending again, as many as the server keeps responses
+  // for.
+  static constexpr std::size_t max_in_flight = 1 << 10;
+
   explicit RiskClient(const std::string &server_address,
-                      const std::string &server_port)
-      : tcp_client_(server_address, server_port) {}
+                      const std::string &server_port) {
+    replicas_.push_back(
+        {rs::format(RS_FMT("{}:{}"), server_address, server_port), {},
+         tcp::Client(server_address, server_port)});
+  }
 
+  // Connect to all replicas, the primary first, and send requests to the
+  // first one that accepts. Replicas that are down are connected again when
+  // the client fails over to them.
+  explicit RiskClient(const std::vector<Replica> &replicas,
+                      FailoverOptions options = {})
+      : failover_(options), in_flight_(max_in_flight),
+        in_flight_bytes_(in_flight_capacity) {
+    for (const auto &[address, port] : replicas) {
+      replicas_.push_back({rs::format(RS_FMT("{}:{}"), address, port),
+                           tcp::resolve(address, port), std::nullopt});
+      connect(replicas_.back());
+    }
+    auto connected = std::find_if(
+        replicas_.begin(), replicas_.end(),
+        [](const auto &replica) { return replica.client.has_value(); });
+    if (connected == replicas_.end()) {
+      throw std::runtime_error("Unable to connect to any risk server replica");
+    }
+    active_ = connected - replicas_.begin();
+    last_heard_ = Clock::now();
+  }
+
+  // Send request. Throw if max_in_flight requests are in flight already.
   template <typename Payload> void send_message(const Payload &payload) {
-    logger->info("Sending message of type {} to risk server",
+    logger->info(RS_FMT("Sending message of type {} to risk server"),
                  payload.messageType);
+    if (failover_) {
+      make_room();
+    }
     protocol::Header header{
         payload.messageType,
         static_cast<PayloadSize>(sizeof(payload)),
         next_package_id(),
         now(),
     };
-    auto sent_size =
-        tcp_client_.send_message(protocol::encode(header, payload));
-    logger->debug("Sent {} bytes to risk server", sent_size);
+    auto &client = active();
+    if (failover_) {
+      // Encoded once, into the window, and copied to the send buffer.
+      auto before = in_flight_bytes_.readable().size();
+      protocol::encode(in_flight_bytes_, header, payload);
+      auto length = in_flight_bytes_.readable().size() - before;
+      push_in_flight({header.sequenceNumber, header.version, length});
+      client.send_buffer().append(
+          in_flight_bytes_.readable().substr(before, length));
+    } else {
+      protocol::encode(client.send_buffer(), header, payload);
+    }
+    auto sent_size = flush();
+    logger->debug(RS_FMT("Sent {} bytes to risk server"), sent_size);
+  }
+
+  // Log on to session and continue numbering requests where the server
+  // expects them. Requests numbered below that have been handled, the client
+  // may send any other requests again with their original numbers, see
+  // set_next_sequence_number. Log on while no response is awaited, the client
+  // logs on again after failing over.
+  protocol::SessionStatus logon(uint64_t session_id) {
+    session_ = session_id;
+    protocol::SessionStatus status{};
+    if (failover_) {
+      try {
+        status = log_on(active());
+      } catch (const std::runtime_error &error) {
+        logger->warn(RS_FMT("Unable to log on to risk server {}: {}"),
+                     active_replica(), error.what());
+        status = fail_over();
+      }
+    } else {
+      send_unsequenced(
+          protocol::Logon{protocol::Logon::MESSAGE_TYPE, session_id,
+                          protocol::Logon::NONE});
+      flush();
+      auto msg = *receive();
+      if (msg.empty() || protocol::decode_header(msg).version !=
+                             protocol::SessionStatus::MESSAGE_TYPE) {
+        throw std::runtime_error("No answer to logon");
+      }
+      status = protocol::decode_payload<protocol::SessionStatus>(msg);
+    }
+    if (status.expectedSequenceNumber != 0) {
+      set_next_sequence_number(status.expectedSequenceNumber);
+    }
+    return status;
   }
 
-  protocol::OrderResponse wait_for_response() const {
-    logger->info("Reading response from risk server");
-    auto msg = tcp_client_.receive_message();
-    logger->debug("Got message of length {}", msg.length());
+  // Number the next request with seq, e.g. to send requests again after
+  // reconnecting.
+  void set_next_sequence_number(SequenceNum seq) noexcept {
+    package_counter_ = seq - 1;
+  }
+
+  // Next response, in the order of the requests, or nothing if the outcome
+  // of its request is unknown: it was answered with a SessionStatus, or was
+  // in flight when the client failed over to a replica that does not know
+  // the session up to it.
+  template <typename Response = protocol::OrderResponse>
+  std::optional<Response> wait_for_response() {
+    logger->info(RS_FMT("Reading response from risk server"));
+    auto received = receive();
+    if (!received) {
+      --unknown_;
+      return std::nullopt;
+    }
+    auto msg = *received;
+    logger->debug(RS_FMT("Got message of length {}"), msg.length());
     auto header = protocol::decode_header(msg);
-    if (header.version != protocol::OrderResponse::MESSAGE_TYPE) {
-      logger->error("Unknown message type {} received from risk server",
+    if (header.version == protocol::SessionStatus::MESSAGE_TYPE) {
+      logger->warn(RS_FMT("Outcome of request {} is unknown to risk server "
+                          "{}"),
+                   header.sequenceNumber, active_replica());
+      return std::nullopt;
+    }
+    if (header.version != Response::MESSAGE_TYPE) {
+      logger->error(RS_FMT("Unknown message type {} received from risk server"),
                     header.version);
-      return {};
+      return std::nullopt;
     }
-    return protocol::decode_payload<protocol::OrderResponse>(msg);
+    return protocol::decode_payload<Response>(msg);
+  }
+
+  // Check the replicas while no response is awaited, e.g. when idle: connect
+  // the replicas that are down, and have the active replica answer a
+  // heartbeat, failing over if it does not.
+  void check_replicas() {
+    if (!failover_) {
+      return;
+    }
+    for (auto &replica : replicas_) {
+      if (!replica.client) {
+        connect(replica);
+      }
+    }
+    drop_closed_standbys();
+    send_heartbeat();
+    // Failing over clears the heartbeat as well.
+    while (heartbeat_sent_) {
+      if (auto msg = check_active()) {
+        logger->warn(RS_FMT("Ignoring message of length {} while checking "
+                            "risk server replicas"),
+                     msg->length());
+      }
+    }
+  }
+
+  // Replica requests are sent to, as address and port.
+  const std::string &active_replica() const noexcept {
+    return replicas_[active_].name;
   }
 
 private:
-  tcp::Client tcp_client_;
+  struct Connection {
+    // Address and port, for logging.
+    std::string name;
+    std::vector<tcp::Endpoint> endpoints;
+    // Nothing while disconnected.
+    std::optional<tcp::Client> client;
+  };
+
+  std::vector<Connection> replicas_;
+  std::size_t active_{0};
+  // Nothing with a single server.
+  std::optional<FailoverOptions> failover_;
+  std::optional<uint64_t> session_;
+  // Request sent and not known to be handled.
+  struct InFlight {
+    SequenceNum seq;
+    uint16_t type;
+    std::size_t length;
+  };
+  // Bytes kept for the encodings of the requests in flight. Each request fits
+  // into a send buffer.
+  static constexpr std::size_t in_flight_capacity = 4 * tcp::msg_buffer_length;
+
+  // Ring of the requests in flight, oldest first, with their encodings back
+  // to back in in_flight_bytes_. Empty with a single server.
+  std::vector<InFlight> in_flight_;
+  std::size_t in_flight_first_{0};
+  std::size_t in_flight_count_{0};
+  Buffer in_flight_bytes_{0};
+  // Responses to hand out as unknown before reading the next one.
+  std::size_t unknown_{0};
+  Clock::time_point last_heard_;
+  std::optional<Clock::time_point> heartbeat_sent_;
   SequenceNum package_counter_{0};
 
   SequenceNum next_package_id() { return ++package_counter_; }
+
+  tcp::Client &active() {
+    if (!replicas_[active_].client) {
+      // All replicas were down on the last failover.
+      fail_over();
+    }
+    return *replicas_[active_].client;
+  }
+
+  void connect(Connection &replica) {
+    try {
+      replica.client.emplace(replica.endpoints, failover_->timeout);
+    } catch (const std::runtime_error &error) {
+      logger->warn(RS_FMT("Risk server {} is down: {}"), replica.name,
+                   error.what());
+    }
+  }
+
+  // Encode message that is not sequenced into the send buffer.
+  template <typename Payload> void send_unsequenced(const Payload &payload) {
+    protocol::Header header{
+        payload.messageType,
+        static_cast<PayloadSize>(sizeof(payload)),
+        0,
+        now(),
+    };
+    protocol::encode(active().send_buffer(), header, payload);
+  }
+
+  // Send the send buffer of the active replica, failing over if it does not
+  // take it within the timeout. Failing over sends the requests in flight
+  // again, the ones just encoded included.
+  std::size_t flush() {
+    try {
+      if (failover_) {
+        return active().flush(failover_->timeout);
+      }
+      return active().flush();
+    } catch (const std::runtime_error &error) {
+      if (!failover_) {
+        throw;
+      }
+      logger->warn(RS_FMT("Lost risk server {}: {}"), active_replica(),
+                   error.what());
+      fail_over();
+      return 0;
+    }
+  }
+
+  // Throw unless another request and its encoding fit into the window.
+  void make_room() {
+    if (in_flight_bytes_.writable() < tcp::msg_buffer_length) {
+      in_flight_bytes_.compact();
+    }
+    if (in_flight_count_ == max_in_flight ||
+        in_flight_bytes_.writable() < tcp::msg_buffer_length) {
+      throw std::runtime_error(rs::format(
+          RS_FMT("{} requests in flight, wait for their responses or check "
+                 "the replicas before sending more"),
+          in_flight_count_));
+    }
+  }
+
+  const InFlight &oldest_in_flight() const noexcept {
+    return in_flight_[in_flight_first_];
+  }
+
+  // Append request, whose encoding has been appended to in_flight_bytes_.
+  void push_in_flight(const InFlight &request) noexcept {
+    in_flight_[(in_flight_first_ + in_flight_count_) % max_in_flight] =
+        request;
+    ++in_flight_count_;
+  }
+
+  // Forget the oldest request and its encoding.
+  void pop_in_flight() noexcept {
+    in_flight_bytes_.consume(oldest_in_flight().length);
+    in_flight_first_ = (in_flight_first_ + 1) % max_in_flight;
+    --in_flight_count_;
+  }
+
+  // Forget requests up to seq, which have been handled.
+  void acknowledge(SequenceNum seq) {
+    while (in_flight_count_ > 0 && oldest_in_flight().seq <= seq) {
+      pop_in_flight();
+    }
+  }
+
+  // Give up on the requests in flight that would change the state of a
+  // replica that cannot tell whether it has handled them: answered ones are
+  // answered as unknown, trades are dropped. Deletions are kept, in order.
+  void forget_unknown_requests() {
+    for (auto n = in_flight_count_; n > 0; --n) {
+      const auto request = oldest_in_flight();
+      auto bytes = in_flight_bytes_.readable().substr(0, request.length);
+      switch (request.type) {
+      case protocol::DeleteOrder::MESSAGE_TYPE: {
+        // Moved to the back, its length cannot exceed the room it leaves.
+        std::array<char, protocol::max_message_length> deletion;
+        std::copy(bytes.begin(), bytes.end(), deletion.begin());
+        pop_in_flight();
+        if (in_flight_bytes_.writable() < request.length) {
+          in_flight_bytes_.compact();
+        }
+        in_flight_bytes_.append({deletion.data(), request.length});
+        push_in_flight(request);
+        continue;
+      }
+      case protocol::PositionQuery::MESSAGE_TYPE:
+        // Answered once per listing.
+        unknown_ += protocol::decode_payload<protocol::PositionQuery>(
+                        bytes.substr(0, bytes.size() - 1))
+                        .count;
+        break;
+      case protocol::Trade::MESSAGE_TYPE:
+        logger->warn(RS_FMT("Trade {} may be lost, risk server {} does not "
+                            "know whether it has applied it"),
+                     request.seq, active_replica());
+        break;
+      default:
+        ++unknown_;
+        break;
+      }
+      pop_in_flight();
+    }
+  }
+
+  // Have the active replica confirm the requests sent so far.
+  void send_heartbeat() {
+    send_unsequenced(protocol::Heartbeat{protocol::Heartbeat::MESSAGE_TYPE,
+                                         package_counter_});
+    heartbeat_sent_ = Clock::now();
+    flush();
+  }
+
+  // Read next message other than a heartbeat from the active replica, or
+  // nothing while responses are to be handed out as unknown, e.g. after
+  // failing over while waiting.
+  std::optional<protocol::MessageView> receive() {
+    if (!failover_) {
+      return active().receive_message();
+    }
+    while (unknown_ == 0) {
+      if (auto msg = check_active()) {
+        return msg;
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Wait for the next message from the active replica, up to the next
+  // heartbeat or the deadline of the last one, and fail over if it does not
+  // answer in time. Heartbeats are taken here, return any other message.
+  std::optional<protocol::MessageView> check_active() {
+    auto deadline = heartbeat_sent_
+                        ? *heartbeat_sent_ + failover_->timeout
+                        : last_heard_ + failover_->heartbeat_interval;
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Clock::now());
+    std::optional<protocol::MessageView> msg;
+    try {
+      msg = active().receive_message(
+          std::max(wait, std::chrono::milliseconds{0}));
+    } catch (const std::runtime_error &error) {
+      logger->warn(RS_FMT("Lost risk server {}: {}"), active_replica(),
+                   error.what());
+      fail_over();
+      return std::nullopt;
+    }
+
+    if (!msg) {
+      if (heartbeat_sent_) {
+        logger->warn(RS_FMT("Risk server {} did not answer within {} ms"),
+                     active_replica(), failover_->timeout.count());
+        fail_over();
+      } else {
+        drop_closed_standbys();
+        send_heartbeat();
+      }
+      return std::nullopt;
+    }
+    if (msg->empty()) {
+      logger->warn(RS_FMT("Risk server {} closed the connection"),
+                   active_replica());
+      fail_over();
+      return std::nullopt;
+    }
+
+    last_heard_ = Clock::now();
+    auto header = protocol::decode_header(*msg);
+    if (header.version == protocol::Heartbeat::MESSAGE_TYPE) {
+      heartbeat_sent_.reset();
+      acknowledge(protocol::decode_payload<protocol::Heartbeat>(*msg).token);
+      return std::nullopt;
+    }
+    // Responses come in the order of the requests.
+    acknowledge(header.sequenceNumber);
+    return msg;
+  }
+
+  // Disconnect standbys that closed their connection. They do not answer
+  // before they are promoted, so only their connection is checked.
+  void drop_closed_standbys() {
+    for (std::size_t i = 0; i < replicas_.size(); ++i) {
+      auto &replica = replicas_[i];
+      if (i == active_ || !replica.client) {
+        continue;
+      }
+      pollfd connection{replica.client->socket().fd, POLLIN, 0};
+      if (poll(&connection, 1, 0) > 0) {
+        logger->warn(RS_FMT("Standby risk server {} closed the connection"),
+                     replica.name);
+        replica.client.reset();
+      }
+    }
+  }
+
+  // Move on to the next replica that answers, connecting it again if needed,
+  // log on to the session and send the requests in flight again. Throw if no
+  // replica answers, after trying each once.
+  protocol::SessionStatus fail_over() {
+    replicas_[active_].client.reset();
+    for (std::size_t i = 1; i <= replicas_.size(); ++i) {
+      active_ = (active_ + 1) % replicas_.size();
+      auto &replica = replicas_[active_];
+      logger->warn(RS_FMT("Failing over to risk server {} with {} requests "
+                          "in flight"),
+                   replica.name, in_flight_count_);
+      try {
+        if (!replica.client) {
+          replica.client.emplace(replica.endpoints, failover_->timeout);
+        }
+        return log_on(*replica.client);
+      } catch (const std::runtime_error &error) {
+        logger->warn(RS_FMT("Unable to fail over to risk server {}: {}"),
+                     replica.name, error.what());
+        replica.client.reset();
+      }
+    }
+    throw std::runtime_error(
+        rs::format(RS_FMT("No risk server replica answered within {} ms"),
+                   failover_->timeout.count()));
+  }
+
+  // Log on to the session on client, if any, and send the requests in flight
+  // again that the replica can tell whether it has handled. Requests it has
+  // handled are answered again.
+  protocol::SessionStatus log_on(tcp::Client &client) {
+    heartbeat_sent_.reset();
+    protocol::SessionStatus status{};
+    if (session_) {
+      send_unsequenced(
+          protocol::Logon{protocol::Logon::MESSAGE_TYPE, *session_,
+                          protocol::Logon::NONE});
+      client.flush(failover_->timeout);
+      auto msg = client.receive_message(failover_->timeout);
+      if (!msg || msg->empty() ||
+          protocol::decode_header(*msg).version !=
+              protocol::SessionStatus::MESSAGE_TYPE) {
+        throw std::runtime_error("No answer to logon");
+      }
+      status = protocol::decode_payload<protocol::SessionStatus>(*msg);
+      // Requests from the expected one on are new to the replica. Below it,
+      // it has seen them, unless it has not seen any since the oldest
+      // request in flight.
+      auto expected = status.expectedSequenceNumber;
+      if (in_flight_count_ > 0 &&
+          (expected == 0 || expected < oldest_in_flight().seq)) {
+        logger->warn(RS_FMT("Risk server {} expects request {}, the outcome "
+                            "of the {} requests in flight from {} is "
+                            "unknown"),
+                     active_replica(), expected, in_flight_count_,
+                     oldest_in_flight().seq);
+        forget_unknown_requests();
+      }
+    }
+    auto bytes = in_flight_bytes_.readable();
+    for (std::size_t i = 0; i < in_flight_count_; ++i) {
+      auto length = in_flight_[(in_flight_first_ + i) % max_in_flight].length;
+      if (client.send_buffer().writable() < length) {
+        client.flush(failover_->timeout);
+      }
+      client.send_buffer().append(bytes.substr(0, length));
+      bytes.remove_prefix(length);
+    }
+    client.flush(failover_->timeout);
+    last_heard_ = Clock::now();
+    return status;
+  }
 };
 
 } // namespace rs
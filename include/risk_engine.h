@@ -0,0 +1,272 @@
+#ifndef INCLUDED_RISKSERVICE_ENGINE_HEADER
+#define INCLUDED_RISKSERVICE_ENGINE_HEADER
+/*
+ * Risk checks and order/instrument state, independent of any transport.
+ */
+
+#include "instrument_table.h"
+#include "limit_config.h"
+#include "logging.h"
+#include "order_expiry.h"
+#include "positions.h"
+#include "protocol.h"
+#include "throttle.h"
+#include "timing_wheel.h"
+#include <array>
+#include <string>
+#include <unordered_map>
+
+namespace rs {
+
+struct Order {
+  ListingID listing_id;
+  Quantity quantity;
+  Side side;
+  SessionID session;
+  // Time at which the order expires, 0 if never.
+  Timestamp expires_at{0};
+  // Index of listing_id in the instrument table of the engine.
+  InstrumentTable::Index instrument{0};
+};
+
+// Checks orders against the position limits of their instrument, session,
+// account and the firm, and keeps the orders and the aggregated state of each
+// of these scopes. Aggregates are updated with every change, so a check is
+// four compares, indexed by the side of the order rather than branching on
+// it. New orders and modifications are also throttled to the order rates of
+// their instrument and session, before any other check.
+// Messages are handed in by function calls and the results are returned, so
+// the engine can be driven by the server as well as by offline tools such as
+// the backtest runner.
+// Not thread-safe, except for reading the published positions.
+class RiskEngine {
+  using OrderMap = std::unordered_map<OrderID, Order>;
+
+public:
+  explicit RiskEngine(LimitConfig);
+
+  ~RiskEngine() noexcept = default;
+
+  // Disallow copying, the position table is mapped memory.
+  RiskEngine(const RiskEngine &) = delete;
+  RiskEngine &operator=(const RiskEngine &) = delete;
+
+  // Allow memberwise moves.
+  RiskEngine(RiskEngine &&other) noexcept = default;
+  RiskEngine &operator=(RiskEngine &&other) noexcept = default;
+
+  // Risk checked message handlers.
+  // Rejected messages do not change the state, except that orders count
+  // towards the order rates once they pass the throttles, whether they are
+  // accepted or not. New orders belong to the given session and are rejected
+  // if the session is not configured or their id is in use by an open order.
+  // Orders over the rate of their instrument or session are rejected with
+  // status THROTTLED.
+
+  [[nodiscard]] protocol::OrderResponse
+  handle_new_order(const protocol::NewOrder &, SessionID = 0);
+  [[nodiscard]] protocol::OrderResponse
+  handle_modify_order(const protocol::ModifyOrderQuantity &);
+  [[nodiscard]] protocol::BatchResponse
+  handle_order_batch(const protocol::OrderBatch &, SessionID = 0);
+  // Return false if the order does not exist.
+  bool handle_delete_order(const protocol::DeleteOrder &);
+  // Return false if the traded order does not exist.
+  bool handle_trade(const protocol::Trade &);
+
+  // Apply state transitions that have been checked elsewhere, e.g. by a
+  // primary server, without risk checks.
+  void apply_new_order(const protocol::NewOrder &, SessionID = 0);
+  void apply_modify_order(const protocol::ModifyOrderQuantity &);
+
+  // Reserve hash tables for the given numbers of orders and listings, and
+  // size the position table for twice the listings, on huge pages if asked, so
+  // that handling messages never rehashes. Call before handling any message and
+  // before publishing positions.
+  void reserve(std::size_t orders, std::size_t listings, bool huge_pages);
+
+  // Run orders through the message handlers of a scratch engine, creating,
+  // modifying, trading and deleting each of them. Warms up the code of the
+  // handlers, and leaves the memory of the order and instrument tables with
+  // the allocator for the tables of real engines.
+  static void warm_up(std::size_t orders);
+
+  // Move the position snapshots to named shared memory, e.g.
+  // "/risk-positions", where other processes can attach to them.
+  void publish_positions(const std::string &shm_name);
+
+  // Snapshots of instrument state, readable from any thread without blocking
+  // the engine.
+  const PositionTable &positions() const noexcept { return positions_; }
+
+  // Current state of listing, empty if it has no orders.
+  InstrumentState instrument_state(ListingID id) const {
+    auto i = instruments_.find(id);
+    return i ? instruments_.state(*i) : InstrumentState{};
+  }
+
+  bool has_session(SessionID id) const noexcept {
+    return sessions_.find(id) != sessions_.end();
+  }
+
+  // Return nullptr if the order does not exist.
+  const Order *find_order(OrderID id) const {
+    auto order_it = orders_.find(id);
+    return order_it == orders_.end() ? nullptr : &order_it->second;
+  }
+
+  const LimitConfig &limits() const noexcept { return config_; }
+
+  // Make orders created from now on expire as given. Orders are retired when
+  // they expire by calling expire_orders.
+  void set_order_expiry(const OrderExpiry &expiry) noexcept {
+    expiry_ = expiry;
+  }
+
+  // Time of the messages handled next, in seconds since the Unix epoch, from
+  // which new orders get their expiry.
+  void set_time(Timestamp now) noexcept { now_ = now; }
+
+  // Advance to time now and retire the orders that have expired, touching at
+  // most max_entries entries of the expiry schedule, and call on_expired(id)
+  // for each retired order. Return false if expired orders are left for
+  // another call. Orders deleted before they expire are skipped.
+  template <typename OnExpired>
+  bool expire_orders(Timestamp now, std::size_t max_entries,
+                     OnExpired &&on_expired) {
+    set_time(now);
+    return expiry_schedule_.advance(
+        now, max_entries, [this, &on_expired](const TimingWheel::Entry &entry) {
+          if (expire_order(entry.key, entry.deadline)) {
+            on_expired(OrderID{entry.key});
+          }
+        });
+  }
+
+  // Monotonic time of the messages handled next, in nanoseconds, against
+  // which order rates are throttled.
+  void set_clock(Nanoseconds now) noexcept { clock_ = now; }
+
+  std::size_t throttled_orders() const noexcept { return throttled_orders_; }
+
+  // Return true if any order may still expire.
+  bool has_expiring_orders() const noexcept {
+    return !expiry_schedule_.empty();
+  }
+
+  std::size_t expired_orders() const noexcept { return expired_orders_; }
+
+  // Replace the limits, e.g. with an update from the admin channel, visiting
+  // only the scopes listed in changes. The aggregates are kept, so the new
+  // limits apply from the next check without recounting any orders. Sessions
+  // new to the config are added, existing sessions keep their account.
+  void update_limits(LimitConfig, const LimitChanges &changes);
+
+  // Update the limits of one scope, as replicated or captured by a server.
+  void apply_limit_update(const protocol::LimitUpdate &update) {
+    auto config = config_;
+    auto changes = config.apply(update);
+    update_limits(std::move(config), changes);
+  }
+
+  // Dump orders and the state and limits of every scope.
+  std::string dump_state() const;
+
+  // Log level of all engines, e.g. WARN to handle messages at full speed.
+  static void set_log_level(logging::Level);
+
+private:
+  struct Session {
+    Exposure exposure;
+    // Exposure of the account the session belongs to.
+    Exposure *account;
+    Throttle throttle;
+  };
+
+  LimitConfig config_;
+
+  OrderMap orders_;
+  Exposure firm_;
+  std::unordered_map<AccountID, Exposure> accounts_;
+  std::unordered_map<SessionID, Session> sessions_;
+  InstrumentTable instruments_;
+
+  // Copy of instrument states for readers outside the engine thread,
+  // published after each change.
+  PositionTable positions_;
+  bool huge_pages_{false};
+
+  // Changes made by the batch being handled, for rolling them back.
+  struct BatchUndo {
+    uint16_t message_type;
+    OrderID order_id;
+    Quantity old_quantity;
+  };
+  std::array<BatchUndo, protocol::OrderBatch::max_entries> batch_undo_;
+
+  OrderExpiry expiry_;
+  Timestamp now_{0};
+  // Expiry of every order that expires, until it comes due.
+  TimingWheel expiry_schedule_;
+  std::size_t expired_orders_{0};
+
+  Nanoseconds clock_{0};
+  std::size_t throttled_orders_{0};
+
+  // Retire order if it still expires at deadline, and publish its listing.
+  bool expire_order(OrderID, Timestamp deadline);
+
+  void add_session(SessionID, const LimitConfig::Session &);
+
+  // Instrument of listing, added with its configured limits if missing.
+  InstrumentTable::Index instrument(ListingID);
+
+  // Order with the instrument of its listing.
+  Order make_order(ListingID, Quantity, Side, SessionID);
+
+  // Session an order counts towards. Orders of unknown sessions, only
+  // possible when applying state transitions of a primary with a different
+  // config, count towards session 0.
+  Session &session_of(const Order &);
+
+  // Scopes an order counts towards, from the narrowest to the widest: its
+  // instrument, and the exposures of its session, account and the firm.
+  struct Scopes {
+    InstrumentTable::Index instrument;
+    std::array<Exposure *, 3> exposures;
+  };
+  Scopes scopes(const Order &);
+
+  // Publish current state of instrument to the snapshot table.
+  void publish(InstrumentTable::Index);
+  void publish(ListingID, const InstrumentState &);
+  void publish_all();
+
+  // Helpers for message handlers.
+  // These publish the changed instrument state.
+
+  bool register_new_order(OrderID, const Order &);
+  bool update_order_quantity(Order &, Quantity);
+  bool delete_order(OrderID);
+
+  // Return true if the order rates of the instrument and session of order
+  // have room for another order, and count the order towards both.
+  bool admit(const Order &);
+
+  // Risk checks against the position limits of all scopes.
+  bool check_new_order(const Order &);
+  bool check_quantity_update(const Order &, Quantity);
+
+  // Unchecked state changes, applied after the risk checks have passed.
+  // These do not publish the changed instrument state.
+  void insert_order(OrderID, const Order &);
+  void set_order_quantity(Order &, Quantity);
+  void erase_order(OrderMap::iterator);
+  // Add qty, which wraps around for decreases, to the open quantity of the
+  // side of order in all its scopes.
+  void add_open_qty(const Order &, Quantity);
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_ENGINE_HEADER
@@ -0,0 +1,279 @@
+#ifndef INCLUDED_RISKSERVICE_ROUTER_HEADER
+#define INCLUDED_RISKSERVICE_ROUTER_HEADER
+/*
+ * Front end that spreads the messages of gateways over several risk servers,
+ * partitioned by listing.
+ *
+ * Backend i of n checks the listings with listingId % n == i, so instrument
+ * limits hold exactly as with a single server. Session, account and firm
+ * limits are enforced per backend, so each backend is given its share of them
+ * in its own limits file. Session order rates apply per backend as well: a
+ * session sending to three backends may send up to three times its rate.
+ *
+ * When a backend fails, the requests for its listings are rejected, including
+ * those it has not answered yet, and position queries get empty positions for
+ * them. The other backends keep serving. All-or-nothing batches spanning
+ * several backends are rejected, since each backend checks its part on its
+ * own. The router logs on with the ROUTED flag, since each backend sees gaps in
+ * the sequence numbers of a session.
+ */
+
+#include "format.h"
+#include "order_expiry.h"
+#include "protocol.h"
+#include "tcp.h"
+#include "timing_wheel.h"
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rs {
+
+// Queue of fixed capacity, allocated once.
+template <typename T> class Fifo {
+
+public:
+  explicit Fifo(std::size_t capacity) : items_(capacity) {}
+
+  bool empty() const noexcept { return size_ == 0; }
+  bool full() const noexcept { return size_ == items_.size(); }
+  std::size_t size() const noexcept { return size_; }
+  std::size_t capacity() const noexcept { return items_.size(); }
+
+  // Item i places behind the front.
+  T &operator[](std::size_t i) noexcept {
+    return items_[(head_ + i) % items_.size()];
+  }
+  T &front() noexcept { return items_[head_]; }
+
+  // Return the slot at the back, keeping what it held before.
+  T &push() noexcept { return (*this)[size_++]; }
+  void pop() noexcept {
+    head_ = (head_ + 1) % items_.size();
+    --size_;
+  }
+
+private:
+  std::vector<T> items_;
+  std::size_t head_{0};
+  std::size_t size_{0};
+};
+
+// Forwards the messages of gateways to the backend of their listing over one
+// persistent, pipelined connection per backend, and answers each request once
+// all backends involved have responded, in the order of the requests.
+//
+// Modifications and deletions carry no listing and go to the backend of the
+// new order, looked up in an index of order ids. Batches and position queries
+// are split by backend and their responses merged. Messages of different
+// sessions share the backend connections, which are switched to the session of
+// the next message with a Logon.
+class RiskRouter {
+  using SequenceNum = decltype(protocol::Header::sequenceNumber);
+  using SessionID = decltype(protocol::Logon::sessionId);
+  using ClientID = uint64_t;
+  using BackendIndex = uint8_t;
+
+public:
+  using Address = std::pair<std::string, std::string>;
+
+  static constexpr std::size_t max_backends = 1 << 6;
+  // Requests of a client that can be waiting for responses at the same time.
+  static constexpr std::size_t max_pending_requests = 1 << 6;
+  // Queued bytes of a backend connection or client at which no more messages
+  // of clients are read. Below the limit, the messages forwarded for any one
+  // message, and the responses to it, fit into the queue.
+  static constexpr std::size_t backlog_limit = tcp::msg_buffer_length / 2;
+  // Most expired orders dropped from the index at once.
+  static constexpr std::size_t expiry_slice = 1 << 10;
+
+  explicit RiskRouter(const std::string &address, const std::string &port,
+                      const std::vector<Address> &backends);
+
+  // Rule of five with same constraints as in tcp::Server (no copy but move ok).
+  ~RiskRouter() noexcept = default;
+
+  RiskRouter(const RiskRouter &) = delete;
+  RiskRouter &operator=(const RiskRouter &) = delete;
+
+  RiskRouter(RiskRouter &&other) noexcept = default;
+  RiskRouter &operator=(RiskRouter &&other) noexcept = default;
+
+  // Serve up to tcp::Server::max_connections clients until stopped, or until
+  // every backend has failed.
+  void wait();
+
+  void stop() noexcept { online_ = false; }
+
+  // Drop indexed orders once they have expired on the backends, which must
+  // expire orders as given.
+  void set_order_expiry(const OrderExpiry &expiry) noexcept {
+    expiry_ = expiry;
+  }
+
+  // Dump full state of router.
+  std::string dump_state() const {
+    std::string s = "\n";
+    s += rs::format(RS_FMT("indexed orders: {}\n"), order_backends_.size());
+    if (expiry_.enabled()) {
+      s += rs::format(RS_FMT("  scheduled to expire: {}\n"),
+                      expiry_schedule_.size());
+    }
+    for (std::size_t i = 0; i < backends_.size(); ++i) {
+      s += rs::format(RS_FMT("backend {}: {}\n"), i,
+                      backends_[i].failed ? "failed" : "");
+      s += rs::format(RS_FMT("  forwarded: {}\n"), backends_[i].forwarded);
+      s += rs::format(RS_FMT("  awaited responses: {}\n"),
+                      backends_[i].awaited.size());
+    }
+    return s;
+  }
+
+private:
+  // Response of a client request, complete when no backend part is missing.
+  struct Request {
+    enum class Kind : uint8_t {
+      ORDER,
+      BATCH,
+      POSITIONS,
+      SESSION_STATUS,
+      HEARTBEAT
+    };
+    Kind kind{Kind::ORDER};
+    uint16_t missing_parts{0};
+    SequenceNum seq{0};
+    protocol::OrderResponse order{};
+    // New order whose id was indexed when forwarded, unindexed on reject.
+    bool indexed{false};
+    protocol::BatchResponse batch{};
+    protocol::SessionStatus status{};
+    protocol::Heartbeat heartbeat{};
+    // Responses to the queried listings, in query order.
+    uint16_t count{0};
+    std::array<protocol::PositionResponse, protocol::PositionQuery::max_listings>
+        positions{};
+    // Backend of each batch entry or queried listing, none if rejected here.
+    std::array<BackendIndex, protocol::OrderBatch::max_entries> backend_of{};
+    // New orders of the batch indexed when forwarded, and their ids.
+    std::bitset<protocol::OrderBatch::max_entries> indexed_entries;
+    std::array<OrderID, protocol::OrderBatch::max_entries> indexed_ids{};
+    // Position responses received from each backend.
+    std::array<uint8_t, max_backends> received{};
+  };
+
+  struct Client {
+    tcp::Connection connection;
+    ClientID id{0};
+    SessionID session{0};
+    Fifo<Request> requests{max_pending_requests};
+    // Number of the request at the front of requests.
+    uint64_t first_request{0};
+  };
+
+  // Responses a backend owes, in the order it sends them.
+  struct Awaited {
+    // Zero for responses to Logons the router sent on its own.
+    ClientID client{0};
+    uint64_t request{0};
+    uint16_t responses{1};
+  };
+
+  struct Backend {
+    tcp::Client client;
+    // Session the backend applies to the next new order.
+    SessionID session{0};
+    Fifo<Awaited> awaited;
+    std::size_t forwarded{0};
+    // Its requests are rejected by the router from now on.
+    bool failed{false};
+  };
+
+  static constexpr BackendIndex no_backend = max_backends;
+
+  // Backend of a new order, until it is deleted, rejected or expires.
+  struct IndexedOrder {
+    BackendIndex backend;
+    // Time at which the order has expired on its backend, 0 if never.
+    Timestamp expires_at;
+  };
+
+  tcp::Server tcp_server_;
+  bool online_{false};
+  std::vector<Backend> backends_;
+  std::vector<Client> clients_;
+  ClientID next_client_id_{1};
+  std::unordered_map<OrderID, IndexedOrder> order_backends_;
+  OrderExpiry expiry_;
+  TimingWheel expiry_schedule_;
+
+  void accept_client();
+
+  // Handle received messages of client while every queue has room for their
+  // consequences.
+  void handle_messages(Client &);
+  bool has_room(const Client &) const noexcept;
+  void handle_message(Client &, protocol::MessageView);
+
+  void handle_new_order(Client &, const protocol::Header &,
+                        const protocol::NewOrder &);
+  void handle_modify_order(Client &, const protocol::Header &,
+                           const protocol::ModifyOrderQuantity &);
+  void handle_order_batch(Client &, const protocol::Header &,
+                          const protocol::OrderBatch &);
+  void handle_position_query(Client &, const protocol::Header &,
+                             const protocol::PositionQuery &);
+  void handle_logon(Client &, const protocol::Header &,
+                    const protocol::Logon &);
+
+  BackendIndex backend_of_listing(ListingID id) const noexcept {
+    return static_cast<BackendIndex>(id % backends_.size());
+  }
+  // Backend of an indexed order, or no_backend.
+  BackendIndex backend_of_order(OrderID) const noexcept;
+  // Index new order to backend unless its id is indexed already, and return
+  // true if it was.
+  bool index(OrderID, BackendIndex);
+  // Drop expired orders from the index, at most expiry_slice of them. Return
+  // true if none are left to drop.
+  bool expire_index();
+
+  // Append request to client, answered once missing_parts responses are in.
+  Request &open_request(Client &, Request::Kind, SequenceNum,
+                        uint16_t missing_parts);
+  uint64_t last_request(const Client &client) const noexcept {
+    return client.first_request + client.requests.size() - 1;
+  }
+
+  // Encode payload into the send queue of backend, in the session of client,
+  // awaiting the given amount of responses for the client's last request.
+  template <typename Payload>
+  void forward(BackendIndex, Client &, SequenceNum, const Payload &,
+               uint16_t responses = 0);
+  void switch_session(Backend &, SessionID);
+
+  // Send queued messages and read and merge responses of backend.
+  void serve_backend(Backend &, BackendIndex, short events);
+  void handle_response(Backend &, BackendIndex, protocol::MessageView);
+  void merge(Request &, BackendIndex, protocol::MessageView);
+  // Answer the parts of requests that backend owes, and will owe, without it,
+  // as if it had rejected them.
+  void fail_backend(BackendIndex, const char *reason);
+  void fail_part(Request &, BackendIndex);
+  // Forget a new order that was indexed to backend but does not exist there.
+  void unindex(OrderID, BackendIndex);
+
+  // Send queued responses of client and read its messages.
+  void serve_client(Client &, short events);
+  // Encode the responses of complete requests at the front into the send
+  // queue of client, as far as it has room.
+  void respond(Client &);
+  Client *find_client(ClientID) noexcept;
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_ROUTER_HEADER
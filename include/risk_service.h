@@ -4,45 +4,66 @@
  * Main service that implements the risk server.
  */
 
+#include "admin.h"
+#include "field_batch.h"
 #include "format.h"
+#include "positions.h"
+#include "replication.h"
+#include "risk_engine.h"
+#include "runtime_profile.h"
+#include "session_sequence.h"
+#include "startup.h"
 #include "tcp.h"
+#include "trace.h"
+#include "udp.h"
+#ifdef RS_COROUTINES
+#include "event_loop.h"
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace rs {
 
-struct InstrumentState {
-  using NetPos = long long;
-  NetPos net_pos{0};
-
-  Quantity buy_qty{0};
-  Quantity sell_qty{0};
-
-  NetPos worst_buy_pos() const noexcept {
-    auto qty = static_cast<NetPos>(buy_qty);
-    return std::max(qty, net_pos + qty);
-  }
-
-  NetPos worst_sell_pos() const noexcept {
-    auto qty = static_cast<NetPos>(sell_qty);
-    return std::max(qty, qty - net_pos);
-  }
-};
-
-struct Order {
-  ListingID listing_id;
-  Quantity quantity;
-  char side;
+// What to do with a client whose responses queue up because it does not read
+// them fast enough.
+enum class SlowConsumerPolicy {
+  // Close the connection.
+  DROP,
+  // Stop reading messages from the client until its responses have been sent.
+  THROTTLE,
+  // Log an error and keep serving the client until its queue is close to full,
+  // then throttle.
+  ALERT,
 };
 
 class RiskService {
+  using SequenceNum = decltype(protocol::Header::sequenceNumber);
 
 public:
+  // Queued response bytes of a client at which the slow consumer policy
+  // applies, and at which the client is throttled regardless of the policy.
+  // Below the limit, the responses to any one message fit into the queue.
+  static constexpr std::size_t backlog_high_watermark =
+      tcp::msg_buffer_length / 4;
+  static constexpr std::size_t backlog_limit = tcp::msg_buffer_length / 2;
+  // Entries of the order expiry schedule handled before each message, and
+  // while waiting for messages.
+  static constexpr std::size_t expiry_slice = 1 << 4;
+  static constexpr std::size_t idle_expiry_slice = 1 << 10;
+
+  // Clients are served by network_threads threads, each accepting them from
+  // a listening socket of its own, see wait.
   explicit RiskService(const std::string &address, const std::string &tcp_port,
-                       Quantity max_buy, Quantity max_sell)
-      : tcp_server_(address, tcp_port), online_(false), max_buy_pos_(max_buy),
-        max_sell_pos_(max_sell) {}
+                       LimitConfig limits, std::size_t network_threads = 1);
 
   // Rule of five with same constraints as in tcp::Server (no copy but move ok).
   ~RiskService() noexcept = default;
@@ -56,62 +77,353 @@ public:
   RiskService(RiskService &&other) noexcept = default;
   RiskService &operator=(RiskService &&other) noexcept = default;
 
-  // Wait for incoming requests and handle them.
+  // Move the one-off costs of handling the first messages to startup, as
+  // given by options. Call before wait and before publishing positions.
+  // Clients connecting meanwhile wait in the listen backlog.
+  void prepare(const startup::Options &);
+
+  // Wait for incoming requests from any number of clients, up to
+  // tcp::Server::max_connections per network thread, and handle them.
+  // Responses are sent without blocking, so a client that does not read them
+  // only delays itself.
+  // With several network threads, all listen at the address with
+  // SO_REUSEPORT, and the kernel spreads connecting clients across them. The
+  // calling thread serves one listener and the trade feed, a thread of its
+  // own each other listener. Clients are received from, decoded and sent to
+  // in parallel, their messages are handled one batch at a time.
   void wait();
 
+#ifdef RS_COROUTINES
+  // Same as wait, but serve each client from a coroutine of its own, on a
+  // single-threaded event loop.
+  void wait_async();
+#endif
+
+  void set_slow_consumer_policy(SlowConsumerPolicy policy) noexcept {
+    slow_consumer_policy_ = policy;
+  }
+
   void stop() noexcept { online_ = false; }
 
+  // Retire open orders when they expire, as if they had been deleted. Expired
+  // orders are retired in slices between messages and while idle, and
+  // replicated and captured as deletions.
+  void set_order_expiry(const OrderExpiry &expiry) noexcept {
+    engine_.set_order_expiry(expiry);
+  }
+
+  // Apply trades from a drop-copy feed of UDP datagrams sent to the given
+  // unicast or multicast address.
+  // Trades that have arrived on the feed are applied before the risk check of
+  // each order message, and while waiting for order messages.
+  void listen_trade_feed(const std::string &address, const std::string &port) {
+    trade_feed_.emplace(address, port);
+  }
+
+  // Accept limit updates from admins connecting to the given address, see
+  // admin.h. Updates apply before the next message is handled, and are
+  // replicated and captured. Backups refuse updates until promotion, their
+  // limits follow the primary.
+  void listen_admin(const std::string &address, const std::string &port) {
+    admin_ = std::make_unique<admin::Channel>(address, port, engine_.limits());
+  }
+
+  // Stream accepted state transitions to backups listening at the given
+  // addresses. In synchronous mode, no response is sent before all backups
+  // have acknowledged the state transitions it caused.
+  void replicate_to(const std::vector<replication::Primary::Address> &backups,
+                    bool synchronous) {
+    primary_.emplace(backups, synchronous);
+    // Backups start applying new orders in session 0.
+    replicated_session_ = 0;
+  }
+
+  // Pin the calling thread, which is to serve, and the other threads of the
+  // service, and set how the service waits and the options of its sockets.
+  // Called after the trade feed and admin channel are set up.
+  void apply_runtime_profile(const runtime::Profile &);
+
+  // Move the position snapshots to named shared memory, e.g.
+  // "/risk-positions", where other processes can attach to them.
+  void publish_positions(const std::string &shm_name) {
+    engine_.publish_positions(shm_name);
+  }
+
+  // Snapshots of instrument state, readable from any thread without blocking
+  // the service.
+  const PositionTable &positions() const noexcept {
+    return engine_.positions();
+  }
+
+  // Record every order message and trade, in the order they are handled, to
+  // a capture file that can be replayed by the backtest runner.
+  void capture_to(const std::string &path);
+
+  // Run as a backup of a primary that replicates to the given address.
+  // Returns when the primary has disconnected or has been silent for the
+  // promotion timeout, after which the service is ready to be promoted by
+  // calling wait. Clients connecting before that are kept in the listen
+  // backlog.
+  void wait_as_backup(const std::string &address, const std::string &port,
+                      std::chrono::milliseconds promotion_timeout =
+                          replication::default_promotion_timeout);
+
   // Dump full state of server.
   std::string dump_state() const {
     std::string s = "\n";
-    s += rs::format("max buy position: {}\nmax sell position: {}\n",
-                    max_buy_pos_, max_sell_pos_);
-    s += "orders: \n";
-    for (const auto &[id, order] : std::as_const(orders_)) {
-      s += rs::format("  id: {}\n", id);
-      s += rs::format("    listing_id: {}\n", order.listing_id);
-      s += rs::format("    quantity: {}\n", order.quantity);
-      s += rs::format("    side: {}\n", std::string{order.side});
+    s += engine_.dump_state();
+    if (trade_feed_) {
+      s += "trade feed: \n";
+      s += rs::format(RS_FMT("  expected sequence number: {}\n"),
+                      trade_feed_seq_.expected());
+      s += rs::format(RS_FMT("  gaps: {}\n"), trade_feed_seq_.gaps);
+      s += rs::format(RS_FMT("  truncated: {}\n"), trade_feed_->truncated);
+      s += rs::format(RS_FMT("  missed: {}\n"), trade_feed_seq_.missed);
+      s += rs::format(RS_FMT("  late: {}\n"), trade_feed_seq_.late);
+      s += rs::format(RS_FMT("  duplicates: {}\n"), trade_feed_seq_.duplicates);
+    }
+    if (primary_) {
+      s += "replication: \n";
+      s += primary_->dump_stats();
     }
-    s += "instrument state: \n";
-    for (const auto &[id, state] : std::as_const(instrument_state_)) {
-      s += rs::format("  id: {}\n", id);
-      s += rs::format("    net_pos: {}\n", state.net_pos);
-      s += rs::format("    buy_qty: {}\n", state.buy_qty);
-      s += rs::format("    sell_qty: {}\n", state.sell_qty);
-      s += rs::format("    worst_buy_pos: {}\n", state.worst_buy_pos());
-      s += rs::format("    worst_sell_pos: {}\n", state.worst_sell_pos());
+    if (!sequences_.empty()) {
+      s += "sessions: \n";
+      for (const auto &[id, sequence] : sequences_) {
+        s += rs::format(RS_FMT("  id: {}\n"), id);
+        s += rs::format(RS_FMT("    expected sequence number: {}\n"),
+                        sequence.expected());
+        s += rs::format(RS_FMT("    gaps: {}\n"), sequence.requests().gaps);
+        s += rs::format(RS_FMT("    duplicates: {}\n"),
+                        sequence.requests().duplicates);
+        s += rs::format(RS_FMT("    replayed: {}\n"), sequence.replayed);
+      }
     }
     return s;
   }
 
 private:
-  tcp::Server tcp_server_;
   bool online_;
 
-  Quantity max_buy_pos_;
-  Quantity max_sell_pos_;
+  RiskEngine engine_;
+  // Session of the new orders in the replication stream, switched by
+  // replicating a Logon.
+  SessionID replicated_session_{0};
+
+  struct ClientConnection {
+    tcp::Connection connection;
+    SessionID session{0};
+    // Not read from until its queued responses have been sent.
+    bool throttled{false};
+    // Reported as a slow consumer since its queue was last empty.
+    bool alerted{false};
+    // Sequencing of the logged on session, nullptr for session 0, which
+    // connections share without sequencing, and for unknown sessions.
+    SessionSequence *sequence{nullptr};
+    // Number of the connection's last logon, see SessionSequence::logon.
+    uint64_t logon{0};
+    // Logged on by a risk-router, which skips the sequence numbers of the
+    // requests it sends to other backends.
+    bool routed{false};
+    // Sequence number of the request being handled, echoed in its responses.
+    SequenceNum request_seq{0};
+  };
+
+  // Listening socket and the clients accepted from it, served by one network
+  // thread.
+  struct Listener {
+    tcp::Server server;
+    std::vector<ClientConnection> clients;
+    // Messages of the client being handled, decoded together.
+    protocol::FieldBatch received;
+  };
+  // Served by the thread calling wait.
+  Listener listener_;
+
+  // Listeners of the other network threads, and the lock they take for
+  // handling messages and anything else that changes the state of the engine.
+  // Behind a pointer, so that the service stays movable.
+  struct NetworkThreads {
+    std::vector<Listener> listeners;
+    // CPU of the thread of each listener, if pinned.
+    std::vector<unsigned> cpus;
+    std::mutex engine_mutex;
+    std::atomic<bool> running{false};
+  };
+  std::unique_ptr<NetworkThreads> network_threads_;
+
+  // Sequences of configured sessions, added at their first logon.
+  std::unordered_map<SessionID, SessionSequence> sequences_;
+  uint64_t logons_{0};
+  SlowConsumerPolicy slow_consumer_policy_{SlowConsumerPolicy::THROTTLE};
+  // Expired orders are left for the next slice.
+  bool expiry_behind_{false};
+  // Poll without blocking.
+  bool busy_wait_{false};
+  tcp::SocketOptions socket_options_;
+
+  std::optional<udp::Receiver> trade_feed_;
+  udp::Sequencer trade_feed_seq_;
+
+  std::optional<replication::Primary> primary_;
+
+  std::unique_ptr<admin::Channel> admin_;
+
+  std::ofstream capture_;
+  // Session of the messages in the capture, switched by capturing a Logon.
+  SessionID captured_session_{0};
+
+  // Held while using the engine and the state shared by all clients, if
+  // there are several network threads.
+  std::unique_lock<std::mutex> lock_engine() {
+    if (!network_threads_) {
+      return {};
+    }
+    return std::unique_lock<std::mutex>(network_threads_->engine_mutex);
+  }
+
+  // The engine lock if it is free, else a lock that owns nothing.
+  std::unique_lock<std::mutex> try_lock_engine() {
+    return std::unique_lock<std::mutex>(network_threads_->engine_mutex,
+                                        std::try_to_lock);
+  }
+
+  // Poll listener and its clients, and the trade feed if listener is the one
+  // of the thread calling wait, until the service stops.
+  void serve(Listener &);
+
+  // Accept a new client, or close its connection if there are too many.
+  void accept_client(Listener &);
+
+#ifdef RS_COROUTINES
+  // Coroutines of wait_async.
+  co::Task<> accept_clients(co::EventLoop &);
+  co::Task<> serve_async(co::EventLoop &, tcp::Connection);
+  co::Task<> read_trade_feed(co::EventLoop &);
+#endif
+
+  // Send queued responses and read and handle messages of client, depending on
+  // the poll events of its socket, decoding them into received.
+  void serve_client(ClientConnection &, short events,
+                    protocol::FieldBatch &received);
+
+  // Handle received messages of client until it is throttled and send the
+  // responses without blocking.
+  void handle_messages(ClientConnection &, protocol::FieldBatch &received);
+
+  // Receive into and send from the buffers of connection, traced.
+  void receive(tcp::Connection &);
+  void send(tcp::Connection &);
 
-  std::unordered_map<OrderID, Order> orders_;
-  std::unordered_map<ListingID, InstrumentState> instrument_state_;
+  // Apply the slow consumer policy if responses to client are queueing up.
+  void check_backlog(ClientConnection &);
+
+  // Handle one message and encode the response, if any, into the send buffer.
+  void handle_message(ClientConnection &, const protocol::BatchedMessage &);
+
+  // Answer a request that has been handled before with its recorded response,
+  // or with the session status if the response has left the window.
+  void replay(ClientConnection &, const protocol::Header &);
+
+  // Encode response into send buffer of client, and record it for replaying
+  // if it answers a sequenced request.
+  template <typename Payload>
+  void respond(ClientConnection &, const Payload &);
+
+  // Retire expired orders, touching at most max_entries schedule entries.
+  void expire_orders(std::size_t max_entries);
+
+  // Poll timeout in milliseconds until expired orders must be retired, a
+  // heartbeat is due or a requested dump must be looked for, -1 if none of
+  // them, 0 if busy polling.
+  int poll_timeout() const noexcept {
+    if (busy_wait_ || expiry_behind_) {
+      return 0;
+    }
+    int timeout = engine_.has_expiring_orders() ? 1000 : -1;
+    auto bound = [&timeout](int limit) {
+      timeout = timeout < 0 ? limit : std::min(timeout, limit);
+    };
+    // Backups are sent heartbeats while there is nothing to replicate.
+    if (primary_) {
+      bound(replication::heartbeat_interval.count());
+    }
+    if (trace::Profiler::dumps_on_signal()) {
+      bound(trace::Profiler::dump_check_interval);
+    }
+    return timeout;
+  }
 
-  // Read messages from client until they close the connection.
-  bool serve_client(const tcp::Socket &);
+  // Switch to the limits last committed on the admin channel, if any, once per
+  // poll event. Takes the engine lock only to apply an update.
+  void apply_limit_updates();
 
-  // Message handlers.
+  // Nothing to do until the next poll event on the thread that called wait,
+  // retire expired orders, dump the profile if requested and flush_output.
+  void flush_idle();
+
+  // Send the pending replication batch and write out the captured messages.
+  void flush_output();
+
+  // Apply all trades that have arrived on the feed, without blocking.
+  void drain_trade_feed();
+  void handle_feed_message(protocol::MessageView);
+
+  void capture(protocol::MessageView msg) {
+    if (capture_.is_open()) {
+      capture_ << msg << protocol::message_delimiter;
+    }
+  }
+
+  // Capture message of client, preceded by a Logon if the client's session
+  // differs from the session of the previously captured message.
+  void capture(SessionID session, protocol::MessageView msg) {
+    if (capture_.is_open() && session != captured_session_) {
+      protocol::Logon logon{protocol::Logon::MESSAGE_TYPE, session,
+                            protocol::Logon::NONE};
+      capture(protocol::encode(
+          protocol::Header{logon.messageType, sizeof(logon), 0, now()},
+          logon));
+      captured_session_ = session;
+    }
+    capture(msg);
+  }
+
+  // Append state transition caused by payload to the replication stream.
+  template <typename Payload>
+  void replicate(const Payload &payload, SequenceNum seq = 0) {
+    if (primary_) {
+      primary_->append(
+          protocol::Header{payload.messageType, sizeof(payload), seq, now()},
+          payload);
+    }
+  }
+
+  // Make new orders replicated next belong to session.
+  void replicate_session(SessionID session) {
+    if (primary_ && replicated_session_ != session) {
+      replicate(protocol::Logon{protocol::Logon::MESSAGE_TYPE, session,
+                                protocol::Logon::NONE});
+      replicated_session_ = session;
+    }
+  }
+
+  // Apply replicated state transition without risk checks.
+  void apply_replicated(protocol::MessageView);
+
+  // Message handlers, replicating accepted state transitions.
 
   [[nodiscard]] protocol::OrderResponse
-  handle_new_order(const protocol::NewOrder &);
+  handle_new_order(const protocol::NewOrder &, SessionID);
   [[nodiscard]] protocol::OrderResponse
   handle_modify_order(const protocol::ModifyOrderQuantity &);
+  [[nodiscard]] protocol::BatchResponse
+  handle_order_batch(const protocol::OrderBatch &, SessionID);
   void handle_delete_order(const protocol::DeleteOrder &);
-  void handle_trade(const protocol::Trade &);
-
-  // Helpers for message handlers.
-
-  bool register_new_order(OrderID, const Order &);
-  bool update_order_quantity(Order &, Quantity);
-  void delete_order(OrderID);
+  void handle_position_query(ClientConnection &,
+                             const protocol::PositionQuery &);
+  void handle_logon(ClientConnection &, const protocol::Logon &);
+  // Trades from the trade feed have a non-zero feed sequence number.
+  void handle_trade(const protocol::Trade &, SequenceNum feed_seq = 0);
 };
 
 } // namespace rs
@@ -0,0 +1,89 @@
+#ifndef INCLUDED_RISKSERVICE_RUNTIME_PROFILE_HEADER
+#define INCLUDED_RISKSERVICE_RUNTIME_PROFILE_HEADER
+/*
+ * Runtime profile of a latency tuned host: which CPUs the server's threads
+ * run on, how the serving thread waits for work and how its sockets are set
+ * up.
+ *
+ * The profile is loaded from a config file with one setting per line:
+ *
+ *   # setting          value
+ *   serving_cpu        3        # thread receiving, checking and responding
+ *   network_cpus       4-5      # other network threads, one CPU each
+ *   housekeeping_cpus  0-1      # all other threads, e.g. the admin thread
+ *   wait               busy     # busy or block
+ *   realtime_priority  50       # SCHED_FIFO priority of network threads
+ *   tcp_nodelay        on
+ *   busy_poll          50       # SO_BUSY_POLL in microseconds
+ *   receive_buffer     4194304
+ *   send_buffer        4194304
+ *
+ * Settings that are not given keep the defaults of the system: threads run on
+ * any CPU with the default scheduling, and the serving thread blocks in poll
+ * until there is work. A busy serving thread never blocks, so it keeps its
+ * CPU busy, which only pays off on a CPU of its own. Isolating that CPU from
+ * other processes is up to the host, e.g. with isolcpus= at boot. The server
+ * reports whether the serving CPU is isolated and keeps its own other threads
+ * off it. A busy thread at realtime priority never lets the kernel's threads
+ * of its CPU run, which can hang the host, so the server refuses to start
+ * with both unless all of its network threads run on isolated CPUs.
+ */
+
+extern "C" {
+#include <pthread.h>
+}
+
+#include "tcp.h"
+#include <istream>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace rs::runtime {
+
+enum class Wait { BLOCK, BUSY };
+
+struct Profile {
+  // The serving thread receives, checks and responds, and applies the trade
+  // feed. It is pinned to this CPU if given, and further network threads, if
+  // any, to one network CPU each.
+  std::optional<unsigned> serving_cpu;
+  std::vector<unsigned> network_cpus;
+  std::vector<unsigned> housekeeping_cpus;
+  Wait wait{Wait::BLOCK};
+  // SCHED_FIFO priority of the serving thread, inherited by further network
+  // threads, 0 for the default scheduling.
+  int realtime_priority{0};
+  // Options of client connections and the trade feed.
+  tcp::SocketOptions sockets;
+
+  // Parse profile, throwing with the line number of the first invalid line.
+  [[nodiscard]] static Profile parse(std::istream &);
+  [[nodiscard]] static Profile load(const std::string &path);
+
+  // Settings and isolation of the serving CPU, for reporting at startup.
+  std::string describe() const;
+
+  // Throw if network threads busy wait at realtime priority on CPUs that are
+  // not all isolated, given the number of further network threads.
+  void check_isolation(std::size_t network_threads) const;
+};
+
+// Parse a CPU list such as "0-3,6", the format of isolcpus= and sysfs.
+[[nodiscard]] std::optional<std::vector<unsigned>>
+parse_cpu_list(const std::string &);
+
+// CPUs isolated from the scheduler at boot.
+[[nodiscard]] std::vector<unsigned> isolated_cpus();
+
+// Let thread run on the given CPUs only.
+void pin_thread(pthread_t thread, const std::vector<unsigned> &cpus);
+
+// Schedule the calling thread first in first out at priority, ahead of all
+// threads with the default scheduling. Needs CAP_SYS_NICE or a high enough
+// RLIMIT_RTPRIO.
+void set_realtime_priority(int priority);
+
+} // namespace rs::runtime
+
+#endif // INCLUDED_RISKSERVICE_RUNTIME_PROFILE_HEADER
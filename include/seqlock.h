@@ -0,0 +1,69 @@
+#ifndef INCLUDED_RISKSERVICE_SEQLOCK_HEADER
+#define INCLUDED_RISKSERVICE_SEQLOCK_HEADER
+/*
+ * Sequence lock for one writer and any number of readers.
+ */
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace rs {
+
+// Value that is written by one thread and read by others without blocking the
+// writer. Readers retry until they read a value that was not modified during
+// the read.
+// The value is stored in lock-free atomic words, so a Seqlock can be placed in
+// memory shared between processes.
+template <typename T> class Seqlock {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+  using Word = uint64_t;
+  static constexpr std::size_t words =
+      (sizeof(T) + sizeof(Word) - 1) / sizeof(Word);
+
+public:
+  // Only one thread may store.
+  void store(const T &value) noexcept {
+    std::array<Word, words> copy{};
+    std::memcpy(copy.data(), static_cast<const void *>(&value), sizeof(T));
+
+    auto seq = seq_.load(std::memory_order_relaxed);
+    // Odd sequence number means that a store is in progress.
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < words; ++i) {
+      data_[i].store(copy[i], std::memory_order_relaxed);
+    }
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  T load() const noexcept {
+    std::array<Word, words> copy;
+    Word before, after;
+    do {
+      before = seq_.load(std::memory_order_acquire);
+      for (std::size_t i = 0; i < words; ++i) {
+        copy[i] = data_[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = seq_.load(std::memory_order_relaxed);
+    } while (before != after || (before & 1));
+
+    T value;
+    std::memcpy(static_cast<void *>(&value), copy.data(), sizeof(T));
+    return value;
+  }
+
+private:
+  std::atomic<Word> seq_{0};
+  std::array<std::atomic<Word>, words> data_{};
+
+  static_assert(std::atomic<Word>::is_always_lock_free);
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_SEQLOCK_HEADER
@@ -0,0 +1,78 @@
+#ifndef INCLUDED_RISKSERVICE_SESSION_SEQUENCE_HEADER
+#define INCLUDED_RISKSERVICE_SESSION_SEQUENCE_HEADER
+/*
+ * Sequencing of the requests of a session across its connections.
+ */
+
+#include "protocol.h"
+#include "udp.h"
+#include <variant>
+#include <vector>
+
+namespace rs {
+
+// Sequence numbers of the requests of one logged on session, and a window of
+// the responses to its most recent requests, for answering requests that a
+// reconnecting client sends again without handling them twice.
+// Checking and recording are O(1).
+class SessionSequence {
+  using SequenceNum = decltype(protocol::Header::sequenceNumber);
+
+public:
+  using Response = std::variant<std::monostate, protocol::OrderResponse,
+                                protocol::BatchResponse>;
+  using Result = udp::Sequencer::Result;
+
+  // Requests whose responses are kept, a power of two.
+  static constexpr std::size_t window_length = 1 << 10;
+
+  SessionSequence() : window_(window_length) {}
+
+  // Check sequence number of next request and update the expected number.
+  // Requests are never reordered on a connection, so a number below the
+  // expected one that has been seen is a request sent again. One that was
+  // skipped has not been handled yet.
+  Result next(SequenceNum seq) noexcept { return requests_.next(seq); }
+
+  // Zero until the first request has been seen.
+  SequenceNum expected() const noexcept { return requests_.expected(); }
+
+  // Keep response to request seq, replacing the response to the request
+  // window_length before it.
+  void record(SequenceNum seq, const Response &response) noexcept {
+    auto &slot = window_[seq & (window_length - 1)];
+    slot.seq = seq;
+    slot.response = response;
+  }
+
+  // Return the response to request seq, or nullptr if the request had no
+  // response or has left the window.
+  const Response *find(SequenceNum seq) const noexcept {
+    const auto &slot = window_[seq & (window_length - 1)];
+    if (slot.seq != seq ||
+        std::holds_alternative<std::monostate>(slot.response)) {
+      return nullptr;
+    }
+    return &slot.response;
+  }
+
+  const udp::Sequencer &requests() const noexcept { return requests_; }
+
+  std::size_t replayed{0};
+  // Number of the last logon to the session. Only the connection of that
+  // logon may send requests, an earlier one still sending is stale.
+  uint64_t logon{0};
+
+private:
+  struct Slot {
+    SequenceNum seq{0};
+    Response response;
+  };
+
+  udp::Sequencer requests_;
+  std::vector<Slot> window_;
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_SESSION_SEQUENCE_HEADER
@@ -0,0 +1,38 @@
+#ifndef INCLUDED_RISKSERVICE_STARTUP_HEADER
+#define INCLUDED_RISKSERVICE_STARTUP_HEADER
+/*
+ * Preparing a process so that its first messages are handled as fast as
+ * later ones, by moving page faults, rehashing and cold code paths to startup.
+ */
+
+#include <cstddef>
+
+namespace rs::startup {
+
+struct Options {
+  // Lock pages in memory once they are touched, so that they are never
+  // swapped out.
+  bool lock_memory{false};
+  // Put the position table on huge pages.
+  bool huge_pages{false};
+  // Table sizes to reserve up front.
+  std::size_t orders{0};
+  std::size_t listings{0};
+  // Synthetic orders to run through the engine before serving.
+  std::size_t warmup_orders{0};
+};
+
+// Lock all current and future pages of the process in memory as they are
+// faulted in. Needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK.
+void lock_memory();
+
+// Keep freed heap memory in the process instead of returning it to the
+// system, so that memory faulted in at startup is reused later.
+void retain_heap() noexcept;
+
+// Fault in the stack pages that handling messages may need.
+void prefault_stack() noexcept;
+
+} // namespace rs::startup
+
+#endif // INCLUDED_RISKSERVICE_STARTUP_HEADER
@@ -0,0 +1,228 @@
+#ifndef INCLUDED_RISKSERVICE_TASK_HEADER
+#define INCLUDED_RISKSERVICE_TASK_HEADER
+/*
+ * Coroutine task type, available in the C++20 build (-DRS_COROUTINES=ON).
+ *
+ * Tasks start when they are awaited, or when they are spawned on an
+ * EventLoop, and resume their awaiter when done. Coroutine frames are
+ * allocated from a pool of fixed size blocks, so creating a task does not
+ * call the global allocator once the pool is warm, and awaiting never
+ * allocates.
+ */
+
+#if __cplusplus < 202002L
+#error "task.h requires C++20, configure with -DRS_COROUTINES=ON"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <optional>
+#include <utility>
+
+namespace rs::co {
+
+// Free list of fixed size blocks for coroutine frames, one per thread.
+// Frames larger than a block, which no coroutine in this project needs, use
+// the global allocator.
+class FramePool {
+  struct Block {
+    Block *next;
+  };
+
+public:
+  static constexpr std::size_t block_size = 1 << 10;
+
+  static void *allocate(std::size_t size) {
+    if (size > block_size) {
+      return ::operator new(size);
+    }
+    auto *&free = free_list();
+    if (free == nullptr) {
+      return ::operator new(block_size);
+    }
+    auto *block = free;
+    free = block->next;
+    return block;
+  }
+
+  static void deallocate(void *ptr, std::size_t size) noexcept {
+    if (size > block_size) {
+      ::operator delete(ptr);
+      return;
+    }
+    auto *block = static_cast<Block *>(ptr);
+    block->next = free_list();
+    free_list() = block;
+  }
+
+  // Allocate blocks up front, e.g. one per connection, so that tasks started
+  // on the hot path find a free block.
+  static void reserve(std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      deallocate(::operator new(block_size), block_size);
+    }
+  }
+
+private:
+  // Blocks are kept until the thread exits.
+  static Block *&free_list() noexcept {
+    thread_local Block *head = nullptr;
+    return head;
+  }
+};
+
+template <typename T> class Task;
+
+namespace task_detail {
+
+struct PromiseBase {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr exception;
+  // Spawned tasks have no awaiter and destroy themselves when done.
+  bool detached{false};
+
+  static void *operator new(std::size_t size) {
+    return FramePool::allocate(size);
+  }
+  static void operator delete(void *ptr, std::size_t size) noexcept {
+    FramePool::deallocate(ptr, size);
+  }
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      auto &promise = handle.promise();
+      if (promise.detached) {
+        if (promise.exception) {
+          // Nobody to report to, spawned tasks must handle their errors.
+          std::terminate();
+        }
+        handle.destroy();
+        return std::noop_coroutine();
+      }
+      // Resume the awaiter without growing the stack.
+      return promise.continuation ? promise.continuation
+                                  : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() noexcept {
+    exception = std::current_exception();
+  }
+
+  void rethrow_if_failed() const {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+};
+
+template <typename T> struct Promise : PromiseBase {
+  std::optional<T> value;
+
+  Task<T> get_return_object() noexcept;
+
+  template <typename U> void return_value(U &&result) {
+    value.emplace(std::forward<U>(result));
+  }
+
+  T result() {
+    rethrow_if_failed();
+    return std::move(*value);
+  }
+};
+
+template <> struct Promise<void> : PromiseBase {
+  Task<void> get_return_object() noexcept;
+
+  void return_void() noexcept {}
+
+  void result() const { rethrow_if_failed(); }
+};
+
+} // namespace task_detail
+
+template <typename T = void> class [[nodiscard]] Task {
+
+public:
+  using promise_type = task_detail::Promise<T>;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  explicit Task(Handle handle) noexcept : handle_(handle) {}
+
+  ~Task() noexcept {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  // A task owns its coroutine frame, so it can only be moved.
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (handle_) {
+        handle_.destroy();
+      }
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+
+  // Start the task and suspend the awaiter until it is done.
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      Handle handle;
+
+      bool await_ready() const noexcept { return false; }
+
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle.promise().continuation = awaiter;
+        return handle;
+      }
+
+      T await_resume() { return handle.promise().result(); }
+    };
+    return Awaiter{handle_};
+  }
+
+  // Give up ownership and start the task, which destroys itself when done.
+  void detach() && {
+    auto handle = std::exchange(handle_, {});
+    handle.promise().detached = true;
+    handle.resume();
+  }
+
+private:
+  Handle handle_;
+};
+
+namespace task_detail {
+
+template <typename T> Task<T> Promise<T>::get_return_object() noexcept {
+  return Task<T>{Task<T>::Handle::from_promise(*this)};
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept {
+  return Task<void>{Task<void>::Handle::from_promise(*this)};
+}
+
+} // namespace task_detail
+
+} // namespace rs::co
+
+#endif // INCLUDED_RISKSERVICE_TASK_HEADER
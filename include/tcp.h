@@ -8,22 +8,28 @@ extern "C" {
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 }
 
+#include "buffer.h"
 #include "protocol.h"
 #include <algorithm>
 #include <array>
 #include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 namespace rs::tcp {
 
+// Capacity of each receive and send buffer.
 constexpr std::size_t msg_buffer_length = (1ull << 16) - 1;
 
 // Extract IPv4 or IPv6 address from addrinfo* data as a string.
@@ -34,10 +40,11 @@ constexpr std::size_t msg_buffer_length = (1ull << 16) - 1;
                                            const std::string & = "");
 
 // SERVER:
-//   Create a socket and bind an address to it.
+//   Create a socket and bind an address to it, shared with other sockets
+//   bound to it with reuse_port.
 //   Return the socket's file descriptor and bound address.
 [[nodiscard]] inline std::pair<int, std::string>
-create_and_bind_socket(const addrinfo *);
+create_and_bind_socket(const addrinfo *, bool reuse_port = false);
 
 // CLIENT:
 //   Create a socket and connect to an address.
@@ -45,6 +52,33 @@ create_and_bind_socket(const addrinfo *);
 [[nodiscard]] inline std::pair<int, std::string>
 create_and_connect_socket(const addrinfo *);
 
+// Address of a server, resolved once, so that connecting to it again needs no
+// lookup.
+struct Endpoint {
+  sockaddr_storage address;
+  socklen_t length;
+  int family;
+  // IP address and port, for logging.
+  std::string name;
+};
+
+// Resolve address and port into the endpoints to try in order.
+[[nodiscard]] std::vector<Endpoint> resolve(const std::string &,
+                                            const std::string &);
+
+// Options of sockets carrying latency sensitive traffic. Zeros keep the
+// system defaults.
+struct SocketOptions {
+  // TCP_NODELAY, send small responses right away instead of coalescing them.
+  bool no_delay{false};
+  // SO_BUSY_POLL, microseconds a blocking receive spins on the device queue
+  // before sleeping.
+  int busy_poll_us{0};
+  // SO_RCVBUF and SO_SNDBUF in bytes, which the kernel doubles.
+  int receive_buffer{0};
+  int send_buffer{0};
+};
+
 // UNIX socket with a file descriptor.
 // The file descriptor is closed on destruction.
 class Socket {
@@ -78,17 +112,41 @@ public:
   // Start listening on socket at fd.
   void try_listen();
 
+  // Make reads and writes return instead of blocking.
+  void set_non_blocking() const;
+
+  // Set the options that differ from the system defaults. TCP_NODELAY is
+  // only set on TCP sockets.
+  void set_options(const SocketOptions &) const;
+
 private:
   // Close file descriptor or do nothing if it is -1.
   void close_fd() noexcept;
 };
 
+// Accepted connection with receive and send buffers from the server's pool.
+// Received messages are framed from the receive buffer as views, responses
+// are encoded into the send buffer and sent together. On a non-blocking
+// socket, bytes the socket cannot take stay queued in the send buffer.
+struct Connection {
+  Socket socket;
+  BufferPool::Handle recv_buffer;
+  BufferPool::Handle send_buffer;
+  // Set when the peer has closed the connection.
+  bool closed{false};
+};
+
 class Server {
 
 public:
   static constexpr std::size_t read_buffer_length = (1ull << 8) - 1;
+  // Connections that can be open at the same time, each holding two buffers.
+  static constexpr std::size_t max_connections = 1 << 4;
 
-  explicit Server(const std::string &, const std::string &);
+  // With reuse_port, several servers can listen at the same address, and the
+  // kernel spreads incoming connections across them.
+  explicit Server(const std::string &, const std::string &,
+                  bool reuse_port = false);
 
   // Rule of five.
   ~Server() noexcept = default;
@@ -103,17 +161,26 @@ public:
   Server(Server &&other) noexcept = default;
   Server &operator=(Server &&other) noexcept = default;
 
-  // Read incoming message from client.
-  [[nodiscard]] protocol::Message receive_message(const Socket &) const;
+  // Read incoming bytes from client into the receive buffer of connection.
+  // Return amount of bytes read, which is zero if the client closed the
+  // connection, or if nothing could be read without blocking.
+  std::size_t receive(Connection &) const;
+
+  // Send the contents of the send buffer of connection and get sent length.
+  // On a non-blocking socket, send as much as the socket takes without
+  // blocking and keep the rest queued.
+  std::size_t send(Connection &) const;
 
-  // Send response to client and get sent length.
-  std::size_t send_message(const Socket &, const protocol::Message &) const;
+  // Accept a new connection and return a Connection object for it.
+  [[nodiscard]] Connection next_connection();
 
-  // Accept a new connection and return a Socket object for it.
-  [[nodiscard]] Socket next_connection();
+  // Listening socket, e.g. for polling incoming connections.
+  const Socket &socket() const noexcept { return socket_; }
 
 private:
   Socket socket_;
+  // Behind a pointer since buffer handles point to the pool.
+  std::unique_ptr<BufferPool> buffer_pool_;
 };
 
 class Client {
@@ -121,6 +188,12 @@ class Client {
 public:
   explicit Client(const std::string &, const std::string &);
 
+  // Connect to the first endpoint that accepts, giving each up to
+  // connect_timeout if given.
+  explicit Client(const std::vector<Endpoint> &,
+                  std::optional<std::chrono::milliseconds> connect_timeout =
+                      std::nullopt);
+
   // Same constraints as in rs::tcp::Server.
   ~Client() noexcept = default;
 
@@ -130,16 +203,53 @@ public:
   Client(Client &&other) noexcept = default;
   Client &operator=(Client &&other) noexcept = default;
 
-  // Read order response from socket.
-  [[nodiscard]] protocol::Message receive_message() const;
+  // Read next message from socket, blocking until it is complete.
+  // The view is valid until the next call and empty if the server closed the
+  // connection.
+  [[nodiscard]] protocol::MessageView receive_message();
+
+  // Read next message, waiting at most timeout for it to be complete.
+  // Return nothing if it is not, and an empty view if the server closed the
+  // connection.
+  [[nodiscard]] std::optional<protocol::MessageView>
+  receive_message(std::chrono::milliseconds timeout);
+
+  // Send message with delimiter to socket and get sent length.
+  std::size_t send_message(protocol::MessageView);
+
+  // Buffer for encoding outgoing messages, sent with flush.
+  Buffer &send_buffer() noexcept { return send_buffer_; }
+  const Buffer &send_buffer() const noexcept { return send_buffer_; }
+  Buffer &recv_buffer() noexcept { return recv_buffer_; }
+
+  // Send and clear the contents of the send buffer and get sent length.
+  std::size_t flush();
 
-  // Send message to socket and get sent length.
-  std::size_t send_message(const protocol::Message &) const;
+  // Same, but throw if the socket does not take all of it within timeout.
+  std::size_t flush(std::chrono::milliseconds timeout);
+
+  // Connected socket, e.g. for polling responses.
+  const Socket &socket() const noexcept { return socket_; }
 
 private:
   Socket socket_;
+  Buffer recv_buffer_{msg_buffer_length};
+  Buffer send_buffer_{msg_buffer_length};
 };
 
+// Send all bytes to socket and get sent length.
+std::size_t send_all(const Socket &, std::string_view);
+
+// Read from socket into the writable end of buffer.
+// The readable bytes are moved to the front first, so that an incomplete
+// message always has room to grow. Return zero if the peer closed the socket
+// and nothing if reading a non-blocking socket would block.
+std::optional<std::size_t> receive_into(const Socket &, Buffer &);
+
+// Send readable bytes of buffer to socket until it would block, consume them
+// and get sent length.
+std::size_t send_from(const Socket &, Buffer &);
+
 } // namespace rs::tcp
 
 #endif // INCLUDED_RISKSERVICE_TCP_HEADER
@@ -0,0 +1,86 @@
+#ifndef INCLUDED_RISKSERVICE_THROTTLE_HEADER
+#define INCLUDED_RISKSERVICE_THROTTLE_HEADER
+/*
+ * Order rate throttle over a sliding window of one second.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace rs {
+
+using Nanoseconds = long long;
+
+// Most orders per second.
+using OrderRate = uint32_t;
+constexpr OrderRate unlimited_rate = std::numeric_limits<OrderRate>::max();
+
+// Counts orders over a sliding window of one second, in a ring of buckets of
+// an eighth of a second each: the window is the bucket of the current time
+// and the seven before it. Moving the window forward clears the buckets that
+// fall out of it, at most all of them, so checking and counting an order take
+// constant time and never allocate, however long ago the last order was.
+// Unlimited throttles count nothing.
+class Throttle {
+
+public:
+  static constexpr std::size_t buckets = 8;
+  static constexpr Nanoseconds bucket_length = 1'000'000'000 / buckets;
+
+  explicit Throttle(OrderRate rate = unlimited_rate) : rate_(rate) {}
+
+  OrderRate rate() const noexcept { return rate_; }
+
+  // Change the rate, keeping the orders counted in the window.
+  void set_rate(OrderRate rate) noexcept { rate_ = rate; }
+
+  // Move the window forward to now and return true if it has room for
+  // another order. Times before the current bucket count as the current one.
+  bool allows(Nanoseconds now) noexcept {
+    if (rate_ == unlimited_rate) {
+      return true;
+    }
+    advance(now);
+    return count_ < rate_;
+  }
+
+  // Count an order in the current bucket, after allows.
+  void add() noexcept {
+    if (rate_ == unlimited_rate) {
+      return;
+    }
+    ++counts_[bucket_ % buckets];
+    ++count_;
+  }
+
+  // Orders in the window.
+  OrderRate count() const noexcept { return count_; }
+
+private:
+  std::array<OrderRate, buckets> counts_{};
+  OrderRate count_{0};
+  OrderRate rate_;
+  // Current bucket, counted from time 0.
+  uint64_t bucket_{0};
+
+  void advance(Nanoseconds now) noexcept {
+    auto bucket = static_cast<uint64_t>(std::max<Nanoseconds>(now, 0)) /
+                  static_cast<uint64_t>(bucket_length);
+    if (bucket <= bucket_) {
+      return;
+    }
+    auto passed = std::min<uint64_t>(bucket - bucket_, buckets);
+    for (uint64_t i = 1; i <= passed; ++i) {
+      auto &count = counts_[(bucket_ + i) % buckets];
+      count_ -= count;
+      count = 0;
+    }
+    bucket_ = bucket;
+  }
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_THROTTLE_HEADER
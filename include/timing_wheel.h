@@ -0,0 +1,184 @@
+#ifndef INCLUDED_RISKSERVICE_TIMING_WHEEL_HEADER
+#define INCLUDED_RISKSERVICE_TIMING_WHEEL_HEADER
+/*
+ * Hierarchical timing wheel with one second ticks.
+ */
+
+#include "protocol.h"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace rs {
+
+// Keys scheduled for deadlines in seconds. Scheduling is O(1), and the due
+// keys are handed out by advance, in slices of bounded work, so that catching
+// up never stalls the caller. Advancing jumps over empty slots, so a long gap
+// costs a scan of the slots of each level rather than a tick per second.
+//
+// Level 0 has a slot per second for the next 256 seconds, each further level
+// 64 slots of 64 times the span of the level below, up to about two years.
+// The slot of a higher level is cascaded into the lower levels when the wheel
+// reaches its span. Keys are not removed when they are cancelled, the caller
+// drops stale keys when they come due.
+class TimingWheel {
+
+public:
+  struct Entry {
+    uint64_t key;
+    Timestamp deadline;
+  };
+
+  static constexpr std::size_t levels = 4;
+
+  // Start at time now, nothing before it ever comes due.
+  explicit TimingWheel(Timestamp now = 0) : current_(now) {}
+
+  std::size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+
+  // Time up to which all due keys have been handed out.
+  Timestamp current() const noexcept { return current_; }
+
+  // Move an empty wheel forward to now, so that it does not tick through the
+  // time in between.
+  void skip_to(Timestamp now) noexcept {
+    if (size_ == 0 && now > current_) {
+      current_ = now;
+    }
+  }
+
+  // Schedule key for deadline, which is due right away if it has passed.
+  void schedule(uint64_t key, Timestamp deadline) {
+    ++size_;
+    insert(Entry{key, deadline});
+  }
+
+  // Hand due keys to on_due(entry) until the wheel has reached now or after
+  // touching max_entries scheduled entries, due or cascaded. Return true if
+  // the wheel has reached now.
+  template <typename OnDue>
+  bool advance(Timestamp now, std::size_t max_entries, OnDue &&on_due) {
+    skip_to(now);
+    std::size_t touched = 0;
+    while (true) {
+      // Entries taken out of their slots are cascaded or handed out before
+      // the next tick.
+      for (auto level = levels; level-- > 0;) {
+        auto &pending = pending_[level];
+        while (pending_length_[level] < pending.size()) {
+          if (touched == max_entries) {
+            return false;
+          }
+          ++touched;
+          auto entry = pending[pending_length_[level]++];
+          if (entry.deadline <= current_) {
+            --size_;
+            on_due(entry);
+          } else {
+            insert(entry);
+          }
+        }
+        pending.clear();
+        pending_length_[level] = 0;
+      }
+      if (current_ >= now) {
+        return true;
+      }
+      tick(next_tick(now));
+    }
+  }
+
+private:
+  static constexpr std::size_t level0_bits = 8;
+  static constexpr std::size_t level_bits = 6;
+  static constexpr std::size_t level0_slots = 1 << level0_bits;
+  static constexpr std::size_t level_slots = 1 << level_bits;
+
+  // Bits below the slot index of level.
+  static constexpr std::size_t shift(std::size_t level) noexcept {
+    return level == 0 ? 0 : level0_bits + (level - 1) * level_bits;
+  }
+  static constexpr std::size_t slots(std::size_t level) noexcept {
+    return level == 0 ? level0_slots : level_slots;
+  }
+  static constexpr Timestamp max_delta =
+      (Timestamp{1} << (level0_bits + (levels - 1) * level_bits)) - 1;
+
+  Timestamp current_;
+  std::size_t size_{0};
+  // Slots of all levels, level 0 first. Slots keep their capacity when they
+  // are emptied.
+  std::array<std::vector<Entry>, level0_slots + (levels - 1) * level_slots>
+      slots_;
+  // Contents of the slots reached by the last tick, and how much of each has
+  // been handled.
+  std::array<std::vector<Entry>, levels> pending_;
+  std::array<std::size_t, levels> pending_length_{};
+
+  static constexpr std::size_t first_slot(std::size_t level) noexcept {
+    return level == 0 ? 0 : level0_slots + (level - 1) * level_slots;
+  }
+
+  std::vector<Entry> &slot(std::size_t level, Timestamp time) noexcept {
+    return slots_[first_slot(level) +
+                  ((time >> shift(level)) & (slots(level) - 1))];
+  }
+  const std::vector<Entry> &slot(std::size_t level,
+                                 Timestamp time) const noexcept {
+    return slots_[first_slot(level) +
+                  ((time >> shift(level)) & (slots(level) - 1))];
+  }
+
+  void insert(const Entry &entry) {
+    if (entry.deadline <= current_) {
+      // Handed out before the next tick.
+      pending_[0].push_back(entry);
+      return;
+    }
+    auto delta = entry.deadline - current_;
+    // Deadlines beyond the last level are placed at its end and cascaded
+    // again from there.
+    auto placed = delta > max_delta ? current_ + max_delta : entry.deadline;
+    delta = placed - current_;
+    std::size_t level = 0;
+    while (level + 1 < levels && delta >= (Timestamp{1} << shift(level + 1))) {
+      ++level;
+    }
+    slot(level, placed).push_back(entry);
+  }
+
+  // Earliest time after the current one, and at most now, at which a tick
+  // reaches a slot that is not empty, or now if there is none. Each level is
+  // scanned once, over the next time each of its slots is reached.
+  Timestamp next_tick(Timestamp now) const noexcept {
+    auto next = now;
+    for (std::size_t level = 0; level < levels; ++level) {
+      const Timestamp span = Timestamp{1} << shift(level);
+      auto time = (current_ / span + 1) * span;
+      for (std::size_t i = 0; i < slots(level) && time < next;
+           ++i, time += span) {
+        if (!slot(level, time).empty()) {
+          next = time;
+          break;
+        }
+      }
+    }
+    return next;
+  }
+
+  // Move to time, past only empty slots, and take out the slots it reaches.
+  void tick(Timestamp time) noexcept {
+    current_ = time;
+    for (std::size_t level = levels; level-- > 1;) {
+      if ((current_ & ((Timestamp{1} << shift(level)) - 1)) == 0) {
+        pending_[level].swap(slot(level, current_));
+      }
+    }
+    pending_[0].swap(slot(0, current_));
+  }
+};
+
+} // namespace rs
+
+#endif // INCLUDED_RISKSERVICE_TIMING_WHEEL_HEADER
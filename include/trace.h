@@ -0,0 +1,170 @@
+#ifndef INCLUDED_RISKSERVICE_TRACE_HEADER
+#define INCLUDED_RISKSERVICE_TRACE_HEADER
+/*
+ * Static tracepoints and a sampling per-stage cycle profiler.
+ *
+ * If <sys/sdt.h> is installed (e.g. systemtap-sdt-dev), RS_TRACE_STAGE places
+ * USDT probes <stage>_entry and <stage>_exit of provider risk_server, which
+ * are single NOPs until a tracer attaches, e.g.
+ *
+ *   bpftrace -e 'usdt:./bin/risk-server:risk_server:new_order_entry
+ *                { @start[tid] = nsecs; }
+ *                usdt:./bin/risk-server:risk_server:new_order_exit
+ *                { @ns = hist(nsecs - @start[tid]); }'
+ *
+ * or perf probe -x ./bin/risk-server sdt_risk_server:new_order_entry.
+ * Without it, the probes compile to nothing.
+ *
+ * The profiler times one in every n stages with the cycle counter, into a
+ * ring buffer of the thread. The rings of all threads are summarized together
+ * on request, e.g. on a signal.
+ * With sampling off, a stage costs one relaxed load.
+ */
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define RS_HAVE_SDT
+#endif
+#endif
+
+#ifdef RS_HAVE_SDT
+extern "C" {
+#include <sys/sdt.h>
+}
+#define RS_PROBE(name) DTRACE_PROBE(risk_server, name)
+#else
+#define RS_PROBE(name) static_cast<void>(0)
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Trace the rest of the enclosing scope as stage, with probes name_entry and
+// name_exit.
+#define RS_TRACE_STAGE(name, stage)                                            \
+  RS_PROBE(name##_entry);                                                      \
+  ::rs::trace::StageScope rs_trace_stage_scope {                               \
+    ::rs::trace::Stage::stage, [] { RS_PROBE(name##_exit); }                   \
+  }
+
+namespace rs::trace {
+
+enum class Stage : uint8_t {
+  RECEIVE,
+  DECODE,
+  NEW_ORDER,
+  MODIFY_ORDER,
+  DELETE_ORDER,
+  TRADE,
+  ORDER_BATCH,
+  POSITION_QUERY,
+  LOGON,
+  SEND,
+};
+constexpr std::size_t stage_count = 10;
+
+// Current value of the cycle counter, which ticks at a constant rate on
+// current CPUs.
+inline uint64_t cycles() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t value;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+  return value;
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Sampling of all threads, each recording into a ring of its own.
+class Profiler {
+
+public:
+  // Samples kept per thread, the most recent ones.
+  static constexpr std::size_t ring_length = 1 << 16;
+
+  // Time one in period stages of each thread, 0 to stop sampling.
+  static void start(uint32_t period) noexcept;
+
+  // Return true if the stage starting now is sampled.
+  static bool sample() noexcept {
+    auto period = period_.load(std::memory_order_relaxed);
+    if (period == 0) {
+      return false;
+    }
+    if (--countdown_ > 0) {
+      return false;
+    }
+    countdown_ = period;
+    return true;
+  }
+
+  // Record the cycles of a sampled stage in the ring of the calling thread.
+  static void record(Stage, uint64_t cycles) noexcept;
+
+  // Count and cycle percentiles of each stage over the rings of all threads,
+  // from any thread.
+  static std::string dump();
+
+  // Longest time in milliseconds between a signal and its dump, for the
+  // serving threads to bound their poll timeouts by.
+  static constexpr int dump_check_interval = 1000;
+
+  // Request a dump from the serving threads whenever signal arrives, e.g.
+  // SIGUSR2.
+  static void dump_on_signal(int signal);
+
+  // Return true if dumps are requested by a signal.
+  static bool dumps_on_signal() noexcept {
+    return dumps_on_signal_.load(std::memory_order_relaxed);
+  }
+
+  // Return true once for each requested dump.
+  static bool take_dump_request() noexcept {
+    return dump_requested_.load(std::memory_order_relaxed) &&
+           dump_requested_.exchange(false);
+  }
+
+private:
+  static std::atomic<uint32_t> period_;
+  static std::atomic<bool> dump_requested_;
+  static std::atomic<bool> dumps_on_signal_;
+  static thread_local uint32_t countdown_;
+};
+
+// Times the scope, if sampled, and calls exit on leaving it.
+template <typename Exit> class StageScope {
+
+public:
+  StageScope(Stage stage, Exit exit) noexcept
+      : stage_(stage), exit_(exit), start_(Profiler::sample() ? cycles() : 0) {}
+
+  ~StageScope() noexcept {
+    if (start_ != 0) {
+      Profiler::record(stage_, cycles() - start_);
+    }
+    exit_();
+  }
+
+  // Bound to its scope.
+  StageScope(const StageScope &) = delete;
+  StageScope &operator=(const StageScope &) = delete;
+  StageScope(StageScope &&) = delete;
+  StageScope &operator=(StageScope &&) = delete;
+
+private:
+  Stage stage_;
+  Exit exit_;
+  uint64_t start_;
+};
+
+} // namespace rs::trace
+
+#endif // INCLUDED_RISKSERVICE_TRACE_HEADER
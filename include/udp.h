@@ -0,0 +1,181 @@
+#ifndef INCLUDED_RISKSERVICE_UDP_HEADER
+#define INCLUDED_RISKSERVICE_UDP_HEADER
+/*
+ * UDP datagram feed receiver and sender.
+ */
+
+extern "C" {
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+}
+
+#include "protocol.h"
+#include "tcp.h"
+#include <algorithm>
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rs::udp {
+
+// Receives datagrams sent to a unicast or multicast address.
+// If the address is a multicast group, the socket joins the group and binds to
+// the wildcard address of the group's family.
+// Datagrams are read in batches of at most batch_length, with one recvmmsg call
+// per batch on Linux. Datagrams longer than datagram_length are dropped.
+class Receiver {
+
+public:
+  static constexpr std::size_t batch_length = 64;
+  static constexpr std::size_t datagram_length = (1ull << 10) - 1;
+
+  explicit Receiver(const std::string &, const std::string &);
+
+  // Same constraints as in rs::tcp::Server.
+  ~Receiver() noexcept = default;
+
+  Receiver(const Receiver &) = delete;
+  Receiver &operator=(const Receiver &) = delete;
+
+  Receiver(Receiver &&other) noexcept = default;
+  Receiver &operator=(Receiver &&other) noexcept = default;
+
+  const tcp::Socket &socket() const noexcept { return socket_; }
+
+  // Read all datagrams that are available without blocking, at most
+  // batch_length, and return the amount of datagrams read, not counting the
+  // truncated ones, which are dropped.
+  // The datagrams are accessible with message(i) until the next call.
+  [[nodiscard]] std::size_t receive_batch();
+
+  [[nodiscard]] std::string_view message(std::size_t i) const noexcept {
+    return {buffers_.data() + slots_[i] * datagram_length, lengths_[i]};
+  }
+
+  // Datagrams dropped for being longer than datagram_length.
+  std::size_t truncated{0};
+
+private:
+  tcp::Socket socket_;
+  // Preallocated receive buffers, one slot of datagram_length per datagram.
+  std::vector<char> buffers_;
+  // Slot and length of each datagram read.
+  std::array<std::size_t, batch_length> slots_{};
+  std::array<std::size_t, batch_length> lengths_{};
+
+  // Keep datagram of slot unless it was truncated, and return true if kept.
+  bool keep(std::size_t count, std::size_t slot, std::size_t length,
+            bool was_truncated) noexcept;
+};
+
+// Sends datagrams to a unicast or multicast address.
+class Sender {
+
+public:
+  explicit Sender(const std::string &, const std::string &);
+
+  ~Sender() noexcept = default;
+
+  Sender(const Sender &) = delete;
+  Sender &operator=(const Sender &) = delete;
+
+  Sender(Sender &&other) noexcept = default;
+  Sender &operator=(Sender &&other) noexcept = default;
+
+  // Send one datagram and get sent length.
+  std::size_t send_message(const protocol::Message &) const;
+
+private:
+  tcp::Socket socket_;
+  sockaddr_storage address_{};
+  socklen_t address_length_{0};
+};
+
+// Sequence number tracking for a feed of datagrams.
+// Datagrams may be lost or reordered. Numbers above the expected one skip a
+// gap, and the numbers in it are missing until they arrive late. The numbers
+// seen within a window behind the expected one are kept in a bitmap, so that
+// only numbers seen before are duplicates. Numbers too far behind to tell
+// count as duplicates as well.
+class Sequencer {
+  using SequenceNum = decltype(protocol::Header::sequenceNumber);
+
+public:
+  enum class Result {
+    IN_ORDER,
+    GAP,
+    // Missing number of an earlier gap.
+    LATE,
+    DUPLICATE,
+  };
+
+  // Numbers behind the expected one that are told apart, a multiple of 64.
+  static constexpr SequenceNum window_length = 1 << 10;
+
+  // Check sequence number of next datagram and update expected number.
+  Result next(SequenceNum seq) noexcept {
+    if (expected_ != 0 && seq < expected_) {
+      if (expected_ - seq > window_length || seen(seq)) {
+        ++duplicates;
+        return Result::DUPLICATE;
+      }
+      mark(seq);
+      // Numbers before the first one were never counted as missed.
+      if (seq > first_) {
+        --missed;
+      }
+      ++late;
+      return Result::LATE;
+    }
+    auto result = Result::IN_ORDER;
+    if (expected_ == 0) {
+      first_ = seq;
+    } else if (seq > expected_) {
+      ++gaps;
+      missed += seq - expected_;
+      result = Result::GAP;
+      // Numbers of the gap have not been seen, at most a window of them is
+      // kept.
+      auto skipped = std::min<SequenceNum>(seq - expected_, window_length);
+      for (auto missing = seq - skipped; missing != seq; ++missing) {
+        seen_[missing / 64 % words] &= ~(uint64_t{1} << missing % 64);
+      }
+    }
+    mark(seq);
+    expected_ = seq + 1;
+    return result;
+  }
+
+  SequenceNum expected() const noexcept { return expected_; }
+
+  std::size_t gaps{0};
+  // Numbers skipped by gaps that have not arrived late, including the ones
+  // that have left the window.
+  std::size_t missed{0};
+  std::size_t late{0};
+  std::size_t duplicates{0};
+
+private:
+  static constexpr std::size_t words = window_length / 64;
+
+  // Zero until the first datagram has been seen.
+  SequenceNum expected_{0};
+  SequenceNum first_{0};
+  // Bit of every number within the window, set if it has been seen.
+  std::array<uint64_t, words> seen_{};
+
+  bool seen(SequenceNum seq) const noexcept {
+    return seen_[seq / 64 % words] >> (seq % 64) & 1;
+  }
+
+  void mark(SequenceNum seq) noexcept {
+    seen_[seq / 64 % words] |= uint64_t{1} << seq % 64;
+  }
+};
+
+} // namespace rs::udp
+
+#endif // INCLUDED_RISKSERVICE_UDP_HEADER
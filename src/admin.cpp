@@ -0,0 +1,138 @@
+#include "admin.h"
+#include "format.h"
+#include "logging.h"
+
+extern "C" {
+#include <sys/socket.h>
+}
+
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace rs::admin {
+
+namespace {
+auto logger = logging::make_logger("admin", logging::Level::INFO);
+} // namespace
+
+Channel::Channel(const std::string &address, const std::string &port,
+                 LimitConfig current)
+    : server_(address, port), limits_(std::move(current)),
+      thread_([this] { run(); }) {}
+
+Channel::~Channel() noexcept {
+  running_ = false;
+  // Wake up the admin thread, blocked in accept or reading from an admin.
+  ::shutdown(server_.socket().fd, SHUT_RDWR);
+  if (int fd = connection_fd_; fd != -1) {
+    ::shutdown(fd, SHUT_RDWR);
+  }
+  thread_.join();
+  delete published_.load();
+}
+
+void Channel::run() {
+  while (running_) {
+    try {
+      auto connection = server_.next_connection();
+      connection_fd_ = connection.socket.fd;
+      serve(connection);
+      connection_fd_ = -1;
+    } catch (const std::exception &error) {
+      connection_fd_ = -1;
+      if (running_) {
+        logger->error(RS_FMT("{}"), error.what());
+      }
+    }
+  }
+}
+
+void Channel::pause() {
+  std::lock_guard lock(limits_mutex_);
+  paused_ = true;
+}
+
+void Channel::resume(LimitConfig current) {
+  std::lock_guard lock(limits_mutex_);
+  limits_ = std::move(current);
+  paused_ = false;
+  delete published_.exchange(nullptr, std::memory_order_acquire);
+}
+
+void Channel::serve(tcp::Connection &connection) {
+  logger->info(RS_FMT("Admin connected on socket {}"), connection.socket.fd);
+  std::string lines;
+  while (running_) {
+    server_.receive(connection);
+    if (connection.closed) {
+      break;
+    }
+    protocol::MessageView line;
+    while (protocol::next_message(*connection.recv_buffer, line)) {
+      if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+      }
+      if (line != "commit") {
+        lines.append(line);
+        lines += '\n';
+        if (lines.size() > max_update_length) {
+          logger->warn(RS_FMT("Admin on socket {} sent more than {} bytes "
+                              "without a commit, disconnecting"),
+                       connection.socket.fd, max_update_length);
+          connection.send_buffer->append(
+              rs::format(RS_FMT("ERROR update longer than {} bytes\n"),
+                         max_update_length));
+          server_.send(connection);
+          return;
+        }
+        continue;
+      }
+      std::string reply = "OK\n";
+      try {
+        commit(lines);
+      } catch (const std::exception &error) {
+        logger->warn(RS_FMT("Rejected limit update: {}"), error.what());
+        reply = rs::format(RS_FMT("ERROR {}\n"), error.what());
+      }
+      lines.clear();
+      connection.send_buffer->append(reply);
+      server_.send(connection);
+    }
+  }
+  logger->info(RS_FMT("Admin on socket {} disconnected"),
+               connection.socket.fd);
+}
+
+void Channel::commit(const std::string &lines) {
+  std::lock_guard lock(limits_mutex_);
+  if (paused_) {
+    throw std::runtime_error("Limits follow the primary until promotion");
+  }
+  std::istringstream input(lines);
+  auto limits = LimitConfig::parse(input, limits_);
+  // Orders of a session already count towards its account.
+  for (const auto &[id, session] : limits.sessions) {
+    auto current_it = limits_.sessions.find(id);
+    if (current_it != limits_.sessions.end() &&
+        current_it->second.account != session.account) {
+      throw std::runtime_error(
+          rs::format(RS_FMT("Session {} belongs to account {}"), id,
+                     current_it->second.account));
+    }
+  }
+  auto update = std::make_unique<Update>(
+      Update{limits, LimitChanges::between(limits_, limits)});
+  limits_ = std::move(limits);
+  // An update the engine has not taken yet is superseded, and its changes
+  // carried over. Only this thread publishes, so none can come in between.
+  if (std::unique_ptr<Update> pending{
+          published_.exchange(nullptr, std::memory_order_acquire)}) {
+    pending->changes.add(update->changes);
+    update->changes = std::move(pending->changes);
+  }
+  published_.store(update.release(), std::memory_order_release);
+  logger->info(RS_FMT("Published limit update"));
+}
+
+} // namespace rs::admin
@@ -0,0 +1,308 @@
+/*
+ * Replay captured messages through risk engines with different position
+ * limits, in parallel on all cores.
+ *
+ * Every combination of capture file and default instrument limits is an
+ * independent job with its own engine, using the other position limits from
+ * the limits file. The results show how many orders each limit configuration
+ * would have rejected and how close the accepted orders came to the limits.
+ * Limits changed by admins while the capture was recorded are applied where
+ * they were, except for the default instrument limits of the job and order
+ * rates, which replays do not throttle.
+ */
+
+#include "format.h"
+#include "risk_engine.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using namespace rs;
+
+struct Result {
+  std::size_t messages{0};
+  std::size_t accepted{0};
+  std::size_t rejected{0};
+  std::size_t trades{0};
+  std::size_t invalid{0};
+  // Highest worst case positions of any listing.
+  InstrumentState::NetPos peak_buy_pos{0};
+  InstrumentState::NetPos peak_sell_pos{0};
+};
+
+class Replay {
+
+public:
+  explicit Replay(LimitConfig limits) : engine_(std::move(limits)) {}
+
+  // Handle all messages of capture, one per line.
+  Result run(std::string_view capture) {
+    std::size_t begin = 0;
+    while (begin < capture.size()) {
+      auto end = capture.find(protocol::message_delimiter, begin);
+      if (end == capture.npos) {
+        end = capture.size();
+      }
+      auto msg = capture.substr(begin, end - begin);
+      begin = end + 1;
+      if (msg.empty()) {
+        continue;
+      }
+      ++result_.messages;
+      try {
+        handle_message(msg);
+      } catch (const std::exception &) {
+        ++result_.invalid;
+      }
+    }
+    return result_;
+  }
+
+private:
+  RiskEngine engine_;
+  SessionID session_{0};
+  Result result_;
+
+  void handle_message(protocol::MessageView msg) {
+    using namespace protocol;
+
+    switch (decode_header(msg).version) {
+    case NewOrder::MESSAGE_TYPE: {
+      auto new_order = decode_payload<NewOrder>(msg);
+      count(engine_.handle_new_order(new_order, session_),
+            new_order.listingId);
+    } break;
+
+    case ModifyOrderQuantity::MESSAGE_TYPE: {
+      auto modify = decode_payload<ModifyOrderQuantity>(msg);
+      auto response = engine_.handle_modify_order(modify);
+      const auto *order = engine_.find_order(modify.orderId);
+      count(response, order ? order->listing_id : 0);
+    } break;
+
+    case DeleteOrder::MESSAGE_TYPE: {
+      engine_.handle_delete_order(decode_payload<DeleteOrder>(msg));
+    } break;
+
+    case Trade::MESSAGE_TYPE: {
+      auto trade = decode_payload<Trade>(msg);
+      if (engine_.handle_trade(trade)) {
+        ++result_.trades;
+        update_peaks(trade.listingId);
+      }
+    } break;
+
+    case OrderBatch::MESSAGE_TYPE: {
+      // Too large for the stack of every worker.
+      thread_local OrderBatch batch;
+      batch = decode_payload<OrderBatch>(msg);
+      auto response = engine_.handle_order_batch(batch, session_);
+      for (std::size_t i = 0; i < batch.count; ++i) {
+        if (response.is_accepted(i)) {
+          ++result_.accepted;
+          const auto *order = engine_.find_order(batch.entries[i].orderId);
+          update_peaks(order->listing_id);
+        } else {
+          ++result_.rejected;
+        }
+      }
+    } break;
+
+    case Logon::MESSAGE_TYPE: {
+      session_ = decode_payload<Logon>(msg).sessionId;
+    } break;
+
+    case LimitUpdate::MESSAGE_TYPE: {
+      auto update = decode_payload<LimitUpdate>(msg);
+      const bool job_limits = update.scope == LimitUpdate::INSTRUMENT &&
+                              (update.flags & LimitUpdate::DEFAULT);
+      const bool rate = update.scope == LimitUpdate::INSTRUMENT_RATE ||
+                        update.scope == LimitUpdate::SESSION_RATE;
+      if (!job_limits && !rate) {
+        engine_.apply_limit_update(update);
+      }
+    } break;
+    }
+  }
+
+  void count(const protocol::OrderResponse &response, ListingID id) {
+    if (response.status == protocol::OrderResponse::Status::ACCEPTED) {
+      ++result_.accepted;
+      update_peaks(id);
+    } else {
+      ++result_.rejected;
+    }
+  }
+
+  void update_peaks(ListingID id) {
+    auto state = engine_.instrument_state(id);
+    result_.peak_buy_pos =
+        std::max(result_.peak_buy_pos, state.worst_buy_pos());
+    result_.peak_sell_pos =
+        std::max(result_.peak_sell_pos, state.worst_sell_pos());
+  }
+};
+
+std::string read_file(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Unable to open capture file {}"), path));
+  }
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+// Limits from, from + step, ..., up to and including to.
+std::vector<Quantity> limit_range(const char *from, const char *to,
+                                  const char *step) {
+  std::vector<Quantity> range;
+  Quantity last = std::stoull(to);
+  Quantity increment = std::max<Quantity>(std::stoull(step), 1);
+  // Stop before the increment would step past the last limit, or overflow.
+  for (Quantity limit = std::stoull(from); limit <= last; limit += increment) {
+    range.push_back(limit);
+    if (last - limit < increment) {
+      break;
+    }
+  }
+  return range;
+}
+
+[[noreturn]] void usage() {
+  std::cerr
+      << "usage: risk-backtest [options] capture_file...\n"
+         "options:\n"
+         "  --limits path              limits file, default unlimited\n"
+         "  --max-buy from to step     default instrument max buy positions\n"
+         "  --max-sell from to step    default instrument max sell positions\n"
+         "  --threads n                worker threads, default all cores\n";
+  exit(2);
+}
+
+} // namespace
+
+int main(const int argc, const char *argv[]) {
+  LimitConfig limits;
+  std::vector<Quantity> max_buys;
+  std::vector<Quantity> max_sells;
+  std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::string> paths;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string option{argv[i]};
+    if (option == "--limits" && i + 1 < argc) {
+      limits = LimitConfig::load(argv[i + 1]);
+      i += 1;
+    } else if (option == "--max-buy" && i + 3 < argc) {
+      max_buys = limit_range(argv[i + 1], argv[i + 2], argv[i + 3]);
+      i += 3;
+    } else if (option == "--max-sell" && i + 3 < argc) {
+      max_sells = limit_range(argv[i + 1], argv[i + 2], argv[i + 3]);
+      i += 3;
+    } else if (option == "--threads" && i + 1 < argc) {
+      threads = std::max(1ull, std::stoull(argv[i + 1]));
+      i += 1;
+    } else if (option.rfind("--", 0) == 0) {
+      std::cerr << rs::format(RS_FMT("error: invalid option '{}'"), option)
+                << '\n';
+      usage();
+    } else {
+      paths.push_back(option);
+    }
+  }
+  if (paths.empty()) {
+    usage();
+  }
+  // Captures do not record when the server handled each message, so replays
+  // cannot throttle order rates.
+  limits.default_instrument_rate = unlimited_rate;
+  limits.default_session_rate = unlimited_rate;
+  limits.instrument_rates.clear();
+  limits.session_rates.clear();
+  // Without a range, only the limits from the file are evaluated.
+  if (max_buys.empty()) {
+    max_buys.push_back(limits.default_instrument.max_pos[BUY]);
+  }
+  if (max_sells.empty()) {
+    max_sells.push_back(limits.default_instrument.max_pos[SELL]);
+  }
+
+  // Per message logging would dominate the run time.
+  RiskEngine::set_log_level(logging::Level::ERROR);
+
+  std::vector<std::string> captures;
+  captures.reserve(paths.size());
+  for (const auto &path : paths) {
+    captures.push_back(read_file(path));
+  }
+
+  struct Job {
+    std::size_t capture;
+    Limits instrument_limits;
+  };
+  std::vector<Job> jobs;
+  for (std::size_t c = 0; c < captures.size(); ++c) {
+    for (auto max_buy : max_buys) {
+      for (auto max_sell : max_sells) {
+        jobs.push_back({c, {max_buy, max_sell}});
+      }
+    }
+  }
+
+  // Workers take the next job until all are done. Jobs share nothing but the
+  // read-only captures, so they need no other synchronization.
+  std::vector<Result> results(jobs.size());
+  std::atomic<std::size_t> next_job{0};
+  auto work = [&] {
+    for (auto j = next_job++; j < jobs.size(); j = next_job++) {
+      auto job_limits = limits;
+      job_limits.default_instrument = jobs[j].instrument_limits;
+      Replay replay(std::move(job_limits));
+      results[j] = replay.run(captures[jobs[j].capture]);
+    }
+  };
+
+  threads = std::min(threads, jobs.size());
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (std::size_t t = 1; t < threads; ++t) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+
+  std::size_t total_messages = 0;
+  std::cout << "capture max_buy max_sell messages accepted rejected trades "
+               "invalid peak_buy_pos peak_sell_pos\n";
+  for (std::size_t j = 0; j < jobs.size(); ++j) {
+    const auto &job = jobs[j];
+    const auto &result = results[j];
+    total_messages += result.messages;
+    std::cout << rs::format(RS_FMT("{} {} {} {} {} {} {} {} {} {}\n"),
+                            paths[job.capture],
+                            job.instrument_limits.max_pos[BUY],
+                            job.instrument_limits.max_pos[SELL],
+                            result.messages, result.accepted, result.rejected,
+                            result.trades, result.invalid, result.peak_buy_pos,
+                            result.peak_sell_pos);
+  }
+  std::cerr << rs::format(
+      RS_FMT("{} jobs, {} messages in {} ms on {} threads\n"), jobs.size(),
+      total_messages, elapsed, threads);
+}
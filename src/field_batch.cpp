@@ -0,0 +1,489 @@
+#include "field_batch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RS_X86
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace rs::protocol {
+
+namespace {
+
+// Bit i of each mask describes byte i of a 64 byte block.
+struct Masks {
+  uint64_t digits;
+  uint64_t spaces;
+  uint64_t delimiters;
+};
+
+// Longest field that is converted without checking for overflow.
+constexpr std::size_t max_safe_digits = 19;
+constexpr std::size_t max_digits = 20;
+
+uint64_t convert_digits(const char *digits, std::size_t length) noexcept {
+  uint64_t value = 0;
+  for (std::size_t i = 0; i < length; ++i) {
+    value = value * 10 + static_cast<uint64_t>(digits[i] - '0');
+  }
+  return value;
+}
+
+struct Scalar {
+  static constexpr const char *name = "scalar";
+
+  static Masks masks(const char *block) noexcept {
+    Masks m{0, 0, 0};
+    for (unsigned i = 0; i < 64; ++i) {
+      const auto bit = uint64_t{1} << i;
+      const char c = block[i];
+      if (c >= '0' && c <= '9') {
+        m.digits |= bit;
+      } else if (c == ' ') {
+        m.spaces |= bit;
+      } else if (c == message_delimiter) {
+        m.delimiters |= bit;
+      }
+    }
+    return m;
+  }
+
+  // Convert field of 1 to max_safe_digits digits, offset bytes into the
+  // buffer.
+  static uint64_t convert(const char *digits, std::size_t length,
+                          std::size_t /* offset */) noexcept {
+    return convert_digits(digits, length);
+  }
+
+  // Convert some of the count fields from begins to ends of data into
+  // values at once, if they can be. Return their number.
+  static std::size_t convert_many(const char * /* data */,
+                                  const uint32_t * /* begins */,
+                                  const uint32_t * /* ends */,
+                                  std::size_t /* count */,
+                                  uint64_t * /* values */) noexcept {
+    return 0;
+  }
+};
+
+// Append the positions of the bits set in mask, counted from base, to out.
+// Return their number.
+inline std::size_t flatten(uint64_t mask, std::size_t base,
+                           uint32_t *out) noexcept {
+  const auto count = static_cast<std::size_t>(__builtin_popcountll(mask));
+  for (std::size_t i = 0; i < count; ++i) {
+    out[i] = static_cast<uint32_t>(base + __builtin_ctzll(mask));
+    mask &= mask - 1;
+  }
+  return count;
+}
+
+#ifdef RS_X86
+
+struct Sse {
+  static constexpr const char *name = "sse4.2";
+
+  // Bit of each byte of a compare result.
+  __attribute__((target("sse4.2"))) static uint64_t bits(__m128i mask) {
+    return static_cast<uint16_t>(_mm_movemask_epi8(mask));
+  }
+
+  __attribute__((target("sse4.2"))) static Masks
+  masks(const char *block) noexcept {
+    const auto below_zero = _mm_set1_epi8('0' - 1);
+    const auto above_nine = _mm_set1_epi8('9' + 1);
+    const auto space = _mm_set1_epi8(' ');
+    const auto delimiter = _mm_set1_epi8(message_delimiter);
+    Masks m{0, 0, 0};
+    for (unsigned i = 0; i < 64; i += 16) {
+      const auto bytes =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i));
+      // Signed compares, bytes above 0x7f are no digits.
+      const auto digits = _mm_and_si128(_mm_cmpgt_epi8(bytes, below_zero),
+                                        _mm_cmplt_epi8(bytes, above_nine));
+      m.digits |= bits(digits) << i;
+      m.spaces |= bits(_mm_cmpeq_epi8(bytes, space)) << i;
+      m.delimiters |= bits(_mm_cmpeq_epi8(bytes, delimiter)) << i;
+    }
+    return m;
+  }
+
+  // Convert field of 1 to max_safe_digits digits, offset bytes into the
+  // buffer. Reading back from the end of the field, unlike forward from its
+  // beginning, stays within the buffer but for its first few bytes.
+  __attribute__((target("sse4.2"))) static uint64_t
+  convert(const char *digits, std::size_t length,
+          std::size_t offset) noexcept {
+    if (offset + length < 16) {
+      return convert_digits(digits, length);
+    }
+    if (length > 16) {
+      return convert_digits(digits, length - 16) * 10'000'000'000'000'000 +
+             convert_last(digits + length, 16);
+    }
+    return convert_last(digits + length, length);
+  }
+
+  // Mask the last length of the 16 bytes before end into a vector and combine
+  // them pairwise, into 2, 4 and 8 digit numbers, and finally the two halves.
+  __attribute__((target("sse4.2"))) static uint64_t
+  convert_last(const char *end, std::size_t length) noexcept {
+    auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(end - 16));
+    const auto in_field = _mm_cmpgt_epi8(
+        _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+        _mm_set1_epi8(static_cast<char>(15 - length)));
+    bytes = _mm_and_si128(_mm_subs_epu8(bytes, _mm_set1_epi8('0')), in_field);
+    const auto pairs = _mm_maddubs_epi16(
+        bytes, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1,
+                             10, 1));
+    const auto quads = _mm_madd_epi16(
+        pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+    const auto octets = _mm_madd_epi16(
+        _mm_packus_epi32(quads, quads),
+        _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+    const auto high = static_cast<uint32_t>(_mm_cvtsi128_si32(octets));
+    const auto low = static_cast<uint32_t>(_mm_extract_epi32(octets, 1));
+    return uint64_t{high} * 100000000 + low;
+  }
+
+  // Two fields of up to 8 digits are converted at once, in a lane of 8
+  // bytes each.
+  __attribute__((target("sse4.2"))) static std::size_t
+  convert_many(const char *data, const uint32_t *begins, const uint32_t *ends,
+               std::size_t count, uint64_t *values) noexcept {
+    const auto first = ends[0] - begins[0];
+    if (count < 2 || ends[0] < 8 || first > 8 || ends[1] - begins[1] > 8) {
+      return 0;
+    }
+    const auto second = ends[1] - begins[1];
+    uint64_t words[2];
+    std::memcpy(&words[0], data + ends[0] - 8, sizeof(words[0]));
+    std::memcpy(&words[1], data + ends[1] - 8, sizeof(words[1]));
+    auto bytes = _mm_set_epi64x(static_cast<long long>(words[1]),
+                                static_cast<long long>(words[0]));
+    const auto in_field = _mm_cmpgt_epi8(
+        _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7),
+        _mm_unpacklo_epi64(_mm_set1_epi8(static_cast<char>(7 - first)),
+                           _mm_set1_epi8(static_cast<char>(7 - second))));
+    bytes = _mm_and_si128(_mm_subs_epu8(bytes, _mm_set1_epi8('0')), in_field);
+    const auto pairs = _mm_maddubs_epi16(bytes, _mm_set1_epi16(0x010a));
+    const auto quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00010064));
+    // The values of fields 0, 1, 0, 1.
+    const auto octets = _mm_madd_epi16(_mm_packus_epi32(quads, quads),
+                                       _mm_set1_epi32(0x00012710));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(values),
+                     _mm_cvtepu32_epi64(octets));
+    return 2;
+  }
+};
+
+struct Avx2 {
+  static constexpr const char *name = "avx2";
+
+  __attribute__((target("avx2"))) static uint64_t bits(__m256i mask) {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(mask));
+  }
+
+  __attribute__((target("avx2"))) static Masks
+  masks(const char *block) noexcept {
+    const auto below_zero = _mm256_set1_epi8('0' - 1);
+    const auto above_nine = _mm256_set1_epi8('9' + 1);
+    const auto space = _mm256_set1_epi8(' ');
+    const auto delimiter = _mm256_set1_epi8(message_delimiter);
+    Masks m{0, 0, 0};
+    for (unsigned i = 0; i < 64; i += 32) {
+      const auto bytes =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + i));
+      const auto digits =
+          _mm256_and_si256(_mm256_cmpgt_epi8(bytes, below_zero),
+                           _mm256_cmpgt_epi8(above_nine, bytes));
+      m.digits |= bits(digits) << i;
+      m.spaces |= bits(_mm256_cmpeq_epi8(bytes, space)) << i;
+      m.delimiters |= bits(_mm256_cmpeq_epi8(bytes, delimiter)) << i;
+    }
+    return m;
+  }
+
+  __attribute__((target("avx2"))) static uint64_t
+  convert(const char *digits, std::size_t length,
+          std::size_t offset) noexcept {
+    return Sse::convert(digits, length, offset);
+  }
+
+  // Four fields of up to 8 digits, or else two of up to 16, are converted
+  // at once, as with Sse::convert_last, in a lane of 8 or 16 bytes each.
+  __attribute__((target("avx2"))) static std::size_t
+  convert_many(const char *data, const uint32_t *begins, const uint32_t *ends,
+               std::size_t count, uint64_t *values) noexcept {
+    if (count >= 4 && ends[0] >= 8 && ends[0] - begins[0] <= 8 &&
+        ends[1] - begins[1] <= 8 && ends[2] - begins[2] <= 8 &&
+        ends[3] - begins[3] <= 8) {
+      convert_quad(data, begins, ends, values);
+      return 4;
+    }
+    if (count >= 2 && ends[0] >= 16 && ends[0] - begins[0] <= 16 &&
+        ends[1] - begins[1] <= 16) {
+      convert_pair(data, begins, ends, values);
+      return 2;
+    }
+    return 0;
+  }
+
+  __attribute__((target("avx2"))) static void
+  convert_quad(const char *data, const uint32_t *begins, const uint32_t *ends,
+               uint64_t *values) noexcept {
+    uint64_t words[4];
+    for (std::size_t i = 0; i < 4; ++i) {
+      std::memcpy(&words[i], data + ends[i] - 8, sizeof(words[i]));
+    }
+    auto bytes = _mm256_set_epi64x(static_cast<long long>(words[3]),
+                                   static_cast<long long>(words[2]),
+                                   static_cast<long long>(words[1]),
+                                   static_cast<long long>(words[0]));
+    // The first digit is the lowest byte, the bits below it are cleared.
+    const auto unused = _mm256_sub_epi64(
+        _mm256_set1_epi64x(64),
+        _mm256_slli_epi64(
+            _mm256_sub_epi64(
+                _mm256_set_epi64x(ends[3], ends[2], ends[1], ends[0]),
+                _mm256_set_epi64x(begins[3], begins[2], begins[1], begins[0])),
+            3));
+    bytes = _mm256_and_si256(
+        _mm256_subs_epu8(bytes, _mm256_set1_epi8('0')),
+        _mm256_sllv_epi64(_mm256_set1_epi64x(-1), unused));
+    const auto pairs = _mm256_maddubs_epi16(bytes, _mm256_set1_epi16(0x010a));
+    const auto quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00010064));
+    // The values of fields 0, 1, 0, 1 and 2, 3, 2, 3.
+    const auto octets = _mm256_madd_epi16(_mm256_packus_epi32(quads, quads),
+                                          _mm256_set1_epi32(0x00012710));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(values),
+        _mm256_cvtepu32_epi64(_mm256_castsi256_si128(
+            _mm256_permute4x64_epi64(octets, 0b1000))));
+  }
+
+  __attribute__((target("avx2"))) static void
+  convert_pair(const char *data, const uint32_t *begins, const uint32_t *ends,
+               uint64_t *values) noexcept {
+    const auto first = ends[0] - begins[0];
+    const auto second = ends[1] - begins[1];
+    auto bytes = _mm256_loadu2_m128i(
+        reinterpret_cast<const __m128i *>(data + ends[1] - 16),
+        reinterpret_cast<const __m128i *>(data + ends[0] - 16));
+    const auto in_field = _mm256_cmpgt_epi8(
+        _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                         0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+        _mm256_set_m128i(_mm_set1_epi8(static_cast<char>(15 - second)),
+                         _mm_set1_epi8(static_cast<char>(15 - first))));
+    bytes = _mm256_and_si256(_mm256_subs_epu8(bytes, _mm256_set1_epi8('0')),
+                             in_field);
+    const auto pairs = _mm256_maddubs_epi16(bytes, _mm256_set1_epi16(0x010a));
+    const auto quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00010064));
+    // Each lane holds the high and low 8 digits of its field, twice.
+    const auto octets = _mm256_madd_epi16(_mm256_packus_epi32(quads, quads),
+                                          _mm256_set1_epi32(0x00012710));
+    const auto combined = _mm256_add_epi64(
+        _mm256_mul_epu32(octets, _mm256_set1_epi64x(100000000)),
+        _mm256_srli_epi64(octets, 32));
+    values[0] = static_cast<uint64_t>(_mm256_extract_epi64(combined, 0));
+    values[1] = static_cast<uint64_t>(_mm256_extract_epi64(combined, 2));
+  }
+};
+
+#endif
+
+} // namespace
+
+// First indexes where fields begin and end and where messages end, from
+// the transitions between digits and other bytes of each 64 byte block. Then
+// converts the fields of each message. Inlined into decode_with, so that the
+// instructions of Isa are inlined as well.
+template <typename Isa>
+__attribute__((always_inline)) inline std::size_t
+FieldBatch::scan(std::string_view bytes) {
+  data_ = bytes;
+  size_ = 0;
+  // At most max_fields fields, each a digit and a separator.
+  const auto window = bytes.substr(0, 2 * max_fields);
+  const auto last_delimiter = window.rfind(message_delimiter);
+  if (last_delimiter == window.npos) {
+    // Longer than the window, left to the text decoder.
+    const auto delimiter = bytes.find(message_delimiter);
+    if (delimiter == bytes.npos) {
+      return 0;
+    }
+    begins_[0] = 0;
+    ends_[0] = static_cast<uint32_t>(delimiter + 1);
+    first_fields_[0] = 0;
+    field_counts_[0] = 0;
+    decoded_[0] = false;
+    return size_ = 1;
+  }
+  std::size_t length = last_delimiter + 1;
+  const char *data = bytes.data();
+
+  std::size_t begun = 0;
+  std::size_t ended = 0;
+  std::size_t messages = 0;
+  uint64_t in_field = 0;
+  char tail[64];
+  std::fill(decoded_.begin(), decoded_.end(), 1);
+  for (std::size_t base = 0; base < length; base += 64) {
+    const char *block = data + base;
+    uint64_t in_range = ~uint64_t{0};
+    if (length - base < 64) {
+      in_range = (uint64_t{1} << (length - base)) - 1;
+      if (bytes.size() - base < 64) {
+        std::memset(tail, 0, sizeof(tail));
+        std::memcpy(tail, block, bytes.size() - base);
+        block = tail;
+      }
+    }
+    const auto m = Isa::masks(block);
+    const auto preceded = (m.digits << 1) | in_field;
+    in_field = m.digits >> 63;
+    const auto delimiters = m.delimiters & in_range;
+    if (auto others = ~(m.digits | m.spaces | m.delimiters) & in_range) {
+      // Not decimal, the message is left to the text decoder.
+      do {
+        const auto bit = __builtin_ctzll(others);
+        const auto message = messages + __builtin_popcountll(
+                                            delimiters &
+                                            ((uint64_t{1} << bit) - 1));
+        if (message < max_messages) {
+          decoded_[message] = false;
+        }
+        others &= others - 1;
+      } while (others != 0);
+    }
+    const auto field_begins = m.digits & ~preceded & in_range;
+    for (auto rest = delimiters; rest != 0; rest &= rest - 1) {
+      const auto bit = __builtin_ctzll(rest);
+      message_ends_[messages] = static_cast<uint32_t>(base + bit);
+      message_fields_[messages] = static_cast<uint32_t>(
+          begun +
+          __builtin_popcountll(field_begins & ((uint64_t{1} << bit) - 1)));
+      ++messages;
+    }
+    begun += flatten(field_begins, base, field_begins_.data() + begun);
+    ended += flatten(~m.digits & preceded & in_range, base,
+                     field_ends_.data() + ended);
+    if (messages >= max_messages) {
+      messages = max_messages;
+      length = message_ends_[messages - 1] + 1;
+      break;
+    }
+  }
+
+  // Fields beyond the last message may not have ended.
+  const std::size_t fields = message_fields_[messages - 1];
+  invalid_fields_.clear();
+  for (std::size_t field = 0; field < fields; ++field) {
+    if (const auto converted = Isa::convert_many(
+            data, field_begins_.data() + field, field_ends_.data() + field,
+            fields - field, values_.data() + field)) {
+      field += converted - 1;
+      continue;
+    }
+    const auto begin = field_begins_[field];
+    const auto digits = field_ends_[field] - begin;
+    if (digits <= max_safe_digits) {
+      values_[field] = Isa::convert(data + begin, digits, begin);
+    } else if (digits > max_digits ||
+               std::from_chars(data + begin, data + begin + digits,
+                               values_[field])
+                       .ec != std::errc{}) {
+      // Beyond 64 bits, left to the text decoder.
+      invalid_fields_.push_back(static_cast<uint32_t>(field));
+    }
+  }
+
+  std::size_t invalid = 0;
+  for (std::size_t message = 0; message < messages; ++message) {
+    const auto end = message_ends_[message];
+    const auto first_field = message == 0 ? 0 : message_fields_[message - 1];
+    const auto field = message_fields_[message];
+    bool valid = decoded_[message];
+    for (; invalid < invalid_fields_.size() && invalid_fields_[invalid] < field;
+         ++invalid) {
+      valid = false;
+    }
+    begins_[message] = message == 0 ? 0 : message_ends_[message - 1] + 1;
+    ends_[message] = end + 1;
+    first_fields_[message] = first_field;
+    field_counts_[message] = valid ? field - first_field : 0;
+    decoded_[message] = valid;
+  }
+  return size_ = messages;
+}
+
+template <>
+std::size_t FieldBatch::decode_with<Scalar>(std::string_view bytes) {
+  return scan<Scalar>(bytes);
+}
+
+#ifdef RS_X86
+template <>
+__attribute__((target("sse4.2"))) std::size_t
+FieldBatch::decode_with<Sse>(std::string_view bytes) {
+  return scan<Sse>(bytes);
+}
+
+template <>
+__attribute__((target("avx2"))) std::size_t
+FieldBatch::decode_with<Avx2>(std::string_view bytes) {
+  return scan<Avx2>(bytes);
+}
+#endif
+
+namespace {
+
+enum class IsaChoice { SCALAR, SSE, AVX2 };
+
+IsaChoice choose_isa() noexcept {
+#ifdef RS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return IsaChoice::AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    return IsaChoice::SSE;
+  }
+#endif
+  return IsaChoice::SCALAR;
+}
+
+const IsaChoice isa = choose_isa();
+
+} // namespace
+
+std::size_t FieldBatch::decode(std::string_view bytes) {
+  switch (isa) {
+#ifdef RS_X86
+  case IsaChoice::AVX2:
+    return decode_with<Avx2>(bytes);
+  case IsaChoice::SSE:
+    return decode_with<Sse>(bytes);
+#endif
+  default:
+    return decode_with<Scalar>(bytes);
+  }
+}
+
+const char *FieldBatch::instruction_set() noexcept {
+  switch (isa) {
+#ifdef RS_X86
+  case IsaChoice::AVX2:
+    return Avx2::name;
+  case IsaChoice::SSE:
+    return Sse::name;
+#endif
+  default:
+    return Scalar::name;
+  }
+}
+
+} // namespace rs::protocol
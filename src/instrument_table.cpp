@@ -0,0 +1,130 @@
+#include "instrument_table.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RS_X86
+#endif
+
+#include <algorithm>
+
+namespace rs {
+
+namespace {
+
+// Arrays of all instruments, read by passes over all of them.
+struct Columns {
+  const InstrumentState::NetPos *net_pos;
+  const Quantity *buy_qty;
+  const Quantity *sell_qty;
+  const Quantity *max_buy_pos;
+  const Quantity *max_sell_pos;
+};
+
+__attribute__((always_inline)) inline std::size_t
+count_over(const Columns &c, std::size_t first, std::size_t last) noexcept {
+  std::size_t over = 0;
+  for (auto i = first; i < last; ++i) {
+    Quantity worst_buy = worst_pos(c.net_pos[i], c.buy_qty[i], BUY);
+    Quantity worst_sell = worst_pos(c.net_pos[i], c.sell_qty[i], SELL);
+    over += (worst_buy > c.max_buy_pos[i]) | (worst_sell > c.max_sell_pos[i]);
+  }
+  return over;
+}
+
+// Count in blocks of a fixed length, which the compiler vectorizes without
+// a runtime check of the trip count, then the rest one by one. Inlined into
+// the callers compiled for each instruction set. Comparing 64 bit integers
+// takes SSE4.2.
+__attribute__((always_inline)) inline std::size_t
+count_over_blocks(const Columns &c, std::size_t n) noexcept {
+  constexpr std::size_t block = 8;
+  std::size_t over = 0;
+  std::size_t i = 0;
+  for (; i + block <= n; i += block) {
+    over += count_over(c, i, i + block);
+  }
+  return over + count_over(c, i, n);
+}
+
+#ifdef RS_X86
+__attribute__((target("avx2"))) std::size_t
+count_over_avx2(const Columns &c, std::size_t n) noexcept {
+  return count_over_blocks(c, n);
+}
+
+__attribute__((target("sse4.2"))) std::size_t
+count_over_sse(const Columns &c, std::size_t n) noexcept {
+  return count_over_blocks(c, n);
+}
+
+std::size_t (*choose_count_over())(const Columns &, std::size_t) noexcept {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return count_over_avx2;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    return count_over_sse;
+  }
+  return count_over_blocks;
+}
+#else
+std::size_t (*choose_count_over())(const Columns &, std::size_t) noexcept {
+  return count_over_blocks;
+}
+#endif
+
+const auto count_over_all = choose_count_over();
+
+} // namespace
+
+InstrumentTable::Index InstrumentTable::add(ListingID id, const Limits &limits,
+                                            OrderRate rate) {
+  auto i = static_cast<Index>(ids_.size());
+  indices_.emplace(id, i);
+  ids_.push_back(id);
+  net_pos_.push_back(0);
+  for (auto side : {BUY, SELL}) {
+    open_qty_[side].push_back(0);
+    max_pos_[side].push_back(limits.max_pos[side]);
+  }
+  throttles_.emplace_back(rate);
+  return i;
+}
+
+void InstrumentTable::reserve(std::size_t listings) {
+  indices_.reserve(listings);
+  ids_.reserve(listings);
+  net_pos_.reserve(listings);
+  for (auto side : {BUY, SELL}) {
+    open_qty_[side].reserve(listings);
+    max_pos_[side].reserve(listings);
+  }
+  throttles_.reserve(listings);
+}
+
+void InstrumentTable::set_limits(Index i, const Limits &limits) noexcept {
+  for (auto side : {BUY, SELL}) {
+    max_pos_[side][i] = limits.max_pos[side];
+  }
+}
+
+void InstrumentTable::set_limits(const Limits &limits) noexcept {
+  for (auto side : {BUY, SELL}) {
+    std::fill(max_pos_[side].begin(), max_pos_[side].end(),
+              limits.max_pos[side]);
+  }
+}
+
+void InstrumentTable::set_order_rate(OrderRate rate) noexcept {
+  for (auto &throttle : throttles_) {
+    throttle.set_rate(rate);
+  }
+}
+
+std::size_t InstrumentTable::count_over_limits() const noexcept {
+  return count_over_all({net_pos_.data(), open_qty_[BUY].data(),
+                         open_qty_[SELL].data(), max_pos_[BUY].data(),
+                         max_pos_[SELL].data()},
+                        size());
+}
+
+} // namespace rs
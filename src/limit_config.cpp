@@ -0,0 +1,283 @@
+#include "limit_config.h"
+#include "format.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace rs {
+
+namespace {
+
+// Parse an unsigned number. Streams read "-5" as 5 wrapped around below 0,
+// so a sign is invalid.
+template <typename Number>
+bool parse_number(const std::string &word, Number &number) {
+  std::istringstream input(word);
+  return word.front() != '-' && static_cast<bool>(input >> number) &&
+         input.eof();
+}
+
+template <typename Number>
+bool read_number(std::istream &line, Number &number) {
+  std::string word;
+  return static_cast<bool>(line >> word) && parse_number(word, number);
+}
+
+// Read an id, or "default" if is_default is given.
+bool read_id(std::istream &line, uint64_t &id, bool *is_default = nullptr) {
+  std::string word;
+  if (!(line >> word)) {
+    return false;
+  }
+  if (is_default && word == "default") {
+    *is_default = true;
+    return true;
+  }
+  return parse_number(word, id);
+}
+
+bool read_limits(std::istream &line, Limits &limits) {
+  return read_number(line, limits.max_pos[BUY]) &&
+         read_number(line, limits.max_pos[SELL]);
+}
+
+// Append the ids whose values differ between from and to, or that only one of
+// them has.
+template <typename Map>
+void add_changed(const Map &from, const Map &to,
+                 std::vector<typename Map::key_type> &changed) {
+  for (const auto &[id, value] : to) {
+    auto from_it = from.find(id);
+    if (from_it == from.end() || !(from_it->second == value)) {
+      changed.push_back(id);
+    }
+  }
+  for (const auto &[id, value] : from) {
+    if (to.count(id) == 0) {
+      changed.push_back(id);
+    }
+  }
+}
+
+template <typename ID>
+void append(std::vector<ID> &to, const std::vector<ID> &from) {
+  to.insert(to.end(), from.begin(), from.end());
+}
+
+} // namespace
+
+LimitConfig LimitConfig::parse(std::istream &input, LimitConfig config) {
+  std::string text;
+  for (std::size_t line_number = 1; std::getline(input, text); ++line_number) {
+    if (auto comment = text.find('#'); comment != text.npos) {
+      text.erase(comment);
+    }
+    std::istringstream line(text);
+    std::string scope;
+    if (!(line >> scope)) {
+      // Empty line.
+      continue;
+    }
+
+    uint64_t id = 0;
+    bool is_default = false;
+    Limits limits;
+    bool valid = false;
+    if (scope == "firm") {
+      valid = read_limits(line, config.firm);
+    } else if (scope == "account") {
+      valid = read_id(line, id, &is_default) && read_limits(line, limits);
+      (is_default ? config.default_account : config.accounts[id]) = limits;
+    } else if (scope == "instrument") {
+      valid = read_id(line, id, &is_default) && read_limits(line, limits);
+      (is_default ? config.default_instrument : config.instruments[id]) =
+          limits;
+    } else if (scope == "session") {
+      Session session;
+      valid = read_id(line, id) && read_id(line, session.account) &&
+              read_limits(line, session.limits);
+      config.sessions[id] = session;
+    } else if (scope == "rate" && line >> scope) {
+      OrderRate rate = unlimited_rate;
+      valid = read_id(line, id, &is_default) && read_number(line, rate);
+      if (scope == "instrument") {
+        (is_default ? config.default_instrument_rate
+                    : config.instrument_rates[id]) = rate;
+      } else if (scope == "session") {
+        (is_default ? config.default_session_rate : config.session_rates[id]) =
+            rate;
+      } else {
+        valid = false;
+      }
+    }
+
+    std::string rest;
+    if (!valid || line >> rest) {
+      throw std::runtime_error(rs::format(
+          RS_FMT("Invalid limit config on line {}: {}"), line_number, text));
+    }
+  }
+  return config;
+}
+
+LimitChanges LimitChanges::between(const LimitConfig &from,
+                                   const LimitConfig &to) {
+  LimitChanges changes;
+  changes.firm = from.firm != to.firm;
+  changes.default_account = from.default_account != to.default_account;
+  changes.default_instrument =
+      from.default_instrument != to.default_instrument;
+  changes.default_instrument_rate =
+      from.default_instrument_rate != to.default_instrument_rate;
+  changes.default_session_rate =
+      from.default_session_rate != to.default_session_rate;
+  add_changed(from.accounts, to.accounts, changes.accounts);
+  add_changed(from.sessions, to.sessions, changes.sessions);
+  add_changed(from.instruments, to.instruments, changes.instruments);
+  add_changed(from.instrument_rates, to.instrument_rates,
+              changes.instrument_rates);
+  add_changed(from.session_rates, to.session_rates, changes.session_rates);
+  return changes;
+}
+
+void LimitChanges::add(const LimitChanges &later) {
+  firm |= later.firm;
+  default_account |= later.default_account;
+  default_instrument |= later.default_instrument;
+  default_instrument_rate |= later.default_instrument_rate;
+  default_session_rate |= later.default_session_rate;
+  append(accounts, later.accounts);
+  append(sessions, later.sessions);
+  append(instruments, later.instruments);
+  append(instrument_rates, later.instrument_rates);
+  append(session_rates, later.session_rates);
+}
+
+std::vector<protocol::LimitUpdate>
+LimitChanges::updates(const LimitConfig &config) const {
+  using protocol::LimitUpdate;
+  std::vector<LimitUpdate> updates;
+  auto add = [&updates](uint16_t scope, uint16_t flags, uint64_t id,
+                        uint64_t account, uint64_t max_buy,
+                        uint64_t max_sell) {
+    updates.push_back(LimitUpdate{LimitUpdate::MESSAGE_TYPE, scope, flags, id,
+                                  account, max_buy, max_sell});
+  };
+  auto add_limits = [&add](uint16_t scope, uint16_t flags, uint64_t id,
+                           const Limits &limits, AccountID account = 0) {
+    add(scope, flags, id, account, limits.max_pos[BUY], limits.max_pos[SELL]);
+  };
+  if (firm) {
+    add_limits(LimitUpdate::FIRM, LimitUpdate::NONE, 0, config.firm);
+  }
+  if (default_account) {
+    add_limits(LimitUpdate::ACCOUNT, LimitUpdate::DEFAULT, 0,
+               config.default_account);
+  }
+  if (default_instrument) {
+    add_limits(LimitUpdate::INSTRUMENT, LimitUpdate::DEFAULT, 0,
+               config.default_instrument);
+  }
+  if (default_instrument_rate) {
+    add(LimitUpdate::INSTRUMENT_RATE, LimitUpdate::DEFAULT, 0, 0,
+        config.default_instrument_rate, 0);
+  }
+  if (default_session_rate) {
+    add(LimitUpdate::SESSION_RATE, LimitUpdate::DEFAULT, 0, 0,
+        config.default_session_rate, 0);
+  }
+  for (auto id : accounts) {
+    add_limits(LimitUpdate::ACCOUNT, LimitUpdate::NONE, id,
+               config.account_limits(id));
+  }
+  for (auto id : sessions) {
+    if (auto session_it = config.sessions.find(id);
+        session_it != config.sessions.end()) {
+      add_limits(LimitUpdate::SESSION, LimitUpdate::NONE, id,
+                 session_it->second.limits, session_it->second.account);
+    }
+  }
+  for (auto id : instruments) {
+    add_limits(LimitUpdate::INSTRUMENT, LimitUpdate::NONE, id,
+               config.instrument_limits(id));
+  }
+  for (auto id : instrument_rates) {
+    add(LimitUpdate::INSTRUMENT_RATE, LimitUpdate::NONE, id, 0,
+        config.instrument_rate(id), 0);
+  }
+  for (auto id : session_rates) {
+    add(LimitUpdate::SESSION_RATE, LimitUpdate::NONE, id, 0,
+        config.session_rate(id), 0);
+  }
+  return updates;
+}
+
+LimitChanges LimitConfig::apply(const protocol::LimitUpdate &update) {
+  using protocol::LimitUpdate;
+  const bool is_default = update.flags & LimitUpdate::DEFAULT;
+  const Limits limits{{update.maxBuy, update.maxSell}};
+  const auto rate = static_cast<OrderRate>(update.maxBuy);
+  LimitChanges changes;
+  switch (update.scope) {
+  case LimitUpdate::FIRM: {
+    firm = limits;
+    changes.firm = true;
+  } break;
+  case LimitUpdate::ACCOUNT: {
+    if (is_default) {
+      default_account = limits;
+      changes.default_account = true;
+    } else {
+      accounts[update.id] = limits;
+      changes.accounts.push_back(update.id);
+    }
+  } break;
+  case LimitUpdate::SESSION: {
+    sessions[update.id] = Session{update.account, limits};
+    changes.sessions.push_back(update.id);
+  } break;
+  case LimitUpdate::INSTRUMENT: {
+    if (is_default) {
+      default_instrument = limits;
+      changes.default_instrument = true;
+    } else {
+      instruments[update.id] = limits;
+      changes.instruments.push_back(update.id);
+    }
+  } break;
+  case LimitUpdate::INSTRUMENT_RATE: {
+    if (is_default) {
+      default_instrument_rate = rate;
+      changes.default_instrument_rate = true;
+    } else {
+      instrument_rates[update.id] = rate;
+      changes.instrument_rates.push_back(update.id);
+    }
+  } break;
+  case LimitUpdate::SESSION_RATE: {
+    if (is_default) {
+      default_session_rate = rate;
+      changes.default_session_rate = true;
+    } else {
+      session_rates[update.id] = rate;
+      changes.session_rates.push_back(update.id);
+    }
+  } break;
+  default:
+    throw std::runtime_error(
+        rs::format(RS_FMT("Invalid limit scope {}"), update.scope));
+  }
+  return changes;
+}
+
+LimitConfig LimitConfig::load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Unable to open limit config {}"), path));
+  }
+  return parse(file);
+}
+
+} // namespace rs
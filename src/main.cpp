@@ -1,22 +1,217 @@
 #include "format.h"
 #include "risk_service.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
 
 int main(const int argc, const char *argv[]) {
-  if (argc != 5) {
-    std::cerr << rs::format("error: wrong number of args {} out of {}",
-                            argc - 1, 4)
+  if (argc < 4) {
+    std::cerr << rs::format(RS_FMT("error: wrong number of args {} out of {}"),
+                            argc - 1, 3)
               << '\n';
-    std::cerr << "usage: risk_service ip_address tcp_port max_buy_position "
-                 "max_sell_position\n";
+    std::cerr
+        << "usage: risk_service ip_address tcp_port limits_file [options]\n"
+           "options:\n"
+           "  --trade-feed udp_address udp_port   read trades from UDP feed\n"
+           "  --replicate-to address port         replicate to backup, may be "
+           "repeated\n"
+           "  --sync-replication                  wait for backups before "
+           "responding\n"
+           "  --backup address port               run as backup until the "
+           "primary is gone\n"
+           "  --promote-after ms                  promote backup after ms "
+           "without events\n"
+           "                                      or heartbeats, default "
+           "1000\n"
+           "  --admin address port                accept limit updates from "
+           "admins\n"
+           "  --reserve orders listings           size tables up front\n"
+           "  --warmup orders                     run synthetic orders before "
+           "serving\n"
+           "  --mlock                             lock memory pages\n"
+           "  --huge-pages                        put position table on huge "
+           "pages\n"
+           "  --positions-shm name                publish positions to shared "
+           "memory\n"
+           "  --order-ttl seconds                 expire orders after their "
+           "creation\n"
+           "  --session-end HH:MM                 expire orders at the end of "
+           "their\n"
+           "                                      session, UTC\n"
+           "  --capture path                      record messages for "
+           "backtesting\n"
+           "  --profile period                    time one in period stages, "
+           "dumped on\n"
+           "                                      SIGUSR2\n"
+           "  --network-threads n                 accept and serve clients on "
+           "n threads\n"
+           "  --runtime-profile path              pin threads, set wait "
+           "strategy and\n"
+           "                                      socket options, see "
+           "runtime.conf\n"
+           "  --slow-consumer drop|throttle|alert what to do with clients not "
+           "reading\n"
+           "                                      their responses, default "
+           "throttle\n"
+#ifdef RS_COROUTINES
+           "  --async                             serve each client from a "
+           "coroutine\n"
+#endif
+      ;
     exit(2);
   }
 
   const std::string address{argv[1]};
   const std::string port{argv[2]};
-  const long long max_buy_pos{std::stoll(argv[3])};
-  const long long max_sell_pos{std::stoll(argv[4])};
+  auto limits = rs::LimitConfig::load(argv[3]);
 
-  rs::RiskService service(address, port, max_buy_pos, max_sell_pos);
+  // Known before the service binds its listening sockets.
+  std::size_t network_threads = 1;
+  for (int i = 4; i + 1 < argc; ++i) {
+    if (std::string{argv[i]} == "--network-threads") {
+      network_threads = std::max(std::stoull(argv[i + 1]), 1ull);
+    }
+  }
+
+  rs::RiskService service(address, port, std::move(limits), network_threads);
+
+  std::vector<rs::replication::Primary::Address> backups;
+  bool sync_replication = false;
+  std::optional<std::string> positions_shm;
+  std::optional<rs::runtime::Profile> runtime_profile;
+  rs::startup::Options startup;
+  bool prepare = false;
+  std::optional<rs::replication::Primary::Address> backup_of;
+  auto promotion_timeout = rs::replication::default_promotion_timeout;
+  rs::OrderExpiry expiry;
+#ifdef RS_COROUTINES
+  bool serve_async = false;
+#endif
+
+  for (int i = 4; i < argc; ++i) {
+    const std::string option{argv[i]};
+    const bool has_address = i + 2 < argc;
+    if (option == "--trade-feed" && has_address) {
+      service.listen_trade_feed(argv[i + 1], argv[i + 2]);
+      i += 2;
+    } else if (option == "--replicate-to" && has_address) {
+      backups.emplace_back(argv[i + 1], argv[i + 2]);
+      i += 2;
+    } else if (option == "--admin" && has_address) {
+      service.listen_admin(argv[i + 1], argv[i + 2]);
+      i += 2;
+    } else if (option == "--sync-replication") {
+      sync_replication = true;
+    } else if (option == "--positions-shm" && i + 1 < argc) {
+      positions_shm.emplace(argv[i + 1]);
+      i += 1;
+    } else if (option == "--reserve" && i + 2 < argc) {
+      startup.orders = std::stoull(argv[i + 1]);
+      startup.listings = std::stoull(argv[i + 2]);
+      prepare = true;
+      i += 2;
+    } else if (option == "--warmup" && i + 1 < argc) {
+      startup.warmup_orders = std::stoull(argv[i + 1]);
+      prepare = true;
+      i += 1;
+    } else if (option == "--mlock") {
+      startup.lock_memory = true;
+      prepare = true;
+    } else if (option == "--huge-pages") {
+      startup.huge_pages = true;
+      prepare = true;
+    } else if (option == "--order-ttl" && i + 1 < argc) {
+      expiry.ttl = std::stoull(argv[i + 1]);
+      i += 1;
+    } else if (option == "--session-end" && i + 1 < argc) {
+      const std::string time{argv[i + 1]};
+      expiry.session_end = rs::OrderExpiry::parse_time_of_day(time);
+      if (!expiry.session_end) {
+        std::cerr << rs::format(RS_FMT("error: invalid time '{}'"), time)
+                  << '\n';
+        exit(2);
+      }
+      i += 1;
+    } else if (option == "--capture" && i + 1 < argc) {
+      service.capture_to(argv[i + 1]);
+      i += 1;
+    } else if (option == "--profile" && i + 1 < argc) {
+      rs::trace::Profiler::start(std::stoul(argv[i + 1]));
+      rs::trace::Profiler::dump_on_signal(SIGUSR2);
+      i += 1;
+    } else if (option == "--network-threads" && i + 1 < argc) {
+      i += 1;
+    } else if (option == "--runtime-profile" && i + 1 < argc) {
+      runtime_profile = rs::runtime::Profile::load(argv[i + 1]);
+      i += 1;
+    } else if (option == "--slow-consumer" && i + 1 < argc) {
+      const std::string policy{argv[i + 1]};
+      if (policy == "drop") {
+        service.set_slow_consumer_policy(rs::SlowConsumerPolicy::DROP);
+      } else if (policy == "throttle") {
+        service.set_slow_consumer_policy(rs::SlowConsumerPolicy::THROTTLE);
+      } else if (policy == "alert") {
+        service.set_slow_consumer_policy(rs::SlowConsumerPolicy::ALERT);
+      } else {
+        std::cerr << rs::format(RS_FMT("error: invalid policy '{}'"), policy)
+                  << '\n';
+        exit(2);
+      }
+      i += 1;
+#ifdef RS_COROUTINES
+    } else if (option == "--async") {
+      serve_async = true;
+#endif
+    } else if (option == "--backup" && has_address) {
+      backup_of.emplace(argv[i + 1], argv[i + 2]);
+      i += 2;
+    } else if (option == "--promote-after" && i + 1 < argc) {
+      promotion_timeout = std::chrono::milliseconds{std::stoul(argv[i + 1])};
+      i += 1;
+    } else {
+      std::cerr << rs::format(RS_FMT("error: invalid option '{}'"), option)
+                << '\n';
+      exit(2);
+    }
+  }
+
+  service.set_order_expiry(expiry);
+
+  // Applied first, so that tables are prepared on the serving CPU.
+  if (runtime_profile) {
+    service.apply_runtime_profile(*runtime_profile);
+  }
+
+  // Tables are prepared before positions are published from them.
+  if (prepare) {
+    service.prepare(startup);
+  }
+  if (positions_shm) {
+    service.publish_positions(*positions_shm);
+  }
+
+  if (backup_of) {
+    service.wait_as_backup(backup_of->first, backup_of->second,
+                           promotion_timeout);
+  }
+  if (!backups.empty()) {
+    service.replicate_to(backups, sync_replication);
+  }
+
+#ifdef RS_COROUTINES
+  if (serve_async) {
+    if (network_threads > 1) {
+      std::cerr << "error: --async serves clients on one thread\n";
+      exit(2);
+    }
+    service.wait_async();
+    return 0;
+  }
+#endif
   service.wait();
 }
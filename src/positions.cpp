@@ -0,0 +1,262 @@
+#include "positions.h"
+#include "format.h"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace rs {
+
+// Identifies mapped memory that contains an initialized table.
+constexpr uint64_t table_magic = 0x5253504f53495431; // "RSPOSIT1"
+
+// At least two slots, so that hashing never shifts by 64 bits.
+[[nodiscard]] static std::size_t round_up_to_power_of_two(std::size_t n) {
+  std::size_t p = 2;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+[[nodiscard]] static void *map_memory(int fd, std::size_t length, int prot) {
+  auto flags = fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED;
+  void *memory = mmap(nullptr, length, prot, flags, fd, 0);
+  if (memory == MAP_FAILED) {
+    throw std::runtime_error(rs::format(
+        RS_FMT("Failed mapping position table: {}"), std::strerror(errno)));
+  }
+  return memory;
+}
+
+// Default huge page size of the system, or 0 if unknown.
+[[nodiscard]] static std::size_t huge_page_length() {
+  std::ifstream meminfo("/proc/meminfo");
+  std::string key;
+  while (meminfo >> key) {
+    if (key == "Hugepagesize:") {
+      std::size_t kilobytes = 0;
+      meminfo >> kilobytes;
+      return kilobytes * 1024;
+    }
+    meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+  }
+  return 0;
+}
+
+// Map anonymous memory on reserved huge pages, rounding length up to whole
+// pages. Return nullptr if no huge pages are available.
+[[nodiscard]] static void *map_huge_pages(std::size_t &length) {
+#ifdef MAP_HUGETLB
+  auto page_length = huge_page_length();
+  if (page_length == 0) {
+    return nullptr;
+  }
+  auto rounded = (length + page_length - 1) / page_length * page_length;
+  void *memory = mmap(nullptr, rounded, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  length = rounded;
+  return memory;
+#else
+  return nullptr;
+#endif
+}
+
+// Ask for transparent huge pages, used for the parts of the memory that span
+// whole aligned huge pages. Must be called before the memory is touched.
+static void advise_huge_pages(void *memory, std::size_t length) noexcept {
+#ifdef MADV_HUGEPAGE
+  madvise(memory, length, MADV_HUGEPAGE);
+#endif
+}
+
+PositionTable::PositionTable(void *memory, std::size_t length, std::string name)
+    : header_(static_cast<Header *>(memory)),
+      slots_(reinterpret_cast<Slot *>(static_cast<char *>(memory) +
+                                      sizeof(Header))),
+      mapped_length_(length), shared_name_(std::move(name)) {}
+
+PositionTable::PositionTable(std::size_t capacity, bool huge_pages) {
+  capacity = round_up_to_power_of_two(capacity);
+  auto length = mapped_length(capacity);
+  void *memory = huge_pages ? map_huge_pages(length) : nullptr;
+  if (memory == nullptr) {
+    memory = map_memory(-1, length, PROT_READ | PROT_WRITE);
+    if (huge_pages) {
+      advise_huge_pages(memory, length);
+    }
+  }
+  *this = PositionTable{memory, length, ""};
+  initialize(capacity);
+}
+
+PositionTable PositionTable::create_shared(const std::string &name,
+                                           std::size_t capacity,
+                                           bool huge_pages) {
+  capacity = round_up_to_power_of_two(capacity);
+  auto length = mapped_length(capacity);
+  int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Failed opening shared memory {}: {}"), name,
+                   std::strerror(errno)));
+  }
+  if (ftruncate(fd, length) < 0) {
+    close(fd);
+    throw std::runtime_error(
+        rs::format(RS_FMT("Failed resizing shared memory {}: {}"), name,
+                   std::strerror(errno)));
+  }
+  void *memory = nullptr;
+  try {
+    memory = map_memory(fd, length, PROT_READ | PROT_WRITE);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+  if (huge_pages) {
+    advise_huge_pages(memory, length);
+  }
+  PositionTable table{memory, length, name};
+  table.initialize(capacity);
+  return table;
+}
+
+PositionTable PositionTable::attach(const std::string &name) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Failed opening shared memory {}: {}"), name,
+                   std::strerror(errno)));
+  }
+  struct stat info;
+  if (fstat(fd, &info) < 0 ||
+      static_cast<std::size_t>(info.st_size) < sizeof(Header)) {
+    close(fd);
+    throw std::runtime_error(
+        rs::format(RS_FMT("Shared memory {} has no position table"), name));
+  }
+  void *memory = nullptr;
+  try {
+    memory = map_memory(fd, info.st_size, PROT_READ);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+  PositionTable table{memory, static_cast<std::size_t>(info.st_size), ""};
+  if (table.header_->magic != table_magic ||
+      mapped_length(table.header_->capacity) > table.mapped_length_) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Shared memory {} has no position table"), name));
+  }
+  return table;
+}
+
+PositionTable::~PositionTable() noexcept { unmap(); }
+
+PositionTable::PositionTable(PositionTable &&other) noexcept
+    : header_(std::exchange(other.header_, nullptr)),
+      slots_(std::exchange(other.slots_, nullptr)),
+      mapped_length_(std::exchange(other.mapped_length_, 0)),
+      shared_name_(std::move(other.shared_name_)) {
+  other.shared_name_.clear();
+}
+
+PositionTable &PositionTable::operator=(PositionTable &&other) noexcept {
+  if (this != &other) {
+    unmap();
+    header_ = std::exchange(other.header_, nullptr);
+    slots_ = std::exchange(other.slots_, nullptr);
+    mapped_length_ = std::exchange(other.mapped_length_, 0);
+    shared_name_ = std::move(other.shared_name_);
+    other.shared_name_.clear();
+  }
+  return *this;
+}
+
+void PositionTable::unmap() noexcept {
+  if (header_ != nullptr) {
+    munmap(header_, mapped_length_);
+    header_ = nullptr;
+    slots_ = nullptr;
+  }
+  if (!shared_name_.empty()) {
+    shm_unlink(shared_name_.c_str());
+    shared_name_.clear();
+  }
+}
+
+void PositionTable::initialize(std::size_t capacity) noexcept {
+  for (std::size_t i = 0; i < capacity; ++i) {
+    new (&slots_[i]) Slot{};
+  }
+  header_->capacity = capacity;
+  // Readers in other processes check the magic before trusting the capacity.
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic = table_magic;
+}
+
+std::size_t PositionTable::capacity() const noexcept {
+  return header_->capacity;
+}
+
+std::size_t PositionTable::home(ListingID id) const noexcept {
+  // Fibonacci hashing, capacity is a power of two.
+  return (id * 0x9e3779b97f4a7c15ull) >> (64 - __builtin_ctzll(capacity())) &
+         (capacity() - 1);
+}
+
+bool PositionTable::publish(ListingID id,
+                            const InstrumentState &state) noexcept {
+  auto mask = capacity() - 1;
+  for (std::size_t n = 0, i = home(id); n < capacity();
+       ++n, i = (i + 1) & mask) {
+    auto &slot = slots_[i];
+    if (!slot.occupied.load(std::memory_order_relaxed)) {
+      // Claim empty slot, readers see the listing only after its state.
+      slot.listing_id.store(id, std::memory_order_relaxed);
+      slot.state.store(state);
+      slot.occupied.store(1, std::memory_order_release);
+      return true;
+    }
+    if (slot.listing_id.load(std::memory_order_relaxed) == id) {
+      slot.state.store(state);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool PositionTable::read(ListingID id, InstrumentState &state) const noexcept {
+  auto mask = capacity() - 1;
+  for (std::size_t n = 0, i = home(id); n < capacity();
+       ++n, i = (i + 1) & mask) {
+    const auto &slot = slots_[i];
+    if (!slot.occupied.load(std::memory_order_acquire)) {
+      return false;
+    }
+    if (slot.listing_id.load(std::memory_order_relaxed) == id) {
+      state = slot.state.load();
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace rs
@@ -0,0 +1,240 @@
+#include "replication.h"
+#include "logging.h"
+
+extern "C" {
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace rs::replication {
+
+auto logger = logging::make_logger("replication", logging::Level::INFO);
+
+Primary::Primary(const std::vector<Address> &backups, bool synchronous)
+    : synchronous_(synchronous) {
+  for (const auto &[address, port] : backups) {
+    logger->info(RS_FMT("Replicating to backup at {}:{}"), address, port);
+    Link link{rs::format(RS_FMT("{}:{}"), address, port),
+              tcp::Client{address, port}, 0, Buffer{queue_length}, 0};
+    // Batches are already as large as they will get when they are sent.
+    int nodelay = 1;
+    setsockopt(link.client.socket().fd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+               sizeof(nodelay));
+    // A backup that stops reading must not stall the engine.
+    link.client.socket().set_non_blocking();
+    links_.push_back(std::move(link));
+  }
+}
+
+namespace {
+
+int milliseconds_until(Nanoseconds deadline) {
+  auto left = deadline - clock_ns();
+  // Rounded up, so that a wait does not return just before the deadline.
+  return left <= 0 ? 0 : static_cast<int>((left + 999'999) / 1'000'000);
+}
+
+Nanoseconds to_ns(std::chrono::milliseconds duration) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+      .count();
+}
+
+} // namespace
+
+void Primary::commit() {
+  if (!synchronous_) {
+    if (heartbeat_due(clock_ns())) {
+      flush();
+    }
+    return;
+  }
+  // Sending the events counts against the timeout as well.
+  const auto deadline = clock_ns() + to_ns(ack_timeout);
+  flush();
+  for (auto link = links_.begin(); link != links_.end();) {
+    try {
+      if (wait_for_acks(*link, deadline)) {
+        ++link;
+        continue;
+      }
+    } catch (const std::exception &error) {
+      logger->error(RS_FMT("Removing backup {}: {}"), link->address,
+                    error.what());
+    }
+    link = links_.erase(link);
+  }
+}
+
+bool Primary::wait_for_acks(Link &link, Nanoseconds deadline) {
+  while (link.acked < sequence_number_) {
+    short events = link.queue.empty() ? POLLIN : POLLIN | POLLOUT;
+    pollfd fd{link.client.socket().fd, events, 0};
+    int ready = poll(&fd, 1, milliseconds_until(deadline));
+    if (ready < 0 && errno != EINTR) {
+      throw std::runtime_error(
+          rs::format(RS_FMT("Failed waiting for acks: {}"),
+                     std::strerror(errno)));
+    }
+    if (ready > 0) {
+      tcp::send_from(link.client.socket(), link.queue);
+    }
+    if (ready > 0 && !read_acks(link)) {
+      logger->error(RS_FMT("Backup {} closed connection, removing it"),
+                    link.address);
+      return false;
+    }
+    if (ready == 0) {
+      logger->error(
+          RS_FMT("Backup {} acknowledged {} of {} events in {} ms, removing "
+                 "it"),
+          link.address, link.acked, sequence_number_, ack_timeout.count());
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Primary::heartbeat_due(Nanoseconds now) const noexcept {
+  return now - last_sent_ns_ >= to_ns(heartbeat_interval);
+}
+
+bool Primary::send_batch(Link &link, Nanoseconds now) {
+  if (batch_.readable().size() > link.queue.writable()) {
+    logger->error(RS_FMT("Backup {} is {} bytes behind, removing it"),
+                  link.address, link.queue.readable().size());
+    return false;
+  }
+  link.queue.append(batch_.readable());
+  tcp::send_from(link.client.socket(), link.queue);
+  if (link.queue.empty()) {
+    link.send_deadline = 0;
+  } else if (link.send_deadline == 0) {
+    link.send_deadline = now + to_ns(send_timeout);
+  } else if (now >= link.send_deadline) {
+    logger->error(
+        RS_FMT("Backup {} has not taken {} queued bytes in {} ms, removing "
+               "it"),
+        link.address, link.queue.readable().size(), send_timeout.count());
+    return false;
+  }
+  if (!read_acks(link)) {
+    logger->error(RS_FMT("Backup {} closed connection, removing it"),
+                  link.address);
+    return false;
+  }
+  return true;
+}
+
+void Primary::flush() {
+  auto now = clock_ns();
+  if (batch_.empty() && heartbeat_due(now)) {
+    protocol::Heartbeat heartbeat{protocol::Heartbeat::MESSAGE_TYPE,
+                                  sequence_number_};
+    protocol::encode_fields(batch_, SequenceNum{0});
+    batch_.append(' ');
+    protocol::encode(batch_,
+                     protocol::Header{heartbeat.messageType, sizeof(heartbeat),
+                                      0, rs::now()},
+                     heartbeat);
+  }
+  if (!batch_.empty()) {
+    last_sent_ns_ = now;
+  }
+  for (auto link = links_.begin(); link != links_.end();) {
+    try {
+      if (send_batch(*link, now)) {
+        ++link;
+        continue;
+      }
+    } catch (const std::exception &error) {
+      logger->error(RS_FMT("Removing backup {}: {}"), link->address,
+                    error.what());
+    }
+    link = links_.erase(link);
+  }
+  batch_.clear();
+  batch_size_ = 0;
+}
+
+bool Primary::read_acks(Link &link) {
+  auto &buffer = link.client.recv_buffer();
+  buffer.compact();
+  ssize_t msg_length = -1;
+  do {
+    msg_length = recv(link.client.socket().fd, buffer.write_ptr(),
+                      buffer.writable(), MSG_DONTWAIT);
+  } while (msg_length < 0 && errno == EINTR);
+  if (msg_length < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return true;
+    }
+    throw std::runtime_error(
+        rs::format(RS_FMT("Failed reading acks from backup {}: {}"),
+                   link.address, std::strerror(errno)));
+  }
+  if (msg_length == 0) {
+    return false;
+  }
+  buffer.commit(msg_length);
+  protocol::MessageView msg;
+  while (protocol::next_message(buffer, msg)) {
+    auto ack = protocol::decode_payload<protocol::ReplicationAck>(msg);
+    link.acked = std::max(link.acked, ack.sequenceNumber);
+  }
+  // Lag is only known for events still inside the window.
+  if (link.acked > 0 && sequence_number_ - link.acked < lag_window_length) {
+    last_lag_ns_ = clock_ns() - append_time_[link.acked % lag_window_length];
+    max_lag_ns_ = std::max(max_lag_ns_, last_lag_ns_);
+  }
+  return true;
+}
+
+std::string Primary::dump_stats() const {
+  std::string s;
+  s += rs::format(RS_FMT("  mode: {}\n"),
+                  synchronous_ ? "synchronous" : "asynchronous");
+  s += rs::format(RS_FMT("  sequence number: {}\n"), sequence_number_);
+  s += rs::format(RS_FMT("  last lag ns: {}\n"), last_lag_ns_);
+  s += rs::format(RS_FMT("  max lag ns: {}\n"), max_lag_ns_);
+  for (const auto &link : links_) {
+    s += rs::format(RS_FMT("  backup: {}\n"), link.address);
+    s += rs::format(RS_FMT("    acked: {}\n"), link.acked);
+    s += rs::format(RS_FMT("    lag events: {}\n"),
+                    sequence_number_ - link.acked);
+  }
+  return s;
+}
+
+Backup::Backup(const std::string &address, const std::string &port,
+               std::chrono::milliseconds promotion_timeout)
+    : tcp_server_(address, port), promotion_timeout_(promotion_timeout) {
+  logger->info(RS_FMT("Backup waiting for primary at {}:{}"), address, port);
+}
+
+bool Backup::wait_for_primary(const tcp::Socket &socket,
+                              const char *missing) const {
+  const auto deadline = clock_ns() + to_ns(promotion_timeout_);
+  while (true) {
+    pollfd fd{socket.fd, POLLIN, 0};
+    int ready = poll(&fd, 1, milliseconds_until(deadline));
+    if (ready > 0) {
+      return true;
+    }
+    if (ready == 0) {
+      logger->error(RS_FMT("{} from primary in {} ms"), missing,
+                    promotion_timeout_.count());
+      return false;
+    }
+    if (errno != EINTR) {
+      throw std::runtime_error(rs::format(
+          RS_FMT("Failed waiting for primary: {}"), std::strerror(errno)));
+    }
+  }
+}
+
+} // namespace rs::replication
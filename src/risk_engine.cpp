@@ -0,0 +1,618 @@
+#include "risk_engine.h"
+#include "format.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace rs {
+
+namespace {
+auto logger = logging::make_logger("risk_engine", logging::Level::DEBUG);
+} // namespace
+
+RiskEngine::RiskEngine(LimitConfig config) : config_(std::move(config)) {
+  firm_.limits = config_.firm;
+  for (const auto &[id, session] : std::as_const(config_.sessions)) {
+    add_session(id, session);
+  }
+}
+
+void RiskEngine::add_session(SessionID id,
+                             const LimitConfig::Session &session) {
+  auto account_it = accounts_.find(session.account);
+  if (account_it == accounts_.end()) {
+    account_it =
+        accounts_
+            .emplace(session.account,
+                     Exposure{{}, config_.account_limits(session.account)})
+            .first;
+  }
+  sessions_.emplace(id, Session{Exposure{{}, session.limits},
+                                &account_it->second,
+                                Throttle{config_.session_rate(id)}});
+}
+
+void RiskEngine::update_limits(LimitConfig config,
+                               const LimitChanges &changes) {
+  config_ = std::move(config);
+
+  // Only changed scopes are visited, all of a kind only if its default changed.
+  // Open orders are kept, new orders increasing a worst case position that is
+  // over its new limit are rejected.
+  if (changes.firm) {
+    firm_.limits = config_.firm;
+    if (!firm_.within_limits()) {
+      logger->warn(RS_FMT("Firm exceeds its new limits"));
+    }
+  }
+  auto update_account = [this](AccountID id, Exposure &exposure) {
+    exposure.limits = config_.account_limits(id);
+    if (!exposure.within_limits()) {
+      logger->warn(RS_FMT("Account {} exceeds its new limits"), id);
+    }
+  };
+  if (changes.default_account) {
+    for (auto &[id, exposure] : accounts_) {
+      update_account(id, exposure);
+    }
+  } else {
+    for (auto id : changes.accounts) {
+      if (auto account_it = accounts_.find(id); account_it != accounts_.end()) {
+        update_account(id, account_it->second);
+      }
+    }
+  }
+  for (auto id : changes.sessions) {
+    auto config_it = config_.sessions.find(id);
+    if (config_it == config_.sessions.end()) {
+      continue;
+    }
+    if (auto session_it = sessions_.find(id); session_it != sessions_.end()) {
+      auto &exposure = session_it->second.exposure;
+      exposure.limits = config_it->second.limits;
+      if (!exposure.within_limits()) {
+        logger->warn(RS_FMT("Session {} exceeds its new limits"), id);
+      }
+    } else {
+      add_session(id, config_it->second);
+    }
+  }
+  if (changes.default_session_rate) {
+    for (auto &[id, session] : sessions_) {
+      session.throttle.set_rate(config_.session_rate(id));
+    }
+  } else {
+    for (auto id : changes.session_rates) {
+      if (auto session_it = sessions_.find(id); session_it != sessions_.end()) {
+        session_it->second.throttle.set_rate(config_.session_rate(id));
+      }
+    }
+  }
+
+  // A default is set for all instruments at once, then the configured ones
+  // are set again.
+  auto set_instrument_limits = [this](ListingID id) {
+    if (auto i = instruments_.find(id)) {
+      instruments_.set_limits(*i, config_.instrument_limits(id));
+    }
+  };
+  if (changes.default_instrument) {
+    instruments_.set_limits(config_.default_instrument);
+    for (const auto &[id, limits] : std::as_const(config_.instruments)) {
+      set_instrument_limits(id);
+    }
+  } else {
+    for (auto id : changes.instruments) {
+      set_instrument_limits(id);
+    }
+  }
+  auto set_instrument_rate = [this](ListingID id) {
+    if (auto i = instruments_.find(id)) {
+      instruments_.set_order_rate(*i, config_.instrument_rate(id));
+    }
+  };
+  if (changes.default_instrument_rate) {
+    instruments_.set_order_rate(config_.default_instrument_rate);
+    for (const auto &[id, rate] : std::as_const(config_.instrument_rates)) {
+      set_instrument_rate(id);
+    }
+  } else {
+    for (auto id : changes.instrument_rates) {
+      set_instrument_rate(id);
+    }
+  }
+  // Instruments are many, look for the ones to report only if there are any.
+  if ((changes.default_instrument || !changes.instruments.empty()) &&
+      instruments_.count_over_limits() > 0) {
+    for (InstrumentTable::Index i = 0; i < instruments_.size(); ++i) {
+      if (!instruments_.within_limits(i)) {
+        logger->warn(RS_FMT("Instrument {} exceeds its new limits"),
+                     instruments_.id(i));
+      }
+    }
+  }
+}
+
+void RiskEngine::set_log_level(logging::Level level) {
+  logger->threshold = level;
+}
+
+[[nodiscard]] protocol::OrderResponse
+RiskEngine::handle_new_order(const protocol::NewOrder &create_msg,
+                             SessionID session) {
+  using protocol::OrderResponse;
+  logger->debug(RS_FMT("Handling creation of order {}"), create_msg.orderId);
+
+  OrderResponse response{OrderResponse::MESSAGE_TYPE, create_msg.orderId,
+                         // Reject by default and change to accept only if order
+                         // creation succeeded.
+                         OrderResponse::Status::REJECTED};
+
+  auto side = side_of(create_msg.side);
+  if (!side) {
+    logger->warn(RS_FMT("Ignoring new order with unknown side {}"),
+                 create_msg.side);
+    return response;
+  }
+
+  if (!has_session(session)) {
+    logger->warn(RS_FMT("Rejecting order {} of unknown session {}"),
+                 create_msg.orderId, session);
+    return response;
+  }
+
+  // Replacing the order would leave its quantity in the aggregates.
+  if (orders_.find(create_msg.orderId) != orders_.end()) {
+    logger->warn(RS_FMT("Rejecting order {} with an id already in use"),
+                 create_msg.orderId);
+    return response;
+  }
+
+  auto order = make_order(create_msg.listingId, create_msg.orderQuantity,
+                          *side, session);
+  // Logged at debug level only, a runaway client would flood the log.
+  if (!admit(order)) {
+    logger->debug(RS_FMT("Throttling order {}"), create_msg.orderId);
+    response.status = OrderResponse::Status::THROTTLED;
+    return response;
+  }
+
+  // Try inserting a new order, if it is valid.
+  if (register_new_order(create_msg.orderId, std::move(order))) {
+    response.status = OrderResponse::Status::ACCEPTED;
+  }
+
+  return response;
+}
+
+[[nodiscard]] protocol::OrderResponse RiskEngine::handle_modify_order(
+    const protocol::ModifyOrderQuantity &modify_msg) {
+  using protocol::OrderResponse;
+  logger->debug(RS_FMT("Handling modification of order {}"),
+                modify_msg.orderId);
+
+  OrderResponse response{OrderResponse::MESSAGE_TYPE, modify_msg.orderId,
+                         OrderResponse::Status::REJECTED};
+
+  auto id = modify_msg.orderId;
+  auto order_it = orders_.find(id);
+  if (order_it == orders_.end()) {
+    // Cannot modify non-existing order.
+    return response;
+  }
+
+  if (!admit(order_it->second)) {
+    logger->debug(RS_FMT("Throttling modification of order {}"), id);
+    response.status = OrderResponse::Status::THROTTLED;
+    return response;
+  }
+
+  if (update_order_quantity(order_it->second, modify_msg.newQuantity)) {
+    // Modification succeeded.
+    response.status = OrderResponse::Status::ACCEPTED;
+  }
+
+  return response;
+}
+
+[[nodiscard]] protocol::BatchResponse
+RiskEngine::handle_order_batch(const protocol::OrderBatch &batch,
+                               SessionID session) {
+  using namespace protocol;
+  logger->debug(RS_FMT("Handling batch of {} orders"), batch.count);
+
+  BatchResponse response{BatchResponse::MESSAGE_TYPE, batch.count, {}};
+  if (!has_session(session)) {
+    logger->warn(RS_FMT("Rejecting batch of unknown session {}"), session);
+    return response;
+  }
+  const bool all_or_nothing = batch.flags & OrderBatch::ALL_OR_NOTHING;
+  bool all_accepted = true;
+  std::size_t undo_length = 0;
+
+  // Apply accepted entries one by one, so that later entries are checked
+  // against the exposure of earlier ones. As with single new orders, a new
+  // order with an id that is already in use is rejected.
+  for (std::size_t i = 0; i < batch.count; ++i) {
+    const auto &entry = batch.entries[i];
+    bool accepted = false;
+
+    switch (entry.messageType) {
+    case NewOrder::MESSAGE_TYPE: {
+      auto side = side_of(entry.side);
+      if (!side || orders_.find(entry.orderId) != orders_.end()) {
+        break;
+      }
+      auto order = make_order(entry.listingId, entry.quantity, *side, session);
+      if (admit(order) && check_new_order(order)) {
+        insert_order(entry.orderId, order);
+        batch_undo_[undo_length++] = {entry.messageType, entry.orderId, 0};
+        accepted = true;
+      }
+    } break;
+
+    case ModifyOrderQuantity::MESSAGE_TYPE: {
+      auto order_it = orders_.find(entry.orderId);
+      if (order_it != orders_.end() && admit(order_it->second) &&
+          check_quantity_update(order_it->second, entry.quantity)) {
+        batch_undo_[undo_length++] = {entry.messageType, entry.orderId,
+                                      order_it->second.quantity};
+        set_order_quantity(order_it->second, entry.quantity);
+        accepted = true;
+      }
+    } break;
+    }
+
+    if (accepted) {
+      response.accepted[i / 64] |= uint64_t{1} << (i % 64);
+    } else {
+      all_accepted = false;
+      if (all_or_nothing) {
+        break;
+      }
+    }
+  }
+
+  if (all_or_nothing && !all_accepted) {
+    // Undo in reverse order, an order may have been modified after creation.
+    while (undo_length > 0) {
+      const auto &undo = batch_undo_[--undo_length];
+      auto order_it = orders_.find(undo.order_id);
+      if (undo.message_type == NewOrder::MESSAGE_TYPE) {
+        erase_order(order_it);
+      } else {
+        set_order_quantity(order_it->second, undo.old_quantity);
+      }
+    }
+    response.accepted = {};
+    return response;
+  }
+
+  // Only the final state of the batch is visible to readers.
+  for (std::size_t i = 0; i < batch.count; ++i) {
+    if (!response.is_accepted(i)) {
+      continue;
+    }
+    publish(orders_[batch.entries[i].orderId].instrument);
+  }
+
+  return response;
+}
+
+bool RiskEngine::handle_delete_order(const protocol::DeleteOrder &delete_msg) {
+  logger->debug(RS_FMT("Handling deletion of order {}"), delete_msg.orderId);
+  return delete_order(delete_msg.orderId);
+}
+
+bool RiskEngine::handle_trade(const protocol::Trade &trade_msg) {
+  logger->debug(RS_FMT("Handling trade {} of listing {}"), trade_msg.tradeId,
+                trade_msg.listingId);
+  auto order_it = orders_.find(trade_msg.tradeId);
+  if (order_it == orders_.end()) {
+    logger->warn(RS_FMT("Ignoring trade {} of unknown order"),
+                 trade_msg.tradeId);
+    return false;
+  }
+  // The position changes in the traded listing.
+  auto traded = order_it->second;
+  if (traded.listing_id != trade_msg.listingId) {
+    traded.listing_id = trade_msg.listingId;
+    traded.instrument = instrument(trade_msg.listingId);
+  }
+  auto [instrument, exposures] = scopes(traded);
+  instruments_.add_trade(instrument, traded.side, trade_msg.tradeQuantity);
+  for (auto *exposure : exposures) {
+    exposure->state.add_trade(traded.side, trade_msg.tradeQuantity);
+  }
+  publish(instrument);
+  return true;
+}
+
+void RiskEngine::apply_new_order(const protocol::NewOrder &create_msg,
+                                 SessionID session) {
+  auto side = side_of(create_msg.side);
+  if (!side) {
+    logger->warn(RS_FMT("Ignoring new order with unknown side {}"),
+                 create_msg.side);
+    return;
+  }
+  auto order = make_order(create_msg.listingId, create_msg.orderQuantity,
+                          *side, session);
+  insert_order(create_msg.orderId, order);
+  publish(order.instrument);
+}
+
+void RiskEngine::apply_modify_order(
+    const protocol::ModifyOrderQuantity &modify_msg) {
+  if (auto order_it = orders_.find(modify_msg.orderId);
+      order_it != orders_.end()) {
+    set_order_quantity(order_it->second, modify_msg.newQuantity);
+    publish(order_it->second.instrument);
+  }
+}
+
+void RiskEngine::reserve(std::size_t orders, std::size_t listings,
+                         bool huge_pages) {
+  orders_.reserve(orders);
+  instruments_.reserve(listings);
+  huge_pages_ = huge_pages;
+  // Linear probing slows down as the table fills up, so keep it at most half
+  // full.
+  auto capacity = std::max(2 * listings, PositionTable::default_capacity);
+  if (!positions_.shared() &&
+      (huge_pages || capacity > positions_.capacity())) {
+    positions_ = PositionTable(capacity, huge_pages);
+    publish_all();
+  }
+}
+
+void RiskEngine::warm_up(std::size_t orders) {
+  using namespace protocol;
+  constexpr ListingID listings = 64;
+
+  auto threshold = logger->threshold;
+  logger->threshold = logging::Level::WARN;
+  {
+    RiskEngine engine{LimitConfig{}};
+    for (OrderID id = 1; id <= orders; ++id) {
+      (void)engine.handle_new_order(
+          NewOrder{NewOrder::MESSAGE_TYPE, id % listings, id, 10, 1,
+                   id % 2 == 0 ? 'B' : 'S'});
+    }
+    for (OrderID id = 1; id <= orders; ++id) {
+      (void)engine.handle_modify_order(
+          ModifyOrderQuantity{ModifyOrderQuantity::MESSAGE_TYPE, id, 5});
+    }
+    for (OrderID id = 1; id <= orders; ++id) {
+      engine.handle_trade(Trade{Trade::MESSAGE_TYPE, id % listings, id, 1, 1});
+    }
+    for (OrderID id = 1; id <= orders; ++id) {
+      engine.handle_delete_order(DeleteOrder{DeleteOrder::MESSAGE_TYPE, id});
+    }
+  }
+  logger->threshold = threshold;
+  logger->info(RS_FMT("Warmed up with {} orders"), orders);
+}
+
+void RiskEngine::publish_positions(const std::string &shm_name) {
+  positions_ = PositionTable::create_shared(shm_name, positions_.capacity(),
+                                            huge_pages_);
+  publish_all();
+  logger->info(RS_FMT("Publishing positions to shared memory {}"), shm_name);
+}
+
+InstrumentTable::Index RiskEngine::instrument(ListingID id) {
+  if (auto i = instruments_.find(id)) {
+    return *i;
+  }
+  return instruments_.add(id, config_.instrument_limits(id),
+                          config_.instrument_rate(id));
+}
+
+Order RiskEngine::make_order(ListingID listing_id, Quantity quantity,
+                             Side side, SessionID session) {
+  Order order{listing_id, quantity, side, session};
+  order.instrument = instrument(listing_id);
+  return order;
+}
+
+RiskEngine::Session &RiskEngine::session_of(const Order &order) {
+  auto session_it = sessions_.find(order.session);
+  if (session_it == sessions_.end()) {
+    session_it = sessions_.find(0);
+  }
+  return session_it->second;
+}
+
+RiskEngine::Scopes RiskEngine::scopes(const Order &order) {
+  auto &session = session_of(order);
+  return {order.instrument, {&session.exposure, session.account, &firm_}};
+}
+
+void RiskEngine::publish(InstrumentTable::Index i) {
+  publish(instruments_.id(i), instruments_.state(i));
+}
+
+void RiskEngine::publish_all() {
+  for (InstrumentTable::Index i = 0; i < instruments_.size(); ++i) {
+    publish(i);
+  }
+}
+
+void RiskEngine::publish(ListingID id, const InstrumentState &state) {
+  if (!positions_.publish(id, state)) {
+    logger->warn(RS_FMT("Position table full, cannot publish listing {}"), id);
+  }
+}
+
+namespace {
+
+void dump_exposure(std::string &s, const Exposure &exposure) {
+  auto limit = [](Quantity max_pos) {
+    return max_pos == Limits::unlimited ? std::string{"unlimited"}
+                                        : rs::format(RS_FMT("{}"), max_pos);
+  };
+  const auto &state = exposure.state;
+  s += rs::format(RS_FMT("    max_buy_pos: {}\n"),
+                  limit(exposure.limits.max_pos[BUY]));
+  s += rs::format(RS_FMT("    max_sell_pos: {}\n"),
+                  limit(exposure.limits.max_pos[SELL]));
+  s += rs::format(RS_FMT("    net_pos: {}\n"), state.net_pos);
+  s += rs::format(RS_FMT("    buy_qty: {}\n"), state.buy_qty());
+  s += rs::format(RS_FMT("    sell_qty: {}\n"), state.sell_qty());
+  s += rs::format(RS_FMT("    worst_buy_pos: {}\n"), state.worst_buy_pos());
+  s += rs::format(RS_FMT("    worst_sell_pos: {}\n"), state.worst_sell_pos());
+}
+
+} // namespace
+
+std::string RiskEngine::dump_state() const {
+  std::string s;
+  s += "orders: \n";
+  for (const auto &[id, order] : std::as_const(orders_)) {
+    s += rs::format(RS_FMT("  id: {}\n"), id);
+    s += rs::format(RS_FMT("    listing_id: {}\n"), order.listing_id);
+    s += rs::format(RS_FMT("    quantity: {}\n"), order.quantity);
+    s += rs::format(RS_FMT("    side: {}\n"),
+                    std::string{side_char(order.side)});
+    s += rs::format(RS_FMT("    session: {}\n"), order.session);
+  }
+  s += "instrument state: \n";
+  for (InstrumentTable::Index i = 0; i < instruments_.size(); ++i) {
+    s += rs::format(RS_FMT("  id: {}\n"), instruments_.id(i));
+    dump_exposure(s, Exposure{instruments_.state(i), instruments_.limits(i)});
+  }
+  s += "session state: \n";
+  for (const auto &[id, session] : std::as_const(sessions_)) {
+    s += rs::format(RS_FMT("  id: {}\n"), id);
+    dump_exposure(s, session.exposure);
+  }
+  s += "account state: \n";
+  for (const auto &[id, exposure] : std::as_const(accounts_)) {
+    s += rs::format(RS_FMT("  id: {}\n"), id);
+    dump_exposure(s, exposure);
+  }
+  s += "firm state: \n";
+  dump_exposure(s, firm_);
+  if (expiry_.enabled()) {
+    s += "order expiry: \n";
+    s += rs::format(RS_FMT("  scheduled: {}\n"), expiry_schedule_.size());
+    s += rs::format(RS_FMT("  expired: {}\n"), expired_orders_);
+  }
+  if (config_.throttles()) {
+    s += "order rates: \n";
+    s += rs::format(RS_FMT("  throttled: {}\n"), throttled_orders_);
+  }
+  return s;
+}
+
+bool RiskEngine::admit(const Order &order) {
+  auto &session = session_of(order);
+  // Both windows move forward, even if the first one is full.
+  bool allowed = instruments_.allows_order(order.instrument, clock_) &
+                 session.throttle.allows(clock_);
+  if (!allowed) {
+    ++throttled_orders_;
+    return false;
+  }
+  instruments_.add_order(order.instrument);
+  session.throttle.add();
+  return true;
+}
+
+bool RiskEngine::check_new_order(const Order &order) {
+  auto [instrument, exposures] = scopes(order);
+  // Every scope is checked, without branching on the results.
+  bool allowed = instruments_.allows(instrument, order.side, order.quantity);
+  for (const auto *exposure : exposures) {
+    allowed &= exposure->allows(order.side, order.quantity);
+  }
+  return allowed;
+}
+
+bool RiskEngine::check_quantity_update(const Order &order, Quantity new_qty) {
+  // Quantity is unsigned, a decrease wraps around and is undone by adding the
+  // worst case position.
+  auto added_qty = new_qty - order.quantity;
+  auto [instrument, exposures] = scopes(order);
+  bool allowed = instruments_.allows(instrument, order.side, added_qty);
+  for (const auto *exposure : exposures) {
+    allowed &= exposure->allows(order.side, added_qty);
+  }
+  return allowed;
+}
+
+bool RiskEngine::register_new_order(OrderID id, const Order &order) {
+  if (!check_new_order(order)) {
+    return false;
+  }
+  insert_order(id, order);
+  publish(order.instrument);
+  return true;
+}
+
+bool RiskEngine::update_order_quantity(Order &order, Quantity new_qty) {
+  if (!check_quantity_update(order, new_qty)) {
+    return false;
+  }
+  set_order_quantity(order, new_qty);
+  publish(order.instrument);
+  return true;
+}
+
+bool RiskEngine::delete_order(OrderID id) {
+  auto order_it = orders_.find(id);
+  if (order_it == orders_.end()) {
+    return false;
+  }
+  auto instrument = order_it->second.instrument;
+  erase_order(order_it);
+  publish(instrument);
+  return true;
+}
+
+void RiskEngine::insert_order(OrderID id, const Order &order) {
+  add_open_qty(order, order.quantity);
+  auto &inserted = orders_[id];
+  inserted = order;
+  if (expiry_.enabled()) {
+    inserted.expires_at = expiry_.deadline(now_);
+    expiry_schedule_.skip_to(now_);
+    expiry_schedule_.schedule(id, inserted.expires_at);
+  }
+}
+
+bool RiskEngine::expire_order(OrderID id, Timestamp deadline) {
+  auto order_it = orders_.find(id);
+  // Deleted, or deleted and created again with a later expiry.
+  if (order_it == orders_.end() || order_it->second.expires_at != deadline) {
+    return false;
+  }
+  logger->debug(RS_FMT("Order {} expired"), id);
+  auto instrument = order_it->second.instrument;
+  erase_order(order_it);
+  publish(instrument);
+  ++expired_orders_;
+  return true;
+}
+
+void RiskEngine::set_order_quantity(Order &order, Quantity new_qty) {
+  add_open_qty(order, new_qty - order.quantity);
+  order.quantity = new_qty;
+}
+
+void RiskEngine::erase_order(OrderMap::iterator order_it) {
+  const auto &order = order_it->second;
+  add_open_qty(order, -order.quantity);
+  orders_.erase(order_it);
+}
+
+void RiskEngine::add_open_qty(const Order &order, Quantity qty) {
+  auto [instrument, exposures] = scopes(order);
+  instruments_.add_open_qty(instrument, order.side, qty);
+  for (auto *exposure : exposures) {
+    exposure->state.open_qty[order.side] += qty;
+  }
+}
+
+} // namespace rs
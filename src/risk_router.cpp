@@ -0,0 +1,707 @@
+#include "risk_router.h"
+#include "logging.h"
+
+extern "C" {
+#include <poll.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+namespace rs {
+
+namespace {
+auto logger = logging::make_logger("risk_router", logging::Level::INFO);
+} // namespace
+
+RiskRouter::RiskRouter(const std::string &address, const std::string &port,
+                       const std::vector<Address> &backends)
+    : tcp_server_(address, port) {
+  if (backends.empty() || backends.size() > max_backends) {
+    throw std::runtime_error(rs::format(
+        RS_FMT("Router needs 1 to {} backends, got {}"), max_backends,
+        backends.size()));
+  }
+  // Every pending request awaits at most a Logon and one part from each
+  // backend.
+  const std::size_t awaited_capacity =
+      2 * tcp::Server::max_connections * max_pending_requests;
+  backends_.reserve(backends.size());
+  for (const auto &[backend_address, backend_port] : backends) {
+    backends_.push_back(Backend{tcp::Client(backend_address, backend_port), 0,
+                                Fifo<Awaited>(awaited_capacity), 0, false});
+    backends_.back().client.socket().set_non_blocking();
+  }
+  logger->info(RS_FMT("Routing to {} backends"), backends_.size());
+}
+
+void RiskRouter::wait() {
+  logger->info(RS_FMT("Waiting for connections"));
+  online_ = true;
+  clients_.reserve(tcp::Server::max_connections);
+  std::vector<pollfd> fds;
+  while (online_) {
+    try {
+      // Wakes up every second while orders may expire, right away if expired
+      // orders are left.
+      int timeout = -1;
+      if (!expiry_schedule_.empty()) {
+        timeout = expire_index() ? 1000 : 0;
+      }
+
+      // Messages left in the receive buffers while queues were full.
+      for (auto &client : clients_) {
+        handle_messages(client);
+      }
+      for (auto &backend : backends_) {
+        if (!backend.failed) {
+          tcp::send_from(backend.client.socket(),
+                         backend.client.send_buffer());
+        }
+      }
+
+      // Listening socket first, then one entry per backend and per client.
+      // Failed backends are ignored by poll.
+      fds.clear();
+      fds.push_back({tcp_server_.socket().fd, POLLIN, 0});
+      for (auto &backend : backends_) {
+        short events = POLLIN;
+        if (!backend.client.send_buffer().empty()) {
+          events |= POLLOUT;
+        }
+        fds.push_back(
+            {backend.failed ? -1 : backend.client.socket().fd, events, 0});
+      }
+      for (const auto &client : clients_) {
+        short events = has_room(client) ? POLLIN : 0;
+        if (!client.connection.send_buffer->empty()) {
+          events |= POLLOUT;
+        }
+        fds.push_back({client.connection.socket.fd, events, 0});
+      }
+
+      if (poll(fds.data(), fds.size(), timeout) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error(
+            rs::format(RS_FMT("Failed polling sockets: {}"),
+                       std::strerror(errno)));
+      }
+
+      for (std::size_t i = 0; i < backends_.size(); ++i) {
+        if (auto events = fds[i + 1].revents; events != 0) {
+          serve_backend(backends_[i], static_cast<BackendIndex>(i), events);
+        }
+      }
+      const auto first_client = backends_.size() + 1;
+      for (std::size_t i = 0; i < clients_.size(); ++i) {
+        serve_client(clients_[i], fds[i + first_client].revents);
+      }
+
+      auto closed = std::remove_if(
+          clients_.begin(), clients_.end(),
+          [](const auto &client) { return client.connection.closed; });
+      if (closed != clients_.end()) {
+        clients_.erase(closed, clients_.end());
+        logger->info(RS_FMT("{}"), dump_state());
+      }
+
+      if (fds[0].revents & POLLIN) {
+        accept_client();
+      }
+    } catch (const std::exception &error) {
+      logger->error(RS_FMT("{}"), error.what());
+    }
+  }
+}
+
+void RiskRouter::accept_client() {
+  // The connection is closed again if the buffer pool is exhausted.
+  auto connection = tcp_server_.next_connection();
+  connection.socket.set_non_blocking();
+  logger->debug(RS_FMT("New connection on socket {}"), connection.socket.fd);
+  clients_.push_back(Client{std::move(connection), next_client_id_++});
+}
+
+void RiskRouter::serve_client(Client &client, short events) {
+  auto &connection = client.connection;
+  try {
+    // Responses merged from the backends since the last poll.
+    respond(client);
+    if ((events & (POLLHUP | POLLERR)) && !has_room(client)) {
+      // Gone, and not read from, nothing left to do.
+      connection.closed = true;
+      return;
+    }
+    if (events & (POLLIN | POLLHUP | POLLERR)) {
+      tcp_server_.receive(connection);
+      if (connection.closed) {
+        logger->debug(RS_FMT("Client on socket {} closed the connection"),
+                      connection.socket.fd);
+        return;
+      }
+      handle_messages(client);
+    }
+    tcp_server_.send(connection);
+  } catch (const std::exception &error) {
+    logger->error(RS_FMT("Closing connection on socket {}: {}"),
+                  connection.socket.fd, error.what());
+    connection.closed = true;
+  }
+}
+
+bool RiskRouter::has_room(const Client &client) const noexcept {
+  if (client.requests.full() ||
+      client.connection.send_buffer->readable().size() >= backlog_limit) {
+    return false;
+  }
+  // One message adds at most a Logon and one part to each backend.
+  return std::all_of(
+      backends_.begin(), backends_.end(), [](const auto &backend) {
+        return backend.failed ||
+               (backend.client.send_buffer().readable().size() <
+                    backlog_limit &&
+                backend.awaited.size() + 2 <= backend.awaited.capacity());
+      });
+}
+
+void RiskRouter::handle_messages(Client &client) {
+  auto &connection = client.connection;
+  protocol::MessageView msg;
+  while (!connection.closed && has_room(client) &&
+         protocol::next_message(*connection.recv_buffer, msg)) {
+    handle_message(client, msg);
+    // Requests rejected by the router itself are answered right away.
+    respond(client);
+  }
+}
+
+void RiskRouter::handle_message(Client &client, protocol::MessageView msg) {
+  using namespace protocol;
+
+  auto header = decode_header(msg);
+  logger->debug(RS_FMT("Routing message of type {}"), header.version);
+
+  switch (header.version) {
+  case NewOrder::MESSAGE_TYPE: {
+    handle_new_order(client, header, decode_payload<NewOrder>(msg));
+  } break;
+
+  case DeleteOrder::MESSAGE_TYPE: {
+    auto deletion = decode_payload<DeleteOrder>(msg);
+    auto backend = backend_of_order(deletion.orderId);
+    if (backend == no_backend) {
+      logger->debug(RS_FMT("Ignoring deletion of unknown order {}"),
+                    deletion.orderId);
+      break;
+    }
+    forward(backend, client, header.sequenceNumber, deletion);
+    order_backends_.erase(deletion.orderId);
+  } break;
+
+  case ModifyOrderQuantity::MESSAGE_TYPE: {
+    handle_modify_order(client, header,
+                        decode_payload<ModifyOrderQuantity>(msg));
+  } break;
+
+  case Trade::MESSAGE_TYPE: {
+    // Trades go wherever their order is, which is normally the backend of
+    // their listing.
+    auto trade = decode_payload<Trade>(msg);
+    auto backend = backend_of_order(trade.tradeId);
+    if (backend == no_backend) {
+      backend = backend_of_listing(trade.listingId);
+    }
+    forward(backend, client, header.sequenceNumber, trade);
+  } break;
+
+  case OrderBatch::MESSAGE_TYPE: {
+    handle_order_batch(client, header, decode_payload<OrderBatch>(msg));
+  } break;
+
+  case PositionQuery::MESSAGE_TYPE: {
+    handle_position_query(client, header, decode_payload<PositionQuery>(msg));
+  } break;
+
+  case Logon::MESSAGE_TYPE: {
+    handle_logon(client, header, decode_payload<Logon>(msg));
+  } break;
+
+  case Heartbeat::MESSAGE_TYPE: {
+    // Answered by the router, after the requests before it.
+    auto &request = open_request(client, Request::Kind::HEARTBEAT,
+                                 header.sequenceNumber, 0);
+    request.heartbeat = decode_payload<Heartbeat>(msg);
+  } break;
+
+  default: {
+    logger->warn(RS_FMT("Ignoring unknown protocol version {}"),
+                 header.version);
+  }
+  }
+}
+
+void RiskRouter::handle_new_order(Client &client,
+                                  const protocol::Header &header,
+                                  const protocol::NewOrder &order) {
+  using protocol::OrderResponse;
+  // An order id that is still indexed goes to the backend of its first order,
+  // which rejects it as a duplicate.
+  auto backend = backend_of_order(order.orderId);
+  bool indexed = false;
+  if (backend == no_backend) {
+    backend = backend_of_listing(order.listingId);
+    indexed = index(order.orderId, backend);
+  }
+  auto &request = open_request(client, Request::Kind::ORDER,
+                               header.sequenceNumber, 1);
+  request.order = {OrderResponse::MESSAGE_TYPE, order.orderId,
+                   OrderResponse::Status::REJECTED};
+  request.indexed = indexed;
+  forward(backend, client, header.sequenceNumber, order, 1);
+}
+
+void RiskRouter::handle_modify_order(
+    Client &client, const protocol::Header &header,
+    const protocol::ModifyOrderQuantity &modify) {
+  using protocol::OrderResponse;
+  // Unknown orders are rejected without asking any backend.
+  auto backend = backend_of_order(modify.orderId);
+  auto &request = open_request(client, Request::Kind::ORDER,
+                               header.sequenceNumber,
+                               backend == no_backend ? 0 : 1);
+  request.order = {OrderResponse::MESSAGE_TYPE, modify.orderId,
+                   OrderResponse::Status::REJECTED};
+  request.indexed = false;
+  if (backend != no_backend) {
+    forward(backend, client, header.sequenceNumber, modify, 1);
+  }
+}
+
+void RiskRouter::handle_order_batch(Client &client,
+                                    const protocol::Header &header,
+                                    const protocol::OrderBatch &batch) {
+  using namespace protocol;
+
+  auto &request = open_request(client, Request::Kind::BATCH,
+                               header.sequenceNumber, 0);
+  request.batch = BatchResponse{BatchResponse::MESSAGE_TYPE, batch.count, {}};
+  request.indexed_entries.reset();
+
+  std::array<bool, max_backends> involved{};
+  uint16_t parts = 0;
+  bool rejected_here = false;
+  for (std::size_t i = 0; i < batch.count; ++i) {
+    const auto &entry = batch.entries[i];
+    auto backend = backend_of_order(entry.orderId);
+    if (entry.messageType == NewOrder::MESSAGE_TYPE && backend == no_backend) {
+      backend = backend_of_listing(entry.listingId);
+    }
+    rejected_here |= backend == no_backend;
+    request.backend_of[i] = backend;
+    if (backend != no_backend && !involved[backend]) {
+      involved[backend] = true;
+      ++parts;
+    }
+  }
+
+  // Backends check their parts independently, so a batch that must not be
+  // split is rejected as a whole.
+  if ((batch.flags & OrderBatch::ALL_OR_NOTHING) &&
+      (rejected_here || parts > 1)) {
+    logger->warn(RS_FMT("Rejecting all-or-nothing batch of {} entries spanning "
+                        "{} backends"),
+                 batch.count, parts);
+    return;
+  }
+
+  for (std::size_t i = 0; i < batch.count; ++i) {
+    const auto &entry = batch.entries[i];
+    if (entry.messageType == NewOrder::MESSAGE_TYPE &&
+        request.backend_of[i] != no_backend &&
+        index(entry.orderId, request.backend_of[i])) {
+      request.indexed_ids[i] = entry.orderId;
+      request.indexed_entries.set(i);
+    }
+  }
+
+  request.missing_parts = parts;
+  OrderBatch part;
+  part.messageType = OrderBatch::MESSAGE_TYPE;
+  part.flags = batch.flags;
+  for (std::size_t backend = 0; backend < backends_.size(); ++backend) {
+    if (!involved[backend]) {
+      continue;
+    }
+    part.count = 0;
+    for (std::size_t i = 0; i < batch.count; ++i) {
+      if (request.backend_of[i] == backend) {
+        part.entries[part.count++] = batch.entries[i];
+      }
+    }
+    forward(static_cast<BackendIndex>(backend), client, header.sequenceNumber,
+            part, 1);
+  }
+}
+
+void RiskRouter::handle_position_query(Client &client,
+                                       const protocol::Header &header,
+                                       const protocol::PositionQuery &query) {
+  using protocol::PositionQuery;
+  using protocol::PositionResponse;
+
+  auto &request = open_request(client, Request::Kind::POSITIONS,
+                               header.sequenceNumber, 0);
+  request.count = query.count;
+  request.received.fill(0);
+  for (std::size_t i = 0; i < query.count; ++i) {
+    request.backend_of[i] = backend_of_listing(query.listingIds[i]);
+    // Left empty if the backend fails before answering.
+    request.positions[i] = {PositionResponse::MESSAGE_TYPE,
+                            query.listingIds[i], 0, 0, 0, 0, 0};
+  }
+
+  PositionQuery part;
+  part.messageType = PositionQuery::MESSAGE_TYPE;
+  for (std::size_t backend = 0; backend < backends_.size(); ++backend) {
+    part.count = 0;
+    for (std::size_t i = 0; i < query.count; ++i) {
+      if (request.backend_of[i] == backend) {
+        part.listingIds[part.count++] = query.listingIds[i];
+      }
+    }
+    if (part.count > 0) {
+      ++request.missing_parts;
+      forward(static_cast<BackendIndex>(backend), client,
+              header.sequenceNumber, part, part.count);
+    }
+  }
+}
+
+void RiskRouter::handle_logon(Client &client, const protocol::Header &header,
+                              const protocol::Logon &logon) {
+  using protocol::SessionStatus;
+  client.session = logon.sessionId;
+  auto &request =
+      open_request(client, Request::Kind::SESSION_STATUS,
+                   header.sequenceNumber,
+                   static_cast<uint16_t>(backends_.size()));
+  request.status = {SessionStatus::MESSAGE_TYPE, logon.sessionId, 0};
+  // Backends expect gaps in the sequence numbers of routed sessions.
+  auto routed = logon;
+  routed.flags |= protocol::Logon::ROUTED;
+  for (std::size_t backend = 0; backend < backends_.size(); ++backend) {
+    forward(static_cast<BackendIndex>(backend), client, header.sequenceNumber,
+            routed, 1);
+  }
+}
+
+RiskRouter::BackendIndex
+RiskRouter::backend_of_order(OrderID id) const noexcept {
+  auto it = order_backends_.find(id);
+  return it == order_backends_.end() ? no_backend : it->second.backend;
+}
+
+bool RiskRouter::index(OrderID id, BackendIndex backend) {
+  // A second later than on the backend, so that the router never forgets an
+  // order that its backend still has.
+  Timestamp expires_at = 0;
+  if (expiry_.enabled()) {
+    expires_at = expiry_.deadline(now()) + 1;
+  }
+  if (!order_backends_.emplace(id, IndexedOrder{backend, expires_at}).second) {
+    return false;
+  }
+  if (expires_at != 0) {
+    expiry_schedule_.skip_to(now());
+    expiry_schedule_.schedule(id, expires_at);
+  }
+  return true;
+}
+
+bool RiskRouter::expire_index() {
+  return expiry_schedule_.advance(
+      now(), expiry_slice, [this](const TimingWheel::Entry &entry) {
+        // Unless deleted, or deleted and created again with a later expiry.
+        auto it = order_backends_.find(entry.key);
+        if (it != order_backends_.end() &&
+            it->second.expires_at == entry.deadline) {
+          order_backends_.erase(it);
+        }
+      });
+}
+
+RiskRouter::Request &RiskRouter::open_request(Client &client,
+                                              Request::Kind kind,
+                                              SequenceNum seq,
+                                              uint16_t missing_parts) {
+  // handle_messages only reads messages of clients with room for a request.
+  auto &request = client.requests.push();
+  request.kind = kind;
+  request.seq = seq;
+  request.missing_parts = missing_parts;
+  return request;
+}
+
+template <typename Payload>
+void RiskRouter::forward(BackendIndex index, Client &client, SequenceNum seq,
+                         const Payload &payload, uint16_t responses) {
+  auto &backend = backends_[index];
+  if (backend.failed) {
+    if (responses > 0) {
+      fail_part(client.requests[last_request(client) - client.first_request],
+                index);
+    }
+    return;
+  }
+  if constexpr (std::is_same_v<Payload, protocol::Logon>) {
+    backend.session = payload.sessionId;
+  } else {
+    switch_session(backend, client.session);
+  }
+  auto &buffer = backend.client.send_buffer();
+  // The queue holds less than backlog_limit bytes, see has_room.
+  if (buffer.writable() < backlog_limit) {
+    buffer.compact();
+  }
+  protocol::encode(
+      buffer,
+      protocol::Header{Payload::MESSAGE_TYPE, sizeof(payload), seq, now()},
+      payload);
+  ++backend.forwarded;
+  if (responses > 0) {
+    backend.awaited.push() = Awaited{client.id, last_request(client),
+                                     responses};
+  }
+}
+
+void RiskRouter::switch_session(Backend &backend, SessionID session) {
+  if (backend.session == session) {
+    return;
+  }
+  protocol::Logon logon{protocol::Logon::MESSAGE_TYPE, session,
+                        protocol::Logon::ROUTED};
+  auto &buffer = backend.client.send_buffer();
+  if (buffer.writable() < backlog_limit) {
+    buffer.compact();
+  }
+  protocol::encode(
+      buffer, protocol::Header{logon.messageType, sizeof(logon), 0, now()},
+      logon);
+  // The SessionStatus it answers with is dropped.
+  backend.awaited.push() = Awaited{};
+  backend.session = session;
+}
+
+void RiskRouter::serve_backend(Backend &backend, BackendIndex index,
+                               short events) {
+  auto &client = backend.client;
+  try {
+    if (events & POLLOUT) {
+      tcp::send_from(client.socket(), client.send_buffer());
+    }
+    if (events & (POLLIN | POLLHUP | POLLERR)) {
+      auto received = tcp::receive_into(client.socket(), client.recv_buffer());
+      if (received && *received == 0) {
+        throw std::runtime_error("Connection closed");
+      }
+      protocol::MessageView msg;
+      while (protocol::next_message(client.recv_buffer(), msg)) {
+        handle_response(backend, index, msg);
+      }
+    }
+  } catch (const std::exception &error) {
+    fail_backend(index, error.what());
+  }
+}
+
+void RiskRouter::handle_response(Backend &backend, BackendIndex index,
+                                 protocol::MessageView msg) {
+  if (backend.awaited.empty()) {
+    logger->warn(RS_FMT("Ignoring unexpected response of backend {}"), index);
+    return;
+  }
+  auto &awaited = backend.awaited.front();
+  auto *client = find_client(awaited.client);
+  const bool part_complete = --awaited.responses == 0;
+  if (client != nullptr) {
+    // Requests leave the queue only once complete, so the request is there.
+    auto &request = client->requests[awaited.request - client->first_request];
+    merge(request, index, msg);
+    if (part_complete) {
+      --request.missing_parts;
+    }
+  }
+  if (part_complete) {
+    backend.awaited.pop();
+  }
+}
+
+void RiskRouter::merge(Request &request, BackendIndex index,
+                       protocol::MessageView msg) {
+  using namespace protocol;
+
+  // Orders rejected by their backend do not exist there.
+  switch (request.kind) {
+  case Request::Kind::ORDER: {
+    request.order.status = decode_payload<OrderResponse>(msg).status;
+    if (request.indexed &&
+        request.order.status != OrderResponse::Status::ACCEPTED) {
+      unindex(request.order.orderId, index);
+    }
+  } break;
+
+  case Request::Kind::BATCH: {
+    auto part = decode_payload<BatchResponse>(msg);
+    std::size_t k = 0;
+    for (std::size_t i = 0; i < request.batch.count; ++i) {
+      if (request.backend_of[i] != index) {
+        continue;
+      }
+      if (part.is_accepted(k)) {
+        request.batch.accepted[i / 64] |= uint64_t{1} << (i % 64);
+      } else if (request.indexed_entries.test(i)) {
+        unindex(request.indexed_ids[i], index);
+      }
+      ++k;
+    }
+  } break;
+
+  case Request::Kind::POSITIONS: {
+    // Answered in the order of the listings in the part, which is query order.
+    auto k = request.received[index]++;
+    for (std::size_t i = 0; i < request.count; ++i) {
+      if (request.backend_of[i] == index && k-- == 0) {
+        request.positions[i] = decode_payload<PositionResponse>(msg);
+        break;
+      }
+    }
+  } break;
+
+  case Request::Kind::SESSION_STATUS: {
+    // Every request before the lowest expected number of any backend that
+    // has seen the session has been handled.
+    auto expected = decode_payload<SessionStatus>(msg).expectedSequenceNumber;
+    auto &merged = request.status.expectedSequenceNumber;
+    if (expected != 0 && (merged == 0 || expected < merged)) {
+      merged = expected;
+    }
+  } break;
+
+  case Request::Kind::HEARTBEAT:
+    // Answered by the router, never forwarded.
+    break;
+  }
+}
+
+void RiskRouter::fail_backend(BackendIndex index, const char *reason) {
+  auto &backend = backends_[index];
+  backend.failed = true;
+  // Only the listings of the backend cannot be checked anymore.
+  logger->critical(RS_FMT("Backend {} failed, rejecting its requests: {}"),
+                   index, reason);
+  for (; !backend.awaited.empty(); backend.awaited.pop()) {
+    const auto &awaited = backend.awaited.front();
+    if (auto *client = find_client(awaited.client)) {
+      fail_part(client->requests[awaited.request - client->first_request],
+                index);
+    }
+  }
+  for (auto it = order_backends_.begin(); it != order_backends_.end();) {
+    it = it->second.backend == index ? order_backends_.erase(it)
+                                     : std::next(it);
+  }
+  if (std::all_of(backends_.begin(), backends_.end(),
+                  [](const auto &backend) { return backend.failed; })) {
+    logger->critical(RS_FMT("All backends failed, stopping"));
+    stop();
+  }
+}
+
+void RiskRouter::fail_part(Request &request, BackendIndex index) {
+  // Orders and batch entries start out rejected and positions empty, so only
+  // the indexed new orders are left to undo.
+  switch (request.kind) {
+  case Request::Kind::ORDER:
+    if (request.indexed) {
+      unindex(request.order.orderId, index);
+    }
+    break;
+  case Request::Kind::BATCH:
+    for (std::size_t i = 0; i < request.batch.count; ++i) {
+      if (request.backend_of[i] == index && request.indexed_entries.test(i)) {
+        unindex(request.indexed_ids[i], index);
+      }
+    }
+    break;
+  case Request::Kind::POSITIONS:
+  case Request::Kind::SESSION_STATUS:
+  case Request::Kind::HEARTBEAT:
+    break;
+  }
+  --request.missing_parts;
+}
+
+void RiskRouter::unindex(OrderID id, BackendIndex index) {
+  // Unless an order of the same id already existed there.
+  if (auto it = order_backends_.find(id);
+      it != order_backends_.end() && it->second.backend == index) {
+    order_backends_.erase(it);
+  }
+}
+
+void RiskRouter::respond(Client &client) {
+  using namespace protocol;
+
+  auto &buffer = *client.connection.send_buffer;
+  while (!client.requests.empty() &&
+         client.requests.front().missing_parts == 0 &&
+         buffer.readable().size() < backlog_limit) {
+    if (buffer.writable() < backlog_limit) {
+      buffer.compact();
+    }
+    const auto &request = client.requests.front();
+    auto encode_response = [&buffer, &request](const auto &payload) {
+      using Payload = std::decay_t<decltype(payload)>;
+      encode(buffer,
+             Header{Payload::MESSAGE_TYPE, sizeof(payload), request.seq, now()},
+             payload);
+    };
+    switch (request.kind) {
+    case Request::Kind::ORDER:
+      encode_response(request.order);
+      break;
+    case Request::Kind::BATCH:
+      encode_response(request.batch);
+      break;
+    case Request::Kind::POSITIONS:
+      for (std::size_t i = 0; i < request.count; ++i) {
+        encode_response(request.positions[i]);
+      }
+      break;
+    case Request::Kind::SESSION_STATUS:
+      encode_response(request.status);
+      break;
+    case Request::Kind::HEARTBEAT:
+      encode_response(request.heartbeat);
+      break;
+    }
+    client.requests.pop();
+    ++client.first_request;
+  }
+}
+
+RiskRouter::Client *RiskRouter::find_client(ClientID id) noexcept {
+  if (id == 0) {
+    return nullptr;
+  }
+  auto it = std::find_if(clients_.begin(), clients_.end(),
+                         [id](const auto &client) { return client.id == id; });
+  return it == clients_.end() ? nullptr : &*it;
+}
+
+} // namespace rs
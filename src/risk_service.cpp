@@ -1,44 +1,476 @@
 #include "risk_service.h"
 #include "logging.h"
+#include "trace.h"
+
+extern "C" {
+#include <poll.h>
+#include <sys/socket.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <variant>
 
 namespace rs {
 
-auto logger = logging::make_logger("risk_service", logging::Level::DEBUG);
+auto logger = logging::make_logger("risk_service", logging::Level::INFO);
+
+namespace {
+
+// Events to poll the socket of a client for.
+short poll_events(const tcp::Connection &connection, bool throttled) {
+  short events = throttled ? 0 : POLLIN;
+  if (!connection.send_buffer->empty()) {
+    events |= POLLOUT;
+  }
+  return events;
+}
+
+} // namespace
+
+RiskService::RiskService(const std::string &address,
+                         const std::string &tcp_port, LimitConfig limits,
+                         std::size_t network_threads)
+    : online_(false), engine_(std::move(limits)),
+      listener_{tcp::Server(address, tcp_port, network_threads > 1), {}, {}} {
+  if (network_threads > 1) {
+    network_threads_ = std::make_unique<NetworkThreads>();
+    network_threads_->listeners.reserve(network_threads - 1);
+    for (std::size_t i = 1; i < network_threads; ++i) {
+      network_threads_->listeners.push_back(
+          Listener{tcp::Server(address, tcp_port, true), {}, {}});
+    }
+  }
+}
+
+void RiskService::prepare(const startup::Options &options) {
+  // Locked first, so that everything faulted in below stays in memory.
+  if (options.lock_memory) {
+    startup::lock_memory();
+  }
+  startup::retain_heap();
+  engine_.reserve(options.orders, options.listings, options.huge_pages);
+  listener_.clients.reserve(tcp::Server::max_connections);
+  RiskEngine::warm_up(options.warmup_orders);
+  startup::prefault_stack();
+  logger->info(RS_FMT("Prepared for {} orders of {} listings"),
+               options.orders, options.listings);
+}
+
+void RiskService::apply_runtime_profile(const runtime::Profile &profile) {
+  // Before anything is changed.
+  profile.check_isolation(network_threads_ ? network_threads_->listeners.size()
+                                           : 0);
+  if (admin_ && !profile.housekeeping_cpus.empty()) {
+    admin_->pin(profile.housekeeping_cpus);
+  }
+  if (profile.serving_cpu) {
+    runtime::pin_thread(pthread_self(), {*profile.serving_cpu});
+  }
+  if (network_threads_ && profile.serving_cpu) {
+    // Otherwise they would share the serving CPU, which they inherit.
+    auto &cpus = network_threads_->cpus;
+    if (profile.network_cpus.size() < network_threads_->listeners.size()) {
+      throw std::runtime_error(
+          rs::format(RS_FMT("Runtime profile has {} network CPUs for {} "
+                            "further network threads"),
+                     profile.network_cpus.size(),
+                     network_threads_->listeners.size()));
+    }
+    cpus.assign(profile.network_cpus.begin(),
+                profile.network_cpus.begin() +
+                    network_threads_->listeners.size());
+  }
+  if (profile.realtime_priority > 0) {
+    runtime::set_realtime_priority(profile.realtime_priority);
+  }
+  busy_wait_ = profile.wait == runtime::Wait::BUSY;
+  socket_options_ = profile.sockets;
+  // The receive buffer of the listening socket sets the window scale offered
+  // to connecting clients.
+  listener_.server.socket().set_options(socket_options_);
+  if (network_threads_) {
+    for (auto &listener : network_threads_->listeners) {
+      listener.server.socket().set_options(socket_options_);
+    }
+  }
+  if (trade_feed_) {
+    trade_feed_->socket().set_options(socket_options_);
+  }
+  logger->info(RS_FMT("{}"), profile.describe());
+}
 
 void RiskService::wait() {
-  logger->info("Waiting for connections");
+  logger->info(RS_FMT("Decoding messages with {} instructions"),
+               protocol::FieldBatch::instruction_set());
+  logger->info(RS_FMT("Waiting for connections"));
   online_ = true;
+  std::vector<std::thread> threads;
+  if (network_threads_) {
+    logger->info(RS_FMT("Serving clients on {} network threads"),
+                 network_threads_->listeners.size() + 1);
+    network_threads_->running = true;
+    const auto &cpus = network_threads_->cpus;
+    for (std::size_t i = 0; i < network_threads_->listeners.size(); ++i) {
+      auto &listener = network_threads_->listeners[i];
+      threads.emplace_back([this, &listener] { serve(listener); });
+      if (i < cpus.size()) {
+        runtime::pin_thread(threads.back().native_handle(), {cpus[i]});
+      }
+    }
+  }
+  serve(listener_);
+  if (network_threads_) {
+    network_threads_->running = false;
+    // Wake up the other network threads, blocked in poll.
+    for (auto &listener : network_threads_->listeners) {
+      ::shutdown(listener.server.socket().fd, SHUT_RDWR);
+    }
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+void RiskService::serve(Listener &listener) {
+  const bool serves_feed = &listener == &listener_;
+  auto serving = [this, serves_feed] {
+    return serves_feed ? online_ : network_threads_->running.load();
+  };
+  auto &clients = listener.clients;
+  clients.reserve(tcp::Server::max_connections);
+  std::vector<pollfd> fds;
+  while (serving()) {
+    try {
+      // Timed idle work is done by the thread that called wait. The others
+      // only flush what they have batched, if the engine is not in use, in
+      // which case its user flushes after it.
+      int timeout = busy_wait_ ? 0 : -1;
+      if (serves_feed) {
+        auto lock = lock_engine();
+        flush_idle();
+        timeout = poll_timeout();
+      } else if (auto lock = try_lock_engine(); lock.owns_lock()) {
+        flush_output();
+      }
+
+      // Listening socket and trade feed first, then one entry per client.
+      // Negative descriptors are ignored by poll.
+      fds.clear();
+      fds.push_back({listener.server.socket().fd, POLLIN, 0});
+      fds.push_back({serves_feed && trade_feed_ ? trade_feed_->socket().fd : -1,
+                     POLLIN, 0});
+      for (const auto &client : clients) {
+        fds.push_back({client.connection.socket.fd,
+                       poll_events(client.connection, client.throttled), 0});
+      }
+
+      if (poll(fds.data(), fds.size(), timeout) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error(
+            rs::format(RS_FMT("Failed polling sockets: {}"),
+                       std::strerror(errno)));
+      }
+      if (!serving()) {
+        break;
+      }
+
+      // Trades that arrived before the client messages must be applied before
+      // they are checked.
+      if (fds[1].revents & POLLIN) {
+        auto lock = lock_engine();
+        drain_trade_feed();
+      }
+      for (std::size_t i = 0; i < clients.size(); ++i) {
+        if (auto events = fds[i + 2].revents; events != 0) {
+          serve_client(clients[i], events, listener.received);
+        }
+      }
+
+      auto closed = std::remove_if(
+          clients.begin(), clients.end(),
+          [](const auto &client) { return client.connection.closed; });
+      if (closed != clients.end()) {
+        clients.erase(closed, clients.end());
+        auto lock = lock_engine();
+        logger->info(RS_FMT("{}"), dump_state());
+      }
+
+      if (fds[0].revents & POLLIN) {
+        accept_client(listener);
+      }
+    } catch (const std::exception &error) {
+      logger->error(RS_FMT("{}"), error.what());
+    }
+  }
+}
+
+void RiskService::accept_client(Listener &listener) {
+  // The connection is closed again if the buffer pool is exhausted.
+  auto connection = listener.server.next_connection();
+  connection.socket.set_non_blocking();
+  connection.socket.set_options(socket_options_);
+  logger->debug(RS_FMT("New connection on socket {}"), connection.socket.fd);
+  // Connections start in session 0 until they log on.
+  listener.clients.push_back(ClientConnection{std::move(connection)});
+}
+
+#ifdef RS_COROUTINES
+void RiskService::wait_async() {
+  logger->info(RS_FMT("Waiting for connections"));
+  online_ = true;
+  // A frame for each client and for the other coroutines, so that accepting a
+  // client does not allocate.
+  co::FramePool::reserve(tcp::Server::max_connections + 2);
+  co::EventLoop loop(tcp::Server::max_connections + 2);
+  loop.on_idle([this, &loop] {
+    if (!online_) {
+      loop.stop();
+    }
+    flush_idle();
+    loop.set_timeout(poll_timeout());
+  });
+  loop.spawn(accept_clients(loop));
+  if (trade_feed_) {
+    loop.spawn(read_trade_feed(loop));
+  }
+  loop.run();
+}
+
+co::Task<> RiskService::accept_clients(co::EventLoop &loop) {
   while (online_) {
+    co_await loop.readable(listener_.server.socket().fd);
     try {
-      auto socket = tcp_server_.next_connection();
-      logger->debug("New connection on socket {}, reading all messages",
-                    socket.fd);
-      while (serve_client(socket))
-        ;
+      // The connection is closed again if the buffer pool is exhausted.
+      auto connection = listener_.server.next_connection();
+      connection.socket.set_non_blocking();
+      connection.socket.set_options(socket_options_);
+      logger->debug(RS_FMT("New connection on socket {}"),
+                    connection.socket.fd);
+      loop.spawn(serve_async(loop, std::move(connection)));
     } catch (const std::exception &error) {
-      logger->error(error.what());
+      logger->error(RS_FMT("{}"), error.what());
     }
-    logger->info(dump_state());
   }
 }
 
-bool RiskService::serve_client(const tcp::Socket &socket) {
-  using namespace protocol;
+co::Task<> RiskService::serve_async(co::EventLoop &loop,
+                                    tcp::Connection connection) {
+  // Connections start in session 0 until they log on.
+  ClientConnection client{std::move(connection)};
+  while (!client.connection.closed) {
+    auto events = co_await loop.ready(
+        client.connection.socket.fd,
+        poll_events(client.connection, client.throttled));
+    serve_client(client, events, listener_.received);
+  }
+  logger->info(RS_FMT("{}"), dump_state());
+}
 
-  auto msg = tcp_server_.receive_message(socket);
-  if (msg.empty()) {
-    // Client closed connection.
-    return false;
+co::Task<> RiskService::read_trade_feed(co::EventLoop &loop) {
+  while (online_) {
+    co_await loop.readable(trade_feed_->socket().fd);
+    try {
+      drain_trade_feed();
+    } catch (const std::exception &error) {
+      logger->error(RS_FMT("{}"), error.what());
+    }
+  }
+}
+#endif
+
+void RiskService::serve_client(ClientConnection &client, short events,
+                               protocol::FieldBatch &received) {
+  auto &connection = client.connection;
+  try {
+    apply_limit_updates();
+    if (events & POLLOUT) {
+      send(connection);
+      if (client.throttled && connection.send_buffer->empty()) {
+        logger->info(RS_FMT("Client on socket {} caught up, resuming"),
+                     connection.socket.fd);
+        client.throttled = false;
+        // Messages received before throttling are still waiting, and are
+        // checked against the trades that have arrived since.
+        {
+          auto lock = lock_engine();
+          drain_trade_feed();
+        }
+        handle_messages(client, received);
+      }
+      if (connection.send_buffer->empty()) {
+        client.alerted = false;
+      }
+    }
+    if ((events & (POLLHUP | POLLERR)) && client.throttled) {
+      // Gone without reading its responses, nothing left to do.
+      connection.closed = true;
+      return;
+    }
+    if ((events & (POLLIN | POLLHUP | POLLERR)) && !client.throttled) {
+      receive(connection);
+      if (connection.closed) {
+        logger->debug(RS_FMT("Client on socket {} closed the connection"),
+                      connection.socket.fd);
+        return;
+      }
+      // Trades that arrived before these messages must be applied before they
+      // are checked.
+      {
+        auto lock = lock_engine();
+        drain_trade_feed();
+      }
+      handle_messages(client, received);
+    }
+  } catch (const std::exception &error) {
+    logger->error(RS_FMT("Closing connection on socket {}: {}"),
+                  connection.socket.fd, error.what());
+    connection.closed = true;
+  }
+}
+
+void RiskService::handle_messages(ClientConnection &client,
+                                  protocol::FieldBatch &received) {
+  auto &connection = client.connection;
+  auto &recv_buffer = *connection.recv_buffer;
+  while (!client.throttled && !connection.closed) {
+    // Decoded before taking the engine, in parallel with other clients.
+    {
+      RS_TRACE_STAGE(decode, DECODE);
+      received.decode(recv_buffer.readable());
+    }
+    if (received.empty()) {
+      break;
+    }
+    auto lock = lock_engine();
+    // Messages received together are throttled as of the same time.
+    engine_.set_clock(replication::clock_ns());
+    // Messages left when the client is throttled are decoded again later.
+    std::size_t consumed = 0;
+    for (std::size_t i = 0;
+         i < received.size() && !client.throttled && !connection.closed; ++i) {
+      recv_buffer.consume(received.end(i) - consumed);
+      consumed = received.end(i);
+      expire_orders(expiry_slice);
+      handle_message(client, received[i]);
+      check_backlog(client);
+    }
+  }
+
+  // State changes must reach the backups before the client sees the responses.
+  if (primary_) {
+    auto lock = lock_engine();
+    primary_->commit();
+  }
+  send(connection);
+}
+
+void RiskService::check_backlog(ClientConnection &client) {
+  auto &connection = client.connection;
+  if (connection.send_buffer->readable().size() < backlog_high_watermark) {
+    return;
+  }
+  // Try making room before blaming the client.
+  if (primary_) {
+    primary_->commit();
+  }
+  send(connection);
+  auto queued = connection.send_buffer->readable().size();
+  if (queued < backlog_high_watermark) {
+    return;
+  }
+
+  switch (slow_consumer_policy_) {
+  case SlowConsumerPolicy::DROP: {
+    logger->warn(RS_FMT("Dropping slow consumer on socket {}, {} bytes queued"),
+                 connection.socket.fd, queued);
+    connection.closed = true;
+    return;
+  }
+  case SlowConsumerPolicy::ALERT: {
+    if (!client.alerted) {
+      logger->error(RS_FMT("Slow consumer on socket {}, {} bytes queued"),
+                    connection.socket.fd, queued);
+      client.alerted = true;
+    }
+    if (queued < backlog_limit) {
+      return;
+    }
+  } break;
+  case SlowConsumerPolicy::THROTTLE:
+    break;
   }
+  logger->warn(RS_FMT("Throttling slow consumer on socket {}, {} bytes queued"),
+               connection.socket.fd, queued);
+  client.throttled = true;
+}
+
+void RiskService::handle_message(ClientConnection &client,
+                                 const protocol::BatchedMessage &msg) {
+  using namespace protocol;
 
   auto header = decode_header(msg);
-  logger->info("Handling message of type {}", header.version);
+  logger->debug(RS_FMT("Handling message of type {}"), header.version);
+
+  // Logons are not sequenced, they start a connection of the session.
+  client.request_seq = header.sequenceNumber;
+  if (client.sequence && header.version != Logon::MESSAGE_TYPE &&
+      client.sequence->logon != client.logon) {
+    // Its requests would interleave with those of the connection that logged
+    // on since, e.g. a gateway that reconnected before this one was closed.
+    logger->warn(RS_FMT("Session {} has logged on again, closing its earlier "
+                        "connection on socket {}"),
+                 client.session, client.connection.socket.fd);
+    client.connection.closed = true;
+    return;
+  }
+  if (client.sequence && header.sequenceNumber != 0 &&
+      header.version != Logon::MESSAGE_TYPE) {
+    switch (client.sequence->next(header.sequenceNumber)) {
+    case SessionSequence::Result::DUPLICATE: {
+      // Position queries change nothing and are answered again.
+      if (header.version != PositionQuery::MESSAGE_TYPE) {
+        replay(client, header);
+        return;
+      }
+    } break;
+    case SessionSequence::Result::GAP: {
+      // Expected behind a risk-router, which sends each backend only the
+      // requests of its listings.
+      if (client.routed) {
+        logger->debug(RS_FMT("Session {} skipped to request {}"),
+                      client.session, header.sequenceNumber);
+      } else {
+        logger->warn(RS_FMT("Session {} skipped to request {}"),
+                     client.session, header.sequenceNumber);
+      }
+    } break;
+    // A skipped request has not been handled, e.g. because a risk-router
+    // sent it to another backend before.
+    case SessionSequence::Result::LATE:
+    case SessionSequence::Result::IN_ORDER:
+      break;
+    }
+  }
+  // Captured after sequencing, so that replays handle every request once.
+  // Heartbeats change nothing and are left out, and limits are only changed
+  // by admins.
+  if (header.version != Heartbeat::MESSAGE_TYPE &&
+      header.version != LimitUpdate::MESSAGE_TYPE) {
+    capture(client.session, msg.text);
+  }
+
+  std::optional<OrderResponse> response;
 
   switch (header.version) {
   case NewOrder::MESSAGE_TYPE: {
-    auto response = handle_new_order(decode_payload<NewOrder>(msg));
-    Header header{OrderResponse::MESSAGE_TYPE, sizeof(response), 1, now()};
-    tcp_server_.send_message(socket, encode(header, response));
+    response =
+        handle_new_order(decode_payload<NewOrder>(msg), client.session);
   } break;
 
   case DeleteOrder::MESSAGE_TYPE: {
@@ -46,156 +478,381 @@ bool RiskService::serve_client(const tcp::Socket &socket) {
   } break;
 
   case ModifyOrderQuantity::MESSAGE_TYPE: {
-    auto response =
+    response =
         handle_modify_order(decode_payload<ModifyOrderQuantity>(msg));
-    Header header{OrderResponse::MESSAGE_TYPE, sizeof(response), 1, now()};
-    tcp_server_.send_message(socket, encode(header, response));
   } break;
 
   case Trade::MESSAGE_TYPE: {
     handle_trade(decode_payload<Trade>(msg));
   } break;
 
+  case OrderBatch::MESSAGE_TYPE: {
+    respond(client, handle_order_batch(decode_payload<OrderBatch>(msg),
+                                       client.session));
+  } break;
+
+  case PositionQuery::MESSAGE_TYPE: {
+    handle_position_query(client, decode_payload<PositionQuery>(msg));
+  } break;
+
+  case Logon::MESSAGE_TYPE: {
+    handle_logon(client, decode_payload<Logon>(msg));
+  } break;
+
+  case Heartbeat::MESSAGE_TYPE: {
+    respond(client, decode_payload<Heartbeat>(msg));
+  } break;
+
   default: {
-    logger->warn("Ignoring unknown protocol version {}", header.version);
+    logger->warn(RS_FMT("Ignoring unknown protocol version {}"),
+                 header.version);
   }
   }
 
-  return true;
+  if (response) {
+    respond(client, *response);
+  }
 }
 
-[[nodiscard]] protocol::OrderResponse
-RiskService::handle_new_order(const protocol::NewOrder &create_msg) {
-  using protocol::OrderResponse;
-  logger->debug("Handling creation of order {}", create_msg.orderId);
+template <typename Payload>
+void RiskService::respond(ClientConnection &client, const Payload &payload) {
+  using namespace protocol;
+  // The queue has room, check_backlog stops handling messages of a client
+  // before it is full.
+  Header header{Payload::MESSAGE_TYPE, sizeof(payload), client.request_seq,
+                now()};
+  encode(*client.connection.send_buffer, header, payload);
+  if constexpr (std::is_same_v<Payload, OrderResponse> ||
+                std::is_same_v<Payload, BatchResponse>) {
+    if (client.sequence && client.request_seq != 0) {
+      client.sequence->record(client.request_seq, payload);
+    }
+  }
+}
 
-  OrderResponse response{OrderResponse::MESSAGE_TYPE, create_msg.orderId,
-                         // Reject by default and change to accept only if order
-                         // creation succeeded.
-                         OrderResponse::Status::REJECTED};
+void RiskService::replay(ClientConnection &client,
+                         const protocol::Header &header) {
+  using namespace protocol;
+  auto seq = header.sequenceNumber;
+  const auto *response = client.sequence->find(seq);
+  if (response == nullptr) {
+    if (header.version != NewOrder::MESSAGE_TYPE &&
+        header.version != ModifyOrderQuantity::MESSAGE_TYPE &&
+        header.version != OrderBatch::MESSAGE_TYPE) {
+      // Deletions and trades are not answered the first time either.
+      return;
+    }
+    // The client still waits for an answer. Its outcome is unknown, so
+    // neither accepted nor rejected, and the status tells the client where
+    // the session stands.
+    logger->warn(RS_FMT("Response to request {} of session {} sent again has "
+                        "left the window, answering with the session status"),
+                 seq, client.session);
+    respond(client, SessionStatus{SessionStatus::MESSAGE_TYPE, client.session,
+                                  client.sequence->expected()});
+    return;
+  }
+  logger->info(RS_FMT("Replaying response to request {} of session {}"), seq,
+               client.session);
+  ++client.sequence->replayed;
+  std::visit(
+      [this, &client](const auto &payload) {
+        using Payload = std::decay_t<decltype(payload)>;
+        if constexpr (!std::is_same_v<Payload, std::monostate>) {
+          respond(client, payload);
+        }
+      },
+      *response);
+}
 
-  if (create_msg.side != 'B' && create_msg.side != 'S') {
-    logger->warn("Ignoring new order with unknown side {}", create_msg.side);
-    return response;
+void RiskService::handle_position_query(ClientConnection &client,
+                                        const protocol::PositionQuery &query) {
+  RS_TRACE_STAGE(position_query, POSITION_QUERY);
+  using protocol::PositionResponse;
+  logger->debug(RS_FMT("Handling position query of {} listings"), query.count);
+  for (std::size_t i = 0; i < query.count; ++i) {
+    auto id = query.listingIds[i];
+    // Read from the snapshot table, like readers in other threads do.
+    // Unknown listings have no position.
+    InstrumentState state;
+    engine_.positions().read(id, state);
+    PositionResponse response{PositionResponse::MESSAGE_TYPE,
+                              id,
+                              state.net_pos,
+                              state.buy_qty(),
+                              state.sell_qty(),
+                              state.worst_buy_pos(),
+                              state.worst_sell_pos()};
+    respond(client, response);
   }
+}
 
-  // Try inserting a new order, if it is valid.
-  Order order{create_msg.listingId, create_msg.orderQuantity, create_msg.side};
-  if (register_new_order(create_msg.orderId, std::move(order))) {
-    response.status = OrderResponse::Status::ACCEPTED;
+void RiskService::capture_to(const std::string &path) {
+  capture_.open(path, std::ios::app);
+  if (!capture_) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Unable to open capture file {}"), path));
   }
+  logger->info(RS_FMT("Capturing messages to {}"), path);
+}
 
-  return response;
+void RiskService::wait_as_backup(const std::string &address,
+                                 const std::string &port,
+                                 std::chrono::milliseconds promotion_timeout) {
+  replication::Backup backup(address, port, promotion_timeout);
+  // Limits follow the primary until promotion.
+  if (admin_) {
+    admin_->pause();
+  }
+  try {
+    backup.serve(
+        [this](protocol::MessageView msg) { apply_replicated(msg); });
+  } catch (const std::exception &error) {
+    logger->error(RS_FMT("{}"), error.what());
+  }
+  logger->warn(RS_FMT("Primary is gone after event {}, promoting to primary"),
+               backup.applied());
+  if (admin_) {
+    admin_->resume(engine_.limits());
+  }
 }
 
-[[nodiscard]] protocol::OrderResponse RiskService::handle_modify_order(
-    const protocol::ModifyOrderQuantity &modify_msg) {
-  using protocol::OrderResponse;
-  logger->debug("Handling modification of order {}", modify_msg.orderId);
+void RiskService::apply_replicated(protocol::MessageView msg) {
+  using namespace protocol;
 
-  OrderResponse response{OrderResponse::MESSAGE_TYPE, modify_msg.orderId,
-                         OrderResponse::Status::REJECTED};
+  auto header = decode_header(msg);
+  // New orders expire relative to the time the primary handled them.
+  engine_.set_time(header.timestamp);
+  switch (header.version) {
+  case NewOrder::MESSAGE_TYPE: {
+    engine_.apply_new_order(decode_payload<NewOrder>(msg),
+                            replicated_session_);
+  } break;
+
+  case Logon::MESSAGE_TYPE: {
+    replicated_session_ = decode_payload<Logon>(msg).sessionId;
+  } break;
+
+  case DeleteOrder::MESSAGE_TYPE: {
+    engine_.handle_delete_order(decode_payload<DeleteOrder>(msg));
+  } break;
+
+  case ModifyOrderQuantity::MESSAGE_TYPE: {
+    engine_.apply_modify_order(decode_payload<ModifyOrderQuantity>(msg));
+  } break;
 
-  auto id = modify_msg.orderId;
-  auto order_it = orders_.find(id);
-  if (order_it == orders_.end()) {
-    // Cannot modify non-existing order.
-    return response;
+  case Trade::MESSAGE_TYPE: {
+    // Keep the trade feed sequence in sync with the primary so that trades it
+    // already applied are dropped as duplicates after promotion.
+    if (header.sequenceNumber != 0) {
+      trade_feed_seq_.next(header.sequenceNumber);
+    }
+    engine_.handle_trade(decode_payload<Trade>(msg));
+  } break;
+
+  case LimitUpdate::MESSAGE_TYPE: {
+    engine_.apply_limit_update(decode_payload<LimitUpdate>(msg));
+  } break;
+
+  default: {
+    logger->warn(RS_FMT("Ignoring replicated message of unknown type {}"),
+                 header.version);
+  }
   }
+}
 
-  if (update_order_quantity(order_it->second, modify_msg.newQuantity)) {
-    // Modification succeeded.
-    response.status = OrderResponse::Status::ACCEPTED;
+void RiskService::apply_limit_updates() {
+  if (!admin_) {
+    return;
   }
+  if (auto update = admin_->take_update()) {
+    logger->info(RS_FMT("Applying limit update"));
+    auto lock = lock_engine();
+    // Backups and backtests apply the same limits between the same orders.
+    for (const auto &scope : update->changes.updates(update->limits)) {
+      replicate(scope);
+      capture(protocol::encode(
+          protocol::Header{scope.messageType, sizeof(scope), 0, now()},
+          scope));
+    }
+    engine_.update_limits(std::move(update->limits), update->changes);
+  }
+}
 
-  return response;
+void RiskService::expire_orders(std::size_t max_entries) {
+  using protocol::DeleteOrder;
+  expiry_behind_ = !engine_.expire_orders(
+      now(), max_entries, [this](OrderID id) {
+        // Backups and backtests see the expiry as a deletion.
+        DeleteOrder deletion{DeleteOrder::MESSAGE_TYPE, id};
+        replicate(deletion);
+        capture(protocol::encode(
+            protocol::Header{deletion.messageType, sizeof(deletion), 0, now()},
+            deletion));
+      });
 }
 
-void RiskService::handle_delete_order(const protocol::DeleteOrder &delete_msg) {
-  logger->debug("Handling deletion of order {}", delete_msg.orderId);
-  delete_order(delete_msg.orderId);
-}
-
-void RiskService::handle_trade(const protocol::Trade &trade_msg) {
-  logger->debug("Handling trade {} of listing {}", trade_msg.tradeId,
-                trade_msg.listingId);
-  auto &state = instrument_state_[trade_msg.listingId];
-  const auto &order = orders_[trade_msg.tradeId];
-  switch (order.side) {
-  case 'B': {
-    state.net_pos -= trade_msg.tradeQuantity;
-  } break;
-  case 'S': {
-    state.net_pos += trade_msg.tradeQuantity;
-  } break;
+void RiskService::receive(tcp::Connection &connection) {
+  RS_TRACE_STAGE(receive, RECEIVE);
+  listener_.server.receive(connection);
+}
+
+void RiskService::send(tcp::Connection &connection) {
+  RS_TRACE_STAGE(send, SEND);
+  listener_.server.send(connection);
+}
+
+void RiskService::flush_idle() {
+  // Out of work for now, good time to retire expired orders.
+  expire_orders(idle_expiry_slice);
+  if (trace::Profiler::take_dump_request()) {
+    logger->info(RS_FMT("{}"), trace::Profiler::dump());
   }
+  flush_output();
 }
 
-bool RiskService::register_new_order(OrderID id, const Order &order) {
-  bool accepted = false;
-  auto &state = instrument_state_[order.listing_id];
+void RiskService::flush_output() {
+  if (primary_) {
+    primary_->flush();
+  }
+  if (capture_.is_open()) {
+    capture_.flush();
+  }
+}
 
-  switch (order.side) {
-  case 'B': {
-    if (order.quantity + state.worst_buy_pos() <= max_buy_pos_) {
-      orders_[id] = order;
-      state.buy_qty += order.quantity;
-      accepted = true;
+void RiskService::drain_trade_feed() {
+  if (!trade_feed_) {
+    return;
+  }
+  for (auto n = trade_feed_->receive_batch(); n > 0;
+       n = trade_feed_->receive_batch()) {
+    logger->debug(RS_FMT("Applying batch of {} datagrams from trade feed"), n);
+    for (std::size_t i = 0; i < n; ++i) {
+      handle_feed_message(trade_feed_->message(i));
     }
-  } break;
-  case 'S': {
-    if (order.quantity + state.worst_sell_pos() <= max_sell_pos_) {
-      orders_[id] = order;
-      state.sell_qty += order.quantity;
-      accepted = true;
+  }
+}
+
+void RiskService::handle_feed_message(protocol::MessageView msg) {
+  using namespace protocol;
+
+  // A malformed datagram must not stop the feed.
+  try {
+    auto header = decode_header(msg);
+    if (header.version != Trade::MESSAGE_TYPE) {
+      logger->warn(RS_FMT("Ignoring message of type {} from trade feed"),
+                   header.version);
+      return;
     }
-  } break;
+    switch (trade_feed_seq_.next(header.sequenceNumber)) {
+    case udp::Sequencer::Result::DUPLICATE: {
+      logger->warn(RS_FMT("Ignoring duplicate trade feed sequence number {}"),
+                   header.sequenceNumber);
+      return;
+    }
+    case udp::Sequencer::Result::GAP: {
+      logger->warn(RS_FMT("Trade feed gap, sequence number {} after {} missed"),
+                   header.sequenceNumber, trade_feed_seq_.missed);
+    } break;
+    case udp::Sequencer::Result::LATE: {
+      logger->info(RS_FMT("Trade feed sequence number {} arrived late"),
+                   header.sequenceNumber);
+    } break;
+    case udp::Sequencer::Result::IN_ORDER:
+      break;
+    }
+    capture(msg);
+    handle_trade(decode_payload<Trade>(msg), header.sequenceNumber);
+  } catch (const std::exception &error) {
+    logger->error(RS_FMT("Invalid trade feed datagram: {}"), error.what());
+  }
+}
+
+[[nodiscard]] protocol::OrderResponse
+RiskService::handle_new_order(const protocol::NewOrder &create_msg,
+                              SessionID session) {
+  RS_TRACE_STAGE(new_order, NEW_ORDER);
+  auto response = engine_.handle_new_order(create_msg, session);
+  if (response.status == protocol::OrderResponse::Status::ACCEPTED) {
+    replicate_session(session);
+    replicate(create_msg);
   }
+  return response;
+}
 
-  return accepted;
+[[nodiscard]] protocol::OrderResponse RiskService::handle_modify_order(
+    const protocol::ModifyOrderQuantity &modify_msg) {
+  RS_TRACE_STAGE(modify_order, MODIFY_ORDER);
+  auto response = engine_.handle_modify_order(modify_msg);
+  if (response.status == protocol::OrderResponse::Status::ACCEPTED) {
+    replicate(modify_msg);
+  }
+  return response;
 }
 
-bool RiskService::update_order_quantity(Order &order, Quantity new_qty) {
-  bool accepted = false;
-  auto old_qty = order.quantity;
-  auto &state = instrument_state_[order.listing_id];
+[[nodiscard]] protocol::BatchResponse
+RiskService::handle_order_batch(const protocol::OrderBatch &batch,
+                                SessionID session) {
+  RS_TRACE_STAGE(order_batch, ORDER_BATCH);
+  using namespace protocol;
+  auto response = engine_.handle_order_batch(batch, session);
 
-  switch (order.side) {
-  case 'B': {
-    if (new_qty - old_qty + state.worst_buy_pos() <= max_buy_pos_) {
-      state.buy_qty += new_qty - old_qty;
-      order.quantity = new_qty;
-      accepted = true;
+  // Only the final state of the batch is replicated.
+  replicate_session(session);
+  for (std::size_t i = 0; i < batch.count; ++i) {
+    if (!response.is_accepted(i)) {
+      continue;
     }
-  } break;
-  case 'S': {
-    if (new_qty - old_qty + state.worst_sell_pos() <= max_sell_pos_) {
-      state.sell_qty += new_qty - old_qty;
-      order.quantity = new_qty;
-      accepted = true;
+    const auto &entry = batch.entries[i];
+    if (entry.messageType == NewOrder::MESSAGE_TYPE) {
+      replicate(NewOrder{NewOrder::MESSAGE_TYPE, entry.listingId, entry.orderId,
+                         entry.quantity, entry.price, entry.side});
+    } else {
+      replicate(ModifyOrderQuantity{ModifyOrderQuantity::MESSAGE_TYPE,
+                                    entry.orderId, entry.quantity});
     }
-  } break;
   }
 
-  return accepted;
+  return response;
 }
 
-void RiskService::delete_order(OrderID id) {
-  auto order_it = orders_.find(id);
-  if (order_it == orders_.end()) {
-    return;
+void RiskService::handle_logon(ClientConnection &client,
+                               const protocol::Logon &logon) {
+  RS_TRACE_STAGE(logon, LOGON);
+  logger->info(RS_FMT("Connection logged on to session {}"), logon.sessionId);
+  client.session = logon.sessionId;
+  client.routed = logon.flags & protocol::Logon::ROUTED;
+  client.sequence = nullptr;
+  if (!engine_.has_session(logon.sessionId)) {
+    // Not sequenced, so that unknown session ids cannot grow the sequences.
+    logger->warn(RS_FMT("Unknown session {}, its orders will be rejected"),
+                 logon.sessionId);
+  } else if (logon.sessionId != 0) {
+    client.sequence = &sequences_[logon.sessionId];
+    // A connection of the session that logged on before is stale from now.
+    client.logon = ++logons_;
+    client.sequence->logon = client.logon;
   }
-  const auto &order = order_it->second;
-  auto &state = instrument_state_[order.listing_id];
-  switch (order.side) {
-  case 'B': {
-    state.buy_qty -= order.quantity;
-  } break;
-  case 'S': {
-    state.sell_qty -= order.quantity;
-  } break;
+
+  protocol::SessionStatus status{
+      protocol::SessionStatus::MESSAGE_TYPE, logon.sessionId,
+      client.sequence ? client.sequence->expected() : 0};
+  respond(client, status);
+}
+
+void RiskService::handle_delete_order(const protocol::DeleteOrder &delete_msg) {
+  RS_TRACE_STAGE(delete_order, DELETE_ORDER);
+  if (engine_.handle_delete_order(delete_msg)) {
+    replicate(delete_msg);
+  }
+}
+
+void RiskService::handle_trade(const protocol::Trade &trade_msg,
+                               SequenceNum feed_seq) {
+  RS_TRACE_STAGE(trade, TRADE);
+  if (engine_.handle_trade(trade_msg)) {
+    replicate(trade_msg, feed_seq);
   }
-  orders_.erase(order_it);
 }
 
 } // namespace rs
@@ -0,0 +1,60 @@
+#include "format.h"
+#include "risk_router.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+[[noreturn]] void usage() {
+  std::cerr << "usage: risk_router [options] ip_address tcp_port "
+               "backend_address backend_port [backend_address backend_port "
+               "...]\n"
+               "Backend i of n checks the listings with id % n == i.\n"
+               "options, as given to the backends:\n"
+               "  --order-ttl seconds  orders expire after their lifetime\n"
+               "  --session-end HH:MM  orders expire at the end of the "
+               "session, UTC\n";
+  exit(2);
+}
+
+} // namespace
+
+int main(const int argc, const char *argv[]) {
+  rs::OrderExpiry expiry;
+  int first = 1;
+  for (; first + 1 < argc; first += 2) {
+    const std::string option{argv[first]};
+    if (option == "--order-ttl") {
+      expiry.ttl = std::stoull(argv[first + 1]);
+    } else if (option == "--session-end") {
+      const std::string time{argv[first + 1]};
+      expiry.session_end = rs::OrderExpiry::parse_time_of_day(time);
+      if (!expiry.session_end) {
+        std::cerr << rs::format(RS_FMT("error: invalid time '{}'"), time)
+                  << '\n';
+        exit(2);
+      }
+    } else {
+      break;
+    }
+  }
+
+  const int args = argc - first;
+  if (args < 4 || args % 2 != 0) {
+    std::cerr << rs::format(RS_FMT("error: wrong number of args {}"), args)
+              << '\n';
+    usage();
+  }
+
+  const std::string address{argv[first]};
+  const std::string port{argv[first + 1]};
+  std::vector<rs::RiskRouter::Address> backends;
+  for (int i = first + 2; i + 1 < argc; i += 2) {
+    backends.emplace_back(argv[i], argv[i + 1]);
+  }
+
+  rs::RiskRouter router(address, port, backends);
+  router.set_order_expiry(expiry);
+  router.wait();
+}
@@ -0,0 +1,230 @@
+#include "runtime_profile.h"
+#include "format.h"
+
+extern "C" {
+#include <sched.h>
+}
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace rs::runtime {
+
+namespace {
+
+bool read_switch(std::istream &line, bool &value) {
+  std::string word;
+  if (!(line >> word) || (word != "on" && word != "off")) {
+    return false;
+  }
+  value = word == "on";
+  return true;
+}
+
+bool read_non_negative(std::istream &line, int &value) {
+  return static_cast<bool>(line >> value) && value >= 0;
+}
+
+std::string format_cpu_list(const std::vector<unsigned> &cpus) {
+  std::string s;
+  for (auto cpu : cpus) {
+    s += rs::format(RS_FMT("{}{}"), s.empty() ? "" : ",", cpu);
+  }
+  return s.empty() ? "any" : s;
+}
+
+} // namespace
+
+Profile Profile::parse(std::istream &input) {
+  Profile profile;
+  std::string text;
+  for (std::size_t line_number = 1; std::getline(input, text); ++line_number) {
+    if (auto comment = text.find('#'); comment != text.npos) {
+      text.erase(comment);
+    }
+    std::istringstream line(text);
+    std::string setting;
+    if (!(line >> setting)) {
+      // Empty line.
+      continue;
+    }
+
+    bool valid = false;
+    std::string word;
+    if (setting == "serving_cpu") {
+      unsigned cpu = 0;
+      valid = static_cast<bool>(line >> cpu);
+      profile.serving_cpu = cpu;
+    } else if (setting == "network_cpus" && line >> word) {
+      auto cpus = parse_cpu_list(word);
+      valid = cpus.has_value();
+      profile.network_cpus = cpus.value_or(std::vector<unsigned>{});
+    } else if (setting == "housekeeping_cpus" && line >> word) {
+      auto cpus = parse_cpu_list(word);
+      valid = cpus.has_value();
+      profile.housekeeping_cpus = cpus.value_or(std::vector<unsigned>{});
+    } else if (setting == "wait" && line >> word) {
+      valid = word == "busy" || word == "block";
+      profile.wait = word == "busy" ? Wait::BUSY : Wait::BLOCK;
+    } else if (setting == "realtime_priority") {
+      valid = read_non_negative(line, profile.realtime_priority) &&
+              profile.realtime_priority <= sched_get_priority_max(SCHED_FIFO);
+    } else if (setting == "tcp_nodelay") {
+      valid = read_switch(line, profile.sockets.no_delay);
+    } else if (setting == "busy_poll") {
+      valid = read_non_negative(line, profile.sockets.busy_poll_us);
+    } else if (setting == "receive_buffer") {
+      valid = read_non_negative(line, profile.sockets.receive_buffer);
+    } else if (setting == "send_buffer") {
+      valid = read_non_negative(line, profile.sockets.send_buffer);
+    }
+
+    std::string rest;
+    if (!valid || line >> rest) {
+      throw std::runtime_error(rs::format(
+          RS_FMT("Invalid runtime profile on line {}: {}"), line_number, text));
+    }
+  }
+  auto network_cpus = profile.network_cpus;
+  if (profile.serving_cpu) {
+    network_cpus.push_back(*profile.serving_cpu);
+  }
+  for (auto cpu : network_cpus) {
+    if (std::count(profile.housekeeping_cpus.begin(),
+                   profile.housekeeping_cpus.end(), cpu)) {
+      throw std::runtime_error(rs::format(
+          RS_FMT("Network CPU {} is also a housekeeping CPU"), cpu));
+    }
+  }
+  return profile;
+}
+
+Profile Profile::load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Unable to open runtime profile {}"), path));
+  }
+  return parse(file);
+}
+
+std::string Profile::describe() const {
+  std::string s = "runtime profile: \n";
+  if (serving_cpu) {
+    const auto isolated = isolated_cpus();
+    s += rs::format(
+        RS_FMT("  serving cpu: {} ({})\n"), *serving_cpu,
+        std::count(isolated.begin(), isolated.end(), *serving_cpu)
+            ? "isolated"
+            : "not isolated");
+  } else {
+    s += "  serving cpu: any\n";
+  }
+  s += rs::format(RS_FMT("  network cpus: {}\n"),
+                  format_cpu_list(network_cpus));
+  s += rs::format(RS_FMT("  housekeeping cpus: {}\n"),
+                  format_cpu_list(housekeeping_cpus));
+  s += rs::format(RS_FMT("  wait: {}\n"),
+                  wait == Wait::BUSY ? "busy" : "block");
+  s += rs::format(RS_FMT("  realtime priority: {}\n"), realtime_priority);
+  s += rs::format(RS_FMT("  tcp nodelay: {}\n"),
+                  sockets.no_delay ? "on" : "off");
+  s += rs::format(RS_FMT("  busy poll us: {}\n"), sockets.busy_poll_us);
+  s += rs::format(RS_FMT("  receive buffer: {}\n"), sockets.receive_buffer);
+  s += rs::format(RS_FMT("  send buffer: {}\n"), sockets.send_buffer);
+  return s;
+}
+
+void Profile::check_isolation(std::size_t network_threads) const {
+  if (wait != Wait::BUSY || realtime_priority == 0) {
+    return;
+  }
+  if (!serving_cpu) {
+    throw std::runtime_error("Runtime profile busy waits at realtime "
+                             "priority without a serving CPU");
+  }
+  std::vector<unsigned> cpus{*serving_cpu};
+  cpus.insert(cpus.end(), network_cpus.begin(),
+              network_cpus.begin() +
+                  std::min(network_threads, network_cpus.size()));
+  const auto isolated = isolated_cpus();
+  for (auto cpu : cpus) {
+    if (std::count(isolated.begin(), isolated.end(), cpu) == 0) {
+      throw std::runtime_error(rs::format(
+          RS_FMT("Runtime profile busy waits at realtime priority on CPU {}, "
+                 "which is not in /sys/devices/system/cpu/isolated"),
+          cpu));
+    }
+  }
+}
+
+std::optional<std::vector<unsigned>> parse_cpu_list(const std::string &list) {
+  std::vector<unsigned> cpus;
+  std::istringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    std::istringstream bounds(range);
+    unsigned first = 0;
+    unsigned last = 0;
+    char dash = 0;
+    std::string rest;
+    if (!(bounds >> first)) {
+      return std::nullopt;
+    }
+    last = first;
+    if (bounds >> dash &&
+        (dash != '-' || !(bounds >> last) || last < first || bounds >> rest)) {
+      return std::nullopt;
+    }
+    if (last >= CPU_SETSIZE) {
+      return std::nullopt;
+    }
+    for (auto cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::vector<unsigned> isolated_cpus() {
+  std::ifstream file("/sys/devices/system/cpu/isolated");
+  std::string list;
+  if (!(file >> list)) {
+    // Missing, or empty if no CPU is isolated.
+    return {};
+  }
+  return parse_cpu_list(list).value_or(std::vector<unsigned>{});
+}
+
+void pin_thread(pthread_t thread, const std::vector<unsigned> &cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) {
+    if (cpu >= CPU_SETSIZE) {
+      throw std::runtime_error(rs::format(RS_FMT("Invalid CPU {}"), cpu));
+    }
+    CPU_SET(cpu, &set);
+  }
+  if (int error = pthread_setaffinity_np(thread, sizeof(set), &set);
+      error != 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Unable to pin thread to CPUs {}: {}"),
+                   format_cpu_list(cpus), std::strerror(error)));
+  }
+}
+
+void set_realtime_priority(int priority) {
+  sched_param param{};
+  param.sched_priority = priority;
+  if (int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+      error != 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Unable to set realtime priority {}: {}"), priority,
+                   std::strerror(error)));
+  }
+}
+
+} // namespace rs::runtime
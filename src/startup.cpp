@@ -0,0 +1,55 @@
+#include "startup.h"
+#include "format.h"
+
+extern "C" {
+#include <sys/mman.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+}
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+namespace rs::startup {
+
+// Stack prefaulted at startup, far more than handling any message needs.
+constexpr std::size_t stack_length = 1 << 18;
+constexpr std::size_t page_length = 1 << 12;
+
+void lock_memory() {
+  // Locking on fault instead of populating every mapping, which would also
+  // populate reserved but unused address space, e.g. of sanitizers.
+#ifdef MCL_ONFAULT
+  constexpr int flags = MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT;
+#else
+  constexpr int flags = MCL_CURRENT | MCL_FUTURE;
+#endif
+  if (mlockall(flags) < 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Unable to lock memory: {}"), std::strerror(errno)));
+  }
+}
+
+void retain_heap() noexcept {
+#ifdef __GLIBC__
+  // Never trim the top of the heap, and serve large blocks, up to the largest
+  // threshold glibc accepts, from the heap too instead of mapping and
+  // unmapping them each time.
+  mallopt(M_TRIM_THRESHOLD, INT_MAX);
+  mallopt(M_MMAP_THRESHOLD, 4 * 1024 * 1024 * sizeof(long));
+#endif
+}
+
+void prefault_stack() noexcept {
+  char stack[stack_length];
+  // Written through a volatile pointer, so that the writes are not elided.
+  volatile char *page = stack;
+  for (std::size_t i = 0; i < stack_length; i += page_length) {
+    page[i] = 0;
+  }
+}
+
+} // namespace rs::startup
@@ -2,6 +2,13 @@
 #include "format.h"
 #include "logging.h"
 
+extern "C" {
+#include <fcntl.h>
+#include <poll.h>
+}
+
+#include <optional>
+
 namespace rs::tcp {
 
 auto logger = rs::logging::make_logger("tcp", rs::logging::Level::INFO);
@@ -30,8 +37,8 @@ auto logger = rs::logging::make_logger("tcp", rs::logging::Level::INFO);
   }
 
   if (result.empty()) {
-    throw std::runtime_error(
-        rs::format("IP string conversion failed: ", std::strerror(errno)));
+    throw std::runtime_error(rs::format(
+        RS_FMT("IP string conversion failed: {}"), std::strerror(errno)));
   }
 
   return result;
@@ -51,30 +58,40 @@ auto logger = rs::logging::make_logger("tcp", rs::logging::Level::INFO);
   if (int error =
           getaddrinfo(address.c_str(), port.c_str(), &hints, &address_info);
       error != 0) {
-    throw std::runtime_error(
-        rs::format("Failed to call getaddrinfo: {}", gai_strerror(error)));
+    throw std::runtime_error(rs::format(
+        RS_FMT("Failed to call getaddrinfo: {}"), gai_strerror(error)));
   }
   return std::unique_ptr<addrinfo, decltype(&freeaddrinfo)>{address_info,
                                                             &freeaddrinfo};
 }
 
 [[nodiscard]] inline std::pair<int, std::string>
-create_and_bind_socket(const addrinfo *address_info) {
+create_and_bind_socket(const addrinfo *address_info, bool reuse_port) {
   // Find a valid address, create a socket, and bind address to socket
   for (auto *ai = address_info; ai != nullptr; ai = ai->ai_next) {
-    logger->debug("Trying address: '{}'", ip_to_string(ai));
+    logger->debug(RS_FMT("Trying address: '{}'"), ip_to_string(ai));
 
     // Create socket
     int socket_fd = socket(ai->ai_family, ai->ai_socktype, 0);
     if (socket_fd < 0) {
-      logger->debug("Socket creation failed: {}", std::strerror(errno));
+      logger->debug(RS_FMT("Socket creation failed: {}"), std::strerror(errno));
+      continue;
+    }
+
+    // Share the address with other servers reusing the port
+    int enable = 1;
+    if (reuse_port && setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &enable,
+                                 sizeof(enable)) < 0) {
+      logger->debug(RS_FMT("Unable to reuse port of socket {}: {}"),
+                    socket_fd, std::strerror(errno));
+      close(socket_fd);
       continue;
     }
 
     // Bind an address to the socket
     if (int status = bind(socket_fd, ai->ai_addr, ai->ai_addrlen); status < 0) {
-      logger->debug("Unable to bind address to socket {}: {}", socket_fd,
-                    std::strerror(errno));
+      logger->debug(RS_FMT("Unable to bind address to socket {}: {}"),
+                    socket_fd, std::strerror(errno));
       close(socket_fd);
       continue;
     }
@@ -84,26 +101,26 @@ create_and_bind_socket(const addrinfo *address_info) {
   }
 
   throw std::runtime_error(
-      rs::format("Unable to find a valid address, cannot bind socket"));
+      rs::format(RS_FMT("Unable to find a valid address, cannot bind socket")));
 }
 
 [[nodiscard]] inline std::pair<int, std::string>
 create_and_connect_socket(const addrinfo *address_info) {
   // Create a client socket and connect to a server socket.
   for (auto *ai = address_info; ai != nullptr; ai = ai->ai_next) {
-    logger->debug("Trying address: '{}'", ip_to_string(ai));
+    logger->debug(RS_FMT("Trying address: '{}'"), ip_to_string(ai));
 
     // Create socket
     int socket_fd = socket(ai->ai_family, ai->ai_socktype, 0);
     if (socket_fd < 0) {
-      logger->debug("Socket creation failed: {}", std::strerror(errno));
+      logger->debug(RS_FMT("Socket creation failed: {}"), std::strerror(errno));
       continue;
     }
 
     // Connect
     if (int status = connect(socket_fd, ai->ai_addr, ai->ai_addrlen);
         status < 0) {
-      logger->debug("Unable to connect socket {}: {}", socket_fd,
+      logger->debug(RS_FMT("Unable to connect socket {}: {}"), socket_fd,
                     std::strerror(errno));
       close(socket_fd);
       continue;
@@ -113,106 +130,361 @@ create_and_connect_socket(const addrinfo *address_info) {
     return {socket_fd, ip_to_string(ai)};
   }
 
-  throw std::runtime_error(
-      rs::format("Unable to find a valid address for connecting socket"));
+  throw std::runtime_error(rs::format(
+      RS_FMT("Unable to find a valid address for connecting socket")));
+}
+
+std::vector<Endpoint> resolve(const std::string &address,
+                              const std::string &port) {
+  auto address_info = get_address_info(address, port);
+  std::vector<Endpoint> endpoints;
+  for (auto *ai = address_info.get(); ai != nullptr; ai = ai->ai_next) {
+    Endpoint endpoint{};
+    std::memcpy(&endpoint.address, ai->ai_addr, ai->ai_addrlen);
+    endpoint.length = ai->ai_addrlen;
+    endpoint.family = ai->ai_family;
+    endpoint.name = rs::format(RS_FMT("{}:{}"), ip_to_string(ai), port);
+    endpoints.push_back(std::move(endpoint));
+  }
+  return endpoints;
 }
 
 void Socket::try_listen() {
   if (int status = listen(fd, backlog_length); status < 0) {
     throw std::runtime_error(
-        rs::format("Unable to listen: {}", std::strerror(errno)));
+        rs::format(RS_FMT("Unable to listen: {}"), std::strerror(errno)));
+  }
+}
+
+void Socket::set_non_blocking() const {
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Unable to set socket {} non-blocking: {}"), fd,
+                   std::strerror(errno)));
+  }
+}
+
+void Socket::set_options(const SocketOptions &options) const {
+  auto set = [this](int level, int name, int value, const char *option) {
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+      throw std::runtime_error(
+          rs::format(RS_FMT("Unable to set {} of socket {}: {}"), option, fd,
+                     std::strerror(errno)));
+    }
+  };
+  if (options.no_delay) {
+    int type = 0;
+    socklen_t length = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &length) == 0 &&
+        type == SOCK_STREAM) {
+      set(IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+  }
+  if (options.busy_poll_us > 0) {
+#ifdef SO_BUSY_POLL
+    set(SOL_SOCKET, SO_BUSY_POLL, options.busy_poll_us, "SO_BUSY_POLL");
+#else
+    throw std::runtime_error("SO_BUSY_POLL is not supported");
+#endif
+  }
+  if (options.receive_buffer > 0) {
+    set(SOL_SOCKET, SO_RCVBUF, options.receive_buffer, "SO_RCVBUF");
+  }
+  if (options.send_buffer > 0) {
+    set(SOL_SOCKET, SO_SNDBUF, options.send_buffer, "SO_SNDBUF");
   }
 }
 
 void Socket::close_fd() noexcept {
   if (fd != -1) {
-    logger->debug("Closing socket {}", fd);
+    logger->debug(RS_FMT("Closing socket {}"), fd);
     close(fd);
     fd = -1;
   }
 }
 
-Server::Server(const std::string &bind_address, const std::string &port) {
-  logger->info("Server binding to {}:{}", bind_address, port);
+Server::Server(const std::string &bind_address, const std::string &port,
+               bool reuse_port)
+    : buffer_pool_(std::make_unique<BufferPool>(2 * max_connections,
+                                                msg_buffer_length)) {
+  logger->info(RS_FMT("Server binding to {}:{}"), bind_address, port);
   auto address_info = get_address_info(bind_address, port);
-  auto [socket_fd, got_address] = create_and_bind_socket(address_info.get());
+  auto [socket_fd, got_address] =
+      create_and_bind_socket(address_info.get(), reuse_port);
   socket_ = Socket{socket_fd};
   socket_.try_listen();
-  logger->debug("Server socket {} bound to {} and is now listening", socket_.fd,
-                got_address);
+  logger->debug(RS_FMT("Server socket {} bound to {} and is now listening"),
+                socket_.fd, got_address);
 }
 
-[[nodiscard]] protocol::Message
-Server::receive_message(const Socket &socket) const {
-  logger->debug("Server reading message from socket {}", socket.fd);
-  std::string buffer(msg_buffer_length, '\0');
-  auto msg_length = recv(socket.fd, buffer.data(), buffer.size(), 0);
-  if (msg_length < 0) {
-    throw std::runtime_error(
-        rs::format("Failed reading message from socket {}: {}", socket.fd,
-                   std::strerror(errno)));
-  }
-  logger->info("Server received message of length {}", msg_length);
-  return buffer.substr(0, msg_length);
+// Writing to a connection closed by the peer must fail with EPIPE instead of
+// killing the process with SIGPIPE.
+#ifdef MSG_NOSIGNAL
+constexpr int send_flags = MSG_NOSIGNAL;
+#else
+constexpr int send_flags = 0;
+#endif
+
+[[nodiscard]] static bool would_block(int error) noexcept {
+  return error == EAGAIN || error == EWOULDBLOCK;
 }
 
-std::size_t Server::send_message(const Socket &socket,
-                                 const protocol::Message &msg) const {
-  logger->debug("Server sending message of length {} to socket {}", msg.size(),
-                socket.fd);
-  auto msg_length = send(socket.fd, msg.data(), msg.size(), 0);
+std::optional<std::size_t> receive_into(const Socket &socket, Buffer &buffer) {
+  buffer.compact();
+  if (buffer.writable() == 0) {
+    throw std::runtime_error(rs::format(
+        RS_FMT("Message from socket {} does not fit into buffer of {} bytes"),
+        socket.fd, buffer.capacity()));
+  }
+  auto msg_length = recv(socket.fd, buffer.write_ptr(), buffer.writable(), 0);
   if (msg_length < 0) {
+    if (would_block(errno) || errno == EINTR) {
+      return std::nullopt;
+    }
     throw std::runtime_error(
-        rs::format("Failed sending message to socket {}: {}", socket.fd,
-                   std::strerror(errno)));
+        rs::format(RS_FMT("Failed reading message from socket {}: {}"),
+                   socket.fd, std::strerror(errno)));
   }
-  logger->info("Server sent message of length {} to socket {}", msg_length,
-               socket.fd);
+  buffer.commit(msg_length);
   return msg_length;
 }
 
-[[nodiscard]] Socket Server::next_connection() {
+std::size_t send_all(const Socket &socket, std::string_view bytes) {
+  std::size_t sent = 0;
+  while (sent < bytes.size()) {
+    auto msg_length = ::send(socket.fd, bytes.data() + sent,
+                             bytes.size() - sent, send_flags);
+    if (msg_length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(
+          rs::format(RS_FMT("Failed sending message to socket {}: {}"),
+                     socket.fd, std::strerror(errno)));
+    }
+    sent += msg_length;
+  }
+  return sent;
+}
+
+std::size_t Server::receive(Connection &connection) const {
+  logger->debug(RS_FMT("Server reading message from socket {}"),
+                connection.socket.fd);
+  auto msg_length = receive_into(connection.socket, *connection.recv_buffer);
+  if (!msg_length) {
+    return 0;
+  }
+  if (*msg_length == 0) {
+    connection.closed = true;
+  }
+  logger->debug(RS_FMT("Server received {} bytes"), *msg_length);
+  return *msg_length;
+}
+
+std::size_t send_from(const Socket &socket, Buffer &buffer) {
+  std::size_t sent = 0;
+  while (!buffer.empty()) {
+    auto bytes = buffer.readable();
+    auto msg_length =
+        ::send(socket.fd, bytes.data(), bytes.size(), send_flags);
+    if (msg_length < 0) {
+      if (would_block(errno)) {
+        // Socket buffer is full, the rest stays queued.
+        break;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(
+          rs::format(RS_FMT("Failed sending message to socket {}: {}"),
+                     socket.fd, std::strerror(errno)));
+    }
+    buffer.consume(msg_length);
+    sent += msg_length;
+  }
+  if (buffer.empty()) {
+    buffer.clear();
+  } else {
+    // Make room for more messages behind the queued bytes.
+    buffer.compact();
+  }
+  return sent;
+}
+
+std::size_t Server::send(Connection &connection) const {
+  auto sent = send_from(connection.socket, *connection.send_buffer);
+  logger->debug(RS_FMT("Server sent {} bytes to socket {}"), sent,
+                connection.socket.fd);
+  return sent;
+}
+
+[[nodiscard]] Connection Server::next_connection() {
   sockaddr_storage client_addr;
   auto sin_size = static_cast<socklen_t>(sizeof(client_addr));
-  auto new_fd =
-      accept(socket_.fd, reinterpret_cast<sockaddr *>(&client_addr), &sin_size);
+  int new_fd = -1;
+  // Interrupted by a signal, e.g. a profiler dump request, keep waiting.
+  do {
+    new_fd = accept(socket_.fd, reinterpret_cast<sockaddr *>(&client_addr),
+                    &sin_size);
+  } while (new_fd < 0 && errno == EINTR);
   if (new_fd < 0) {
     throw std::runtime_error(
-        rs::format("Failed accepting new connection to socket {}: {}",
+        rs::format(RS_FMT("Failed accepting new connection to socket {}: {}"),
                    socket_.fd, std::strerror(errno)));
   }
-  return Socket{new_fd};
+  Socket socket{new_fd};
+  return Connection{std::move(socket), buffer_pool_->acquire(),
+                    buffer_pool_->acquire()};
 }
 
 Client::Client(const std::string &server_addr, const std::string &port) {
-  logger->debug("Client connecting to {}:{}", server_addr, port);
+  logger->debug(RS_FMT("Client connecting to {}:{}"), server_addr, port);
   auto address_info = get_address_info(server_addr, port);
   auto [socket_fd, got_address] = create_and_connect_socket(address_info.get());
   socket_ = Socket{socket_fd};
-  logger->info("Socket {} connected to '{}'", socket_.fd, got_address);
+  logger->info(RS_FMT("Socket {} connected to '{}'"), socket_.fd, got_address);
 }
 
-[[nodiscard]] protocol::Message Client::receive_message() const {
-  logger->debug("Client reading server response");
-  std::string buffer(msg_buffer_length, '\0');
-  auto msg_length = recv(socket_.fd, buffer.data(), buffer.size(), 0);
-  if (msg_length < 0) {
-    throw std::runtime_error(
-        rs::format("Failed reading message from socket {}: {}", socket_.fd,
-                   std::strerror(errno)));
+Client::Client(const std::vector<Endpoint> &endpoints,
+               std::optional<std::chrono::milliseconds> connect_timeout) {
+  for (const auto &endpoint : endpoints) {
+    logger->debug(RS_FMT("Client connecting to {}"), endpoint.name);
+    Socket socket{::socket(endpoint.family, SOCK_STREAM, 0)};
+    if (socket.fd < 0) {
+      logger->debug(RS_FMT("Socket creation failed: {}"), std::strerror(errno));
+      continue;
+    }
+
+    // Connect without blocking and wait for the connection to complete, up
+    // to the timeout
+    const int flags = fcntl(socket.fd, F_GETFL);
+    if (connect_timeout) {
+      socket.set_non_blocking();
+    }
+    const auto *address =
+        reinterpret_cast<const sockaddr *>(&endpoint.address);
+    int status = connect(socket.fd, address, endpoint.length);
+    if (status < 0 && errno == EINPROGRESS) {
+      pollfd connecting{socket.fd, POLLOUT, 0};
+      int error = ETIMEDOUT;
+      if (poll(&connecting, 1, static_cast<int>(connect_timeout->count())) >
+          0) {
+        auto length = static_cast<socklen_t>(sizeof(error));
+        getsockopt(socket.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+      }
+      status = error == 0 ? 0 : -1;
+      errno = error;
+    }
+    if (status < 0) {
+      logger->debug(RS_FMT("Unable to connect to {}: {}"), endpoint.name,
+                    std::strerror(errno));
+      continue;
+    }
+    if (fcntl(socket.fd, F_SETFL, flags) < 0) {
+      throw std::runtime_error(
+          rs::format(RS_FMT("Unable to set socket {} blocking: {}"), socket.fd,
+                     std::strerror(errno)));
+    }
+
+    socket_ = std::move(socket);
+    logger->info(RS_FMT("Socket {} connected to '{}'"), socket_.fd,
+                 endpoint.name);
+    return;
   }
-  return buffer.substr(0, msg_length);
+
+  throw std::runtime_error(rs::format(
+      RS_FMT("Unable to connect to {}"),
+      endpoints.empty() ? "no address" : endpoints.front().name));
 }
 
-std::size_t Client::send_message(const protocol::Message &msg) const {
-  logger->debug("Client sending message of size {}", msg.size());
-  auto msg_length = send(socket_.fd, msg.data(), msg.size(), 0);
-  if (msg_length < 0) {
-    throw std::runtime_error(
-        rs::format("Failed sending message to socket {}: {}", socket_.fd,
-                   std::strerror(errno)));
+[[nodiscard]] protocol::MessageView Client::receive_message() {
+  logger->debug(RS_FMT("Client reading server response"));
+  protocol::MessageView msg;
+  while (!protocol::next_message(recv_buffer_, msg)) {
+    if (receive_into(socket_, recv_buffer_) == 0) {
+      return {};
+    }
   }
+  return msg;
+}
+
+[[nodiscard]] std::optional<protocol::MessageView>
+Client::receive_message(std::chrono::milliseconds timeout) {
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  protocol::MessageView msg;
+  while (!protocol::next_message(recv_buffer_, msg)) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    pollfd readable{socket_.fd, POLLIN, 0};
+    int ready = poll(&readable, 1,
+                     static_cast<int>(std::max<long long>(left.count(), 0)));
+    if (ready < 0 && errno != EINTR) {
+      throw std::runtime_error(
+          rs::format(RS_FMT("Failed polling socket {}: {}"), socket_.fd,
+                     std::strerror(errno)));
+    }
+    if (ready == 0) {
+      return std::nullopt;
+    }
+    if (ready > 0 && receive_into(socket_, recv_buffer_) == 0) {
+      return protocol::MessageView{};
+    }
+  }
+  return msg;
+}
+
+std::size_t Client::send_message(protocol::MessageView msg) {
+  logger->debug(RS_FMT("Client sending message of size {}"), msg.size());
+  send_buffer_.append(msg);
+  send_buffer_.append(protocol::message_delimiter);
+  return flush();
+}
+
+std::size_t Client::flush() {
+  auto msg_length = send_all(socket_, send_buffer_.readable());
+  send_buffer_.clear();
   return msg_length;
 }
 
+std::size_t Client::flush(std::chrono::milliseconds timeout) {
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::size_t sent = 0;
+  while (!send_buffer_.empty()) {
+    auto bytes = send_buffer_.readable();
+    auto msg_length = ::send(socket_.fd, bytes.data(), bytes.size(),
+                             send_flags | MSG_DONTWAIT);
+    if (msg_length >= 0) {
+      send_buffer_.consume(msg_length);
+      sent += msg_length;
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (!would_block(errno)) {
+      throw std::runtime_error(
+          rs::format(RS_FMT("Failed sending message to socket {}: {}"),
+                     socket_.fd, std::strerror(errno)));
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    pollfd writable{socket_.fd, POLLOUT, 0};
+    int ready = left.count() > 0
+                    ? poll(&writable, 1, static_cast<int>(left.count()))
+                    : 0;
+    if (ready == 0) {
+      throw std::runtime_error(
+          rs::format(RS_FMT("Socket {} took {} of {} bytes within {} ms"),
+                     socket_.fd, sent, sent + bytes.size(), timeout.count()));
+    }
+    if (ready < 0 && errno != EINTR) {
+      throw std::runtime_error(
+          rs::format(RS_FMT("Failed polling socket {}: {}"), socket_.fd,
+                     std::strerror(errno)));
+    }
+  }
+  send_buffer_.clear();
+  return sent;
+}
+
 } // namespace rs::tcp
@@ -0,0 +1,156 @@
+#include "trace.h"
+#include "format.h"
+
+extern "C" {
+#include <signal.h>
+}
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace rs::trace {
+
+std::atomic<uint32_t> Profiler::period_{0};
+std::atomic<bool> Profiler::dump_requested_{false};
+std::atomic<bool> Profiler::dumps_on_signal_{false};
+thread_local uint32_t Profiler::countdown_{1};
+
+namespace {
+
+constexpr std::array<const char *, stage_count> stage_names = {
+    "receive", "decode",      "new_order",      "modify_order", "delete_order",
+    "trade",   "order_batch", "position_query", "logon",        "send"};
+
+// A sample is the stage in the top byte and the cycles below it, so that it
+// is written and read as one word while other threads dump the ring.
+constexpr unsigned stage_shift = 56;
+constexpr uint64_t cycles_mask = (uint64_t{1} << stage_shift) - 1;
+
+// Written by its thread only, read by the thread dumping all rings.
+struct Ring {
+  std::unique_ptr<std::atomic<uint64_t>[]> samples{
+      new std::atomic<uint64_t>[Profiler::ring_length]};
+  // Samples recorded so far, the last ring_length of them are kept.
+  std::atomic<std::size_t> recorded{0};
+};
+
+// Rings of all threads that have recorded a sample, kept after their threads
+// exit.
+std::mutex rings_mutex;
+std::vector<std::shared_ptr<Ring>> rings;
+
+// Allocated and registered by the first sample of the thread.
+thread_local std::shared_ptr<Ring> ring;
+
+// Cycle counter and clock when sampling started, for converting cycles to
+// nanoseconds.
+std::atomic<uint64_t> start_cycles{0};
+std::atomic<int64_t> start_ns{0};
+
+int64_t now_ns() noexcept {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+void Profiler::start(uint32_t period) noexcept {
+  start_cycles = cycles();
+  start_ns = now_ns();
+  period_ = period;
+}
+
+void Profiler::record(Stage stage, uint64_t cycles) noexcept {
+  if (!ring) {
+    ring = std::make_shared<Ring>();
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    rings.push_back(ring);
+  }
+  auto recorded = ring->recorded.load(std::memory_order_relaxed);
+  ring->samples[recorded % ring_length].store(
+      (uint64_t{static_cast<uint8_t>(stage)} << stage_shift) |
+          (cycles & cycles_mask),
+      std::memory_order_relaxed);
+  ring->recorded.store(recorded + 1, std::memory_order_release);
+}
+
+std::string Profiler::dump() {
+  std::string s = "profile: \n";
+  // Samples being overwritten while they are read are counted with either
+  // their old or their new value.
+  std::array<std::vector<uint64_t>, stage_count> per_stage;
+  std::size_t thread_count = 0;
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for (const auto &thread_ring : rings) {
+      const auto kept = std::min(
+          thread_ring->recorded.load(std::memory_order_acquire), ring_length);
+      thread_count += kept > 0;
+      for (std::size_t i = 0; i < kept; ++i) {
+        auto sample =
+            thread_ring->samples[i].load(std::memory_order_relaxed);
+        per_stage[sample >> stage_shift].push_back(sample & cycles_mask);
+      }
+    }
+  }
+  if (thread_count == 0) {
+    s += "  no samples\n";
+    return s;
+  }
+  const auto elapsed_cycles = cycles() - start_cycles;
+  const auto elapsed_ns = now_ns() - start_ns;
+  const uint64_t ps_per_cycle =
+      elapsed_cycles == 0
+          ? 0
+          : static_cast<uint64_t>(elapsed_ns) * 1000 / elapsed_cycles;
+  auto ns = [ps_per_cycle](uint64_t cycles) {
+    return cycles * ps_per_cycle / 1000;
+  };
+  s += rs::format(RS_FMT("  sampling period: {}\n"), period_.load());
+  s += rs::format(RS_FMT("  ps per cycle: {}\n"), ps_per_cycle);
+  s += rs::format(RS_FMT("  threads: {}\n"), thread_count);
+  for (std::size_t stage = 0; stage < stage_count; ++stage) {
+    auto &samples = per_stage[stage];
+    if (samples.empty()) {
+      continue;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](std::size_t p) {
+      return samples[(samples.size() - 1) * p / 100];
+    };
+    s += rs::format(RS_FMT("  {}: \n"), stage_names[stage]);
+    s += rs::format(RS_FMT("    samples: {}\n"), samples.size());
+    s += rs::format(RS_FMT("    cycles min/p50/p99/max: {}/{}/{}/{}\n"),
+                    samples.front(), percentile(50), percentile(99),
+                    samples.back());
+    s += rs::format(RS_FMT("    ns p50/p99/max: {}/{}/{}\n"),
+                    ns(percentile(50)), ns(percentile(99)),
+                    ns(samples.back()));
+  }
+  return s;
+}
+
+void Profiler::dump_on_signal(int signal) {
+  struct sigaction action {};
+  // Only sets a lock-free flag, which is safe in a signal handler. The
+  // serving threads look at it at least every dump_check_interval, and
+  // system calls interrupted by the signal are restarted where possible.
+  action.sa_handler = [](int) { dump_requested_.store(true); };
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(signal, &action, nullptr) < 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Unable to handle signal {}: {}"), signal,
+                   std::strerror(errno)));
+  }
+  dumps_on_signal_ = true;
+}
+
+} // namespace rs::trace
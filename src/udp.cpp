@@ -0,0 +1,236 @@
+#include "udp.h"
+#include "format.h"
+#include "logging.h"
+
+extern "C" {
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+namespace rs::udp {
+
+auto logger = rs::logging::make_logger("udp", rs::logging::Level::INFO);
+
+[[nodiscard]] static auto get_address_info(const std::string &address,
+                                           const std::string &port) {
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  addrinfo *address_info;
+  if (int error =
+          getaddrinfo(address.c_str(), port.c_str(), &hints, &address_info);
+      error != 0) {
+    throw std::runtime_error(rs::format(
+        RS_FMT("Failed to call getaddrinfo: {}"), gai_strerror(error)));
+  }
+  return std::unique_ptr<addrinfo, decltype(&freeaddrinfo)>{address_info,
+                                                            &freeaddrinfo};
+}
+
+[[nodiscard]] static bool is_multicast(const addrinfo *ai) {
+  switch (ai->ai_family) {
+  case AF_INET: {
+    const auto *sa = reinterpret_cast<const sockaddr_in *>(ai->ai_addr);
+    return IN_MULTICAST(ntohl(sa->sin_addr.s_addr));
+  }
+  case AF_INET6: {
+    const auto *sa6 = reinterpret_cast<const sockaddr_in6 *>(ai->ai_addr);
+    return IN6_IS_ADDR_MULTICAST(&sa6->sin6_addr);
+  }
+  default:
+    return false;
+  }
+}
+
+// Bind socket to the wildcard address at the port of the multicast group and
+// join the group on the default interface.
+static void bind_and_join_group(int socket_fd, const addrinfo *ai) {
+  int reuse = 1;
+  if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) <
+      0) {
+    throw std::runtime_error(rs::format(
+        RS_FMT("Unable to set SO_REUSEADDR: {}"), std::strerror(errno)));
+  }
+
+  if (ai->ai_family == AF_INET) {
+    auto group = *reinterpret_cast<const sockaddr_in *>(ai->ai_addr);
+    sockaddr_in any = group;
+    any.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(socket_fd, reinterpret_cast<sockaddr *>(&any), sizeof(any)) < 0) {
+      throw std::runtime_error(rs::format(
+          RS_FMT("Unable to bind multicast socket: {}"), std::strerror(errno)));
+    }
+    ip_mreq request;
+    request.imr_multiaddr = group.sin_addr;
+    request.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(socket_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request,
+                   sizeof(request)) < 0) {
+      throw std::runtime_error(rs::format(
+          RS_FMT("Unable to join multicast group: {}"), std::strerror(errno)));
+    }
+  } else {
+    auto group = *reinterpret_cast<const sockaddr_in6 *>(ai->ai_addr);
+    sockaddr_in6 any = group;
+    any.sin6_addr = in6addr_any;
+    if (bind(socket_fd, reinterpret_cast<sockaddr *>(&any), sizeof(any)) < 0) {
+      throw std::runtime_error(rs::format(
+          RS_FMT("Unable to bind multicast socket: {}"), std::strerror(errno)));
+    }
+    ipv6_mreq request;
+    request.ipv6mr_multiaddr = group.sin6_addr;
+    request.ipv6mr_interface = 0;
+    if (setsockopt(socket_fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &request,
+                   sizeof(request)) < 0) {
+      throw std::runtime_error(rs::format(
+          RS_FMT("Unable to join multicast group: {}"), std::strerror(errno)));
+    }
+  }
+}
+
+Receiver::Receiver(const std::string &address, const std::string &port)
+    : buffers_(batch_length * datagram_length) {
+  logger->info(RS_FMT("Receiver binding to {}:{}"), address, port);
+  auto address_info = get_address_info(address, port);
+  const auto *ai = address_info.get();
+
+  int socket_fd = ::socket(ai->ai_family, ai->ai_socktype, 0);
+  if (socket_fd < 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Socket creation failed: {}"), std::strerror(errno)));
+  }
+  socket_ = tcp::Socket{socket_fd};
+
+  if (is_multicast(ai)) {
+    bind_and_join_group(socket_.fd, ai);
+  } else if (bind(socket_.fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Unable to bind address to socket {}: {}"),
+                   socket_.fd, std::strerror(errno)));
+  }
+
+  // Reading a batch must never block the caller.
+  if (fcntl(socket_.fd, F_SETFL, fcntl(socket_.fd, F_GETFL) | O_NONBLOCK) < 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Unable to set socket {} non-blocking: {}"),
+                   socket_.fd, std::strerror(errno)));
+  }
+  logger->debug(RS_FMT("Receiver socket {} is now bound"), socket_.fd);
+}
+
+[[nodiscard]] std::size_t Receiver::receive_batch() {
+#ifdef __linux__
+  std::array<iovec, batch_length> iovecs;
+  std::array<mmsghdr, batch_length> headers;
+  for (std::size_t i = 0; i < batch_length; ++i) {
+    iovecs[i].iov_base = buffers_.data() + i * datagram_length;
+    iovecs[i].iov_len = datagram_length;
+    std::memset(&headers[i].msg_hdr, 0, sizeof(headers[i].msg_hdr));
+    headers[i].msg_hdr.msg_iov = &iovecs[i];
+    headers[i].msg_hdr.msg_iovlen = 1;
+  }
+  int count = recvmmsg(socket_.fd, headers.data(), batch_length, 0, nullptr);
+  if (count < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
+    throw std::runtime_error(
+        rs::format(RS_FMT("Failed reading datagrams from socket {}: {}"),
+                   socket_.fd, std::strerror(errno)));
+  }
+  std::size_t kept = 0;
+  for (int i = 0; i < count; ++i) {
+    if (keep(kept, i, headers[i].msg_len,
+             headers[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+      ++kept;
+    }
+  }
+  return kept;
+#else
+  // No recvmmsg, read one datagram per syscall.
+  std::size_t kept = 0;
+  for (std::size_t slot = 0; slot < batch_length; ++slot) {
+    iovec iov{buffers_.data() + slot * datagram_length, datagram_length};
+    msghdr header{};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    auto msg_length = recvmsg(socket_.fd, &header, 0);
+    if (msg_length < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      throw std::runtime_error(
+          rs::format(RS_FMT("Failed reading datagram from socket {}: {}"),
+                     socket_.fd, std::strerror(errno)));
+    }
+    if (keep(kept, slot, static_cast<std::size_t>(msg_length),
+             header.msg_flags & MSG_TRUNC)) {
+      ++kept;
+    }
+  }
+  return kept;
+#endif
+}
+
+bool Receiver::keep(std::size_t count, std::size_t slot, std::size_t length,
+                    bool was_truncated) noexcept {
+  if (was_truncated) {
+    ++truncated;
+    logger->warn(
+        RS_FMT("Dropping datagram longer than {} bytes from socket {}"),
+        datagram_length, socket_.fd);
+    return false;
+  }
+  slots_[count] = slot;
+  lengths_[count] = length;
+  return true;
+}
+
+Sender::Sender(const std::string &address, const std::string &port) {
+  logger->debug(RS_FMT("Sender sending to {}:{}"), address, port);
+  auto address_info = get_address_info(address, port);
+  const auto *ai = address_info.get();
+
+  int socket_fd = ::socket(ai->ai_family, ai->ai_socktype, 0);
+  if (socket_fd < 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Socket creation failed: {}"), std::strerror(errno)));
+  }
+  socket_ = tcp::Socket{socket_fd};
+  std::memcpy(&address_, ai->ai_addr, ai->ai_addrlen);
+  address_length_ = ai->ai_addrlen;
+
+  // Allow receivers on the same host to see our multicast datagrams.
+  if (is_multicast(ai)) {
+    int loop = 1;
+    if (ai->ai_family == AF_INET) {
+      setsockopt(socket_.fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
+                 sizeof(loop));
+    } else {
+      setsockopt(socket_.fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop,
+                 sizeof(loop));
+    }
+  }
+}
+
+std::size_t Sender::send_message(const protocol::Message &msg) const {
+  logger->debug(RS_FMT("Sender sending datagram of size {}"), msg.size());
+  auto msg_length =
+      sendto(socket_.fd, msg.data(), msg.size(), 0,
+             reinterpret_cast<const sockaddr *>(&address_), address_length_);
+  if (msg_length < 0) {
+    throw std::runtime_error(
+        rs::format(RS_FMT("Failed sending datagram to socket {}: {}"),
+                   socket_.fd, std::strerror(errno)));
+  }
+  return msg_length;
+}
+
+} // namespace rs::udp
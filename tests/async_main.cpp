@@ -0,0 +1,95 @@
+#include "async_risk_client.h"
+#include "event_loop.h"
+#include "format.h"
+#include <iostream>
+
+using namespace rs::protocol;
+
+namespace {
+
+enum class Instrument : unsigned {
+  OurStock = 1,
+  OtherStock = 2,
+};
+
+NewOrder make_order(Instrument instrument, uint64_t order_id,
+                    uint64_t quantity, char side) {
+  return {NewOrder::MESSAGE_TYPE, static_cast<uint64_t>(instrument), order_id,
+          quantity, 1, side};
+}
+
+// Spawned coroutines must not throw.
+rs::co::Task<> check_order(rs::AsyncRiskClient &client, NewOrder order) {
+  try {
+    auto response = co_await client.check(order);
+    std::cout << rs::format(RS_FMT("order {} {}\n"), order.orderId,
+                            response.status == OrderResponse::Status::ACCEPTED
+                                ? "accepted"
+                                : "rejected");
+  } catch (const std::exception &error) {
+    std::cerr << rs::format(RS_FMT("order {} failed: {}\n"), order.orderId,
+                            error.what());
+  }
+}
+
+rs::co::Task<> trade_and_batch(rs::AsyncRiskClient &client) {
+  try {
+    co_await client.post(
+        Trade{Trade::MESSAGE_TYPE,
+              static_cast<uint64_t>(Instrument::OtherStock), 1, 4, 1});
+    co_await client.post(DeleteOrder{DeleteOrder::MESSAGE_TYPE, 3});
+
+    // Last entry exceeds the max buy position, so the first batch is rejected
+    // as a whole and the second batch is accepted partially.
+    OrderBatch batch{OrderBatch::MESSAGE_TYPE, OrderBatch::ALL_OR_NOTHING, 3,
+                     {}};
+    for (std::size_t i = 0; i < batch.count; ++i) {
+      batch.entries[i] = {NewOrder::MESSAGE_TYPE,
+                          static_cast<uint64_t>(Instrument::OurStock),
+                          5 + i,
+                          i < 2 ? 5u : 1u,
+                          1,
+                          'B'};
+    }
+    for (auto flags : {OrderBatch::ALL_OR_NOTHING, OrderBatch::NONE}) {
+      batch.flags = flags;
+      auto response = co_await client.check(batch);
+      for (std::size_t i = 0; i < response.count; ++i) {
+        std::cout << rs::format(RS_FMT("batch order {} {}\n"),
+                                batch.entries[i].orderId,
+                                response.is_accepted(i) ? "accepted"
+                                                        : "rejected");
+      }
+    }
+  } catch (const std::exception &error) {
+    std::cerr << rs::format(RS_FMT("batch failed: {}\n"), error.what());
+  }
+}
+
+// Check the first orders concurrently, then the rest in sequence once they are
+// done.
+rs::co::Task<> run(rs::co::EventLoop &loop, rs::AsyncRiskClient &client) {
+  loop.spawn(check_order(client, make_order(Instrument::OurStock, 1, 10, 'B')));
+  loop.spawn(
+      check_order(client, make_order(Instrument::OtherStock, 2, 15, 'S')));
+  loop.spawn(check_order(client, make_order(Instrument::OtherStock, 3, 4, 'B')));
+  co_await check_order(client, make_order(Instrument::OtherStock, 4, 20, 'B'));
+  co_await trade_and_batch(client);
+}
+
+} // namespace
+
+int main(const int argc, const char *argv[]) {
+  if (argc != 3) {
+    std::cerr << rs::format(RS_FMT("error: wrong number of args {} out of {}"),
+                            argc - 1, 2)
+              << '\n';
+    std::cerr << "usage: test-async server_address server_port\n";
+    exit(2);
+  }
+
+  rs::co::EventLoop loop;
+  rs::AsyncRiskClient client(loop, argv[1], argv[2]);
+  loop.spawn(run(loop, client));
+  loop.run();
+}
@@ -0,0 +1,110 @@
+/*
+ * Benchmark of FieldBatch against the per-message text decoders, on a buffer
+ * of NewOrder messages with their headers.
+ *
+ *   risk-batch-bench [repetitions]
+ *
+ * Each decoder takes the whole buffer apart, header and payload of every
+ * message, repetitions times. The fastest repetition is printed as bytes per
+ * second, as slower ones are mostly other processes taking the CPU.
+ */
+
+#include "field_batch.h"
+#include "format.h"
+#include "protocol.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+using namespace rs::protocol;
+
+// Messages as they arrive from a gateway, with fields of 1 to 19 digits.
+std::string order_flow(std::size_t size) {
+  std::string text;
+  for (uint64_t i = 0; text.size() < size; ++i) {
+    text += encode(Header{1, 40, static_cast<uint32_t>(i),
+                          1'624'217'690'000'000'000 + i},
+                   NewOrder{NewOrder::MESSAGE_TYPE, i % 64, i, 1 + i % 100,
+                            1'000'000 + i % 5000, i % 2 ? 'B' : 'S'});
+    text += message_delimiter;
+  }
+  return text;
+}
+
+uint64_t checksum(const Header &h, const NewOrder &p) {
+  return h.sequenceNumber + h.timestamp + p.listingId + p.orderId +
+         p.orderQuantity + p.orderPrice;
+}
+
+uint64_t decode_text(std::string_view bytes) {
+  uint64_t sum = 0;
+  for (auto end = bytes.find(message_delimiter); end != bytes.npos;
+       end = bytes.find(message_delimiter)) {
+    const auto msg = bytes.substr(0, end);
+    sum += checksum(decode_header(msg), decode_payload<NewOrder>(msg));
+    bytes.remove_prefix(end + 1);
+  }
+  return sum;
+}
+
+uint64_t decode_batch(FieldBatch &batch, std::string_view bytes) {
+  uint64_t sum = 0;
+  while (const auto count = batch.decode(bytes)) {
+    for (std::size_t i = 0; i < count; ++i) {
+      sum += checksum(decode_header(batch[i]),
+                      decode_payload<NewOrder>(batch[i]));
+    }
+    bytes.remove_prefix(batch.end(count - 1));
+  }
+  return sum;
+}
+
+// Bytes per second of the fastest of repetitions calls of decode.
+template <typename Decode>
+double best_rate(const std::string &text, uint64_t repetitions,
+                 Decode decode) {
+  const auto expected = decode_text(text);
+  double best = 0;
+  for (uint64_t i = 0; i < repetitions; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto sum = decode(text);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (sum != expected) {
+      throw std::runtime_error("Decoders differ");
+    }
+    best = std::max(best, text.size() / elapsed.count());
+  }
+  return best;
+}
+
+} // namespace
+
+int main(const int argc, const char *argv[]) {
+  if (argc > 2) {
+    std::cerr << "usage: risk-batch-bench [repetitions]\n";
+    exit(2);
+  }
+  const uint64_t repetitions = argc == 2 ? std::stoull(argv[1]) : 2000;
+  try {
+    const auto text = order_flow(1 << 16);
+    FieldBatch batch;
+    const auto text_rate = best_rate(text, repetitions, decode_text);
+    const auto batch_rate = best_rate(text, repetitions, [&](auto &bytes) {
+      return decode_batch(batch, bytes);
+    });
+    std::cout << rs::format(RS_FMT("text: {} MB/s, batch ({}): {} MB/s\n"),
+                            static_cast<uint64_t>(text_rate / 1e6),
+                            FieldBatch::instruction_set(),
+                            static_cast<uint64_t>(batch_rate / 1e6));
+  } catch (const std::exception &error) {
+    std::cerr << rs::format(RS_FMT("FAILED {}\n"), error.what());
+    return 1;
+  }
+}
@@ -0,0 +1,289 @@
+/*
+ * Failover of RiskClient between scripted replicas.
+ *
+ * Each scenario runs a client against a primary and a standby on local
+ * ports, played by threads that answer as scripted, and checks the responses
+ * the client hands out and the requests the replicas receive:
+ *
+ *   risk-failover-test [base_port]
+ *
+ * Ports from base_port on, default 47400, must be free.
+ */
+
+#include "format.h"
+#include "risk_client.h"
+#include "tcp.h"
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+
+using namespace rs;
+using namespace rs::protocol;
+using Status = OrderResponse::Status;
+
+constexpr uint64_t session = 7;
+
+struct Failure : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+void check(bool ok, const char *what) {
+  if (!ok) {
+    throw Failure(what);
+  }
+}
+
+// Replica played by a thread, serving one connection of the client.
+class Scripted {
+
+public:
+  explicit Scripted(const std::string &port) : server_("127.0.0.1", port) {}
+
+  // Accept the connection of the client and run script on it.
+  void play(std::function<void(Scripted &)> script) {
+    thread_ = std::thread([this, script = std::move(script)] {
+      try {
+        connection_.emplace(server_.next_connection());
+        script(*this);
+      } catch (const std::exception &error) {
+        failure_ = error.what();
+      }
+      // Closes the connection.
+      connection_.reset();
+    });
+  }
+
+  // Wait for the script to end, and return why it failed, if it did.
+  const std::string &join() {
+    thread_.join();
+    return failure_;
+  }
+
+  // Next request other than a heartbeat, which are answered unless silent, or
+  // nothing if the client closed the connection.
+  std::optional<Header> receive() {
+    while (true) {
+      MessageView msg;
+      while (!next_message(*connection_->recv_buffer, msg)) {
+        server_.receive(*connection_);
+        if (connection_->closed) {
+          return std::nullopt;
+        }
+      }
+      auto header = decode_header(msg);
+      if (header.version != Heartbeat::MESSAGE_TYPE) {
+        return header;
+      }
+      if (!silent) {
+        answer(Header{header.version, sizeof(Heartbeat), 0, 0},
+               decode_payload<Heartbeat>(msg));
+      }
+    }
+  }
+
+  // Receive the next request, which must be of type.
+  Header expect(uint16_t type) {
+    auto header = receive();
+    check(header && header->version == type, "unexpected request");
+    return *header;
+  }
+
+  template <typename Payload>
+  void answer(const Header &header, const Payload &payload) {
+    encode(*connection_->send_buffer, header, payload);
+    server_.send(*connection_);
+  }
+
+  void log_on(uint32_t expected) {
+    expect(Logon::MESSAGE_TYPE);
+    answer(Header{SessionStatus::MESSAGE_TYPE, sizeof(SessionStatus), 0, 0},
+           SessionStatus{SessionStatus::MESSAGE_TYPE, session, expected});
+  }
+
+  void accept(const Header &request, uint64_t order_id) {
+    answer(Header{OrderResponse::MESSAGE_TYPE, sizeof(OrderResponse),
+                  request.sequenceNumber, 0},
+           OrderResponse{OrderResponse::MESSAGE_TYPE, order_id,
+                         Status::ACCEPTED});
+  }
+
+  // Wait until the client closes the connection.
+  void drain() {
+    while (receive()) {
+    }
+  }
+
+  // Heartbeats are not answered.
+  bool silent{false};
+
+private:
+  tcp::Server server_;
+  std::optional<tcp::Connection> connection_;
+  std::thread thread_;
+  std::string failure_;
+};
+
+NewOrder order(uint64_t id) {
+  return NewOrder{NewOrder::MESSAGE_TYPE, 1, id, 10, 1, 'B'};
+}
+
+// Run scenario with a primary and a standby, both played as scripted.
+void run(const char *name, unsigned &port,
+         std::function<void(Scripted &)> primary_script,
+         std::function<void(Scripted &)> standby_script,
+         std::function<void(RiskClient &)> client_script) {
+  const auto primary_port = std::to_string(port++);
+  const auto standby_port = std::to_string(port++);
+  Scripted primary(primary_port);
+  Scripted standby(standby_port);
+  primary.play(std::move(primary_script));
+  standby.play(std::move(standby_script));
+  // Scripts waiting for the client see it close its connections.
+  std::exception_ptr failure;
+  try {
+    RiskClient client({{"127.0.0.1", primary_port},
+                       {"127.0.0.1", standby_port}});
+    client.logon(session);
+    client_script(client);
+  } catch (...) {
+    failure = std::current_exception();
+  }
+  const auto &primary_failure = primary.join();
+  const auto &standby_failure = standby.join();
+  for (const auto &script_failure : {primary_failure, standby_failure}) {
+    if (!script_failure.empty()) {
+      throw Failure(rs::format(RS_FMT("{}: {}"), name, script_failure));
+    }
+  }
+  if (failure) {
+    std::rethrow_exception(failure);
+  }
+  std::cout << rs::format(RS_FMT("ok {}\n"), name);
+}
+
+bool accepted(const std::optional<OrderResponse> &response) {
+  return response && response->status == Status::ACCEPTED;
+}
+
+} // namespace
+
+int main(const int argc, const char *argv[]) {
+  if (argc > 2) {
+    std::cerr << "usage: risk-failover-test [base_port]\n";
+    exit(2);
+  }
+  unsigned port = argc == 2 ? std::stoul(argv[1]) : 47400;
+  // Failing over is expected.
+  rs::logger->threshold = logging::Level::CRITICAL;
+
+  try {
+    // The old primary accepted order 1 and lost the connection with order 2
+    // in flight. The promoted standby does not know the session, so order 2
+    // is unknown rather than sent again and rejected as a duplicate.
+    run(
+        "promoted standby", port,
+        [](Scripted &primary) {
+          primary.log_on(0);
+          primary.accept(primary.expect(NewOrder::MESSAGE_TYPE), 1);
+          primary.expect(NewOrder::MESSAGE_TYPE);
+        },
+        [](Scripted &standby) {
+          standby.log_on(0);
+          auto request = standby.expect(NewOrder::MESSAGE_TYPE);
+          check(request.sequenceNumber == 3, "order 2 not sent again");
+          standby.accept(request, 3);
+          standby.drain();
+        },
+        [](RiskClient &client) {
+          client.send_message(order(1));
+          check(accepted(client.wait_for_response()), "order 1 accepted");
+          client.send_message(order(2));
+          check(!client.wait_for_response(), "order 2 unknown");
+          client.send_message(order(3));
+          check(accepted(client.wait_for_response()), "order 3 accepted");
+        });
+
+    // A silent primary is given up after a heartbeat and its timeout. The
+    // standby knows the session up to order 1, which is sent again.
+    run(
+        "silent primary", port,
+        [](Scripted &primary) {
+          primary.log_on(0);
+          primary.expect(NewOrder::MESSAGE_TYPE);
+          primary.silent = true;
+          primary.drain();
+        },
+        [](Scripted &standby) {
+          standby.log_on(1);
+          standby.accept(standby.expect(NewOrder::MESSAGE_TYPE), 1);
+          standby.drain();
+        },
+        [](RiskClient &client) {
+          const auto start = std::chrono::steady_clock::now();
+          client.send_message(order(1));
+          check(accepted(client.wait_for_response()), "order 1 accepted");
+          check(std::chrono::steady_clock::now() - start <
+                    std::chrono::milliseconds{900},
+                "failed over within heartbeat interval and timeout");
+        });
+
+    // The standby has handled order 1, but its response has left the window,
+    // so it answers order 1 sent again with its session status.
+    run(
+        "replay miss", port,
+        [](Scripted &primary) {
+          primary.log_on(0);
+          primary.expect(NewOrder::MESSAGE_TYPE);
+        },
+        [](Scripted &standby) {
+          standby.log_on(2);
+          auto request = standby.expect(NewOrder::MESSAGE_TYPE);
+          check(request.sequenceNumber == 1, "order 1 sent again");
+          standby.answer(Header{SessionStatus::MESSAGE_TYPE,
+                                sizeof(SessionStatus), request.sequenceNumber,
+                                0},
+                         SessionStatus{SessionStatus::MESSAGE_TYPE, session,
+                                       2});
+          standby.drain();
+        },
+        [](RiskClient &client) {
+          client.send_message(order(1));
+          check(!client.wait_for_response(), "order 1 unknown");
+        });
+
+    // Deletions are not answered, the window of requests in flight fills up
+    // unless responses or heartbeats confirm them.
+    run(
+        "bounded window", port,
+        [](Scripted &primary) {
+          primary.log_on(0);
+          primary.drain();
+        },
+        [](Scripted &standby) { standby.drain(); },
+        [](RiskClient &client) {
+          for (std::size_t i = 0; i < RiskClient::max_in_flight; ++i) {
+            client.send_message(
+                DeleteOrder{DeleteOrder::MESSAGE_TYPE, uint64_t{i}});
+          }
+          bool refused = false;
+          try {
+            client.send_message(order(1));
+          } catch (const std::runtime_error &) {
+            refused = true;
+          }
+          check(refused, "request beyond the window refused");
+          client.check_replicas();
+          client.send_message(order(1));
+        });
+  } catch (const std::exception &error) {
+    std::cerr << rs::format(RS_FMT("FAILED {}\n"), error.what());
+    return 1;
+  }
+}
@@ -0,0 +1,136 @@
+/*
+ * Benchmark of rs::format against the recursive formatter it replaced, on
+ * the text encodings of NewOrder and Trade messages with their headers.
+ *
+ *   risk-format-bench [iterations]
+ *
+ * Each encoding is timed with both formatters over the same messages, whose
+ * fields change with every iteration, and the speedup is printed.
+ */
+
+#include "format.h"
+#include "protocol.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+using namespace rs::protocol;
+
+// rs::format before format strings were parsed at compile time.
+namespace recursive {
+
+template <typename T> inline std::string to_string(const T &val) {
+  return std::to_string(val);
+}
+
+inline std::string format(const std::string &fmt) { return fmt; }
+
+template <typename T, typename... Args>
+inline std::string format(const std::string &fmt, const T &arg,
+                          const Args &...rest) {
+  auto field_begin = fmt.find("{}");
+  if (field_begin == std::string::npos) {
+    throw std::runtime_error("Invalid format string: mismatching amount of "
+                             "replacement fields and format args");
+  }
+  std::stringstream out;
+  out << fmt.substr(0, field_begin) << to_string(arg)
+      << format(fmt.substr(field_begin + 2), rest...);
+  return out.str();
+}
+
+std::string header_text(const Header &h) {
+  return format("{} {} {} {}", h.version, h.payloadSize, h.sequenceNumber,
+                h.timestamp);
+}
+
+std::string encode_message(const Header &h, const NewOrder &p) {
+  return header_text(h) + " " +
+         format("{} {} {} {} {} {}", p.messageType, p.listingId, p.orderId,
+                p.orderQuantity, p.orderPrice, p.side);
+}
+
+std::string encode_message(const Header &h, const Trade &p) {
+  return header_text(h) + " " +
+         format("{} {} {} {} {}", p.messageType, p.listingId, p.tradeId,
+                p.tradeQuantity, p.tradePrice);
+}
+
+} // namespace recursive
+
+Header header(uint64_t i) {
+  return Header{1, 40, static_cast<uint32_t>(i),
+                1'624'217'690'000'000'000 + i};
+}
+
+NewOrder order(uint64_t i) {
+  return NewOrder{NewOrder::MESSAGE_TYPE, i % 64, i, 1 + i % 100,
+                  1'000'000 + i % 5000, i % 2 ? 'B' : 'S'};
+}
+
+Trade trade(uint64_t i) {
+  return Trade{Trade::MESSAGE_TYPE, i % 64, i, 1 + i % 100,
+               1'000'000 + i % 5000};
+}
+
+// Nanoseconds per call of encode over iterations messages.
+template <typename Encode>
+double time_ns(uint64_t iterations, Encode encode, std::size_t &sink) {
+  const auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < iterations; ++i) {
+    sink += encode(i).size();
+  }
+  const std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+template <typename Recursive, typename Current>
+void compare(const char *name, uint64_t iterations, Recursive recursive,
+             Current current) {
+  for (uint64_t i = 0; i < 1000; ++i) {
+    if (recursive(i) != current(i)) {
+      throw std::runtime_error(
+          rs::format(RS_FMT("{} encodings differ at {}"), name, i));
+    }
+  }
+  std::size_t sink = 0;
+  auto before = time_ns(iterations, recursive, sink);
+  auto after = time_ns(iterations, current, sink);
+  std::cout << name << ": recursive " << before << " ns, rs::format " << after
+            << " ns, " << before / after << "x faster (" << sink
+            << " bytes)\n";
+}
+
+} // namespace
+
+int main(const int argc, const char *argv[]) {
+  if (argc > 2) {
+    std::cerr << "usage: risk-format-bench [iterations]\n";
+    exit(2);
+  }
+  const uint64_t iterations = argc == 2 ? std::stoull(argv[1]) : 1'000'000;
+  try {
+    compare(
+        "NewOrder", iterations,
+        [](uint64_t i) {
+          return recursive::encode_message(header(i), order(i));
+        },
+        [](uint64_t i) { return encode(header(i), order(i)); });
+    compare(
+        "Trade", iterations,
+        [](uint64_t i) {
+          return recursive::encode_message(header(i), trade(i));
+        },
+        [](uint64_t i) { return encode(header(i), trade(i)); });
+  } catch (const std::exception &error) {
+    std::cerr << rs::format(RS_FMT("FAILED {}\n"), error.what());
+    return 1;
+  }
+}
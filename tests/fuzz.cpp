@@ -0,0 +1,734 @@
+/*
+ * Differential fuzzing of the risk engine against the reference model, and
+ * fuzzing of the message decoders.
+ *
+ * Input bytes are read as a limit config followed by a stream of messages,
+ * with limit updates and steps of the clocks in between, which throttle and
+ * expire orders. The limit config must survive writing it as a config file
+ * and parsing it.
+ * Every message is encoded, decoded again and handed to the engine and to the
+ * model, which must respond the same and agree on the state of every listing,
+ * including its published snapshot, after every message. Inputs whose first
+ * byte is a multiple of 8 are fed to all decoders instead. As one message, it
+ * must either fail to decode or decode to a message that survives encoding and
+ * decoding unchanged. Split into messages by the batch decoder, each message
+ * must decode exactly as with the text decoders.
+ *
+ * Built as risk-fuzz, the input is random bytes from a seed:
+ *
+ *   risk-fuzz [--seed n] [--runs n] [--length bytes]
+ *
+ * Built with -DRS_LIBFUZZER=ON and clang, risk-fuzz-libfuzzer is a libFuzzer
+ * target, e.g. risk-fuzz-libfuzzer -max_len=4096 corpus_dir
+ */
+
+#include "field_batch.h"
+#include "format.h"
+#include "reference_model.h"
+#include "risk_engine.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using namespace rs;
+
+// Messages use listings 1 to max_listing, order ids up to max_order_id, so
+// that they collide, and sessions up to max_session, of which the last is not
+// configured.
+constexpr ListingID max_listing = 8;
+constexpr OrderID max_order_id = 32;
+constexpr SessionID max_session = 3;
+
+// Engine and model disagree, or a decoded message does not encode back.
+struct Mismatch : std::logic_error {
+  using std::logic_error::logic_error;
+};
+
+// Reads values from the input, all zero once it is used up.
+class Input {
+
+public:
+  Input(const uint8_t *data, std::size_t size) : data_(data), size_(size) {}
+
+  bool empty() const noexcept { return size_ == 0; }
+
+  // Next bytes as a big-endian integer.
+  uint64_t take(std::size_t bytes) noexcept {
+    uint64_t value = 0;
+    for (; bytes > 0 && size_ > 0; --bytes, --size_) {
+      value = value << 8 | *data_++;
+    }
+    return value;
+  }
+
+  // Value in [0, n), for n up to 256.
+  uint64_t below(uint64_t n) noexcept { return take(1) % n; }
+
+private:
+  const uint8_t *data_;
+  std::size_t size_;
+};
+
+// Mostly small, so that limits are hit, sometimes up to 2^32 - 1.
+Quantity quantity(Input &in) {
+  return in.below(8) == 0 ? in.take(4) : in.below(32);
+}
+
+char side(Input &in) {
+  switch (in.below(16)) {
+  case 0:
+    return static_cast<char>(in.take(1));
+  case 1:
+  case 2:
+  case 3:
+  case 4:
+  case 5:
+  case 6:
+  case 7:
+    return 'B';
+  default:
+    return 'S';
+  }
+}
+
+Limits limits(Input &in) {
+  auto limit = [&in] {
+    return in.below(4) == 0 ? Limits::unlimited : Quantity{in.below(64)};
+  };
+  auto max_buy_pos = limit();
+  return Limits{{max_buy_pos, limit()}};
+}
+
+// Mostly unlimited, sometimes low enough to be hit.
+OrderRate order_rate(Input &in) {
+  return in.below(4) == 0 ? OrderRate(in.below(8)) : unlimited_rate;
+}
+
+// Sessions 1 and 2 share account 1, session 0 has account 0.
+LimitConfig limit_config(Input &in) {
+  LimitConfig config;
+  config.firm = limits(in);
+  config.default_account = limits(in);
+  config.accounts[1] = limits(in);
+  config.sessions[0] = {0, limits(in)};
+  config.sessions[1] = {1, limits(in)};
+  config.sessions[2] = {1, limits(in)};
+  config.default_instrument = limits(in);
+  config.instruments[1] = limits(in);
+  config.default_instrument_rate = order_rate(in);
+  config.instrument_rates[1] = order_rate(in);
+  config.default_session_rate = order_rate(in);
+  config.session_rates[1] = order_rate(in);
+  return config;
+}
+
+// Session end given as HH:MM must parse back, and out of range or malformed
+// times must not parse.
+void check_time_of_day(Timestamp session_end) {
+  const auto hours = session_end / 3600;
+  const auto minutes = session_end % 3600 / 60;
+  const auto time = rs::format(RS_FMT("{}:{}"), hours, minutes);
+  if (OrderExpiry::parse_time_of_day(time) != session_end) {
+    throw Mismatch(rs::format(RS_FMT("Time of day '{}' parses wrong"), time));
+  }
+  for (const auto &invalid :
+       {rs::format(RS_FMT("{}:{}"), hours + 24, minutes),
+        rs::format(RS_FMT("{}:{}"), hours, minutes + 60),
+        rs::format(RS_FMT("{}:{}x"), hours, minutes),
+        rs::format(RS_FMT("-{}:{}"), hours, minutes),
+        rs::format(RS_FMT("{}{}"), hours, minutes), std::string{"ab:cd"},
+        std::string{":"}, std::string{"1:2:3"}, std::string{"001:00"}}) {
+    if (OrderExpiry::parse_time_of_day(invalid)) {
+      throw Mismatch(
+          rs::format(RS_FMT("Invalid time of day '{}' parses"), invalid));
+    }
+  }
+}
+
+// Mostly none, else lifetimes of up to a few minutes and a session end at any
+// minute of the day.
+OrderExpiry order_expiry(Input &in) {
+  OrderExpiry expiry;
+  if (in.below(2) == 0) {
+    return expiry;
+  }
+  if (in.below(4) != 0) {
+    expiry.ttl = 1 + in.below(255);
+  }
+  if (in.below(4) == 0) {
+    expiry.session_end = in.take(2) % (OrderExpiry::day / 60) * 60;
+    check_time_of_day(*expiry.session_end);
+  }
+  return expiry;
+}
+
+// Append limits as the end of a line of a limit config file.
+void append_limits(std::string &text, const Limits &limits) {
+  rs::format_append(text, RS_FMT(" {} {}\n"), limits.max_pos[BUY],
+                    limits.max_pos[SELL]);
+}
+
+// Lines of an admin update on top of current, changing one to four scopes.
+// Sessions keep their accounts, the unconfigured one may join any account.
+std::string limit_update(Input &in, const LimitConfig &current) {
+  std::string lines;
+  for (auto n = 1 + in.below(4); n > 0; --n) {
+    switch (in.below(10)) {
+    case 0:
+      lines += "firm";
+      append_limits(lines, limits(in));
+      break;
+    case 1:
+      lines += "account default";
+      append_limits(lines, limits(in));
+      break;
+    case 2:
+      rs::format_append(lines, RS_FMT("account {}"), in.below(3));
+      append_limits(lines, limits(in));
+      break;
+    case 3: {
+      SessionID id = in.below(max_session + 1);
+      auto session_it = current.sessions.find(id);
+      AccountID account = session_it == current.sessions.end()
+                              ? in.below(3)
+                              : session_it->second.account;
+      rs::format_append(lines, RS_FMT("session {} {}"), id, account);
+      append_limits(lines, limits(in));
+    } break;
+    case 4:
+      lines += "instrument default";
+      append_limits(lines, limits(in));
+      break;
+    case 5:
+      rs::format_append(lines, RS_FMT("instrument {}"),
+                        1 + in.below(max_listing));
+      append_limits(lines, limits(in));
+      break;
+    case 6:
+      rs::format_append(lines, RS_FMT("rate instrument default {}\n"),
+                        order_rate(in));
+      break;
+    case 7:
+      rs::format_append(lines, RS_FMT("rate instrument {} {}\n"),
+                        1 + in.below(max_listing), order_rate(in));
+      break;
+    case 8:
+      rs::format_append(lines, RS_FMT("rate session default {}\n"),
+                        order_rate(in));
+      break;
+    default:
+      rs::format_append(lines, RS_FMT("rate session {} {}\n"),
+                        in.below(max_session + 1), order_rate(in));
+      break;
+    }
+  }
+  return lines;
+}
+
+// Limit config file of config, sorted so that equal configs give equal text.
+std::string config_text(const LimitConfig &config) {
+  std::string text;
+  auto limits = [&text](const Limits &limits) { append_limits(text, limits); };
+  text += "firm";
+  limits(config.firm);
+  text += "account default";
+  limits(config.default_account);
+  for (const auto &[id, account] : std::map<AccountID, Limits>(
+           config.accounts.begin(), config.accounts.end())) {
+    rs::format_append(text, RS_FMT("account {}"), id);
+    limits(account);
+  }
+  for (const auto &[id, session] : std::map<SessionID, LimitConfig::Session>(
+           config.sessions.begin(), config.sessions.end())) {
+    rs::format_append(text, RS_FMT("session {} {}"), id, session.account);
+    limits(session.limits);
+  }
+  text += "instrument default";
+  limits(config.default_instrument);
+  for (const auto &[id, instrument] : std::map<ListingID, Limits>(
+           config.instruments.begin(), config.instruments.end())) {
+    rs::format_append(text, RS_FMT("instrument {}"), id);
+    limits(instrument);
+  }
+  rs::format_append(text, RS_FMT("rate instrument default {}\n"),
+                    config.default_instrument_rate);
+  for (const auto &[id, rate] : std::map<ListingID, OrderRate>(
+           config.instrument_rates.begin(), config.instrument_rates.end())) {
+    rs::format_append(text, RS_FMT("rate instrument {} {}\n"), id, rate);
+  }
+  rs::format_append(text, RS_FMT("rate session default {}\n"),
+                    config.default_session_rate);
+  for (const auto &[id, rate] : std::map<SessionID, OrderRate>(
+           config.session_rates.begin(), config.session_rates.end())) {
+    rs::format_append(text, RS_FMT("rate session {} {}\n"), id, rate);
+  }
+  return text;
+}
+
+// The config file of config must parse to config again. With an invalid line
+// appended, it must not parse.
+void check_parser(const LimitConfig &config) {
+  auto text = config_text(config);
+  std::istringstream input(text);
+  auto parsed = config_text(LimitConfig::parse(input));
+  if (parsed != text) {
+    throw Mismatch(rs::format(RS_FMT("Limit config '{}' parses as '{}'"), text,
+                              parsed));
+  }
+  for (const char *line :
+       {"account 2 -1 5", "instrument 2 5 -1", "session 4 -1 5 5",
+        "session -4 1 5 5", "instrument 2 5", "firm 5 5 5",
+        "rate session 1 -1", "rate instrument default -5"}) {
+    std::istringstream invalid(text + line);
+    try {
+      static_cast<void>(LimitConfig::parse(invalid));
+    } catch (const std::runtime_error &) {
+      continue;
+    }
+    throw Mismatch(rs::format(RS_FMT("Limit config parses '{}'"), line));
+  }
+}
+
+bool unchanged(const LimitChanges &changes) {
+  return !changes.firm && !changes.default_account &&
+         !changes.default_instrument && !changes.default_instrument_rate &&
+         !changes.default_session_rate && changes.accounts.empty() &&
+         changes.sessions.empty() && changes.instruments.empty() &&
+         changes.instrument_rates.empty() && changes.session_rates.empty();
+}
+
+template <typename Payload, typename = void>
+struct has_text_encoder : std::false_type {};
+template <typename Payload>
+struct has_text_encoder<
+    Payload, std::void_t<decltype(protocol::encode(std::declval<Payload>()))>>
+    : std::true_type {};
+
+// Message with delimiter as encoded into send buffers.
+template <typename Payload>
+std::string encoded(const protocol::Header &header, const Payload &payload) {
+  Buffer buffer{1 << 16};
+  protocol::encode(buffer, header, payload);
+  return std::string{buffer.readable()};
+}
+
+// Encode and decode payload, which must give the same message.
+template <typename Payload>
+Payload round_trip(const protocol::Header &header, const Payload &payload) {
+  using namespace protocol;
+  auto msg = encoded(header, payload);
+  if constexpr (has_text_encoder<Payload>::value) {
+    if (encode(header, payload) + message_delimiter != msg) {
+      throw Mismatch(rs::format(RS_FMT("Text encoders differ on '{}'"),
+                                encode(header, payload)));
+    }
+  }
+  Payload decoded{};
+  try {
+    decoded = decode_payload<Payload>(msg);
+  } catch (const std::exception &error) {
+    throw Mismatch(rs::format(RS_FMT("Unable to decode encoded '{}': {}"), msg,
+                              error.what()));
+  }
+  if (encoded(decode_header(msg), decoded) != msg) {
+    throw Mismatch(rs::format(RS_FMT("Decoding changes '{}' to '{}'"), msg,
+                              encoded(decode_header(msg), decoded)));
+  }
+  static FieldBatch batch;
+  if (batch.decode(msg) != 1 ||
+      encoded(decode_header(batch[0]), decode_payload<Payload>(batch[0])) !=
+          msg) {
+    throw Mismatch(rs::format(RS_FMT("Batch decoding changes '{}'"), msg));
+  }
+  return decoded;
+}
+
+// Encoding of msg decoded as Payload, empty if it does not decode.
+template <typename Payload, typename Message>
+std::optional<std::string> decoded(const Message &msg) {
+  using namespace protocol;
+  try {
+    return encoded(decode_header(msg), decode_payload<Payload>(msg));
+  } catch (const std::exception &) {
+    return std::nullopt;
+  }
+}
+
+template <typename Payload>
+void check_batch_decoder(const protocol::BatchedMessage &msg) {
+  if (decoded<Payload>(msg) != decoded<Payload>(msg.text)) {
+    throw Mismatch(rs::format(RS_FMT("Batch and text decoders differ on '{}'"),
+                              msg.text));
+  }
+}
+
+template <typename Payload> void check_decoder(protocol::MessageView msg) {
+  using namespace protocol;
+  Header header{};
+  Payload payload{};
+  try {
+    header = decode_header(msg);
+    payload = decode_payload<Payload>(msg);
+  } catch (const std::exception &) {
+    // Invalid messages are rejected with any exception.
+    return;
+  }
+  round_trip(header, payload);
+}
+
+void check_decoders(protocol::MessageView bytes) {
+  using namespace protocol;
+  Buffer buffer{bytes.size()};
+  buffer.append(bytes);
+  static FieldBatch batch;
+  while (batch.decode(buffer.readable()) > 0) {
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      MessageView msg;
+      next_message(buffer, msg);
+      if (batch[i].text != msg) {
+        throw Mismatch(rs::format(RS_FMT("Batch splits '{}' as '{}'"), msg,
+                                  batch[i].text));
+      }
+      check_batch_decoder<NewOrder>(batch[i]);
+      check_batch_decoder<DeleteOrder>(batch[i]);
+      check_batch_decoder<ModifyOrderQuantity>(batch[i]);
+      check_batch_decoder<Trade>(batch[i]);
+      check_batch_decoder<OrderResponse>(batch[i]);
+      check_batch_decoder<ReplicationAck>(batch[i]);
+      check_batch_decoder<PositionQuery>(batch[i]);
+      check_batch_decoder<PositionResponse>(batch[i]);
+      check_batch_decoder<OrderBatch>(batch[i]);
+      check_batch_decoder<BatchResponse>(batch[i]);
+      check_batch_decoder<Logon>(batch[i]);
+      check_batch_decoder<SessionStatus>(batch[i]);
+      check_batch_decoder<Heartbeat>(batch[i]);
+      check_batch_decoder<LimitUpdate>(batch[i]);
+    }
+  }
+
+  const auto msg = bytes;
+  check_decoder<NewOrder>(msg);
+  check_decoder<DeleteOrder>(msg);
+  check_decoder<ModifyOrderQuantity>(msg);
+  check_decoder<Trade>(msg);
+  check_decoder<OrderResponse>(msg);
+  check_decoder<ReplicationAck>(msg);
+  check_decoder<PositionQuery>(msg);
+  check_decoder<PositionResponse>(msg);
+  check_decoder<OrderBatch>(msg);
+  check_decoder<BatchResponse>(msg);
+  check_decoder<Logon>(msg);
+  check_decoder<SessionStatus>(msg);
+  check_decoder<Heartbeat>(msg);
+  check_decoder<LimitUpdate>(msg);
+}
+
+// Runs a stream of messages through engine and model side by side.
+class Checker {
+
+public:
+  Checker(const LimitConfig &config, const OrderExpiry &expiry)
+      : engine_(config), model_(config) {
+    engine_.set_order_expiry(expiry);
+    model_.set_order_expiry(expiry);
+    set_time(time_);
+  }
+
+  // Handle messages until the input is used up, return how many.
+  std::size_t run(Input &in) {
+    using namespace protocol;
+    while (!in.empty()) {
+      ++handled_;
+      // Sometimes up to about a second passes, moving the throttle windows.
+      if (in.below(4) == 0) {
+        clock_ += static_cast<Nanoseconds>(in.take(2)) * 20'000;
+        engine_.set_clock(clock_);
+        model_.set_clock(clock_);
+      }
+      // Sometimes seconds pass, rarely up to most of a day, expiring orders.
+      if (in.below(4) == 0) {
+        set_time(time_ + (in.below(16) == 0 ? in.take(2) : in.below(64)));
+      }
+      // Sometimes limits are updated, as from the admin channel.
+      if (in.below(32) == 0) {
+        update_limits(in);
+      }
+      switch (in.below(8)) {
+      case 0:
+      case 1: {
+        auto msg = transmit(NewOrder{NewOrder::MESSAGE_TYPE, listing(in),
+                                     order_id(in), quantity(in), 1, side(in)});
+        check_response(engine_.handle_new_order(msg, session_),
+                       model_.new_order(msg, session_));
+      } break;
+      case 2: {
+        auto msg = transmit(ModifyOrderQuantity{
+            ModifyOrderQuantity::MESSAGE_TYPE, order_id(in), quantity(in)});
+        check_response(engine_.handle_modify_order(msg),
+                       model_.modify_order(msg));
+      } break;
+      case 3: {
+        auto msg =
+            transmit(DeleteOrder{DeleteOrder::MESSAGE_TYPE, order_id(in)});
+        check(engine_.handle_delete_order(msg) == model_.delete_order(msg),
+              "deletion result");
+      } break;
+      case 4: {
+        auto msg = transmit(Trade{Trade::MESSAGE_TYPE, listing(in),
+                                  order_id(in), quantity(in), 1});
+        check(engine_.handle_trade(msg) == model_.trade(msg), "trade result");
+      } break;
+      case 5: {
+        auto msg = transmit(order_batch(in));
+        auto actual = engine_.handle_order_batch(msg, session_);
+        auto expected = model_.order_batch(msg, session_);
+        check(actual.count == expected.count &&
+                  actual.accepted == expected.accepted,
+              "batch response");
+      } break;
+      default: {
+        auto msg =
+            transmit(Logon{Logon::MESSAGE_TYPE, in.below(max_session + 1),
+                           static_cast<uint16_t>(in.below(2))});
+        session_ = msg.sessionId;
+      } break;
+      }
+      check_listings();
+    }
+    return handled_;
+  }
+
+private:
+  RiskEngine engine_;
+  reference::Model model_;
+  SessionID session_{0};
+  Nanoseconds clock_{0};
+  // Seconds since the Unix epoch, a November evening of 2023 to begin.
+  Timestamp time_{1'700'000'000};
+  std::size_t handled_{0};
+  // Encoded message being handled.
+  std::string message_;
+
+  static ListingID listing(Input &in) { return 1 + in.below(max_listing); }
+
+  // Expire orders in small slices, as the network threads do.
+  void set_time(Timestamp now) {
+    time_ = now;
+    while (!engine_.expire_orders(now, 1 + handled_ % 8, [](OrderID) {})) {
+    }
+    model_.set_time(now);
+    check_listings();
+  }
+
+  // Parse an update on top of the current limits, as the admin channel does,
+  // and apply it to engine and model. Replicated as one message per scope, it
+  // must give the same limits.
+  void update_limits(Input &in) {
+    using namespace protocol;
+    const auto &current = engine_.limits();
+    message_ = limit_update(in, current);
+    std::istringstream lines(message_);
+    auto limits = LimitConfig::parse(lines, current);
+    auto changes = LimitChanges::between(current, limits);
+    auto replicated = current;
+    for (const auto &update : changes.updates(limits)) {
+      static_cast<void>(replicated.apply(round_trip(
+          Header{update.messageType, sizeof(update), 0, 0}, update)));
+    }
+    if (!unchanged(LimitChanges::between(replicated, limits))) {
+      throw Mismatch(rs::format(RS_FMT("Replicating limit update '{}' gives "
+                                       "other limits"),
+                                message_));
+    }
+    model_.update_limits(limits);
+    engine_.update_limits(std::move(limits), changes);
+  }
+  static OrderID order_id(Input &in) { return 1 + in.below(max_order_id); }
+
+  // Mostly small batches, sometimes up to the maximum.
+  static protocol::OrderBatch order_batch(Input &in) {
+    using namespace protocol;
+    OrderBatch batch{OrderBatch::MESSAGE_TYPE,
+                     static_cast<uint16_t>(in.below(2)), 0, {}};
+    batch.count = static_cast<uint16_t>(
+        in.below(16) == 0 ? in.take(2) % (OrderBatch::max_entries + 1)
+                          : in.below(8));
+    for (std::size_t i = 0; i < batch.count; ++i) {
+      uint16_t type = in.below(2) == 0 ? NewOrder::MESSAGE_TYPE
+                                       : ModifyOrderQuantity::MESSAGE_TYPE;
+      if (in.below(16) == 0) {
+        type = static_cast<uint16_t>(in.take(2));
+      }
+      batch.entries[i] = {type,         listing(in), order_id(in),
+                          quantity(in), 1,           side(in)};
+    }
+    return batch;
+  }
+
+  template <typename Payload> Payload transmit(const Payload &payload) {
+    protocol::Header header{payload.messageType, sizeof(payload),
+                            static_cast<uint32_t>(handled_), 0};
+    message_ = encoded(header, payload);
+    message_.pop_back();
+    return round_trip(header, payload);
+  }
+
+  void check(bool same, const char *what) const {
+    if (!same) {
+      throw Mismatch(rs::format(RS_FMT("Engine and model differ in {} after "
+                                       "message {} '{}' of session {}"),
+                                what, handled_, message_, session_));
+    }
+  }
+
+  void check_response(const protocol::OrderResponse &actual,
+                      protocol::OrderResponse::Status expected) const {
+    check(actual.status == expected, "order response");
+  }
+
+  void check_listings() const {
+    auto same = [](const InstrumentState &a, const InstrumentState &b) {
+      return a.net_pos == b.net_pos && a.open_qty == b.open_qty;
+    };
+    for (ListingID id = 1; id <= max_listing; ++id) {
+      auto expected = model_.instrument_state(id);
+      check(same(engine_.instrument_state(id), expected), "instrument state");
+      InstrumentState published;
+      engine_.positions().read(id, published);
+      check(same(published, expected), "published instrument state");
+    }
+  }
+};
+
+// Return the number of messages handled, throw Mismatch on a failed check.
+std::size_t fuzz(const uint8_t *data, std::size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  if (data[0] % 8 == 0) {
+    check_decoders(protocol::MessageView{
+        reinterpret_cast<const char *>(data + 1), size - 1});
+    return 1;
+  }
+  Input in{data + 1, size - 1};
+  auto config = limit_config(in);
+  check_parser(config);
+  Checker checker{config, order_expiry(in)};
+  return checker.run(in);
+}
+
+} // namespace
+
+#ifdef RS_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, std::size_t size) {
+  static const bool quiet = [] {
+    RiskEngine::set_log_level(logging::Level::CRITICAL);
+    return true;
+  }();
+  static_cast<void>(quiet);
+  try {
+    fuzz(data, size);
+  } catch (const Mismatch &mismatch) {
+    std::cerr << mismatch.what() << '\n';
+    std::abort();
+  }
+  return 0;
+}
+
+#else
+
+namespace {
+
+[[noreturn]] void usage() {
+  std::cerr << "usage: risk-fuzz [options]\n"
+               "options:\n"
+               "  --seed n          seed of the first run, default 1\n"
+               "  --runs n          runs with consecutive seeds, default 1000\n"
+               "  --length bytes    input bytes per run, default 4096\n";
+  exit(2);
+}
+
+// Random input of run, every eighth a message for the decoders, mostly made
+// of digits and spaces so that it gets past the first field.
+std::vector<uint8_t> random_input(uint64_t seed, std::size_t length) {
+  std::mt19937_64 random{seed};
+  std::vector<uint8_t> input(length);
+  for (auto &byte : input) {
+    byte = static_cast<uint8_t>(random());
+  }
+  if (length == 0) {
+    return input;
+  }
+  if (seed % 8 != 0) {
+    input[0] |= 1;
+    return input;
+  }
+  constexpr std::string_view text = "0123456789 0123456789          \n";
+  input[0] = 0;
+  input.resize(std::min<std::size_t>(length, 1 + random() % 4096));
+  for (std::size_t i = 1; i < input.size(); ++i) {
+    if (random() % 64 != 0) {
+      input[i] = text[random() % text.size()];
+    }
+  }
+  return input;
+}
+
+} // namespace
+
+int main(const int argc, const char *argv[]) {
+  uint64_t seed = 1;
+  uint64_t runs = 1000;
+  std::size_t length = 4096;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string option{argv[i]};
+    if (option == "--seed" && i + 1 < argc) {
+      seed = std::stoull(argv[i + 1]);
+      i += 1;
+    } else if (option == "--runs" && i + 1 < argc) {
+      runs = std::stoull(argv[i + 1]);
+      i += 1;
+    } else if (option == "--length" && i + 1 < argc) {
+      length = std::stoull(argv[i + 1]);
+      i += 1;
+    } else {
+      std::cerr << rs::format(RS_FMT("error: invalid option '{}'"), option)
+                << '\n';
+      usage();
+    }
+  }
+
+  // Rejects are expected all the time.
+  RiskEngine::set_log_level(logging::Level::CRITICAL);
+
+  std::size_t messages = 0;
+  for (auto run = seed; run < seed + runs; ++run) {
+    auto input = random_input(run, length);
+    try {
+      messages += fuzz(input.data(), input.size());
+    } catch (const Mismatch &mismatch) {
+      std::cerr << rs::format(RS_FMT("seed {}: {}\n"), run, mismatch.what());
+      return 1;
+    }
+  }
+  std::cerr << rs::format(RS_FMT("{} runs from seed {}, {} messages, no "
+                                 "mismatch\n"),
+                          runs, seed, messages);
+}
+
+#endif
@@ -1,13 +1,16 @@
 #include "format.h"
 #include "risk_client.h"
+#include "udp.h"
 #include <iostream>
+#include <optional>
 
 int main(const int argc, const char *argv[]) {
-  if (argc != 3) {
-    std::cerr << rs::format("error: wrong number of args {} out of {}",
+  if (argc != 3 && argc != 5) {
+    std::cerr << rs::format(RS_FMT("error: wrong number of args {} out of {}"),
                             argc - 1, 2)
               << '\n';
-    std::cerr << "usage: test server_address server_port\n";
+    std::cerr << "usage: test server_address server_port "
+                 "[trade_feed_address trade_feed_port]\n";
     exit(2);
   }
 
@@ -16,7 +19,15 @@ int main(const int argc, const char *argv[]) {
 
   rs::RiskClient client(address, port);
 
+  // Send trades to the trade feed of the server instead, if given.
+  std::optional<rs::udp::Sender> trade_feed;
+  if (argc == 5) {
+    trade_feed.emplace(argv[3], argv[4]);
+  }
+
   std::size_t order_counter = 0;
+  // Sequence number of the last datagram sent to the trade feed.
+  uint32_t feed_seq = 0;
 
   enum class Instrument : unsigned {
     OurStock = 1,
@@ -26,11 +37,13 @@ int main(const int argc, const char *argv[]) {
   using namespace rs::protocol;
 
   auto check_response = [&client](const auto &order_id) {
-    if (auto response = client.wait_for_response();
-        response.status == OrderResponse::Status::ACCEPTED) {
-      std::cout << rs::format("order {} accepted\n", order_id);
+    auto response = client.wait_for_response();
+    if (!response) {
+      std::cout << rs::format(RS_FMT("order {} unknown\n"), order_id);
+    } else if (response->status == OrderResponse::Status::ACCEPTED) {
+      std::cout << rs::format(RS_FMT("order {} accepted\n"), order_id);
     } else {
-      std::cout << rs::format("order {} rejected\n", order_id);
+      std::cout << rs::format(RS_FMT("order {} rejected\n"), order_id);
     }
   };
 
@@ -77,7 +90,13 @@ int main(const int argc, const char *argv[]) {
   {
     Trade trade{Trade::MESSAGE_TYPE,
                 static_cast<uint64_t>(Instrument::OtherStock), 1, 4, 1};
-    client.send_message(trade);
+    if (trade_feed) {
+      Header header{Trade::MESSAGE_TYPE, sizeof(trade), ++feed_seq,
+                    rs::now()};
+      trade_feed->send_message(encode(header, trade));
+    } else {
+      client.send_message(trade);
+    }
   }
   {
     DeleteOrder delete_order{
@@ -86,4 +105,44 @@ int main(const int argc, const char *argv[]) {
     };
     client.send_message(delete_order);
   }
+  {
+    // Last entry exceeds the max buy position, so the first batch is rejected
+    // as a whole and the second batch is accepted partially.
+    OrderBatch batch{OrderBatch::MESSAGE_TYPE, OrderBatch::ALL_OR_NOTHING, 3,
+                     {}};
+    for (std::size_t i = 0; i < batch.count; ++i) {
+      batch.entries[i] = {NewOrder::MESSAGE_TYPE,
+                          static_cast<uint64_t>(Instrument::OurStock),
+                          ++order_counter,
+                          i < 2 ? 5u : 1u,
+                          1,
+                          'B'};
+    }
+    for (auto flags : {OrderBatch::ALL_OR_NOTHING, OrderBatch::NONE}) {
+      batch.flags = flags;
+      client.send_message(batch);
+      auto response =
+          client.wait_for_response<BatchResponse>().value_or(BatchResponse{});
+      for (std::size_t i = 0; i < response.count; ++i) {
+        std::cout << rs::format(RS_FMT("batch order {} {}\n"),
+                                batch.entries[i].orderId,
+                                response.is_accepted(i) ? "accepted"
+                                                        : "rejected");
+      }
+    }
+  }
+  {
+    PositionQuery query{PositionQuery::MESSAGE_TYPE, 2, {}};
+    query.listingIds[0] = static_cast<uint64_t>(Instrument::OurStock);
+    query.listingIds[1] = static_cast<uint64_t>(Instrument::OtherStock);
+    client.send_message(query);
+    for (std::size_t i = 0; i < query.count; ++i) {
+      auto pos = client.wait_for_response<PositionResponse>().value_or(
+          PositionResponse{});
+      std::cout << rs::format(RS_FMT("listing {} net {} buy {} sell {} "
+                                     "worst buy {} worst sell {}\n"),
+                              pos.listingId, pos.netPos, pos.buyQty,
+                              pos.sellQty, pos.worstBuyPos, pos.worstSellPos);
+    }
+  }
 }
@@ -0,0 +1,305 @@
+#ifndef INCLUDED_RISKSERVICE_REFERENCE_MODEL_HEADER
+#define INCLUDED_RISKSERVICE_REFERENCE_MODEL_HEADER
+/*
+ * Obviously correct model of the risk engine, for differential testing.
+ *
+ * The model keeps nothing but the open orders and the fills, and counts every
+ * aggregate from them again for each check. It is slow, but it has no
+ * incremental state that could drift from the orders. Counts are exact as
+ * long as quantities are below 2^32 and there are fewer than 2^31 of them.
+ */
+
+#include "limit_config.h"
+#include "order_expiry.h"
+#include "positions.h"
+#include "protocol.h"
+#include "throttle.h"
+#include <algorithm>
+#include <array>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace rs::reference {
+
+// Handles the messages the engine handles, by the rules of the protocol:
+// a new order or modification is accepted if, in each scope of the order, the
+// worst case position of the order's side is within its limit afterwards.
+// Before that, it is throttled if as many orders as the rate of its listing or
+// session have passed the throttles within the window of the clock, the
+// bucket of the clock and the buckets before it that make up one second.
+// Batch entries are handled like single messages, one after another, and all
+// of them are undone if an all-or-nothing batch has a rejected entry.
+// New orders expire after their lifetime or at the first end of session after
+// their creation, whichever comes first.
+class Model {
+  using Status = protocol::OrderResponse::Status;
+
+public:
+  explicit Model(LimitConfig config) : config_(std::move(config)) {}
+
+  // Time of the messages handled next, never earlier than before.
+  void set_clock(Nanoseconds now) { clock_ = now; }
+
+  void set_order_expiry(const OrderExpiry &expiry) { expiry_ = expiry; }
+
+  // Time in seconds from which new orders expire, never earlier than before.
+  // Orders expired at now are gone.
+  void set_time(Timestamp now) {
+    now_ = now;
+    for (auto it = orders_.begin(); it != orders_.end();) {
+      auto expires_at = it->second.expires_at;
+      it = expires_at != 0 && expires_at <= now ? orders_.erase(it)
+                                                : std::next(it);
+    }
+  }
+
+  // Limits of the messages handled next. Orders, fills and admissions are
+  // kept, and each check uses the limits and rates of the moment.
+  void update_limits(LimitConfig config) { config_ = std::move(config); }
+
+  Status new_order(const protocol::NewOrder &msg, SessionID session) {
+    if ((msg.side != 'B' && msg.side != 'S') ||
+        config_.sessions.count(session) == 0 || orders_.count(msg.orderId)) {
+      return Status::REJECTED;
+    }
+    Order order{msg.listingId, msg.orderQuantity, msg.side, session,
+                expires_at()};
+    if (!admit(order)) {
+      return Status::THROTTLED;
+    }
+    orders_[msg.orderId] = order;
+    if (!within_limits(order)) {
+      orders_.erase(msg.orderId);
+      return Status::REJECTED;
+    }
+    return Status::ACCEPTED;
+  }
+
+  Status modify_order(const protocol::ModifyOrderQuantity &msg) {
+    auto order_it = orders_.find(msg.orderId);
+    if (order_it == orders_.end()) {
+      return Status::REJECTED;
+    }
+    auto &order = order_it->second;
+    if (!admit(order)) {
+      return Status::THROTTLED;
+    }
+    auto old_quantity = order.quantity;
+    order.quantity = msg.newQuantity;
+    if (!within_limits(order)) {
+      order.quantity = old_quantity;
+      return Status::REJECTED;
+    }
+    return Status::ACCEPTED;
+  }
+
+  protocol::BatchResponse order_batch(const protocol::OrderBatch &batch,
+                                      SessionID session) {
+    using namespace protocol;
+    BatchResponse response{BatchResponse::MESSAGE_TYPE, batch.count, {}};
+    if (config_.sessions.count(session) == 0) {
+      return response;
+    }
+    const auto orders = orders_;
+    for (std::size_t i = 0; i < batch.count; ++i) {
+      const auto &entry = batch.entries[i];
+      auto status = Status::REJECTED;
+      if (entry.messageType == NewOrder::MESSAGE_TYPE) {
+        status = new_order(NewOrder{entry.messageType, entry.listingId,
+                                    entry.orderId, entry.quantity, entry.price,
+                                    entry.side},
+                           session);
+      } else if (entry.messageType == ModifyOrderQuantity::MESSAGE_TYPE) {
+        status = modify_order(ModifyOrderQuantity{
+            entry.messageType, entry.orderId, entry.quantity});
+      }
+      if (status == Status::ACCEPTED) {
+        response.accepted[i / 64] |= uint64_t{1} << (i % 64);
+      } else if (batch.flags & OrderBatch::ALL_OR_NOTHING) {
+        orders_ = orders;
+        response.accepted = {};
+        return response;
+      }
+    }
+    return response;
+  }
+
+  bool delete_order(const protocol::DeleteOrder &msg) {
+    return orders_.erase(msg.orderId) == 1;
+  }
+
+  // A buy fill lowers the net position, a sell fill raises it.
+  bool trade(const protocol::Trade &msg) {
+    auto order_it = orders_.find(msg.tradeId);
+    if (order_it == orders_.end()) {
+      return false;
+    }
+    const auto &order = order_it->second;
+    auto quantity = static_cast<NetPos>(msg.tradeQuantity);
+    fills_.push_back(Fill{msg.listingId, order.session,
+                          order.side == 'B' ? -quantity : quantity});
+    return true;
+  }
+
+  InstrumentState instrument_state(ListingID id) const {
+    InstrumentState state;
+    for (const auto &[order_id, order] : orders_) {
+      if (order.listing_id == id) {
+        state.open_qty[order.side == 'B' ? BUY : SELL] += order.quantity;
+      }
+    }
+    for (const auto &fill : fills_) {
+      if (fill.listing_id == id) {
+        state.net_pos += fill.net_pos;
+      }
+    }
+    return state;
+  }
+
+private:
+  using NetPos = InstrumentState::NetPos;
+
+  struct Order {
+    ListingID listing_id;
+    Quantity quantity;
+    char side;
+    SessionID session;
+    // 0 if never.
+    Timestamp expires_at;
+  };
+
+  // Change of the net position of session in the traded listing.
+  struct Fill {
+    ListingID listing_id;
+    SessionID session;
+    NetPos net_pos;
+  };
+
+  enum class Scope { INSTRUMENT, SESSION, ACCOUNT, FIRM };
+  static constexpr std::array<Scope, 4> scopes = {
+      Scope::INSTRUMENT, Scope::SESSION, Scope::ACCOUNT, Scope::FIRM};
+
+  LimitConfig config_;
+  std::map<OrderID, Order> orders_;
+  std::vector<Fill> fills_;
+  Nanoseconds clock_{0};
+  OrderExpiry expiry_;
+  Timestamp now_{0};
+  // Buckets of the clock at which orders of each listing and session passed
+  // limited throttles. Kept when a batch is undone, as by the engine.
+  std::map<ListingID, std::vector<Nanoseconds>> listing_admissions_;
+  std::map<SessionID, std::vector<Nanoseconds>> session_admissions_;
+
+  // Earliest of the end of the lifetime and the next end of session strictly
+  // after now, 0 if neither is set.
+  Timestamp expires_at() const {
+    std::vector<Timestamp> times;
+    if (expiry_.ttl > 0) {
+      times.push_back(now_ + expiry_.ttl);
+    }
+    if (expiry_.session_end) {
+      auto end = *expiry_.session_end % OrderExpiry::day;
+      times.push_back(now_ + (end + OrderExpiry::day - 1 -
+                              now_ % OrderExpiry::day) % OrderExpiry::day + 1);
+    }
+    return times.empty() ? 0 : *std::min_element(times.begin(), times.end());
+  }
+
+  // Return true if fewer than rate admissions are within the window.
+  bool has_room(const std::vector<Nanoseconds> &admissions,
+                OrderRate rate) const {
+    auto first = clock_ / Throttle::bucket_length -
+                 static_cast<Nanoseconds>(Throttle::buckets) + 1;
+    auto in_window =
+        std::count_if(admissions.begin(), admissions.end(),
+                      [first](Nanoseconds bucket) { return bucket >= first; });
+    return rate == unlimited_rate || static_cast<OrderRate>(in_window) < rate;
+  }
+
+  bool admit(const Order &order) {
+    auto instrument_rate = config_.instrument_rate(order.listing_id);
+    auto session_rate = config_.session_rate(order.session);
+    auto &listing = listing_admissions_[order.listing_id];
+    auto &session = session_admissions_[order.session];
+    if (!has_room(listing, instrument_rate) ||
+        !has_room(session, session_rate)) {
+      return false;
+    }
+    // Unlimited throttles count nothing.
+    auto bucket = clock_ / Throttle::bucket_length;
+    if (instrument_rate != unlimited_rate) {
+      listing.push_back(bucket);
+    }
+    if (session_rate != unlimited_rate) {
+      session.push_back(bucket);
+    }
+    return true;
+  }
+
+  AccountID account(SessionID session) const {
+    return config_.sessions.at(session).account;
+  }
+
+  // Return true if an order or fill of listing and session counts towards
+  // scope of order.
+  bool in_scope(Scope scope, const Order &order, ListingID listing,
+                SessionID session) const {
+    switch (scope) {
+    case Scope::INSTRUMENT:
+      return listing == order.listing_id;
+    case Scope::SESSION:
+      return session == order.session;
+    case Scope::ACCOUNT:
+      return account(session) == account(order.session);
+    case Scope::FIRM:
+      return true;
+    }
+    return false;
+  }
+
+  const Limits &limits(Scope scope, const Order &order) const {
+    switch (scope) {
+    case Scope::INSTRUMENT:
+      return config_.instrument_limits(order.listing_id);
+    case Scope::SESSION:
+      return config_.sessions.at(order.session).limits;
+    case Scope::ACCOUNT:
+      return config_.account_limits(account(order.session));
+    case Scope::FIRM:
+      break;
+    }
+    return config_.firm;
+  }
+
+  bool within_limits(const Order &order) const {
+    for (auto scope : scopes) {
+      NetPos net_pos = 0;
+      NetPos open = 0;
+      for (const auto &[id, other] : orders_) {
+        if (other.side == order.side &&
+            in_scope(scope, order, other.listing_id, other.session)) {
+          open += static_cast<NetPos>(other.quantity);
+        }
+      }
+      for (const auto &fill : fills_) {
+        if (in_scope(scope, order, fill.listing_id, fill.session)) {
+          net_pos += fill.net_pos;
+        }
+      }
+      // Position if all open orders of the side are filled, or if none are.
+      auto worst = order.side == 'B' ? std::max(open, net_pos + open)
+                                     : std::max(open, open - net_pos);
+      auto max_pos =
+          limits(scope, order).max_pos[order.side == 'B' ? BUY : SELL];
+      if (worst > 0 && static_cast<Quantity>(worst) > max_pos) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+} // namespace rs::reference
+
+#endif // INCLUDED_RISKSERVICE_REFERENCE_MODEL_HEADER